@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <errno.h>
+
+#include "libmultidb.h"
+
+/*
+ * Compares codec throughput on generated t/ style column data:
+ * serial ids, quoted site keys, quoted paths, timestamps and NULLs,
+ * plus a site's settings as a JSON object of some 190 bytes.  Each
+ * column is packed into --block_size blocks of newline separated
+ * values, and every value is also compressed on its own the way
+ * write_col_file() sees it.  The stored rows are what a compression =
+ * auto table writes, block header included, plain when that's smaller.
+ */
+
+static gint rows = 100000;
+static gint block_size = 65536;
+static gint rounds = 20;
+
+static GOptionEntry entries[] = {
+  { "rows", 0, 0, G_OPTION_ARG_INT, &rows, "Rows of generated data", "N" },
+  { "block_size", 0, 0, G_OPTION_ARG_INT, &block_size, "Bytes per column block", "B" },
+  { "rounds", 0, 0, G_OPTION_ARG_INT, &rounds, "Passes over the data per codec", "R" },
+  { NULL }
+};
+
+static const gchar *site_keys[] = {
+    "smtp_password", "smtp_username", "baseDir", "password", "smtp_host", "smtp_port", "cache_dir", "log_level"
+};
+
+static const gchar *site_dirs[] = {
+    "/opt/joy", "/opt/test", "/var/lib/multidb", "/srv/www/site", "/home/joy/uploads"
+};
+
+gchar * generate_value(const gchar *col, gint i)
+{
+    if (0 == g_strcmp0("id", col)) {
+        return(g_strdup_printf("%i", i + 1));
+    }
+
+    if (0 == g_strcmp0("site_key", col)) {
+        return(g_strdup_printf("'%s'", site_keys[i % G_N_ELEMENTS(site_keys)]));
+    }
+
+    if (0 == g_strcmp0("site_value", col)) {
+        return(g_strdup_printf("'%s/%i'", site_dirs[i % G_N_ELEMENTS(site_dirs)], i % 997));
+    }
+
+    if (0 == g_strcmp0("settings", col)) {
+        gint site = i % 997;
+
+        return(g_strdup_printf("'{\"smtp_host\": \"smtp%i.example.com\", \"smtp_port\": %i, \"smtp_username\": \"site%i\", "
+            "\"cache_dir\": \"/var/lib/multidb/cache/site%i\", \"log_dir\": \"/var/lib/multidb/log/site%i\", \"log_level\": \"%s\"}'",
+            site % 4, 0 == i % 5 ? 465 : 587, site, site, site, 0 == i % 7 ? "debug" : "info"));
+    }
+
+    if (0 == g_strcmp0("updated", col)) {
+        if (0 == i % 3) {
+            return(g_strdup("NULL"));
+        }
+        return(g_strdup_printf("'2014-10-%02iT%02i:%02i'", 1 + (i / 1440) % 28, (i / 60) % 24, i % 60));
+    }
+
+    return(g_strdup_printf("'2014-10-06T21:%02i'", i % 60));
+}
+
+void free_block(gpointer block)
+{
+    g_string_free(block, TRUE);
+}
+
+void bench_blocks(MdbCodec codec, const gchar *col, GPtrArray *values)
+{
+    GByteArray *packed = g_byte_array_new();
+    GByteArray *plain = g_byte_array_new();
+    GPtrArray *blocks = g_ptr_array_new_with_free_func(free_block);
+    GString *block = NULL;
+
+    for (guint i = 0; i < values->len; ++i) {
+        if (NULL == block) {
+            block = g_string_sized_new(block_size);
+        }
+
+        g_string_append(block, g_ptr_array_index(values, i));
+        g_string_append_c(block, '\n');
+
+        if (block->len >= (gsize) block_size) {
+            g_ptr_array_add(blocks, block);
+            block = NULL;
+        }
+    }
+    if (block) {
+        g_ptr_array_add(blocks, block);
+    }
+
+    gsize raw_bytes = 0;
+    gsize packed_bytes = 0;
+    gint64 compress_usec = 0;
+    gint64 decompress_usec = 0;
+
+    for (gint round = 0; round < rounds; ++round) {
+        for (guint i = 0; i < blocks->len; ++i) {
+            GString *b = g_ptr_array_index(blocks, i);
+
+            gint64 start = g_get_monotonic_time();
+            gsize wrote = mdb_compress(codec, b->str, b->len, packed);
+            compress_usec += g_get_monotonic_time() - start;
+
+            if (0 == wrote) {
+                fprintf(stderr, "error: %s: compress failed\n", mdb_codec_name(codec));
+                exit(EXIT_FAILURE);
+            }
+
+            start = g_get_monotonic_time();
+            if (!mdb_decompress(codec, (gchar *) packed->data, wrote, plain, b->len)) {
+                fprintf(stderr, "error: %s: decompress failed\n", mdb_codec_name(codec));
+                exit(EXIT_FAILURE);
+            }
+            decompress_usec += g_get_monotonic_time() - start;
+
+            if (0 == round) {
+                raw_bytes += b->len;
+                packed_bytes += wrote;
+            }
+        }
+    }
+
+    gdouble mb = (gdouble) raw_bytes * rounds / (1024.0 * 1024.0);
+
+    g_print("%s\tblock\t%s\t%lu\t%lu\t%.2f\t%.1f\t%.1f\n",
+        mdb_codec_name(codec), col, raw_bytes, packed_bytes,
+        (gdouble) raw_bytes / (packed_bytes ? packed_bytes : 1),
+        mb / (compress_usec ? compress_usec / 1e6 : 1e-6),
+        mb / (decompress_usec ? decompress_usec / 1e6 : 1e-6));
+
+    g_ptr_array_free(blocks, TRUE);
+    g_byte_array_free(packed, TRUE);
+    g_byte_array_free(plain, TRUE);
+}
+
+void bench_values(MdbCodec codec, const gchar *col, GPtrArray *values)
+{
+    GByteArray *packed = g_byte_array_new();
+
+    gsize raw_bytes = 0;
+    gsize packed_bytes = 0;
+    gint64 start = g_get_monotonic_time();
+
+    for (guint i = 0; i < values->len; ++i) {
+        const gchar *v = g_ptr_array_index(values, i);
+        gsize len = strlen(v);
+        gsize wrote = mdb_compress(codec, v, len, packed);
+
+        raw_bytes += len;
+        packed_bytes += (0 == wrote || wrote >= len) ? len : wrote;
+    }
+
+    gint64 usec = g_get_monotonic_time() - start;
+    gdouble mb = (gdouble) raw_bytes / (1024.0 * 1024.0);
+
+    g_print("%s\tvalue\t%s\t%lu\t%lu\t%.2f\t%.1f\t-\n",
+        mdb_codec_name(codec), col, raw_bytes, packed_bytes,
+        (gdouble) raw_bytes / (packed_bytes ? packed_bytes : 1),
+        mb / (usec ? usec / 1e6 : 1e-6));
+
+    g_byte_array_free(packed, TRUE);
+}
+
+void bench_stored(const gchar *col, GPtrArray *values)
+{
+    GByteArray *packed = g_byte_array_new();
+
+    gsize raw_bytes = 0;
+    gsize stored_bytes = 0;
+    gint64 start = g_get_monotonic_time();
+
+    for (guint i = 0; i < values->len; ++i) {
+        const gchar *v = g_ptr_array_index(values, i);
+        gsize len = strlen(v);
+        gsize wrote = pack_col_text(v, len, MDB_CODEC_AUTO, packed);
+
+        raw_bytes += len;
+        stored_bytes += wrote ? wrote : len;
+    }
+
+    gint64 usec = g_get_monotonic_time() - start;
+    gdouble mb = (gdouble) raw_bytes / (1024.0 * 1024.0);
+
+    g_print("%s\tstored\t%s\t%lu\t%lu\t%.2f\t%.1f\t-\n",
+        mdb_codec_name(MDB_CODEC_AUTO), col, raw_bytes, stored_bytes,
+        (gdouble) raw_bytes / (stored_bytes ? stored_bytes : 1),
+        mb / (usec ? usec / 1e6 : 1e-6));
+
+    g_byte_array_free(packed, TRUE);
+}
+
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context;
+
+    context = g_option_context_new("- multidb codec benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_print("option parsing failed: %s\n", error->message);
+        exit(EXIT_FAILURE);
+    }
+
+    const gchar *cols[] = { "id", "site_key", "site_value", "settings", "updated", "inserted" };
+    MdbCodec codecs[] = { MDB_CODEC_LZ4, MDB_CODEC_ZSTD };
+
+    g_print("codec\tunit\tcolumn\traw_bytes\tpacked_bytes\tratio\tcompress_MBps\tdecompress_MBps\n");
+
+    for (guint c = 0; c < G_N_ELEMENTS(cols); ++c) {
+        GPtrArray *values = g_ptr_array_new_with_free_func(g_free);
+
+        for (gint i = 0; i < rows; ++i) {
+            g_ptr_array_add(values, generate_value(cols[c], i));
+        }
+
+        for (guint k = 0; k < G_N_ELEMENTS(codecs); ++k) {
+            if (!mdb_codec_available(codecs[k])) {
+                continue;
+            }
+
+            bench_blocks(codecs[k], cols[c], values);
+            bench_values(codecs[k], cols[c], values);
+        }
+
+        if (mdb_codec_available(MDB_CODEC_AUTO)) {
+            bench_stored(cols[c], values);
+        }
+
+        g_ptr_array_free(values, TRUE);
+    }
+
+    return(EXIT_SUCCESS);
+}
@@ -0,0 +1,555 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <errno.h>
+
+#include "libmultidb.h"
+
+/*
+ * Statement throughput and latency at 1, 2, 4 ... --writers concurrent
+ * processes.  Every writer count gets a fresh database under --dir with
+ * bench_main (id, grp, val and --width text columns of --pad bytes) and
+ * bench_dim (16 rows that bench_main.grp joins to), then runs:
+ *
+ *   insert_single  one ./cli_multidb process per INSERT
+ *   insert_bulk    --rows INSERTs through the library, in process
+ *   txn_ingest     BEGIN, BENCH_TXN_INSERTS INSERTs and COMMIT, in process
+ *   point_select   SELECT * ... WHERE id = ?
+ *   filtered_scan  SELECT id, val ... WHERE grp = ? (1 row in 16)
+ *   full_scan      SELECT * FROM bench_main
+ *   join           bench_main joined to bench_dim, WHERE id < 64
+ *   update         UPDATE ... SET val = val + 1 WHERE id = ?
+ *   delete         DELETE ... WHERE id = ?
+ *   copy_from      COPY FROM of a CSV of BENCH_COPY_ROWS rows, 2 workers
+ *   copy_to        COPY TO of bench_main as CSV, 2 workers, a directory per op
+ *   parse          parsing alone of a join SELECT, INSERT, UPDATE or DELETE
+ *
+ * The ops of a case are dealt out to the writers round robin and every
+ * statement is derived from its op number and --seed, so a run does the
+ * same work whatever the writer count.  The results go to --output as
+ * JSON, one object per case and writer count.
+ */
+
+static gint rows = 2000;
+static gint width = 4;
+static gint pad = 32;
+static gint writers = 4;
+static gint ops = 100;
+static gint scans = 10;
+static gint spawns = 50;
+static gint seed = 1;
+static gchar *dir = NULL;
+static gchar *output = "../bench_output.txt";
+static gchar *cli = "./cli_multidb";
+static gchar *copy_file = NULL;
+static gchar *export_dir = NULL;
+
+static GOptionEntry entries[] = {
+  { "rows", 0, 0, G_OPTION_ARG_INT, &rows, "Rows inserted by insert_bulk", "N" },
+  { "width", 0, 0, G_OPTION_ARG_INT, &width, "Text columns besides id, grp and val", "W" },
+  { "pad", 0, 0, G_OPTION_ARG_INT, &pad, "Bytes in each text value", "B" },
+  { "writers", 0, 0, G_OPTION_ARG_INT, &writers, "Most concurrent processes (1, 2, 4 ... up to it)", "N" },
+  { "ops", 0, 0, G_OPTION_ARG_INT, &ops, "Statements in each point case", "N" },
+  { "scans", 0, 0, G_OPTION_ARG_INT, &scans, "Statements in each scan and join case", "N" },
+  { "spawns", 0, 0, G_OPTION_ARG_INT, &spawns, "cli_multidb processes in insert_single", "N" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed of the ids the statements pick", "S" },
+  { "dir", 0, 0, G_OPTION_ARG_STRING, &dir, "Where the databases go and are kept (default: a temporary directory, removed at the end)", "DIR" },
+  { "output", 0, 0, G_OPTION_ARG_STRING, &output, "JSON results", "FILE" },
+  { "cli", 0, 0, G_OPTION_ARG_STRING, &cli, "cli_multidb for insert_single", "PATH" },
+  { NULL }
+};
+
+#define BENCH_GROUPS 16
+#define BENCH_TXN_INSERTS 5
+#define BENCH_COPY_ROWS 100
+
+typedef void (*BenchOp)(gint k);
+
+struct bench_case {
+    const gchar *name;
+    BenchOp op;
+    gint *count;
+};
+
+/*
+ * splitmix64, so the ids don't depend on the platform's rand()
+ */
+
+guint64 bench_mix(guint64 x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+    return(x ^ (x >> 31));
+}
+
+gint bench_id(gint k)
+{
+    return(1 + bench_mix(((guint64) seed << 32) ^ k) % rows);
+}
+
+gchar * bench_insert_sql(gint k)
+{
+    GString *cols = g_string_new("id, grp, val");
+    GString *values = g_string_new(NULL);
+
+    g_string_append_printf(values, "0, %i, %i.5", 1 + k % BENCH_GROUPS, k);
+
+    for (gint c = 0; c < width; ++c) {
+        g_string_append_printf(cols, ", pad%i", c);
+        g_string_append(values, ", '");
+        for (gint i = 0; i < pad; ++i) {
+            g_string_append_c(values, 'a' + (k + c + i) % 26);
+        }
+        g_string_append_c(values, '\'');
+    }
+
+    gchar *sql = g_strdup_printf("INSERT INTO bench_main (%s) VALUES (%s);", cols->str, values->str);
+
+    g_string_free(cols, TRUE);
+    g_string_free(values, TRUE);
+
+    return(sql);
+}
+
+void bench_insert_single(gint k)
+{
+    gchar *sql = bench_insert_sql(rows + k);
+    pid_t pid = fork();
+
+    if (0 == pid) {
+        execl(cli, cli, "--sql_insert", sql, (char *) NULL);
+        fprintf(stderr, "error: exec(%s): %s\n", cli, g_strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+
+    int status;
+    if (-1 == pid || -1 == waitpid(pid, &status, 0) || !WIFEXITED(status) || EXIT_SUCCESS != WEXITSTATUS(status)) {
+        fprintf(stderr, "error: %s --sql_insert failed\n", cli);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(sql);
+}
+
+void bench_insert_bulk(gint k)
+{
+    gchar *sql = bench_insert_sql(k);
+
+    execute_ddl_insert(sql);
+    g_free(sql);
+}
+
+void bench_txn_ingest(gint k)
+{
+    mdb_begin();
+
+    for (gint i = 0; i < BENCH_TXN_INSERTS; ++i) {
+        gchar *sql = bench_insert_sql(2 * rows + k * BENCH_TXN_INSERTS + i);
+
+        execute_ddl_insert(sql);
+        g_free(sql);
+    }
+
+    mdb_commit();
+}
+
+void bench_point_select(gint k)
+{
+    gchar *sql = g_strdup_printf("SELECT * FROM bench_main WHERE id = %i;", bench_id(k));
+
+    execute_ddl_select(sql);
+    g_free(sql);
+}
+
+void bench_filtered_scan(gint k)
+{
+    gchar *sql = g_strdup_printf("SELECT id, val FROM bench_main WHERE grp = %i;", 1 + k % BENCH_GROUPS);
+
+    execute_ddl_select(sql);
+    g_free(sql);
+}
+
+void bench_full_scan(gint k G_GNUC_UNUSED)
+{
+    execute_ddl_select("SELECT * FROM bench_main;");
+}
+
+void bench_join(gint k G_GNUC_UNUSED)
+{
+    execute_ddl_select("SELECT bench_main.id, bench_dim.label FROM bench_main inner join bench_dim on bench_main.grp = bench_dim.id WHERE bench_main.id < 64;");
+}
+
+void bench_update(gint k)
+{
+    gchar *sql = g_strdup_printf("UPDATE bench_main SET val = val + 1 WHERE id = %i;", bench_id(k));
+
+    execute_ddl_update(sql);
+    g_free(sql);
+}
+
+/* Each op its own row: bench_id() would pick some twice */
+
+void bench_delete(gint k)
+{
+    gchar *sql = g_strdup_printf("DELETE FROM bench_main WHERE id = %i;", 1 + (gint) ((gint64) k * rows / ops));
+
+    execute_ddl_delete(sql);
+    g_free(sql);
+}
+
+void bench_copy_from(gint k G_GNUC_UNUSED)
+{
+    GString *sql = g_string_new("COPY bench_main (grp, val");
+
+    for (gint c = 0; c < width; ++c) {
+        g_string_append_printf(sql, ", pad%i", c);
+    }
+    g_string_append_printf(sql, ") FROM '%s' (FORMAT csv, PARALLEL 2);", copy_file);
+
+    execute_copy(sql->str);
+    g_string_free(sql, TRUE);
+}
+
+void bench_copy_to(gint k)
+{
+    gchar *sql = g_strdup_printf("COPY bench_main TO '%s%i' (FORMAT csv, PARALLEL 2);", export_dir, k);
+
+    execute_copy(sql);
+    g_free(sql);
+}
+
+/* Parsed into expression trees and freed, never run */
+
+void bench_parse(gint k)
+{
+    static const gchar *sql[] = {
+        "SELECT bench_main.id, upper(bench_dim.label) || '!' FROM bench_main inner join bench_dim on bench_main.grp = bench_dim.id "
+            "WHERE bench_main.id < 64 AND (bench_main.val IS NOT NULL OR bench_main.grp = 3);",
+        "INSERT INTO bench_main (id, grp, val) VALUES (0, 7, -42);",
+        "UPDATE bench_main SET val = (val + 1) * 2, grp = 3 WHERE id = 17 AND val >= 0;",
+        "DELETE FROM bench_main WHERE id = 17 OR val % 5 = 1;"
+    };
+    struct ddl_parsed ddl;
+
+    switch (k % 4) {
+        case 0: ddl = parse_select(sql[0]); break;
+        case 1: ddl = parse_insert(sql[1]); break;
+        case 2: ddl = parse_update(sql[2]); break;
+        default: ddl = parse_delete(sql[3]); break;
+    }
+
+    free_ddl_parsed(&ddl);
+}
+
+void read_all(int fd, gpointer buf, gsize len)
+{
+    for (gsize got = 0; got < len; ) {
+        ssize_t n = read(fd, (gchar *) buf + got, len - got);
+
+        if (-1 == n && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "error: read: writer went away\n");
+            exit(EXIT_FAILURE);
+        }
+
+        got += n;
+    }
+}
+
+/*
+ * A writer waits on start (for all of them to exist), then sends back
+ * its first and last times and the latency of each of its ops
+ */
+
+void bench_writer(BenchOp op, gint count, gint writer, gint nwriters, int start, int results)
+{
+    gchar c;
+
+    /* SELECTs print their rows */
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    while (0 != read(start, &c, 1) && EINTR == errno) {
+    }
+
+    GArray *latency = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint64 first = g_get_monotonic_time();
+
+    for (gint k = writer; k < count; k += nwriters) {
+        gint64 t = g_get_monotonic_time();
+
+        op(k);
+        t = g_get_monotonic_time() - t;
+        g_array_append_val(latency, t);
+    }
+
+    gint64 last = g_get_monotonic_time();
+    guint n = latency->len;
+
+    write_fd(results, (gchar *) &first, sizeof(first));
+    write_fd(results, (gchar *) &last, sizeof(last));
+    write_fd(results, (gchar *) &n, sizeof(n));
+    write_fd(results, latency->data, n * sizeof(gint64));
+
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
+
+gint cmp_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a;
+    gint64 y = *(const gint64 *) b;
+
+    return(x < y ? -1 : x > y);
+}
+
+gint64 percentile(GArray *sorted, gdouble p)
+{
+    if (0 == sorted->len) {
+        return(0);
+    }
+
+    guint i = (guint) (p * (sorted->len - 1) + 0.5);
+
+    return(g_array_index(sorted, gint64, i));
+}
+
+void bench_case_run(struct bench_case *bc, gint nwriters, GString *json)
+{
+    int start[2];
+    int results[nwriters][2];
+    pid_t pids[nwriters];
+
+    if (-1 == pipe(start)) {
+        fprintf(stderr, "error: pipe: %s\n", g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+
+    for (gint w = 0; w < nwriters; ++w) {
+        if (-1 == pipe(results[w])) {
+            fprintf(stderr, "error: pipe: %s\n", g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        pids[w] = fork();
+        if (-1 == pids[w]) {
+            fprintf(stderr, "error: fork: %s\n", g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (0 == pids[w]) {
+            close(start[1]);
+            close(results[w][0]);
+            bench_writer(bc->op, *bc->count, w, nwriters, start[0], results[w][1]);
+        }
+
+        close(results[w][1]);
+    }
+
+    /* Go */
+    close(start[0]);
+    close(start[1]);
+
+    GArray *latency = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint64 first = G_MAXINT64;
+    gint64 last = 0;
+
+    for (gint w = 0; w < nwriters; ++w) {
+        gint64 t[2];
+        guint n;
+
+        read_all(results[w][0], t, sizeof(t));
+        read_all(results[w][0], &n, sizeof(n));
+
+        guint at = latency->len;
+        g_array_set_size(latency, at + n);
+        read_all(results[w][0], &g_array_index(latency, gint64, at), n * sizeof(gint64));
+        close(results[w][0]);
+
+        first = MIN(first, t[0]);
+        last = MAX(last, t[1]);
+
+        int status;
+        if (-1 == waitpid(pids[w], &status, 0) || !WIFEXITED(status) || EXIT_SUCCESS != WEXITSTATUS(status)) {
+            fprintf(stderr, "error: %s: writer %i failed\n", bc->name, w);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    g_array_sort(latency, cmp_gint64);
+
+    gdouble seconds = (last - first) / 1e6;
+    gint64 sum = 0;
+    for (guint i = 0; i < latency->len; ++i) {
+        sum += g_array_index(latency, gint64, i);
+    }
+
+    gdouble per_sec = seconds > 0 ? latency->len / seconds : 0;
+    gint64 mean = latency->len ? sum / latency->len : 0;
+
+    g_print("%-14s %2i %6u %10.1f %8li %8li %8li %8li %8li\n", bc->name, nwriters, latency->len, per_sec,
+        mean, percentile(latency, 0.5), percentile(latency, 0.9), percentile(latency, 0.99), percentile(latency, 1.0));
+
+    g_string_append_printf(json,
+        "%s\n    {\"case\": \"%s\", \"writers\": %i, \"ops\": %u, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+        "\"latency_us\": {\"mean\": %li, \"p50\": %li, \"p90\": %li, \"p99\": %li, \"max\": %li}}",
+        '[' == json->str[json->len - 1] ? "" : ",", bc->name, nwriters, latency->len, seconds, per_sec,
+        mean, percentile(latency, 0.5), percentile(latency, 0.9), percentile(latency, 0.99), percentile(latency, 1.0));
+
+    g_array_free(latency, TRUE);
+}
+
+/*
+ * A fresh database for each writer count
+ */
+
+void bench_setup(const gchar *prefix)
+{
+    g_setenv("MULTIDB_PREFIX", prefix, TRUE);
+    mdb_init();
+
+    GString *sql = g_string_new("CREATE TABLE bench_main (id serial, grp integer, val double");
+    for (gint c = 0; c < width; ++c) {
+        g_string_append_printf(sql, ", pad%i text", c);
+    }
+    g_string_append(sql, ");");
+
+    execute_ddl_create(sql->str);
+    execute_ddl_create("CREATE TABLE bench_dim (id serial, label text);");
+
+    for (gint g = 1; g <= BENCH_GROUPS; ++g) {
+        gchar *insert = g_strdup_printf("INSERT INTO bench_dim (id, label) VALUES (0, 'group%i');", g);
+
+        execute_ddl_insert(insert);
+        g_free(insert);
+    }
+
+    /* What copy_from loads, the same rows each time */
+    GString *csv = g_string_new(NULL);
+    GError *error = NULL;
+
+    for (gint k = 0; k < BENCH_COPY_ROWS; ++k) {
+        g_string_append_printf(csv, "%i,%i.5", 1 + k % BENCH_GROUPS, k);
+        for (gint c = 0; c < width; ++c) {
+            g_string_append_c(csv, ',');
+            for (gint i = 0; i < pad; ++i) {
+                g_string_append_c(csv, 'a' + (k + c + i) % 26);
+            }
+        }
+        g_string_append_c(csv, '\n');
+    }
+
+    g_free(copy_file);
+    copy_file = g_strconcat(prefix, "copy.csv", NULL);
+
+    if (!g_file_set_contents(copy_file, csv->str, csv->len, &error)) {
+        fprintf(stderr, "error: %s: %s\n", copy_file, error->message);
+        exit(EXIT_FAILURE);
+    }
+
+    g_string_free(csv, TRUE);
+    g_string_free(sql, TRUE);
+
+    g_free(export_dir);
+    export_dir = g_strconcat(prefix, "export", NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context;
+
+    context = g_option_context_new("- multidb statement benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_print("option parsing failed: %s\n", error->message);
+        exit(EXIT_FAILURE);
+    }
+
+    if (rows < 1 || width < 0 || pad < 1 || writers < 1 || ops < 1 || scans < 1 || spawns < 1 || ops > rows) {
+        fprintf(stderr, "error: --rows, --pad, --writers, --ops, --scans and --spawns must be positive, --ops at most --rows\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* A directory of our own goes when the run is over, --dir stays */
+    gboolean temp_dir = NULL == dir;
+
+    if (temp_dir) {
+        dir = g_build_filename(g_get_tmp_dir(), "multidb_bench_XXXXXX", NULL);
+        if (NULL == g_mkdtemp(dir)) {
+            fprintf(stderr, "error: g_mkdtemp: %s: %s\n", dir, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct bench_case cases[] = {
+        { "insert_single", bench_insert_single, &spawns },
+        { "insert_bulk", bench_insert_bulk, &rows },
+        { "txn_ingest", bench_txn_ingest, &ops },
+        { "point_select", bench_point_select, &ops },
+        { "filtered_scan", bench_filtered_scan, &scans },
+        { "full_scan", bench_full_scan, &scans },
+        { "join", bench_join, &scans },
+        { "update", bench_update, &ops },
+        { "delete", bench_delete, &ops },
+        { "copy_from", bench_copy_from, &scans },
+        { "copy_to", bench_copy_to, &scans },
+        { "parse", bench_parse, &ops },
+    };
+
+    GString *json = g_string_new(NULL);
+    g_string_append_printf(json, "{\"bench\": \"multidb\", \"rows\": %i, \"width\": %i, \"pad\": %i, \"ops\": %i, "
+        "\"scans\": %i, \"spawns\": %i, \"seed\": %i, \"results\": [", rows, width, pad, ops, scans, spawns, seed);
+
+    g_print("%-14s %2s %6s %10s %8s %8s %8s %8s %8s\n", "case", "w", "ops", "ops/s", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+
+    /* 1, 2, 4 ... and --writers even if it isn't a power of two */
+    for (gint nwriters = 1; ; nwriters = MIN(nwriters * 2, writers)) {
+        gchar *prefix = g_strdup_printf("%s/w%i/", dir, nwriters);
+
+        bench_setup(prefix);
+
+        for (guint c = 0; c < G_N_ELEMENTS(cases); ++c) {
+            bench_case_run(&cases[c], nwriters, json);
+        }
+
+        g_free(prefix);
+
+        if (nwriters == writers) {
+            break;
+        }
+    }
+
+    g_string_append(json, "\n]}\n");
+
+    if (!g_file_set_contents(output, json->str, json->len, &error)) {
+        fprintf(stderr, "error: %s: %s\n", output, error->message);
+        exit(EXIT_FAILURE);
+    }
+
+    if (temp_dir) {
+        remove_tree(dir);
+        fprintf(stderr, "results: %s\n", output);
+    }
+    else {
+        fprintf(stderr, "results: %s, databases: %s\n", output, dir);
+    }
+
+    g_string_free(json, TRUE);
+
+    return(EXIT_SUCCESS);
+}
@@ -12,6 +12,21 @@ static gchar *sql_insert = NULL;
 static gchar *sql_select = NULL;
 static gchar *sql_delete = NULL;
 static gchar *sql_update = NULL;
+static gchar *sql_alter = NULL;
+static gchar *sql_copy = NULL;
+static gchar **sql = NULL;
+static gboolean stats = FALSE;
+static gboolean tail_changes = FALSE;
+static gint64 from = 0;
+static gint64 count = 0;
+static gchar *add_consumer = NULL;
+static gboolean before_values = FALSE;
+static gint64 ack_changes = -1;
+static gchar *consumer = NULL;
+static gchar *drop_consumer = NULL;
+static gchar *replica = NULL;
+static gboolean once = FALSE;
+static gchar *snapshot = NULL;
 // static gint max_size = 8;
 // static gboolean verbose = FALSE;
 // static gboolean beep = FALSE;
@@ -23,6 +38,21 @@ static GOptionEntry entries[] = {
   { "sql_select", 0, 0, G_OPTION_ARG_STRING, &sql_select, "A SELECT statement", NULL },
   { "sql_delete", 0, 0, G_OPTION_ARG_STRING, &sql_delete, "A DELETE statement", NULL },
   { "sql_update", 0, 0, G_OPTION_ARG_STRING, &sql_update, "An UPDATE statement", NULL },
+  { "sql_alter", 0, 0, G_OPTION_ARG_STRING, &sql_alter, "An ALTER TABLE statement", NULL },
+  { "sql_copy", 0, 0, G_OPTION_ARG_STRING, &sql_copy, "A COPY statement", NULL },
+  { "sql", 0, 0, G_OPTION_ARG_STRING_ARRAY, &sql, "Any statement, BEGIN, COMMIT or ROLLBACK; repeat to run several in order", NULL },
+  { "stats", 0, 0, G_OPTION_ARG_NONE, &stats, "Print the performance counters of every process (after the statement, if any)", NULL },
+  { "tail-changes", 0, 0, G_OPTION_ARG_NONE, &tail_changes, "Print the change log and wait for more", NULL },
+  { "from", 0, 0, G_OPTION_ARG_INT64, &from, "Start --tail-changes at this LSN", "LSN" },
+  { "count", 0, 0, G_OPTION_ARG_INT64, &count, "Stop --tail-changes after N changes", "N" },
+  { "add-consumer", 0, 0, G_OPTION_ARG_STRING, &add_consumer, "Log changes from now on, and keep them, for consumer NAME", "NAME" },
+  { "before-values", 0, 0, G_OPTION_ARG_NONE, &before_values, "With --add-consumer: log the values rows had before each change too", NULL },
+  { "ack-changes", 0, 0, G_OPTION_ARG_INT64, &ack_changes, "Let --consumer's changes before LSN go", "LSN" },
+  { "consumer", 0, 0, G_OPTION_ARG_STRING, &consumer, "The consumer --ack-changes is for", "NAME" },
+  { "drop-consumer", 0, 0, G_OPTION_ARG_STRING, &drop_consumer, "Stop keeping changes for consumer NAME", "NAME" },
+  { "replica", 0, 0, G_OPTION_ARG_FILENAME, &replica, "Make this database a replica of the one under PRIMARY and follow its change log", "PRIMARY" },
+  { "once", 0, 0, G_OPTION_ARG_NONE, &once, "Stop --replica once it has caught up", NULL },
+  { "snapshot", 0, 0, G_OPTION_ARG_FILENAME, &snapshot, "Copy the database as of now to DIR/multidb, holding writers off meanwhile", "DIR" },
   // { "max-size", 0, 0, G_OPTION_ARG_INT, &max_size, "Test up to 2^M items", "M" },
   // { "verbose", 0, 0, G_OPTION_ARG_NONE, &verbose, "Be verbose", NULL },
   // { "beep", 0, 0, G_OPTION_ARG_NONE, &beep, "Beep when done", NULL },
@@ -60,6 +90,45 @@ int main(int argc, char *argv[])
     else if (sql_update) {
         execute_ddl_update(sql_update);
     }
+    else if (sql_alter) {
+        execute_ddl_alter(sql_alter);
+    }
+    else if (sql_copy) {
+        execute_copy(sql_copy);
+    }
+    else if (sql) {
+        /* A transaction left open is rolled back at exit */
+        for (gchar **statement = sql; *statement; ++statement) {
+            execute_sql(*statement);
+        }
+    }
+    else if (tail_changes) {
+        mdb_tail_changes(from, count);
+    }
+    else if (add_consumer) {
+        g_print("%li\n", mdb_changes_register(MULTIDB_DATADIR, add_consumer, before_values));
+    }
+    else if (ack_changes >= 0) {
+        if (NULL == consumer) {
+            fprintf(stderr, "error: --ack-changes: needs --consumer\n");
+            exit(EXIT_FAILURE);
+        }
+
+        mdb_changes_ack(MULTIDB_DATADIR, consumer, ack_changes);
+    }
+    else if (drop_consumer) {
+        mdb_changes_drop(MULTIDB_DATADIR, drop_consumer);
+    }
+    else if (replica) {
+        mdb_replica_follow(replica, once);
+    }
+    else if (snapshot) {
+        mdb_snapshot(snapshot);
+    }
+
+    if (stats) {
+        mdb_stats_print();
+    }
 
     return(EXIT_SUCCESS);
 }
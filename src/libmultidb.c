@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -8,8 +9,39 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <libgen.h>
+#include <dirent.h>
 
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <utime.h>
+#include <fnmatch.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#endif
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#ifdef MDB_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef MDB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef MDB_HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include "libmultidb.h"
 
@@ -27,6 +59,7 @@ void mdb_init(void)
     MULTIDB_SCHEMADIR = g_strconcat(MULTIDB_DATADIR, "/", "schema", NULL);
     MULTIDB_TABLESDIR = g_strconcat(MULTIDB_DATADIR, "/", "tables", NULL);
     MULTIDB_PURGATORYDIR = g_strconcat(MULTIDB_DATADIR, "/", "purgatory", NULL);
+    MULTIDB_TXNDIR = g_strconcat(MULTIDB_DATADIR, "/", "txn", NULL);
     
     list = g_slist_append(list, MULTIDB_BASEDIR);
     list = g_slist_append(list, MULTIDB_DATADIR);
@@ -41,26 +74,26 @@ void mdb_init(void)
     }
 
     g_slist_free(list);
+
+    /* Whatever the last statements counted since the last flush */
+    atexit(mdb_stats_flush);
+
+    /* Finish the commits of processes that died publishing them */
+    mdb_txn_recover();
+    atexit(mdb_txn_exit);
 }
 
+/* parse_create()'s states; the other statements go through the lexer */
 enum {
     STATE_START,
     STATE_TABLENAME,
-    STATE_FROM,
-    STATE_INNER_JOIN,
-    STATE_SET,
-    STATE_UPDATE,
     STATE_START_COLS,
     STATE_PROCESS_COLS,
     STATE_END_COLS,
 
-    STATE_WHERE,
-
-    STATE_VALUES_CONSTANT,
-    STATE_START_VALUES,
-    STATE_PROCESS_VALUES,
-    STATE_END_VALUES,
-    STATE_END
+    STATE_WITH,
+    STATE_START_OPTIONS,
+    STATE_PROCESS_OPTIONS
 };
 
 char *tickGTokenType(GTokenType token);
@@ -71,7 +104,13 @@ char *tickGTokenType(GTokenType token);
  *      site_key VARCHAR(512),
  *      updated timestamp,
  *      inserted timestamp
- *  );
+ *  ) WITH (compression = lz4, buckets = 64);
+ *
+ *  CREATE TABLE log (id serial, at timestamp, msg text)
+ *      PARTITION BY RANGE (at) (
+ *          PARTITION p2014_10 VALUES LESS THAN ('2014-11-01'),
+ *          PARTITION p_rest VALUES LESS THAN (MAXVALUE)
+ *      );
  */
 
 struct ddl_parsed parse_create(const gchar *text)
@@ -175,6 +214,23 @@ struct ddl_parsed parse_create(const gchar *text)
 
                         ddl_create.row = g_slist_append(ddl_create.row, g_strdup(_buf));
                     }
+                    else if (G_TOKEN_IDENTIFIER == nextToken && 0 == g_ascii_strncasecmp("WITH", scanner->next_value.v_identifier, strlen("WITH"))) {
+                        state = STATE_WITH;
+
+                        ddl_create.row = g_slist_append(ddl_create.row, g_strdup(_buf));
+                        g_free(_buf);
+                        _buf = NULL;
+                    }
+                    else if (G_TOKEN_IDENTIFIER == nextToken && 0 == g_ascii_strcasecmp("PARTITION", scanner->next_value.v_identifier)) {
+                        ddl_create.row = g_slist_append(ddl_create.row, g_strdup(_buf));
+                        g_free(_buf);
+                        _buf = NULL;
+
+                        g_scanner_get_next_token(scanner);
+                        parse_partition_by(scanner, &ddl_create);
+
+                        state = expr_peek_keyword(scanner, "WITH") ? STATE_WITH : STATE_END_COLS;
+                    }
                     else {
                         g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
                         exit(EXIT_FAILURE);
@@ -218,8 +274,82 @@ struct ddl_parsed parse_create(const gchar *text)
                 }
             break;
 
+            case STATE_WITH:
+                if (G_TOKEN_IDENTIFIER == tokenType && 0 == g_ascii_strncasecmp("WITH", scanner->value.v_identifier, strlen("WITH"))) {
+                    state = STATE_START_OPTIONS;
+                }
+                else {
+                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+
+            case STATE_START_OPTIONS:
+                if (G_TOKEN_LEFT_PAREN == tokenType) {
+                    state = STATE_PROCESS_OPTIONS;
+                }
+                else {
+                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+
+            /*
+             * Options are kept as "key=value", the same as the SET list of an UPDATE
+             */
+
+            case STATE_PROCESS_OPTIONS:
+                if (G_TOKEN_IDENTIFIER == tokenType || G_TOKEN_STRING == tokenType) {
+                    const gchar *v = G_TOKEN_IDENTIFIER == tokenType ? scanner->value.v_identifier : scanner->value.v_string;
+
+                    if (NULL == _buf) {
+                        _buf = g_strdup(v);
+                    }
+                    else {
+                        t = _buf;
+                        _buf = g_strconcat(_buf, v, NULL);
+                        g_free(t);
+                    }
+                }
+                else if (G_TOKEN_INT == tokenType && _buf) {
+                    converted = g_strdup_printf("%li", scanner->value.v_int);
+                    t = _buf;
+                    _buf = g_strconcat(_buf, converted, NULL);
+                    g_free(t);
+                    g_free(converted);
+                }
+                else if (G_TOKEN_EQUAL_SIGN == tokenType && _buf) {
+                    t = _buf;
+                    _buf = g_strconcat(_buf, "=", NULL);
+                    g_free(t);
+                }
+                else if ((G_TOKEN_COMMA == tokenType || G_TOKEN_RIGHT_PAREN == tokenType) && _buf) {
+                    if (NULL == g_strstr_len(_buf, strlen(_buf), "=")) {
+                        g_scanner_error(scanner, "Table option without a value: %s\n", _buf);
+                        exit(EXIT_FAILURE);
+                    }
+
+                    ddl_create.options = g_slist_append(ddl_create.options, g_strdup(_buf));
+                    g_free(_buf);
+                    _buf = NULL;
+
+                    if (G_TOKEN_RIGHT_PAREN == tokenType) {
+                        state = STATE_END_COLS;
+                    }
+                }
+                else {
+                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+
             case STATE_END_COLS:
-                if (';' != tokenType && G_TOKEN_EOF != tokenType) {
+                if (G_TOKEN_IDENTIFIER == tokenType && NULL == ddl_create.partition_by &&
+                    0 == g_ascii_strcasecmp("PARTITION", scanner->value.v_identifier)
+                ) {
+                    parse_partition_by(scanner, &ddl_create);
+                }
+                else if (';' != tokenType && G_TOKEN_EOF != tokenType) {
                     g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
                 }
             break;
@@ -231,6 +361,217 @@ struct ddl_parsed parse_create(const gchar *text)
     return(ddl_create);
 }
 
+void ddl_syntax_error(GScanner *scanner, const gchar *expected)
+{
+    fprintf(stderr, "error: %s: expected %s at position %u\n", scanner->input_name, expected, g_scanner_cur_position(scanner));
+    exit(EXIT_FAILURE);
+}
+
+void ddl_expect_keyword(GScanner *scanner, const gchar *word)
+{
+    if (!expr_peek_keyword(scanner, word)) {
+        ddl_syntax_error(scanner, word);
+    }
+
+    g_scanner_get_next_token(scanner);
+}
+
+void ddl_expect(GScanner *scanner, GTokenType token, const gchar *expected)
+{
+    if (token != g_scanner_get_next_token(scanner)) {
+        ddl_syntax_error(scanner, expected);
+    }
+}
+
+/*
+ *  PARTITION p2014_10 VALUES LESS THAN ('2014-11-01')
+ *
+ *  (PARTITION already read)
+ */
+
+struct ddl_partition * parse_partition_def(GScanner *scanner)
+{
+    struct ddl_partition *def = g_malloc0(sizeof(struct ddl_partition));
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a partition name");
+    def->name = g_strdup(scanner->value.v_identifier);
+
+    ddl_expect_keyword(scanner, "VALUES");
+    ddl_expect_keyword(scanner, "LESS");
+    ddl_expect_keyword(scanner, "THAN");
+    ddl_expect(scanner, G_TOKEN_LEFT_PAREN, "(");
+
+    const gchar *sign = "";
+    GTokenType token = g_scanner_get_next_token(scanner);
+    if ('-' == token) {
+        sign = "-";
+        token = g_scanner_get_next_token(scanner);
+    }
+
+    switch ((int) token) {
+        case G_TOKEN_STRING:
+            def->bound = g_strdup_printf("'%s'", scanner->value.v_string);
+        break;
+
+        case G_TOKEN_INT:
+            def->bound = g_strdup_printf("%s%lu", sign, scanner->value.v_int);
+        break;
+
+        case G_TOKEN_FLOAT:
+            def->bound = g_strconcat(sign, g_ascii_dtostr(buf, sizeof(buf), scanner->value.v_float), NULL);
+        break;
+
+        case G_TOKEN_IDENTIFIER:
+            if (0 == g_ascii_strcasecmp("MAXVALUE", scanner->value.v_identifier)) {
+                break;
+            }
+            ddl_syntax_error(scanner, "a value or MAXVALUE");
+        break;
+
+        default:
+            ddl_syntax_error(scanner, "a value or MAXVALUE");
+    }
+
+    if (G_TOKEN_STRING == token && '-' == sign[0]) {
+        ddl_syntax_error(scanner, "a number after -");
+    }
+
+    ddl_expect(scanner, G_TOKEN_RIGHT_PAREN, ")");
+
+    return(def);
+}
+
+/*
+ *  PARTITION BY RANGE (col) (PARTITION ..., PARTITION ...)
+ *
+ *  (PARTITION already read)
+ */
+
+void parse_partition_by(GScanner *scanner, struct ddl_parsed *ddl)
+{
+    ddl_expect_keyword(scanner, "BY");
+    ddl_expect_keyword(scanner, "RANGE");
+    ddl_expect(scanner, G_TOKEN_LEFT_PAREN, "(");
+    ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a column name");
+    ddl->partition_by = g_strdup(scanner->value.v_identifier);
+    ddl_expect(scanner, G_TOKEN_RIGHT_PAREN, ")");
+    ddl_expect(scanner, G_TOKEN_LEFT_PAREN, "(");
+
+    GTokenType token;
+
+    do {
+        ddl_expect_keyword(scanner, "PARTITION");
+        ddl->partitions = g_slist_append(ddl->partitions, parse_partition_def(scanner));
+        token = g_scanner_get_next_token(scanner);
+    } while (G_TOKEN_COMMA == token);
+
+    if (G_TOKEN_RIGHT_PAREN != token) {
+        ddl_syntax_error(scanner, ", or )");
+    }
+}
+
+void free_ddl_partition(struct ddl_partition *def)
+{
+    g_free(def->name);
+    g_free(def->bound);
+    g_free(def);
+}
+
+/*
+ *  ALTER TABLE log ADD PARTITION p2014_12 VALUES LESS THAN ('2015-01-01');
+ *  ALTER TABLE log DROP PARTITION p2014_10;
+ *  ALTER TABLE log SET (concurrency = optimistic);
+ */
+
+struct ddl_parsed parse_alter(const gchar *text)
+{
+    GScanner *scanner;
+
+    scanner = g_scanner_new(NULL);
+
+    /* feed in the text */
+    g_scanner_input_text(scanner, text, strlen(text));
+
+    /* give the error handler an idea on how the input is named */
+    scanner->input_name = "ALTER TABLE";
+
+    struct ddl_parsed ddl_alter = {NULL, NULL};
+
+    ddl_expect_keyword(scanner, "ALTER");
+    ddl_expect_keyword(scanner, "TABLE");
+    ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a table name");
+    ddl_alter.tbl_name = g_strdup(scanner->value.v_identifier);
+
+    if (expr_peek_keyword(scanner, "ADD")) {
+        g_scanner_get_next_token(scanner);
+        ddl_expect_keyword(scanner, "PARTITION");
+
+        ddl_alter.action = g_strdup("ADD");
+        ddl_alter.partitions = g_slist_append(ddl_alter.partitions, parse_partition_def(scanner));
+    }
+    else if (expr_peek_keyword(scanner, "DROP")) {
+        g_scanner_get_next_token(scanner);
+        ddl_expect_keyword(scanner, "PARTITION");
+        ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a partition name");
+
+        struct ddl_partition *def = g_malloc0(sizeof(struct ddl_partition));
+        def->name = g_strdup(scanner->value.v_identifier);
+
+        ddl_alter.action = g_strdup("DROP");
+        ddl_alter.partitions = g_slist_append(ddl_alter.partitions, def);
+    }
+    else if (expr_peek_keyword(scanner, "SET")) {
+        g_scanner_get_next_token(scanner);
+        ddl_expect(scanner, G_TOKEN_LEFT_PAREN, "(");
+
+        do {
+            ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a table option");
+            gchar *name = g_strdup(scanner->value.v_identifier);
+
+            ddl_expect(scanner, G_TOKEN_EQUAL_SIGN, "=");
+
+            gchar *value = NULL;
+            GTokenType token = g_scanner_get_next_token(scanner);
+
+            if (G_TOKEN_IDENTIFIER == token) {
+                value = g_strdup(scanner->value.v_identifier);
+            }
+            else if (G_TOKEN_INT == token) {
+                value = g_strdup_printf("%li", scanner->value.v_int);
+            }
+            else {
+                ddl_syntax_error(scanner, "a value");
+            }
+
+            ddl_alter.options = g_slist_append(ddl_alter.options, g_strconcat(name, "=", value, NULL));
+            g_free(value);
+            g_free(name);
+        } while (G_TOKEN_COMMA == g_scanner_get_next_token(scanner));
+
+        if (G_TOKEN_RIGHT_PAREN != scanner->token) {
+            ddl_syntax_error(scanner, ", or )");
+        }
+
+        ddl_alter.action = g_strdup("SET");
+    }
+    else {
+        ddl_syntax_error(scanner, "ADD PARTITION, DROP PARTITION or SET");
+    }
+
+    GTokenType token = g_scanner_get_next_token(scanner);
+    if (';' == token) {
+        token = g_scanner_get_next_token(scanner);
+    }
+    if (G_TOKEN_EOF != token) {
+        ddl_syntax_error(scanner, "end of statement");
+    }
+
+    g_scanner_destroy(scanner);
+
+    return(ddl_alter);
+}
+
 char *tickGTokenType(GTokenType token)
 {
     static gchar _hack[2] = "!";
@@ -316,10 +657,11 @@ void write_fd(int fd, gchar *buf, size_t nbyte)
 {
     ssize_t wrote = 0;
 
-    for (int written = 0; written != nbyte; written += wrote) {
-        wrote = write(fd, buf, nbyte - written);
+    for (size_t written = 0; written != nbyte; written += wrote) {
+        wrote = write(fd, buf + written, nbyte - written);
         if (-1 == wrote) {
             if (EINTR == errno) {
+                wrote = 0;
                 continue;
             }
             else {
@@ -328,6 +670,8 @@ void write_fd(int fd, gchar *buf, size_t nbyte)
             }
         }
     }
+
+    mdb_counters()->bytes_written += nbyte;
 }
 
 void write_file(gchar *path, gchar *buf)
@@ -354,2658 +698,13340 @@ void write_file(gchar *path, gchar *buf)
     g_io_channel_unref(file);
 }
 
-void read_first_line(const gchar *path, gchar **buf)
+/*
+ * Column file compression
+ *
+ * A compressed column file starts with an 8 byte header: "\0MB", the codec
+ * and the uncompressed length (little endian), and has compressed bytes
+ * after it.  Text values never start with a NUL, and binary ones are at
+ * most 8 bytes long, so only a file longer than the header can be
+ * compressed: uncompressed files are read exactly as they were written.
+ */
+
+#define MDB_BLOCK_MAGIC "\0MB"
+#define MDB_BLOCK_HEADER_SIZE 8
+
+/* Values shorter than this are never worth a codec */
+#define MDB_COMPRESS_MIN_BYTES 64
+
+/* With "auto", values at least this long go to zstd instead of lz4 */
+#define MDB_COMPRESS_ZSTD_BYTES 4096
+
+#define MDB_ZSTD_LEVEL 3
+
+gboolean mdb_codec_from_name(const gchar *name, MdbCodec *codec)
 {
-    GError *error = NULL;
-    GIOChannel *file = g_io_channel_new_file(path, "r", &error);
-    if (error) {
-        *buf = NULL;
-        return;
-        // fprintf(stderr, "error: g_io_channel_new_file: [%s] %s\n", path, error->message);
-        // exit(EXIT_FAILURE);
+    if (0 == g_ascii_strcasecmp("none", name)) {
+        *codec = MDB_CODEC_NONE;
+    }
+    else if (0 == g_ascii_strcasecmp("lz4", name)) {
+        *codec = MDB_CODEC_LZ4;
+    }
+    else if (0 == g_ascii_strcasecmp("zstd", name)) {
+        *codec = MDB_CODEC_ZSTD;
+    }
+    else if (0 == g_ascii_strcasecmp("auto", name)) {
+        *codec = MDB_CODEC_AUTO;
+    }
+    else {
+        return(FALSE);
     }
 
-    g_io_channel_read_line(file, buf, NULL, NULL, &error);
-    if (error) {
-        *buf = NULL;
-        return;
-        // fprintf(stderr, "error: g_io_channel_read_line: %s\n", error->message);
-        // exit(EXIT_FAILURE);
+    return(TRUE);
+}
+
+const gchar * mdb_codec_name(MdbCodec codec)
+{
+    switch (codec) {
+        case MDB_CODEC_NONE: return("none");
+        case MDB_CODEC_LZ4:  return("lz4");
+        case MDB_CODEC_ZSTD: return("zstd");
+        case MDB_CODEC_AUTO: return("auto");
     }
-    // g_print ("Read %u bytes: %s\n", len, *buf);
-    
-    g_io_channel_shutdown(file, TRUE, &error);
-    if (error) {
-        fprintf(stderr, "error: g_io_channel_shutdown %s\n", error->message);
-        exit(EXIT_FAILURE);
-    } 
-    
-    g_io_channel_unref(file);
+
+    return("unknown");
 }
 
-void execute_ddl_create(gchar *sql)
+gboolean mdb_codec_available(MdbCodec codec)
 {
-    struct ddl_parsed ddl_create = parse_create(sql);
+    switch (codec) {
+        case MDB_CODEC_NONE:
+            return(TRUE);
+
+        /* auto with nothing to pick from would quietly compress nothing */
+        case MDB_CODEC_AUTO:
+            return(mdb_codec_available(MDB_CODEC_LZ4) || mdb_codec_available(MDB_CODEC_ZSTD));
+
+        case MDB_CODEC_LZ4:
+#ifdef MDB_HAVE_LZ4
+            return(TRUE);
+#else
+            return(FALSE);
+#endif
 
-    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", ddl_create.tbl_name, NULL);
-    if (g_file_test(schema_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: schema: %s: already exists: %s\n", ddl_create.tbl_name, schema_path);
-        exit(EXIT_FAILURE);
-    }
-    if (0 != g_mkdir_with_parents(schema_path, 0775)) {
-        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", schema_path, g_strerror(errno));
-        exit(EXIT_FAILURE);
+        case MDB_CODEC_ZSTD:
+#ifdef MDB_HAVE_ZSTD
+            return(TRUE);
+#else
+            return(FALSE);
+#endif
     }
 
-    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", ddl_create.tbl_name, NULL);
-    if (g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: table: %s: already exists: %s\n", ddl_create.tbl_name, table_path);
-        exit(EXIT_FAILURE);
-    }
-    if (0 != g_mkdir_with_parents(table_path, 0775)) {
-        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", table_path, g_strerror(errno));
-        exit(EXIT_FAILURE);
-    }
+    return(FALSE);
+}
 
-    GSList* paths = NULL, *iterator = NULL;
-    paths = g_slist_append(paths, g_strconcat(table_path, "/", "rows", NULL));
-    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", NULL));
-    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", "/", "columns", NULL));
-    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", "/", "serial", NULL));
-    for (iterator = paths; iterator; iterator = iterator->next) {
-        if (0 != g_mkdir_with_parents(iterator->data, 0775)) {
-            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", iterator->data, g_strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-    }
+/*
+ * Returns the compressed size, or 0 when the codec is unavailable or failed
+ */
 
-    g_slist_free_full(paths, g_free);
+gsize mdb_compress(MdbCodec codec, const gchar *src, gsize src_len, GByteArray *dst)
+{
+    gsize wrote = 0;
 
-    for (int i = 0; i < 4096; ++i) {
-        gchar *converted = g_strdup_printf("%04d", i);
-        gchar *path = g_strconcat(table_path, "/", "rows", "/", converted, NULL);
-        if (0 != g_mkdir_with_parents(path, 0775)) {
-            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", iterator->data, g_strerror(errno));
-            exit(EXIT_FAILURE);
+    g_byte_array_set_size(dst, 0);
+
+    if (MDB_CODEC_LZ4 == codec) {
+#ifdef MDB_HAVE_LZ4
+        int bound = LZ4_compressBound(src_len);
+
+        g_byte_array_set_size(dst, bound);
+        wrote = LZ4_compress_default(src, (char *) dst->data, src_len, bound);
+#endif
+    }
+    else if (MDB_CODEC_ZSTD == codec) {
+#ifdef MDB_HAVE_ZSTD
+        size_t bound = ZSTD_compressBound(src_len);
+
+        g_byte_array_set_size(dst, bound);
+        wrote = ZSTD_compress(dst->data, bound, src, src_len, MDB_ZSTD_LEVEL);
+        if (ZSTD_isError(wrote)) {
+            wrote = 0;
         }
-        g_free(converted);
-        g_free(path);
+#endif
     }
 
-    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "version", NULL);
-    write_file(path, "v1");
-    g_free(path);
+    g_byte_array_set_size(dst, wrote);
 
-    path = g_strconcat(table_path, "/", "metadata", "/", "roid", NULL);
-    write_file(path, "0");
-    g_free(path);
+    return(wrote);
+}
 
-    for (iterator = ddl_create.row; iterator; iterator = iterator->next) {
-        gchar **items = g_strsplit(iterator->data, " ", 2);
+/*
+ * Inflates into dst, which is left NUL terminated
+ */
 
-        gchar *path = g_strconcat(schema_path, "/", items[0], NULL);
-        // g_print("%s :: %s\n", path, items[1]);
-		write_file(path, items[1]);
-        g_free(path);
+gboolean mdb_decompress(MdbCodec codec, const gchar *src, gsize src_len, GByteArray *dst, gsize raw_len)
+{
+    gboolean ret = FALSE;
 
-        if (0 == g_ascii_strncasecmp("serial", items[1], strlen("serial"))) {
-            gchar *path = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", items[0], NULL);
-            write_file(path, "0");
-            g_free(path);
-        }
+    g_byte_array_set_size(dst, raw_len + 1);
 
-        g_strfreev(items);
+    if (MDB_CODEC_LZ4 == codec) {
+#ifdef MDB_HAVE_LZ4
+        ret = (int) raw_len == LZ4_decompress_safe(src, (char *) dst->data, src_len, raw_len);
+#endif
+    }
+    else if (MDB_CODEC_ZSTD == codec) {
+#ifdef MDB_HAVE_ZSTD
+        ret = raw_len == ZSTD_decompress(dst->data, raw_len, src, src_len);
+#endif
     }
 
-    g_slist_free_full(ddl_create.row, g_free);
+    dst->data[raw_len] = '\0';
 
-    g_free(schema_path);
-    g_free(table_path);
+    return(ret);
 }
 
-void execute_ddl_insert(gchar *sql)
+MdbCodec pick_codec(MdbCodec codec, gsize len)
 {
-    struct ddl_parsed ddl_insert = parse_insert(sql);
-    GSList *cols = NULL;
-    GSList *values = NULL;
-
-    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", ddl_insert.tbl_name, NULL);
-    if (!g_file_test(schema_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: schema: %s: does not already exist: %s\n", ddl_insert.tbl_name, schema_path);
-        exit(EXIT_FAILURE);
+    if (len < MDB_COMPRESS_MIN_BYTES) {
+        return(MDB_CODEC_NONE);
     }
 
-    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", ddl_insert.tbl_name, NULL);
-    if (!g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: table: %s: does not already exist: %s\n", ddl_insert.tbl_name, table_path);
-        exit(EXIT_FAILURE);
+    if (MDB_CODEC_AUTO == codec) {
+        if (len >= MDB_COMPRESS_ZSTD_BYTES && mdb_codec_available(MDB_CODEC_ZSTD)) {
+            return(MDB_CODEC_ZSTD);
+        }
+        if (mdb_codec_available(MDB_CODEC_LZ4)) {
+            return(MDB_CODEC_LZ4);
+        }
+        if (mdb_codec_available(MDB_CODEC_ZSTD)) {
+            return(MDB_CODEC_ZSTD);
+        }
+
+        return(MDB_CODEC_NONE);
     }
 
-    for (cols = ddl_insert.cols; cols; cols = cols->next) {
-        gchar *path = g_strconcat(schema_path, "/", cols->data, NULL);
-        if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
-            fprintf(stderr, "error: schema: [%s]::[%s]: not found: %s\n", ddl_insert.tbl_name, cols->data, path);
+    return(codec);
+}
+
+MdbCodec load_table_codec(gchar *table_path)
+{
+    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "compression", NULL);
+    MdbCodec codec = MDB_CODEC_NONE;
+    gchar *buf;
+
+    read_first_line(path, &buf);
+    if (buf) {
+        if (!mdb_codec_from_name(g_strstrip(buf), &codec)) {
+            fprintf(stderr, "error: compression: unknown codec: %s: %s\n", buf, path);
             exit(EXIT_FAILURE);
         }
-        g_free(path);
+        g_free(buf);
     }
 
-    gchar *bucket = next_row_bucket(table_path);
-
-    cols = ddl_insert.cols;
-    values = ddl_insert.values;
-    while (cols && values) {
-        struct stat st;
-        gchar *bucket_file = g_strconcat(bucket, "/", cols->data, NULL);
-        gchar *serial_file = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", cols->data, NULL);
+    g_free(path);
 
-        // g_print("[%s] -> [%s]\n", cols->data, bucket_file);
+    return(codec);
+}
 
-        if (0 == stat(serial_file, &st) && 0 == g_ascii_strncasecmp("0", values->data, strlen("0"))) {
-            gint serial = next_serial(table_path, serial_file);
-            gchar *buf = g_strdup_printf("%i", serial);
-            write_file(bucket_file, buf);
-            g_free(buf);
-        }
-        else {
-            write_file(bucket_file, values->data);
-        }
+/*
+ * Row buckets: a row lives in rows/<roid % buckets>/<roid>.  Tables made
+ * before the option have no metadata/buckets and use MDB_BUCKETS_DEFAULT.
+ */
 
-        g_free(bucket_file);
+gboolean mdb_buckets_from_name(const gchar *name, gint *buckets)
+{
+    gchar *end = NULL;
+    gint64 n = g_ascii_strtoll(name, &end, 10);
 
-        cols = cols->next;
-        values = values->next;
+    if (end == name || '\0' != *end || n < 1 || n > MDB_BUCKETS_MAX) {
+        return(FALSE);
     }
 
-    g_slist_free_full(ddl_insert.cols, g_free);
-    g_slist_free_full(ddl_insert.values, g_free);
+    *buckets = n;
 
-    g_free(bucket);
+    return(TRUE);
 }
 
-gint next_serial(gchar *table_path, gchar *serial_file) 
+gint load_table_buckets(gchar *table_path)
 {
-    get_table_lock(table_path);
-
+    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "buckets", NULL);
+    gint buckets = MDB_BUCKETS_DEFAULT;
     gchar *buf;
 
-    read_first_line(serial_file, &buf);
+    read_first_line(path, &buf);
+    if (buf) {
+        if (!mdb_buckets_from_name(g_strstrip(buf), &buckets)) {
+            fprintf(stderr, "error: buckets: invalid count: %s: %s\n", buf, path);
+            exit(EXIT_FAILURE);
+        }
+        g_free(buf);
+    }
 
-    gint64 serial = g_ascii_strtoll(buf, NULL, 10);
-    ++serial;
-    g_free(buf);
+    g_free(path);
 
-    buf = g_strdup_printf("%li", serial);
-    write_file(serial_file, buf);
-    g_free(buf);
+    return(buckets);
+}
 
-    free_table_lock(table_path);
+/*
+ * Concurrency: how UPDATE and DELETE keep writers of the same row apart.
+ * pessimistic (the default) locks each row; optimistic reads it, works
+ * out the change, and only claims the row's version if nobody has
+ * bumped it meanwhile.  metadata/concurrency holds the name.
+ */
+
+gboolean mdb_concurrency_from_name(const gchar *name, gboolean *optimistic)
+{
+    if (0 == g_ascii_strcasecmp("pessimistic", name)) {
+        *optimistic = FALSE;
+    }
+    else if (0 == g_ascii_strcasecmp("optimistic", name)) {
+        *optimistic = TRUE;
+    }
+    else {
+        return(FALSE);
+    }
 
-    return(serial);
+    return(TRUE);
 }
 
-gchar * next_row_bucket(gchar *table_path)
+gboolean load_table_optimistic(gchar *table_path)
 {
-    gint roid = next_roid(table_path);
+    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "concurrency", NULL);
+    gboolean optimistic = FALSE;
+    gchar *buf;
 
-    gchar *roid_file = g_strdup_printf("%i", roid);
-    gchar *bucket_dir = g_strdup_printf("%04i", roid % 4096);
-    gchar *bucket_path = g_strconcat(table_path, "/", "rows", "/", bucket_dir, "/", roid_file, NULL);
+    read_first_line(path, &buf);
+    if (buf) {
+        if (!mdb_concurrency_from_name(g_strstrip(buf), &optimistic)) {
+            fprintf(stderr, "error: concurrency: unknown mode: %s: %s\n", buf, path);
+            exit(EXIT_FAILURE);
+        }
+        g_free(buf);
+    }
 
-    g_free(roid_file);
-    g_free(bucket_dir);
+    g_free(path);
 
-    if (0 != g_mkdir_with_parents(bucket_path, 0775)) {
-        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", bucket_path, g_strerror(errno));
-        exit(EXIT_FAILURE);
+    return(optimistic);
+}
+
+/*
+ * Range partitioning: metadata/partition_by names the key column, each
+ * metadata/partitions/<name> holds its bound (or MAXVALUE) and the rows
+ * live under partitions/<name>/rows instead of rows.
+ */
+
+gchar * table_partition_col(const gchar *table)
+{
+    gchar *path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "metadata", "/", "partition_by", NULL);
+    gchar *buf;
+
+    read_first_line(path, &buf);
+    g_free(path);
+
+    if (buf) {
+        g_strstrip(buf);
     }
 
-    return(bucket_path);
+    return(buf);
 }
 
-gint next_roid(gchar *table_path)
+struct mdb_partition * mdb_partition_new(const gchar *name, const gchar *bound, MdbColumnType col_type)
 {
-    gchar *roid_file = g_strconcat(table_path, "/", "metadata", "/", "roid", NULL);
+    struct mdb_partition *part = g_malloc0(sizeof(struct mdb_partition));
 
-    get_table_lock(table_path);
+    part->name = g_strdup(name);
+    part->max = NULL == bound;
+    part->bound.col_type = col_type;
 
-    gchar *buf;
+    if (bound && (!mdb_col_from_literal(col_type, bound, &part->bound) || part->bound.null)) {
+        fprintf(stderr, "error: partition: %s: invalid bound: %s\n", name, bound);
+        exit(EXIT_FAILURE);
+    }
 
-    read_first_line(roid_file, &buf);
+    return(part);
+}
 
-    // g_print("cur roid: %s\n", buf);
-    gint64 roid = g_ascii_strtoll(buf, NULL, 10);
-    ++roid;
-    g_free(buf);
+void free_mdb_partition(struct mdb_partition *part)
+{
+    g_free(part->name);
+    g_free(part->bound.v_text);
+    g_free(part);
+}
 
-    buf = g_strdup_printf("%li", roid);
-    write_file(roid_file, buf);
-    g_free(buf);
+/* For g_ptr_array_sort(): by bound, MAXVALUE last */
 
-    free_table_lock(table_path);
+gint mdb_partition_cmp(gconstpointer a, gconstpointer b)
+{
+    const struct mdb_partition *x = *(struct mdb_partition **) a;
+    const struct mdb_partition *y = *(struct mdb_partition **) b;
+
+    if (x->max || y->max) {
+        return(x->max - y->max);
+    }
 
-    return(roid);
+    return(mdb_col_cmp(&x->bound, &y->bound));
 }
 
-void get_table_lock(gchar *table_path)
+GPtrArray * load_partitions(const gchar *table, const gchar *col)
 {
-    gchar *lock_file = g_strconcat(table_path, "/", "tbl_lock", NULL);
-    struct stat st;
-    int fd = 0;
+    GPtrArray *parts = g_ptr_array_new_with_free_func((GDestroyNotify) free_mdb_partition);
+    MdbColumnType col_type = MDB_COL_TEXT;
+
+    mdb_col_type_from_name(g_hash_table_lookup(cached_schema(table), col), &col_type);
 
-    if (0 == stat(lock_file, &st)) {
-        fprintf(stderr, "lock file (%s) already exists (%s)\n", lock_file, g_strerror(errno));
+    gchar *parts_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "metadata", "/", "partitions", NULL);
+    GDir *dir = dir_open(parts_path);
+    if (NULL == dir) {
+        fprintf(stderr, "error: table: %s: partitions: does not exist: %s\n", table, parts_path);
         exit(EXIT_FAILURE);
     }
 
-    while ((fd = open(lock_file, O_CREAT|O_RDWR|O_EXCL, 0644)) < 0) {
-        if (errno != EEXIST) {
-            fprintf(stderr, "error: open(%s): %s\n", lock_file, g_strerror(errno));
+    const gchar *name;
+    while ((name = g_dir_read_name(dir))) {
+        gchar *path = g_strconcat(parts_path, "/", name, NULL);
+        gchar *buf;
+
+        read_first_line(path, &buf);
+        if (NULL == buf) {
+            fprintf(stderr, "error: partition: %s: no bound: %s\n", name, path);
             exit(EXIT_FAILURE);
         }
+        g_strstrip(buf);
 
-        if (stat(lock_file, &st) == 0 && time(NULL) - st.st_mtime > 120) {
-            fprintf(stderr, "error: open(%s): waiting for over 120 seconds\n", lock_file);
-            exit(EXIT_FAILURE);
+        g_ptr_array_add(parts, mdb_partition_new(name, g_ascii_strcasecmp("MAXVALUE", buf) ? buf : NULL, col_type));
+
+        g_free(buf);
+        g_free(path);
+    }
+
+    g_dir_close(dir);
+    g_free(parts_path);
+
+    g_ptr_array_sort(parts, mdb_partition_cmp);
+
+    return(parts);
+}
+
+/*
+ * The partitions of a CREATE TABLE, checked and in order
+ */
+
+GPtrArray * partitions_from_ddl(GSList *defs, MdbColumnType col_type)
+{
+    GPtrArray *parts = g_ptr_array_new_with_free_func((GDestroyNotify) free_mdb_partition);
+
+    for (GSList *iterator = defs; iterator; iterator = iterator->next) {
+        struct ddl_partition *def = iterator->data;
+
+        for (guint i = 0; i < parts->len; ++i) {
+            if (0 == g_strcmp0(def->name, ((struct mdb_partition *) g_ptr_array_index(parts, i))->name)) {
+                fprintf(stderr, "error: partition: %s: already exists\n", def->name);
+                exit(EXIT_FAILURE);
+            }
         }
 
-        sleep(1);
+        g_ptr_array_add(parts, mdb_partition_new(def->name, def->bound, col_type));
     }
 
-    pid_t pid = getpid();
+    g_ptr_array_sort(parts, mdb_partition_cmp);
 
-    gchar *converted = g_strdup_printf("%i", pid);
-    write_fd(fd, converted, strlen(converted));
-    g_free(converted);
+    for (guint i = 1; i < parts->len; ++i) {
+        struct mdb_partition *prev = g_ptr_array_index(parts, i - 1);
+        struct mdb_partition *part = g_ptr_array_index(parts, i);
 
-    close(fd);
+        if (0 == mdb_partition_cmp(&prev, &part)) {
+            fprintf(stderr, "error: partition: %s: same bound as %s\n", part->name, prev->name);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    g_free(lock_file);
+    return(parts);
 }
 
-void free_table_lock(gchar *table_path)
+/*
+ * The rows directory first, so an INSERT never picks a partition that
+ * has nowhere to put the row
+ */
+
+void create_partition(const gchar *table_path, struct ddl_partition *def)
 {
-    gchar *lock_file = g_strconcat(table_path, "/", "tbl_lock", NULL);
+    gchar *path = g_strconcat(table_path, "/", "partitions", "/", def->name, "/", "rows", NULL);
 
-    if (-1 == unlink(lock_file)) {
-        fprintf(stderr, "error: unlink(%s): %s\n", lock_file, g_strerror(errno));
+    if (0 != g_mkdir_with_parents(path, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", path, g_strerror(errno));
         exit(EXIT_FAILURE);
     }
+    g_free(path);
 
-    g_free(lock_file);
+    path = g_strconcat(table_path, "/", "metadata", "/", "partitions", "/", def->name, NULL);
+    write_file(path, def->bound ? def->bound : "MAXVALUE");
+    g_free(path);
 }
 
 /*
- * INSERT INTO album (id, name, year) VALUES (0, 'Vacation', 2014);
+ * The partition an INSERT's row goes in, NULL for unpartitioned tables
  */
 
-struct ddl_parsed parse_insert(const gchar *text)
+gchar * insert_partition(const gchar *table, GSList *cols, GSList *values)
 {
-    GScanner *scanner;
-    
-    scanner = g_scanner_new(NULL);
-    
-    /* feed in the text */
-    g_scanner_input_text(scanner, text, strlen(text));
-    
-    /* give the error handler an idea on how the input is named */
-    scanner->input_name = "INSERT INTO";
+    gchar *col = table_partition_col(table);
 
-    int state = STATE_START;
-    gchar *_buf = NULL;
+    if (NULL == col) {
+        return(NULL);
+    }
 
-    struct ddl_parsed ddl_create = {NULL, NULL, NULL, NULL};
+    const gchar *literal = NULL;
+    for (; cols && values; cols = cols->next, values = values->next) {
+        if (0 == g_strcmp0(col, cols->data)) {
+            literal = values->data;
+        }
+    }
 
-    while (!g_scanner_eof(scanner))
-    {
-        static int nested = 0;
-        GTokenType tokenType = g_scanner_get_next_token(scanner);
+    gchar *name = partition_for(table, col, literal);
 
-        switch (state) {
-            case STATE_START: 
-                if (G_TOKEN_IDENTIFIER != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
+    if (NULL == name) {
+        fprintf(stderr, "error: [%s]::[%s]: no partition for %s\n", table, col, literal);
+        exit(EXIT_FAILURE);
+    }
 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("INSERT", scanner->value.v_identifier, strlen("INSERT"))) {
-                        if (NULL == _buf) {
-                            _buf = g_strdup("INSERT ");
-                        }
-                        else {
-                            g_scanner_error(scanner, "Unexpected INSERT INTO preamble: %s\n", _buf);
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    else if (0 == g_ascii_strncasecmp("INTO", scanner->value.v_identifier, strlen("INTO"))) {
-                        gchar *t = _buf;
-                        _buf = g_strconcat(_buf, scanner->value.v_identifier, NULL);
-                        g_free(t);
-                            
-                        if (0 != g_ascii_strncasecmp("INSERT INTO", _buf, strlen("INSERT INTO"))) {
-                            g_scanner_error(scanner, "Unexpected INSERT INTO preamble: %s\n", _buf);
-                            exit(EXIT_FAILURE);
-                        }
+    g_free(col);
 
-                        g_free(_buf);
-                        _buf = NULL;
+    return(name);
+}
 
-                        state = STATE_TABLENAME;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            break;
+/* The partition whose range holds the key literal, NULL if none does */
+gchar * partition_for(const gchar *table, const gchar *col, const gchar *literal)
+{
+    MdbColumnType col_type = MDB_COL_TEXT;
+    struct mdb_col key;
 
-            case STATE_TABLENAME: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    state = STATE_START_COLS;
+    mdb_col_type_from_name(g_hash_table_lookup(cached_schema(table), col), &col_type);
 
-                    ddl_create.tbl_name = g_strdup(scanner->value.v_identifier);
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    if (!mdb_col_from_literal(col_type, literal, &key) || key.null) {
+        fprintf(stderr, "error: [%s]::[%s]: partition key can't be NULL\n", table, col);
+        exit(EXIT_FAILURE);
+    }
 
-            case STATE_START_COLS: 
-                if (G_TOKEN_LEFT_PAREN == tokenType) {
-                    state = STATE_PROCESS_COLS;
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    GPtrArray *parts = load_partitions(table, col);
+    gchar *name = NULL;
 
-            case STATE_PROCESS_COLS: 
-                if (G_TOKEN_COMMA == tokenType) {
-                    /* nothing to do here */
-                }
-                else if (G_TOKEN_RIGHT_PAREN == tokenType) {
-                    state = STATE_VALUES_CONSTANT;
-                }
-                else if (G_TOKEN_IDENTIFIER == tokenType) {
-                    ddl_create.cols = g_slist_append(ddl_create.cols, g_strdup(scanner->value.v_identifier));
-                }
-            break;
+    for (guint i = 0; i < parts->len && NULL == name; ++i) {
+        struct mdb_partition *part = g_ptr_array_index(parts, i);
 
-            case STATE_VALUES_CONSTANT: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("VALUES", scanner->value.v_identifier, strlen("VALUES"))) {
-                        state = STATE_START_VALUES;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
+        if (part->max || mdb_col_cmp(&key, &part->bound) < 0) {
+            name = g_strdup(part->name);
+        }
+    }
+
+    g_ptr_array_free(parts, TRUE);
+    g_free(key.v_text);
+
+    return(name);
+}
+
+gboolean is_partition_col(struct mdb_expr *expr, const gchar *table, const gchar *col)
+{
+    return(MDB_EXPR_COLUMN == expr->kind && (NULL == expr->table || 0 == g_strcmp0(table, expr->table)) &&
+        0 == g_strcmp0(col, expr->col));
+}
+
+/*
+ * FALSE when no row of part, which starts at lo (NULL for the first),
+ * can satisfy expr.  Only ANDs, ORs and comparisons of the key with a
+ * literal are looked at; anything else might match.
+ */
+
+gboolean partition_may_match(struct mdb_expr *expr, const gchar *table, const gchar *col, const struct mdb_col *lo, const struct mdb_partition *part)
+{
+    if (NULL == expr || MDB_EXPR_BINARY != expr->kind) {
+        return(TRUE);
+    }
+
+    struct mdb_expr *left = g_ptr_array_index(expr->args, 0);
+    struct mdb_expr *right = g_ptr_array_index(expr->args, 1);
+    MdbExprOp op = expr->op;
+
+    switch (op) {
+        case MDB_OP_AND:
+            return(partition_may_match(left, table, col, lo, part) && partition_may_match(right, table, col, lo, part));
+
+        case MDB_OP_OR:
+            return(partition_may_match(left, table, col, lo, part) || partition_may_match(right, table, col, lo, part));
+
+        case MDB_OP_EQ:
+        case MDB_OP_LT:
+        case MDB_OP_LE:
+        case MDB_OP_GT:
+        case MDB_OP_GE:
+        break;
+
+        default:
+            return(TRUE);
+    }
+
+    /* literal op key is key op' literal */
+    if (MDB_EXPR_LITERAL == left->kind && is_partition_col(right, table, col)) {
+        struct mdb_expr *t = left;
+        left = right;
+        right = t;
+
+        switch (op) {
+            case MDB_OP_LT: op = MDB_OP_GT; break;
+            case MDB_OP_LE: op = MDB_OP_GE; break;
+            case MDB_OP_GT: op = MDB_OP_LT; break;
+            case MDB_OP_GE: op = MDB_OP_LE; break;
+            default: break;
+        }
+    }
+
+    if (!is_partition_col(left, table, col) || MDB_EXPR_LITERAL != right->kind) {
+        return(TRUE);
+    }
+
+    /* Comparing with NULL is never true */
+    if (right->value.null) {
+        return(FALSE);
+    }
+
+    MdbColumnType col_type = part->bound.col_type;
+    struct mdb_col v = right->value;
+    v.v_text = g_strdup(right->value.v_text);
+
+    gboolean number = MDB_COL_INT64 == v.col_type || MDB_COL_DOUBLE == v.col_type;
+    gboolean number_key = MDB_COL_INT64 == col_type || MDB_COL_DOUBLE == col_type;
+
+    if (v.col_type != col_type && !(number && number_key) &&
+        (MDB_COL_TEXT != v.col_type || !mdb_col_cast(&v, col_type))
+    ) {
+        mdb_col_clear(&v);
+        return(TRUE);
+    }
+
+    /* v >= lo, and v < the partition's bound */
+    gint from_lo = lo ? mdb_col_cmp(&v, lo) : 1;
+    gboolean below_hi = part->max || mdb_col_cmp(&v, &part->bound) < 0;
+    gboolean ret = TRUE;
+
+    switch (op) {
+        case MDB_OP_EQ: ret = from_lo >= 0 && below_hi; break;
+        case MDB_OP_LT: ret = from_lo > 0; break;
+        case MDB_OP_LE: ret = from_lo >= 0; break;
+        case MDB_OP_GT:
+        case MDB_OP_GE: ret = below_hi; break;
+        default: break;
+    }
+
+    mdb_col_clear(&v);
+
+    return(ret);
+}
+
+void remove_tree(const gchar *path)
+{
+    GDir *dir = dir_open((gchar *) path);
+
+    if (dir) {
+        const gchar *name;
+
+        while ((name = g_dir_read_name(dir))) {
+            gchar *child = g_strconcat(path, "/", name, NULL);
+            remove_tree(child);
+            g_free(child);
+        }
+
+        g_dir_close(dir);
+    }
+
+    if (0 != g_remove(path)) {
+        fprintf(stderr, "error: g_remove: %s: %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void write_col_file(gchar *path, gchar *buf, MdbCodec codec)
+{
+    static GByteArray *packed = NULL;
+
+    if (NULL == packed) {
+        packed = g_byte_array_new();
+    }
+
+    gsize len = pack_col_text(buf, strlen(buf), codec, packed);
+
+    if (0 == len) {
+        write_file(path, buf);
+        return;
+    }
+
+    int fd = open(path, O_CREAT|O_WRONLY|O_TRUNC, 0666);
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    write_fd(fd, (gchar *) packed->data, len);
+
+    close(fd);
+}
+
+/*
+ * A text value as its column file holds it compressed, block header
+ * first, into packed; 0 when it is to be kept as plain text
+ */
+
+gsize pack_col_text(const gchar *buf, gsize len, MdbCodec codec, GByteArray *packed)
+{
+    MdbCodec use = pick_codec(codec, len);
+
+    /* The header only has room for a 32 bit length */
+    if (MDB_CODEC_NONE == use || len > G_MAXUINT32) {
+        return(0);
+    }
+
+    gsize wrote = mdb_compress(use, buf, len, packed);
+
+    /* Didn't shrink: keep the value as plain text */
+    if (0 == wrote || wrote + MDB_BLOCK_HEADER_SIZE >= len) {
+        return(0);
+    }
+
+    guint8 header[MDB_BLOCK_HEADER_SIZE] = { '\0', 'M', 'B', use };
+    guint32 raw_len = GUINT32_TO_LE(len);
+    memcpy(&header[4], &raw_len, sizeof(raw_len));
+
+    g_byte_array_prepend(packed, header, MDB_BLOCK_HEADER_SIZE);
+
+    return(packed->len);
+}
+
+/*
+ * Reads a whole column file, inflating it if it is compressed.  Both the
+ * raw and the inflated bytes live in buffers reused from call to call, so
+ * the returned data is only good until the next call.  NULL if the file
+ * can't be opened (e.g. the row was deleted out from under us).
+ */
+
+const gchar * read_col_file(const gchar *path, gsize *len)
+{
+    return(read_col_file_at(AT_FDCWD, path, len));
+}
+
+/*
+ * read_col_file() of a path relative to the directory fd at
+ */
+
+const gchar * read_col_file_at(int at, const gchar *path, gsize *len)
+{
+    static GByteArray *raw = NULL;
+    static GByteArray *plain = NULL;
+
+    if (NULL == raw) {
+        raw = g_byte_array_new();
+        plain = g_byte_array_new();
+    }
+
+    return(read_col_file_into(at, path, raw, plain, len));
+}
+
+/*
+ * read_col_file_at() into the caller's buffers, for threads: raw takes
+ * the file, plain what it inflates to
+ */
+
+const gchar * read_col_file_into(int at, const gchar *path, GByteArray *raw, GByteArray *plain, gsize *len)
+{
+    int fd = openat(at, path, O_RDONLY|O_CLOEXEC);
+    if (-1 == fd) {
+        return(NULL);
+    }
+
+    ++mdb_counters()->files_opened;
+
+    struct stat st;
+    if (-1 == fstat(fd, &st)) {
+        close(fd);
+        return(NULL);
+    }
+
+    g_byte_array_set_size(raw, st.st_size + 1);
+
+    gsize got = 0;
+    while (got < (gsize) st.st_size) {
+        ssize_t n = read(fd, raw->data + got, st.st_size - got);
+        if (-1 == n) {
+            if (EINTR == errno) {
+                continue;
+            }
+            fprintf(stderr, "error: read(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (0 == n) {
             break;
+        }
+        got += n;
+    }
+
+    close(fd);
+
+    mdb_counters()->bytes_read += got;
+
+    return(col_file_inflate(path, raw->data, got, plain, len));
+}
+
+/*
+ * The value held in the raw bytes of a column file: inflated into a
+ * reused buffer if it starts with a block header, otherwise the bytes
+ * themselves, NUL terminated at data[got] (which must be writable).
+ */
+
+const gchar * col_file_value(const gchar *path, guint8 *data, gsize got, gsize *len)
+{
+    static GByteArray *plain = NULL;
+
+    if (NULL == plain) {
+        plain = g_byte_array_new();
+    }
+
+    return(col_file_inflate(path, data, got, plain, len));
+}
+
+const gchar * col_file_inflate(const gchar *path, guint8 *data, gsize got, GByteArray *plain, gsize *len)
+{
+    if (got > MDB_BLOCK_HEADER_SIZE && 0 == memcmp(data, MDB_BLOCK_MAGIC, 3)) {
+        MdbCodec codec = data[3];
+        guint32 raw_len;
+        memcpy(&raw_len, &data[4], sizeof(raw_len));
+        raw_len = GUINT32_FROM_LE(raw_len);
+
+        if (!mdb_decompress(codec, (gchar *) data + MDB_BLOCK_HEADER_SIZE, got - MDB_BLOCK_HEADER_SIZE, plain, raw_len)) {
+            fprintf(stderr, "error: %s: unable to decompress (codec %s)\n", path, mdb_codec_name(codec));
+            exit(EXIT_FAILURE);
+        }
+
+        *len = raw_len;
+        return((gchar *) plain->data);
+    }
+
+    data[got] = '\0';
+
+    *len = got;
+    return((gchar *) data);
+}
+
+void read_first_line(const gchar *path, gchar **buf)
+{
+    gsize len = 0;
+    const gchar *data = read_col_file(path, &len);
+
+    if (NULL == data || 0 == len) {
+        *buf = NULL;
+        return;
+    }
+
+    const gchar *eol = memchr(data, '\n', len);
+
+    *buf = g_strndup(data, eol ? (gsize) (eol - data + 1) : len);
+}
+
+void execute_ddl_create(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    const gchar *second = sql + strspn(sql, " \t\r\n");
+
+    mdb_refuse_replica("CREATE");
+    mdb_quiesce_enter();
+
+    second += strspn(second, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    second += strspn(second, " \t\r\n");
+
+    /* CREATE MATERIALIZED VIEW makes its table with a CREATE TABLE */
+    if (0 == g_ascii_strncasecmp("MATERIALIZED", second, strlen("MATERIALIZED"))) {
+        execute_create_view(sql);
+        mdb_quiesce_leave();
+        return;
+    }
+
+    struct ddl_parsed ddl_create = parse_create(sql);
+    MdbCodec codec = MDB_CODEC_NONE;
+    gint buckets = MDB_BUCKETS_DEFAULT;
+    gboolean optimistic = FALSE;
+    gboolean lsm = FALSE;
+    gint memtable_kb = 0;
+
+    for (GSList *iterator = ddl_create.options; iterator; iterator = iterator->next) {
+        gchar **items = g_strsplit(iterator->data, "=", 2);
+
+        if (0 == g_ascii_strcasecmp("compression", items[0])) {
+            if (!mdb_codec_from_name(items[1], &codec)) {
+                fprintf(stderr, "error: compression: unknown codec: %s\n", items[1]);
+                exit(EXIT_FAILURE);
+            }
+            if (!mdb_codec_available(codec)) {
+                fprintf(stderr, "error: compression: %s: %s\n", items[1], MDB_CODEC_AUTO == codec ? "no codec compiled in" : "not compiled in");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (0 == g_ascii_strcasecmp("buckets", items[0])) {
+            if (!mdb_buckets_from_name(items[1], &buckets)) {
+                fprintf(stderr, "error: buckets: invalid count: %s (1 to %d)\n", items[1], MDB_BUCKETS_MAX);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (0 == g_ascii_strcasecmp("concurrency", items[0])) {
+            if (!mdb_concurrency_from_name(items[1], &optimistic)) {
+                fprintf(stderr, "error: concurrency: unknown mode: %s (optimistic or pessimistic)\n", items[1]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (0 == g_ascii_strcasecmp("engine", items[0])) {
+            if (!mdb_engine_from_name(items[1], &lsm)) {
+                fprintf(stderr, "error: engine: unknown engine: %s (files or lsm)\n", items[1]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (0 == g_ascii_strcasecmp("memtable_kb", items[0])) {
+            if (!mdb_memtable_from_name(items[1], &memtable_kb)) {
+                fprintf(stderr, "error: memtable_kb: invalid size: %s (1 to %d)\n", items[1], MDB_LSM_MEMTABLE_KB_MAX);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            fprintf(stderr, "error: table option: %s: unknown\n", items[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        g_strfreev(items);
+    }
+
+    if (memtable_kb && !lsm) {
+        fprintf(stderr, "error: memtable_kb: only for engine = lsm\n");
+        exit(EXIT_FAILURE);
+    }
+    if (lsm && ddl_create.partition_by) {
+        fprintf(stderr, "error: engine: lsm tables can't be partitioned\n");
+        exit(EXIT_FAILURE);
+    }
+    if (lsm && MDB_CODEC_NONE != codec) {
+        fprintf(stderr, "error: engine: lsm tables can't be compressed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (GSList *iterator = ddl_create.row; iterator; iterator = iterator->next) {
+        gchar **items = g_strsplit(iterator->data, " ", 2);
+        MdbColumnType col_type;
+
+        if (NULL == items[1] || !mdb_col_type_from_name(items[1], &col_type)) {
+            fprintf(stderr, "error: schema: %s: %s: unknown type: %s\n", ddl_create.tbl_name, items[0], items[1] ? items[1] : "");
+            exit(EXIT_FAILURE);
+        }
+
+        g_strfreev(items);
+    }
+
+    if (ddl_create.partition_by) {
+        gchar *type = NULL;
+
+        for (GSList *iterator = ddl_create.row; iterator; iterator = iterator->next) {
+            gchar **items = g_strsplit(iterator->data, " ", 2);
+
+            if (0 == g_strcmp0(ddl_create.partition_by, items[0])) {
+                type = g_strdup(items[1]);
+            }
+
+            g_strfreev(items);
+        }
+
+        MdbColumnType col_type;
+        if (NULL == type) {
+            fprintf(stderr, "error: partition: %s: no such column\n", ddl_create.partition_by);
+            exit(EXIT_FAILURE);
+        }
+        if (0 == g_ascii_strncasecmp("serial", type, strlen("serial"))) {
+            fprintf(stderr, "error: partition: %s: can't partition by a serial column\n", ddl_create.partition_by);
+            exit(EXIT_FAILURE);
+        }
+
+        mdb_col_type_from_name(type, &col_type);
+        g_ptr_array_free(partitions_from_ddl(ddl_create.partitions, col_type), TRUE);
+        g_free(type);
+    }
+
+    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", ddl_create.tbl_name, NULL);
+    if (g_file_test(schema_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: schema: %s: already exists: %s\n", ddl_create.tbl_name, schema_path);
+        exit(EXIT_FAILURE);
+    }
+    if (0 != g_mkdir_with_parents(schema_path, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", schema_path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", ddl_create.tbl_name, NULL);
+    if (g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: table: %s: already exists: %s\n", ddl_create.tbl_name, table_path);
+        exit(EXIT_FAILURE);
+    }
+    if (0 != g_mkdir_with_parents(table_path, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", table_path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    GSList* paths = NULL, *iterator = NULL;
+    if (lsm) {
+        paths = g_slist_append(paths, g_strconcat(table_path, "/", "lsm", "/", "runs", NULL));
+    }
+    else if (NULL == ddl_create.partition_by) {
+        paths = g_slist_append(paths, g_strconcat(table_path, "/", "rows", NULL));
+    }
+    else {
+        paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", "/", "partitions", NULL));
+    }
+    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", NULL));
+    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", "/", "columns", NULL));
+    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", "/", "serial", NULL));
+    paths = g_slist_append(paths, g_strconcat(table_path, "/", "metadata", "/", "nulls", NULL));
+    for (iterator = paths; iterator; iterator = iterator->next) {
+        if (0 != g_mkdir_with_parents(iterator->data, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", iterator->data, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    g_slist_free_full(paths, g_free);
+
+    /*
+     * Buckets are made by the first row that lands in them, so scans of
+     * the rows directory only see the buckets that hold something
+     */
+
+    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "version", NULL);
+    gchar *version = g_strdup_printf("v%d", MDB_TABLE_VERSION);
+    write_file(path, version);
+    g_free(version);
+    g_free(path);
+
+    path = g_strconcat(table_path, "/", "metadata", "/", "roid", NULL);
+    write_file(path, "0");
+    g_free(path);
+
+    path = g_strconcat(table_path, "/", "metadata", "/", "buckets", NULL);
+    gchar *buckets_text = g_strdup_printf("%d", buckets);
+    write_file(path, buckets_text);
+    g_free(buckets_text);
+    g_free(path);
+
+    if (MDB_CODEC_NONE != codec) {
+        path = g_strconcat(table_path, "/", "metadata", "/", "compression", NULL);
+        write_file(path, (gchar *) mdb_codec_name(codec));
+        g_free(path);
+    }
+
+    if (optimistic) {
+        path = g_strconcat(table_path, "/", "metadata", "/", "concurrency", NULL);
+        write_file(path, "optimistic");
+        g_free(path);
+    }
+
+    if (lsm) {
+        path = g_strconcat(table_path, "/", "metadata", "/", "engine", NULL);
+        write_file(path, "lsm");
+        g_free(path);
+
+        path = g_strconcat(table_path, "/", "metadata", "/", "memtable_kb", NULL);
+        gchar *memtable_text = g_strdup_printf("%d", memtable_kb ? memtable_kb : MDB_LSM_MEMTABLE_KB_DEFAULT);
+        write_file(path, memtable_text);
+        g_free(memtable_text);
+        g_free(path);
+    }
+
+    if (ddl_create.partition_by) {
+        path = g_strconcat(table_path, "/", "metadata", "/", "partition_by", NULL);
+        write_file(path, ddl_create.partition_by);
+        g_free(path);
+
+        for (iterator = ddl_create.partitions; iterator; iterator = iterator->next) {
+            create_partition(table_path, iterator->data);
+        }
+    }
+
+    for (iterator = ddl_create.row; iterator; iterator = iterator->next) {
+        gchar **items = g_strsplit(iterator->data, " ", 2);
+
+        gchar *path = g_strconcat(schema_path, "/", items[0], NULL);
+        // g_print("%s :: %s\n", path, items[1]);
+		write_file(path, items[1]);
+        g_free(path);
+
+        if (0 == g_ascii_strncasecmp("serial", items[1], strlen("serial"))) {
+            gchar *path = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", items[0], NULL);
+            write_file(path, "0");
+            g_free(path);
+        }
+
+        g_strfreev(items);
+    }
+
+    mdb_change_log_ddl("CREATE", ddl_create.tbl_name);
+
+    g_slist_free_full(ddl_create.row, g_free);
+    g_slist_free_full(ddl_create.options, g_free);
+    g_slist_free_full(ddl_create.partitions, (GDestroyNotify) free_ddl_partition);
+    g_free(ddl_create.partition_by);
+
+    g_free(schema_path);
+    g_free(table_path);
+
+    mdb_quiesce_leave();
+
+    mdb_stats_statement(MDB_STMT_CREATE, started_us);
+}
+
+/*
+ * Only the concurrency mode can change once a table exists.  Both modes
+ * claim a row's version before writing it, so writers of either kind
+ * running across the change still keep out of each other's way.
+ */
+
+void execute_alter_options(gchar *table_path, GSList *options)
+{
+    for (GSList *iterator = options; iterator; iterator = iterator->next) {
+        gchar **items = g_strsplit(iterator->data, "=", 2);
+        gboolean optimistic;
+
+        if (0 != g_ascii_strcasecmp("concurrency", items[0])) {
+            fprintf(stderr, "error: table option: %s: can't be changed\n", items[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        if (!mdb_concurrency_from_name(items[1], &optimistic)) {
+            fprintf(stderr, "error: concurrency: unknown mode: %s (optimistic or pessimistic)\n", items[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        gchar *path = g_strconcat(table_path, "/", "metadata", "/", "concurrency", NULL);
+        write_file(path, optimistic ? "optimistic" : "pessimistic");
+        g_free(path);
+
+        g_strfreev(items);
+    }
+}
+
+/*
+ * ADD PARTITION appends a range above the last bound.  DROP PARTITION
+ * forgets the partition and renames its directory into purgatory, so
+ * its rows are gone in one step; the files are removed afterwards.
+ */
+
+void execute_ddl_alter(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    struct ddl_parsed ddl_alter = parse_alter(sql);
+
+    mdb_refuse_replica("ALTER");
+    mdb_quiesce_enter();
+
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", ddl_alter.tbl_name, NULL);
+    if (!g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: table: %s: does not already exist: %s\n", ddl_alter.tbl_name, table_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == g_strcmp0("SET", ddl_alter.action)) {
+        execute_alter_options(table_path, ddl_alter.options);
+        mdb_change_log_ddl("ALTER", ddl_alter.tbl_name);
+
+        g_slist_free_full(ddl_alter.options, g_free);
+        g_free(ddl_alter.action);
+        g_free(ddl_alter.tbl_name);
+        g_free(table_path);
+
+        mdb_quiesce_leave();
+
+        mdb_stats_statement(MDB_STMT_ALTER, started_us);
+        return;
+    }
+
+    struct ddl_partition *def = ddl_alter.partitions->data;
+
+    gchar *col = table_partition_col(ddl_alter.tbl_name);
+    if (NULL == col) {
+        fprintf(stderr, "error: table: %s: not partitioned\n", ddl_alter.tbl_name);
+        exit(EXIT_FAILURE);
+    }
+
+    GPtrArray *parts = load_partitions(ddl_alter.tbl_name, col);
+    struct mdb_partition *found = NULL;
+
+    for (guint i = 0; i < parts->len; ++i) {
+        struct mdb_partition *part = g_ptr_array_index(parts, i);
+
+        if (0 == g_strcmp0(def->name, part->name)) {
+            found = part;
+        }
+    }
+
+    if (0 == g_strcmp0("ADD", ddl_alter.action)) {
+        if (found) {
+            fprintf(stderr, "error: partition: %s: already exists\n", def->name);
+            exit(EXIT_FAILURE);
+        }
+
+        MdbColumnType col_type = MDB_COL_TEXT;
+        mdb_col_type_from_name(g_hash_table_lookup(cached_schema(ddl_alter.tbl_name), col), &col_type);
+
+        struct mdb_partition *part = mdb_partition_new(def->name, def->bound, col_type);
+        struct mdb_partition *last = parts->len ? g_ptr_array_index(parts, parts->len - 1) : NULL;
+
+        if (last && (last->max || mdb_partition_cmp(&part, &last) <= 0)) {
+            fprintf(stderr, "error: partition: %s: bound must be above %s's\n", def->name, last->name);
+            exit(EXIT_FAILURE);
+        }
+
+        free_mdb_partition(part);
+
+        get_table_lock(table_path);
+        create_partition(table_path, def);
+        free_table_lock(table_path);
+    }
+    else {
+        if (NULL == found) {
+            fprintf(stderr, "error: partition: %s: not found\n", def->name);
+            exit(EXIT_FAILURE);
+        }
+
+        if (0 != g_mkdir_with_parents(MULTIDB_PURGATORYDIR, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", MULTIDB_PURGATORYDIR, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        gchar *bound_path = g_strconcat(table_path, "/", "metadata", "/", "partitions", "/", def->name, NULL);
+        gchar *part_path = g_strconcat(table_path, "/", "partitions", "/", def->name, NULL);
+        gchar *purgatory_path = g_strdup_printf("%s/%s.%s.%d", MULTIDB_PURGATORYDIR, ddl_alter.tbl_name, def->name, getpid());
+
+        get_table_lock(table_path);
+
+        if (0 != g_remove(bound_path)) {
+            free_table_lock(table_path);
+            fprintf(stderr, "error: g_remove: %s: %s\n", bound_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (0 != g_rename(part_path, purgatory_path)) {
+            free_table_lock(table_path);
+            fprintf(stderr, "error: g_rename: %s -> %s: %s\n", part_path, purgatory_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        free_table_lock(table_path);
+
+        remove_tree(purgatory_path);
+        ++mdb_counters()->purgatory_reclaimed;
+
+        g_free(bound_path);
+        g_free(part_path);
+        g_free(purgatory_path);
+    }
+
+    mdb_change_log_ddl("ALTER", ddl_alter.tbl_name);
+
+    g_ptr_array_free(parts, TRUE);
+    g_slist_free_full(ddl_alter.partitions, (GDestroyNotify) free_ddl_partition);
+    g_free(ddl_alter.action);
+    g_free(ddl_alter.tbl_name);
+    g_free(table_path);
+    g_free(col);
+
+    mdb_quiesce_leave();
+
+    mdb_stats_statement(MDB_STMT_ALTER, started_us);
+}
+
+void execute_ddl_insert(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    struct ddl_parsed ddl_insert = parse_insert(sql);
+    GSList *cols = NULL;
+    GSList *values = NULL;
+
+    mdb_refuse_replica("INSERT");
+    mdb_quiesce_enter();
+
+    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", ddl_insert.tbl_name, NULL);
+    if (!g_file_test(schema_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: schema: %s: does not already exist: %s\n", ddl_insert.tbl_name, schema_path);
+        exit(EXIT_FAILURE);
+    }
+
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", ddl_insert.tbl_name, NULL);
+    if (!g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: table: %s: does not already exist: %s\n", ddl_insert.tbl_name, table_path);
+        exit(EXIT_FAILURE);
+    }
+
+    mdb_refuse_view(ddl_insert.tbl_name, "INSERT");
+
+    for (cols = ddl_insert.cols; cols; cols = cols->next) {
+        gchar *path = g_strconcat(schema_path, "/", cols->data, NULL);
+        if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+            fprintf(stderr, "error: schema: [%s]::[%s]: not found: %s\n", ddl_insert.tbl_name, cols->data, path);
+            exit(EXIT_FAILURE);
+        }
+        g_free(path);
+    }
+
+    MdbCodec codec = load_table_codec(table_path);
+    gint version = table_version(ddl_insert.tbl_name);
+    GHashTable *schema = cached_schema(ddl_insert.tbl_name);
+
+    /* Check every typed value before the row exists */
+    if (version >= 2) {
+        for (cols = ddl_insert.cols, values = ddl_insert.values; cols && values; cols = cols->next, values = values->next) {
+            struct mdb_col mdb_col;
+            MdbColumnType col_type;
+
+            mdb_col_type_from_name(g_hash_table_lookup(schema, cols->data), &col_type);
+
+            if (!mdb_col_from_literal(col_type, values->data, &mdb_col)) {
+                fprintf(stderr, "error: [%s]::[%s]: invalid value: %s\n", ddl_insert.tbl_name, (gchar *) cols->data, (gchar *) values->data);
+                exit(EXIT_FAILURE);
+            }
+
+            g_free(mdb_col.v_text);
+        }
+    }
+
+    if (lsm_view(ddl_insert.tbl_name) && !mdb_txn()->active) {
+        lsm_insert(table_path, ddl_insert.tbl_name, ddl_insert.cols, ddl_insert.values);
+
+        g_slist_free_full(ddl_insert.cols, g_free);
+        g_slist_free_full(ddl_insert.values, g_free);
+
+        mdb_quiesce_leave();
+
+        mdb_stats_statement(MDB_STMT_INSERT, started_us);
+        return;
+    }
+
+    gchar *partition = insert_partition(ddl_insert.tbl_name, ddl_insert.cols, ddl_insert.values);
+    struct mdb_txn_op *op = NULL;
+    gchar *bucket = NULL;
+    gint64 roid = 0;
+
+    /* A transaction's is only logged at COMMIT, so it's kept in case */
+    GHashTable *after = mdb_txn()->active || mdb_change_wanted(ddl_insert.tbl_name) ? mdb_change_cols_new() : NULL;
+
+    if (mdb_txn()->active) {
+        /* Staged without a roid: serials and NULL bits wait for COMMIT too */
+        op = mdb_txn_op_new(MDB_TXN_INSERT, ddl_insert.tbl_name);
+        op->partition = partition;
+        op->staged = mdb_txn_stage(mdb_txn());
+        op->after = after;
+        bucket = g_strdup(op->staged);
+
+        if (0 != g_mkdir_with_parents(bucket, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", bucket, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        bucket = next_row_bucket(table_path, partition);
+        g_free(partition);
+        roid = entry_roid(bucket);
+
+        /* Nobody pools a value of the row before it's all written */
+        row_version_take(ddl_insert.tbl_name, roid);
+    }
+
+    cols = ddl_insert.cols;
+    values = ddl_insert.values;
+    while (cols && values) {
+        struct stat st;
+        gchar *bucket_file = g_strconcat(bucket, "/", cols->data, NULL);
+        gchar *serial_file = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", cols->data, NULL);
+        MdbColumnType col_type = MDB_COL_TEXT;
+
+        mdb_col_type_from_name(g_hash_table_lookup(schema, cols->data), &col_type);
+
+        // g_print("[%s] -> [%s]\n", cols->data, bucket_file);
+
+        gboolean is_serial = 0 == stat(serial_file, &st) && 0 == g_ascii_strncasecmp("0", values->data, strlen("0"));
+
+        if (is_serial && op) {
+            op->serials = g_slist_append(op->serials, g_strdup(cols->data));
+        }
+        else if (is_serial) {
+            gint serial = next_serial(table_path, serial_file);
+            gchar *buf = g_strdup_printf("%i", serial);
+            if (version >= 2) {
+                write_typed_col_file(bucket_file, MDB_COL_INT64, buf, MDB_CODEC_NONE);
+            }
+            else {
+                write_file(bucket_file, buf);
+            }
+            mdb_change_add_literal(after, ddl_insert.tbl_name, cols->data, buf);
+            g_free(buf);
+        }
+        else if (version >= 2) {
+            mdb_change_add_literal(after, ddl_insert.tbl_name, cols->data, values->data);
+
+            if (write_typed_col_file(bucket_file, col_type, values->data, codec)) {
+                if (op) {
+                    op->nulls = g_slist_append(op->nulls, g_strdup(cols->data));
+                }
+                else {
+                    set_null_bit(ddl_insert.tbl_name, cols->data, roid, TRUE);
+                }
+            }
+        }
+        else {
+            mdb_change_add_literal(after, ddl_insert.tbl_name, cols->data, values->data);
+            write_col_file(bucket_file, values->data, codec);
+        }
+
+        g_free(bucket_file);
+        g_free(serial_file);
+
+        cols = cols->next;
+        values = values->next;
+    }
+
+    /* v2 rows are complete: serials are filled in and everything else left out is NULL */
+    if (version >= 2) {
+        GHashTableIter iter;
+        gpointer key, value;
+
+        g_hash_table_iter_init(&iter, schema);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            if (g_slist_find_custom(ddl_insert.cols, key, (GCompareFunc) g_strcmp0)) {
+                continue;
+            }
+
+            gchar *bucket_file = g_strconcat(bucket, "/", key, NULL);
+            gchar *serial_file = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", key, NULL);
+
+            gboolean is_serial = g_file_test(serial_file, G_FILE_TEST_IS_REGULAR);
+
+            if (is_serial && op) {
+                op->serials = g_slist_append(op->serials, g_strdup(key));
+            }
+            else if (is_serial) {
+                gchar *buf = g_strdup_printf("%i", next_serial(table_path, serial_file));
+                write_typed_col_file(bucket_file, MDB_COL_INT64, buf, MDB_CODEC_NONE);
+                mdb_change_add_literal(after, ddl_insert.tbl_name, key, buf);
+                g_free(buf);
+            }
+            else if (op) {
+                write_bytes_file(bucket_file, NULL, 0);
+                op->nulls = g_slist_append(op->nulls, g_strdup(key));
+                mdb_change_add_literal(after, ddl_insert.tbl_name, key, "NULL");
+            }
+            else {
+                write_bytes_file(bucket_file, NULL, 0);
+                set_null_bit(ddl_insert.tbl_name, key, roid, TRUE);
+                mdb_change_add_literal(after, ddl_insert.tbl_name, key, "NULL");
+            }
+
+            g_free(bucket_file);
+            g_free(serial_file);
+        }
+    }
+
+    /* A transaction's INSERT is logged at COMMIT, once it has a roid */
+    if (NULL == op && after) {
+        mdb_change_log("INSERT", ddl_insert.tbl_name, roid, NULL, after);
+        g_hash_table_destroy(after);
+    }
+    if (NULL == op) {
+        row_version_release(ddl_insert.tbl_name, roid);
+    }
+
+    g_slist_free_full(ddl_insert.cols, g_free);
+    g_slist_free_full(ddl_insert.values, g_free);
+
+    g_free(bucket);
+
+    mdb_quiesce_leave();
+
+    mdb_stats_statement(MDB_STMT_INSERT, started_us);
+}
+
+gint next_serial(gchar *table_path, gchar *serial_file) 
+{
+    return(next_serials(table_path, serial_file, 1));
+}
+
+/*
+ * Hand out count serials at once; returns the first
+ */
+
+gint next_serials(gchar *table_path, gchar *serial_file, gint count)
+{
+    get_table_lock(table_path);
+
+    gchar *buf;
+
+    read_first_line(serial_file, &buf);
+
+    gint64 serial = g_ascii_strtoll(buf, NULL, 10);
+    g_free(buf);
+
+    buf = g_strdup_printf("%li", serial + count);
+    write_file(serial_file, buf);
+    g_free(buf);
+
+    free_table_lock(table_path);
+
+    return(serial + 1);
+}
+
+gchar * next_row_bucket(gchar *table_path, const gchar *partition)
+{
+    gchar *bucket_path = row_entry_path(table_path, partition, next_roid(table_path));
+
+    if (0 != g_mkdir_with_parents(bucket_path, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", bucket_path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return(bucket_path);
+}
+
+gchar * row_entry_path(gchar *table_path, const gchar *partition, gint roid)
+{
+    gchar *rows_path = partition ?
+        g_strconcat(table_path, "/", "partitions", "/", partition, "/", "rows", NULL) :
+        g_strconcat(table_path, "/", "rows", NULL);
+
+    /* could have been dropped */
+    if (partition && !g_file_test(rows_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: partition: %s: does not exist: %s\n", partition, rows_path);
+        exit(EXIT_FAILURE);
+    }
+
+    gchar *roid_file = g_strdup_printf("%i", roid);
+    gchar *bucket_dir = g_strdup_printf("%04i", roid % load_table_buckets(table_path));
+    gchar *bucket_path = g_strconcat(rows_path, "/", bucket_dir, "/", roid_file, NULL);
+
+    g_free(rows_path);
+    g_free(roid_file);
+    g_free(bucket_dir);
+
+    return(bucket_path);
+}
+
+gint next_roid(gchar *table_path)
+{
+    return(next_roids(table_path, 1));
+}
+
+/*
+ * Hand out count roids at once; returns the first
+ */
+
+gint next_roids(gchar *table_path, gint count)
+{
+    gchar *roid_file = g_strconcat(table_path, "/", "metadata", "/", "roid", NULL);
+
+    get_table_lock(table_path);
+
+    gchar *buf;
+
+    read_first_line(roid_file, &buf);
+
+    // g_print("cur roid: %s\n", buf);
+    gint64 roid = g_ascii_strtoll(buf, NULL, 10);
+    g_free(buf);
+
+    buf = g_strdup_printf("%li", roid + count);
+    write_file(roid_file, buf);
+    g_free(buf);
+
+    free_table_lock(table_path);
+
+    mdb_counters()->roids_allocated += count;
+
+    g_free(roid_file);
+
+    return(roid + 1);
+}
+
+void get_table_lock(gchar *table_path)
+{
+    gchar *lock_file = g_strconcat(table_path, "/", "tbl_lock", NULL);
+    struct stat st;
+    int fd = 0;
+    gulong backoff = 1000;
+
+    /* A committing transaction already holds it */
+    if (g_hash_table_contains(mdb_txn()->locked, table_path)) {
+        g_free(lock_file);
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+
+    while ((fd = open(lock_file, O_CREAT|O_RDWR|O_EXCL, 0644)) < 0) {
+        if (errno != EEXIST) {
+            fprintf(stderr, "error: open(%s): %s\n", lock_file, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (stat(lock_file, &st) == 0 && time(NULL) - st.st_mtime > 120) {
+            fprintf(stderr, "error: open(%s): waiting for over 120 seconds\n", lock_file);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Holders are quick: retry after 1ms, backing off to 100ms */
+        g_usleep(backoff);
+        backoff = MIN(backoff * 2, 100000);
+    }
+
+    mdb_counters()->lock_wait_us += g_get_monotonic_time() - start;
+    ++mdb_counters()->lock_acquisitions;
+
+    pid_t pid = getpid();
+
+    gchar *converted = g_strdup_printf("%i", pid);
+    write_fd(fd, converted, strlen(converted));
+    g_free(converted);
+
+    close(fd);
+
+    g_free(lock_file);
+}
+
+void free_table_lock(gchar *table_path)
+{
+    if (g_hash_table_contains(mdb_txn()->locked, table_path)) {
+        return;
+    }
+
+    gchar *lock_file = g_strconcat(table_path, "/", "tbl_lock", NULL);
+
+    if (-1 == unlink(lock_file)) {
+        fprintf(stderr, "error: unlink(%s): %s\n", lock_file, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(lock_file);
+}
+
+/*
+ * data/quiesce keeps writers out while --snapshot copies the data
+ * directory.  A statement that writes holds byte 0 shared while it runs
+ * and a snapshot holds it exclusive.  Writers get to byte 0 through
+ * byte 1, holding it only for as long as that takes, so once a snapshot
+ * has byte 1 no new write starts and a stream of them can't starve it.
+ * The statements a COMMIT runs take nothing more.
+ */
+
+struct mdb_quiesce * mdb_quiesce(void)
+{
+    static struct mdb_quiesce quiesce = { -1, 0 };
+
+    if (-1 == quiesce.fd) {
+        gchar *path = g_strconcat(MULTIDB_DATADIR, "/", "quiesce", NULL);
+
+        quiesce.fd = open(path, O_CREAT|O_RDWR|O_CLOEXEC, 0666);
+        if (-1 == quiesce.fd) {
+            fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        g_free(path);
+    }
+
+    return(&quiesce);
+}
+
+void quiesce_lock(short type, gint64 byte)
+{
+    struct flock lock = { .l_type = type, .l_whence = SEEK_SET, .l_start = byte, .l_len = 1 };
+
+    mdb_lock_wait(mdb_quiesce()->fd, &lock, "quiesce");
+}
+
+void mdb_quiesce_enter(void)
+{
+    if (mdb_quiesce()->depth++) {
+        return;
+    }
+
+    quiesce_lock(F_RDLCK, 1);
+    quiesce_lock(F_RDLCK, 0);
+
+    struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 1, .l_len = 1 };
+    fcntl(mdb_quiesce()->fd, F_SETLK, &lock);
+
+    /* Nobody can register a consumer until this write is done */
+    mdb_changes_refresh();
+}
+
+/* Once the writes under way are done, none start until mdb_quiesce_leave() */
+void mdb_quiesce_writers(void)
+{
+    if (mdb_quiesce()->depth++) {
+        fprintf(stderr, "error: quiesce: can't hold off writers while writing\n");
+        exit(EXIT_FAILURE);
+    }
+
+    quiesce_lock(F_WRLCK, 1);
+    quiesce_lock(F_WRLCK, 0);
+}
+
+void mdb_quiesce_leave(void)
+{
+    if (--mdb_quiesce()->depth) {
+        return;
+    }
+
+    struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 2 };
+    fcntl(mdb_quiesce()->fd, F_SETLK, &lock);
+}
+
+/*
+ * Byte 2 is the switch that makes a COMMIT visible all at once: a
+ * SELECT holds it shared while it reads and txn_publish() exclusive
+ * while it plays the log, so a scan sees all of a commit or none of it
+ */
+
+void mdb_commits_hold(void)
+{
+    quiesce_lock(F_RDLCK, 2);
+}
+
+void mdb_commits_exclude(void)
+{
+    quiesce_lock(F_WRLCK, 2);
+}
+
+void mdb_commits_release(void)
+{
+    struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 2, .l_len = 1 };
+    fcntl(mdb_quiesce()->fd, F_SETLK, &lock);
+}
+
+/*
+ * Row locks are fcntl locks on byte <roid> of metadata/row_locks, a file
+ * that stays empty, so writers of different rows never wait for each
+ * other.  Closing any fd of a file drops all of a process's locks on it,
+ * so each table's is opened once and kept.
+ */
+
+int row_lock_fd(const gchar *table)
+{
+    static GHashTable *fds = NULL;
+
+    if (NULL == fds) {
+        fds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    gpointer fd = g_hash_table_lookup(fds, table);
+    if (fd) {
+        return(GPOINTER_TO_INT(fd) - 1);
+    }
+
+    gchar *path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "metadata", "/", "row_locks", NULL);
+    int row_fd = open(path, O_CREAT|O_RDWR|O_CLOEXEC, 0666);
+    if (-1 == row_fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_hash_table_insert(fds, g_strdup(table), GINT_TO_POINTER(row_fd + 1));
+    g_free(path);
+
+    return(row_fd);
+}
+
+GHashTable * row_lock_tables(void)
+{
+    static GHashTable *tables = NULL;
+
+    if (NULL == tables) {
+        tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    return(tables);
+}
+
+/* The row's version is claimed too, which keeps optimistic writers out */
+void row_lock(const gchar *table, gint64 roid)
+{
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = roid, .l_len = 1 };
+
+    mdb_lock_wait(row_lock_fd(table), &lock, table);
+
+    if (!g_hash_table_contains(row_lock_tables(), table)) {
+        g_hash_table_add(row_lock_tables(), g_strdup(table));
+    }
+
+    row_version_take(table, roid);
+}
+
+void row_unlock(const gchar *table, gint64 roid)
+{
+    struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = roid, .l_len = 1 };
+
+    row_version_release(table, roid);
+    fcntl(row_lock_fd(table), F_SETLK, &lock);
+}
+
+/* Every row lock this process holds */
+void row_unlock_all(void)
+{
+    struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0 };
+    GHashTableIter iter;
+    gpointer table;
+
+    row_version_release_all();
+
+    g_hash_table_iter_init(&iter, row_lock_tables());
+    while (g_hash_table_iter_next(&iter, &table, NULL)) {
+        fcntl(row_lock_fd(table), F_SETLK, &lock);
+    }
+
+    g_hash_table_remove_all(row_lock_tables());
+}
+
+/*
+ * Lock the scan's current row and look at it again, as it may have been
+ * changed or deleted since it was read.  Left unlocked when it no longer
+ * matches.
+ */
+
+gboolean lock_matching_row(struct mdb_tbl_scanner *scan, struct mdb_expr *where, GHashTable *paths)
+{
+    gint64 roid = entry_roid(scan->entry_path);
+
+    row_lock(scan->table, roid);
+
+    /* What was read ahead is from before the lock */
+    for (guint i = 0; i < scan->prefetch_cols->len; ++i) {
+        take_prefetched(scan->entry_path, g_ptr_array_index(scan->prefetch_cols, i));
+    }
+
+    if (mdb_row_exists(scan->table, scan->entry_path) && row_matches(where, paths, scan->table)) {
+        return(TRUE);
+    }
+
+    row_unlock(scan->table, roid);
+
+    return(FALSE);
+}
+
+/*
+ * Row versions: one 8 byte word per row id in metadata/row_versions,
+ * mapped shared by every process.  The low half counts the row's writes
+ * and is odd while one is under way; the top half then holds the
+ * writer's pid, so the claim of a writer that died can be taken over.
+ * A new row's word is 0.
+ */
+
+struct mdb_row_versions * row_versions(const gchar *table)
+{
+    static GHashTable *tables = NULL;
+
+    if (NULL == tables) {
+        tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    struct mdb_row_versions *versions = g_hash_table_lookup(tables, table);
+    if (versions) {
+        return(versions);
+    }
+
+    gchar *path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "metadata", "/", "row_versions", NULL);
+
+    versions = g_new0(struct mdb_row_versions, 1);
+    versions->path = path;
+    versions->fd = open(path, O_CREAT|O_RDWR|O_CLOEXEC, 0666);
+    if (-1 == versions->fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_hash_table_insert(tables, g_strdup(table), versions);
+
+    return(versions);
+}
+
+/*
+ * Map enough of the file for roid, growing it by MDB_ROW_VERSIONS_GROW
+ * words when it's short.  The growing is done under an fcntl lock of the
+ * whole file, so two processes can't shrink it back between them.
+ */
+
+guint64 * row_version_word(const gchar *table, gint64 roid)
+{
+    struct mdb_row_versions *versions = row_versions(table);
+
+    if ((gsize) roid < versions->count) {
+        return(&versions->words[roid]);
+    }
+
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0 };
+    struct stat st;
+
+    mdb_lock_wait(versions->fd, &lock, versions->path);
+
+    if (-1 == fstat(versions->fd, &st)) {
+        fprintf(stderr, "error: fstat(%s): %s\n", versions->path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    gsize count = st.st_size / sizeof(guint64);
+    if ((gsize) roid >= count) {
+        count = (roid / MDB_ROW_VERSIONS_GROW + 1) * MDB_ROW_VERSIONS_GROW;
+
+        if (-1 == ftruncate(versions->fd, count * sizeof(guint64))) {
+            fprintf(stderr, "error: ftruncate(%s): %s\n", versions->path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    lock.l_type = F_UNLCK;
+    fcntl(versions->fd, F_SETLK, &lock);
+
+    if (versions->words) {
+        munmap(versions->words, versions->count * sizeof(guint64));
+    }
+
+    versions->words = mmap(NULL, count * sizeof(guint64), PROT_READ|PROT_WRITE, MAP_SHARED, versions->fd, 0);
+    if (MAP_FAILED == versions->words) {
+        fprintf(stderr, "error: mmap(%s): %s\n", versions->path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    versions->count = count;
+
+    return(&versions->words[roid]);
+}
+
+/* This process's claims, as <table>/<roid> */
+GHashTable * row_version_claims(void)
+{
+    static GHashTable *claims = NULL;
+
+    if (NULL == claims) {
+        claims = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    return(claims);
+}
+
+gboolean row_version_held(const gchar *table, gint64 roid)
+{
+    gchar *key = g_strdup_printf("%s/%li", table, roid);
+    gboolean held = g_hash_table_contains(row_version_claims(), key);
+
+    g_free(key);
+
+    return(held);
+}
+
+/*
+ * The row's version once nobody is writing it, or as it is when the
+ * writer is us.  A claim whose pid has gone is from a writer that died
+ * part way, and is ended; the row stays as that writer left it.  So is
+ * one with our pid that we don't hold: an earlier process had our pid.
+ */
+
+guint64 row_version_idle(const gchar *table, gint64 roid)
+{
+    gint64 start = 0;
+    gulong backoff_us = 1;
+
+    for (;;) {
+        guint64 *word = row_version_word(table, roid);
+        guint64 seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+
+        if (0 == (MDB_ROW_VERSION(seen) & 1)) {
+            if (start) {
+                mdb_counters()->lock_wait_us += g_get_monotonic_time() - start;
+            }
+            return(seen);
+        }
+
+        pid_t owner = MDB_ROW_VERSION_PID(seen);
+        if (owner == getpid() && row_version_held(table, roid)) {
+            return(seen);
+        }
+
+        if (owner == getpid() || (-1 == kill(owner, 0) && ESRCH == errno)) {
+            __atomic_compare_exchange_n(word, &seen, (guint64) (MDB_ROW_VERSION(seen) + 1), FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        if (0 == start) {
+            start = g_get_monotonic_time();
+        }
+
+        g_usleep(backoff_us);
+        backoff_us = MIN(backoff_us * 2, 1000);
+    }
+}
+
+/* Mark the row as being written, if it's still at version seen or ours */
+gboolean row_version_claim(const gchar *table, gint64 roid, guint64 seen)
+{
+    if (row_version_held(table, roid)) {
+        return(TRUE);
+    }
+
+    guint64 *word = row_version_word(table, roid);
+    guint64 mine = ((guint64) getpid() << 32) | (guint32) (MDB_ROW_VERSION(seen) + 1);
+
+    if (!__atomic_compare_exchange_n(word, &seen, mine, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return(FALSE);
+    }
+
+    g_hash_table_add(row_version_claims(), g_strdup_printf("%s/%li", table, roid));
+
+    return(TRUE);
+}
+
+/* Claim the row, waiting for its writer if need be; claims nest */
+void row_version_take(const gchar *table, gint64 roid)
+{
+    while (!row_version_claim(table, roid, row_version_idle(table, roid))) {
+        ;
+    }
+}
+
+/* Next, even, version: readers that noted an earlier one will see it moved */
+void row_version_release(const gchar *table, gint64 roid)
+{
+    gchar *key = g_strdup_printf("%s/%li", table, roid);
+
+    if (g_hash_table_remove(row_version_claims(), key)) {
+        guint64 *word = row_version_word(table, roid);
+
+        __atomic_store_n(word, (guint64) (MDB_ROW_VERSION(*word) + 1), __ATOMIC_RELEASE);
+    }
+
+    g_free(key);
+}
+
+void row_version_release_all(void)
+{
+    GList *keys = g_hash_table_get_keys(row_version_claims());
+
+    for (GList *iterator = keys; iterator; iterator = iterator->next) {
+        gchar *table = g_strdup(iterator->data);
+        gchar *slash = strrchr(table, '/');
+
+        *slash = '\0';
+        row_version_release(table, g_ascii_strtoll(slash + 1, NULL, 10));
+        g_free(table);
+    }
+
+    g_list_free(keys);
+}
+
+/* The row's version, if nobody is writing it */
+gboolean row_version_peek(const gchar *table, gint64 roid, guint32 *version)
+{
+    guint64 word = __atomic_load_n(row_version_word(table, roid), __ATOMIC_ACQUIRE);
+
+    *version = MDB_ROW_VERSION(word);
+
+    return(0 == (*version & 1));
+}
+
+/*
+ * The optimistic lock_matching_row(): no lock, only the row's version
+ * noted before the row is read again and, with sets, its new values
+ * worked out into values.  The row is then claimed if its version
+ * hasn't moved meanwhile, and read again if it has.  A row that keeps
+ * changing under us is left to the row lock after MDB_OCC_RETRIES tries;
+ * *locked says which happened.
+ */
+
+gboolean occ_matching_row(struct mdb_tbl_scanner *scan, struct mdb_expr *where, GHashTable *paths, GSList *sets, GHashTable *values, gboolean *locked)
+{
+    gint64 roid = entry_roid(scan->entry_path);
+
+    *locked = FALSE;
+
+    for (guint tries = 0; tries < MDB_OCC_RETRIES; ++tries) {
+        guint64 seen = row_version_idle(scan->table, roid);
+
+        /* What was read ahead may be from before the version */
+        for (guint i = 0; i < scan->prefetch_cols->len; ++i) {
+            take_prefetched(scan->entry_path, g_ptr_array_index(scan->prefetch_cols, i));
+        }
+
+        if (!mdb_row_exists(scan->table, scan->entry_path) || !row_matches(where, paths, scan->table)) {
+            return(FALSE);
+        }
+
+        if (sets) {
+            compute_sets(scan->table, paths, sets, values);
+        }
+
+        if (row_version_claim(scan->table, roid, seen)) {
+            ++mdb_counters()->occ_writes;
+            return(TRUE);
+        }
+
+        ++mdb_counters()->occ_conflicts;
+    }
+
+    if (!lock_matching_row(scan, where, paths)) {
+        return(FALSE);
+    }
+
+    if (sets) {
+        compute_sets(scan->table, paths, sets, values);
+    }
+
+    *locked = TRUE;
+
+    return(TRUE);
+}
+
+/*
+ * INSERT INTO album (id, name, year) VALUES (0, 'Vacation', 2014);
+ */
+
+struct ddl_parsed parse_insert(const gchar *text)
+{
+    struct mdb_lexer lex;
+    struct ddl_parsed ddl_insert = { NULL };
+
+    mdb_lex_init(&lex, text, "INSERT INTO");
+    lex_expect_keyword(&lex, "INSERT");
+    lex_expect_keyword(&lex, "INTO");
+
+    struct mdb_token table = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a table name");
+    ddl_insert.tbl_name = lex_token_text(&table);
+
+    lex_expect_symbol(&lex, "(");
+    do {
+        struct mdb_token col = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a column name");
+
+        ddl_insert.cols = g_slist_append(ddl_insert.cols, lex_token_text(&col));
+    } while (lex_accept_symbol(&lex, ","));
+    lex_expect_symbol(&lex, ")");
+
+    lex_expect_keyword(&lex, "VALUES");
+
+    lex_expect_symbol(&lex, "(");
+    do {
+        ddl_insert.values = g_slist_append(ddl_insert.values, parse_insert_value(&lex));
+    } while (lex_accept_symbol(&lex, ","));
+    lex_expect_symbol(&lex, ")");
+
+    lex_expect_end(&lex);
+
+    return(ddl_insert);
+}
+
+/*
+ * A value as INSERT keeps it: numbers written out again, strings in
+ * single quotes, NULL and true as they are
+ */
+
+gchar * parse_insert_value(struct mdb_lexer *lex)
+{
+    gboolean negative = lex_accept_symbol(lex, "-");
+    gchar converted[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (MDB_TOKEN_INT == lex->next.kind) {
+        g_snprintf(converted, sizeof(converted), "%s%li", negative ? "-" : "", (glong) lex->next.v_int);
+    }
+    else if (MDB_TOKEN_FLOAT == lex->next.kind) {
+        converted[0] = '-';
+        g_ascii_dtostr(&converted[negative ? 1 : 0], sizeof(converted) - 1, lex->next.v_float);
+    }
+    else if (MDB_TOKEN_STRING == lex->next.kind && !negative) {
+        struct mdb_token token = lex_take(lex);
+
+        return(lex_string_literal(&token));
+    }
+    else if (MDB_TOKEN_IDENTIFIER == lex->next.kind && !negative) {
+        struct mdb_token token = lex_take(lex);
+
+        return(lex_token_text(&token));
+    }
+    else {
+        lex_syntax_error(lex, "a value");
+    }
+
+    lex_take(lex);
+
+    return(g_strdup(converted));
+}
+
+GDir * dir_open(gchar *path)
+{
+    GError *error = NULL;
+    GDir *dir = g_dir_open(path, 0, &error);
+    if (error) {
+        return(NULL);
+        // fprintf(stderr, "error: g_dir_open [%s]: %s\n", path, error->message);
+        // exit(EXIT_FAILURE);
+    }
+
+    return(dir);
+}
+
+/*
+ * Bump allocation for executor temporaries.  Memory comes out of
+ * MDB_ARENA_BLOCK_SIZE blocks and is only given back by
+ * mdb_arena_reset(), which keeps the blocks for reuse: a loop that
+ * resets to a mark each time round stops calling malloc once its first
+ * pass has grown the arena.
+ */
+
+struct mdb_arena * mdb_arena_new(void)
+{
+    struct mdb_arena *arena = g_malloc0(sizeof(struct mdb_arena));
+
+    arena->blocks = g_ptr_array_new_with_free_func(g_free);
+
+    return(arena);
+}
+
+void mdb_arena_free(struct mdb_arena *arena)
+{
+    g_ptr_array_free(arena->blocks, TRUE);
+    g_free(arena);
+}
+
+gpointer mdb_arena_alloc(struct mdb_arena *arena, gsize size)
+{
+    size = (size + 7) & ~((gsize) 7);
+
+    while (arena->block < arena->blocks->len) {
+        struct mdb_arena_block *block = g_ptr_array_index(arena->blocks, arena->block);
+
+        if (arena->used + size <= block->size) {
+            gpointer p = &block->data[arena->used];
+            arena->used += size;
+            return(p);
+        }
+
+        ++arena->block;
+        arena->used = 0;
+    }
+
+    gsize block_size = MAX(size, MDB_ARENA_BLOCK_SIZE);
+    struct mdb_arena_block *block = g_malloc(sizeof(struct mdb_arena_block) + block_size);
+
+    block->size = block_size;
+    g_ptr_array_add(arena->blocks, block);
+
+    arena->block = arena->blocks->len - 1;
+    arena->used = size;
+
+    return(block->data);
+}
+
+gchar * mdb_arena_strdup(struct mdb_arena *arena, const gchar *str)
+{
+    gsize len = strlen(str);
+    gchar *copy = mdb_arena_alloc(arena, len + 1);
+
+    memcpy(copy, str, len + 1);
+
+    return(copy);
+}
+
+/* NULL terminated, like g_strconcat() */
+
+gchar * mdb_arena_strconcat(struct mdb_arena *arena, const gchar *first, ...)
+{
+    va_list args;
+    gsize len = 0;
+
+    va_start(args, first);
+    for (const gchar *s = first; s; s = va_arg(args, const gchar *)) {
+        len += strlen(s);
+    }
+    va_end(args);
+
+    gchar *ret = mdb_arena_alloc(arena, len + 1);
+    gchar *p = ret;
+
+    va_start(args, first);
+    for (const gchar *s = first; s; s = va_arg(args, const gchar *)) {
+        gsize n = strlen(s);
+        memcpy(p, s, n);
+        p += n;
+    }
+    va_end(args);
+
+    *p = '\0';
+
+    return(ret);
+}
+
+struct mdb_arena_mark mdb_arena_mark(struct mdb_arena *arena)
+{
+    struct mdb_arena_mark mark = { arena->block, arena->used };
+
+    return(mark);
+}
+
+void mdb_arena_reset(struct mdb_arena *arena, struct mdb_arena_mark mark)
+{
+    arena->block = mark.block;
+    arena->used = mark.used;
+}
+
+/*
+ * Statement scoped: each execute_ddl_*() starts it empty and its row
+ * loops reset it to a mark taken at the top of every row
+ */
+
+struct mdb_arena * mdb_stmt_arena(void)
+{
+    static struct mdb_arena *arena = NULL;
+
+    if (NULL == arena) {
+        arena = mdb_arena_new();
+    }
+
+    return(arena);
+}
+
+void mdb_stmt_begin(void)
+{
+    struct mdb_arena_mark empty = { 0, 0 };
+
+    mdb_arena_reset(mdb_stmt_arena(), empty);
+}
+
+/*
+ * Directory traversal on O_DIRECTORY fds, so rows are opened relative to
+ * their bucket instead of resolving the full path from the root each
+ * time.  Linux reads entries with getdents64 into a large buffer;
+ * elsewhere readdir() on the same fd.
+ */
+
+#ifdef __linux__
+struct linux_dirent64 {
+    guint64 d_ino;
+    gint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+gboolean mdb_dir_open_at(struct mdb_dir *dir, int at, const gchar *name)
+{
+    memset(dir, 0, sizeof(struct mdb_dir));
+
+    dir->fd = openat(at, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (-1 == dir->fd) {
+        return(FALSE);
+    }
+
+    ++mdb_counters()->files_opened;
+
+#ifdef __linux__
+    dir->buf = g_malloc(MDB_DIRENT_BUF_SIZE);
+#else
+    dir->dir = fdopendir(dir->fd);
+    if (NULL == dir->dir) {
+        close(dir->fd);
+        dir->fd = -1;
+        return(FALSE);
+    }
+#endif
+
+    return(TRUE);
+}
+
+void mdb_dir_close(struct mdb_dir *dir)
+{
+    if (-1 == dir->fd) {
+        return;
+    }
+
+#ifdef __linux__
+    close(dir->fd);
+    g_free(dir->buf);
+#else
+    closedir(dir->dir);
+#endif
+
+    memset(dir, 0, sizeof(struct mdb_dir));
+    dir->fd = -1;
+}
+
+/*
+ * The next subdirectory, skipping . and ..; NULL at the end
+ */
+
+const gchar * mdb_dir_read(struct mdb_dir *dir)
+{
+    for (;;) {
+        const gchar *name;
+        unsigned char d_type;
+
+#ifdef __linux__
+        if (dir->pos >= dir->len) {
+            long n = syscall(SYS_getdents64, dir->fd, dir->buf, MDB_DIRENT_BUF_SIZE);
+
+            if (-1 == n) {
+                fprintf(stderr, "error: getdents64: %s\n", g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            if (0 == n) {
+                return(NULL);
+            }
+
+            dir->pos = 0;
+            dir->len = n;
+        }
+
+        struct linux_dirent64 *d = (struct linux_dirent64 *) (dir->buf + dir->pos);
+        dir->pos += d->d_reclen;
+        name = d->d_name;
+        d_type = d->d_type;
+#else
+        struct dirent *d = readdir(dir->dir);
+
+        if (NULL == d) {
+            return(NULL);
+        }
+        name = d->d_name;
+        d_type = d->d_type;
+#endif
+
+        if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]))) {
+            continue;
+        }
+
+        if (DT_UNKNOWN == d_type) {
+            struct stat st;
+
+            if (-1 == fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+                continue;
+            }
+            d_type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+
+        if (DT_DIR == d_type) {
+            return(name);
+        }
+    }
+}
+
+/*
+ * O_DIRECTORY fds of recently visited rows, keyed by entry path, so all
+ * the columns of a row are opened relative to one fd.  Callers look the
+ * fd up whenever they need it and never keep it: the whole set is closed
+ * when it fills up.
+ */
+
+void close_entry_fd(gpointer fd)
+{
+    close(GPOINTER_TO_INT(fd));
+}
+
+GHashTable * entry_fds(void)
+{
+    static GHashTable *fds = NULL;
+
+    if (NULL == fds) {
+        fds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, close_entry_fd);
+    }
+
+    return(fds);
+}
+
+void remember_entry_fd(const gchar *entry_path, int fd)
+{
+    GHashTable *fds = entry_fds();
+
+    if (g_hash_table_size(fds) >= MDB_ENTRY_FDS_MAX) {
+        g_hash_table_remove_all(fds);
+    }
+
+    g_hash_table_insert(fds, g_strdup(entry_path), GINT_TO_POINTER(fd));
+}
+
+/*
+ * -1 if the row is gone
+ */
+
+int entry_dir_fd(const gchar *entry_path)
+{
+    gpointer fd;
+
+    if (g_hash_table_lookup_extended(entry_fds(), entry_path, NULL, &fd)) {
+        return(GPOINTER_TO_INT(fd));
+    }
+
+    int at = open(entry_path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (-1 != at) {
+        ++mdb_counters()->files_opened;
+        remember_entry_fd(entry_path, at);
+    }
+
+    return(at);
+}
+
+/*
+ * Batched column reads.  A scan names the columns it will read, and the
+ * files of its next MDB_PREFETCH_ROWS rows are read in one go: with
+ * io_uring the openat, read and close calls of a batch are each
+ * submitted together and reaped as they complete, otherwise (no
+ * liburing, a kernel without io_uring or without those three ops, or
+ * MULTIDB_NO_IO_URING set) they are done one after another.  The raw bytes wait in prefetched() until
+ * load_mdb_col() takes them.
+ */
+
+#ifdef MDB_HAVE_LIBURING
+struct io_uring * mdb_ring(void)
+{
+    static struct io_uring ring;
+    static int state = 0;   /* 0 untried, 1 up, -1 unavailable */
+
+    if (0 == state) {
+        state = -1;
+
+        if (NULL == g_getenv("MULTIDB_NO_IO_URING") && 0 == io_uring_queue_init(MDB_IO_QUEUE_DEPTH, &ring, 0)) {
+            /* Kernels before 5.6 have a ring but not these ops */
+            struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+
+            if (probe && io_uring_opcode_supported(probe, IORING_OP_OPENAT) && io_uring_opcode_supported(probe, IORING_OP_READ) && io_uring_opcode_supported(probe, IORING_OP_CLOSE)) {
+                state = 1;
+            }
+            else {
+                io_uring_queue_exit(&ring);
+            }
+
+            if (probe) {
+                io_uring_free_probe(probe);
+            }
+        }
+    }
+
+    return(1 == state ? &ring : NULL);
+}
+
+/*
+ * Queue one op per request that wants it, MDB_IO_QUEUE_DEPTH at a time,
+ * and hand each completion back to its request
+ */
+
+void ring_run(struct io_uring *ring, GPtrArray *reqs, MdbIoOp op)
+{
+    guint next = 0;
+
+    while (next < reqs->len) {
+        guint queued = 0;
+
+        for (; next < reqs->len && queued < MDB_IO_QUEUE_DEPTH; ++next) {
+            struct mdb_io_req *req = g_ptr_array_index(reqs, next);
+
+            if (MDB_IO_OPEN != op && -1 == req->fd) {
+                continue;
+            }
+
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+            switch (op) {
+                case MDB_IO_OPEN:
+                    io_uring_prep_openat(sqe, req->at, req->name, O_RDONLY|O_CLOEXEC, 0);
+                break;
+
+                case MDB_IO_READ:
+                    io_uring_prep_read(sqe, req->fd, req->data, MDB_IO_READ_SIZE, 0);
+                break;
+
+                case MDB_IO_CLOSE:
+                    io_uring_prep_close(sqe, req->fd);
+                break;
+            }
+
+            io_uring_sqe_set_data(sqe, req);
+            ++queued;
+        }
+
+        if (0 == queued) {
+            break;
+        }
+
+        int ret = io_uring_submit_and_wait(ring, queued);
+        if (ret < 0) {
+            fprintf(stderr, "error: io_uring_submit: %s\n", g_strerror(-ret));
+            exit(EXIT_FAILURE);
+        }
+
+        while (queued--) {
+            struct io_uring_cqe *cqe;
+
+            ret = io_uring_wait_cqe(ring, &cqe);
+            if (ret < 0) {
+                fprintf(stderr, "error: io_uring_wait_cqe: %s\n", g_strerror(-ret));
+                exit(EXIT_FAILURE);
+            }
+
+            struct mdb_io_req *req = io_uring_cqe_get_data(cqe);
+
+            switch (op) {
+                case MDB_IO_OPEN:
+                    req->fd = cqe->res < 0 ? -1 : cqe->res;
+                    req->retry = cqe->res < 0 && -ENOENT != cqe->res;
+                    mdb_counters()->files_opened += cqe->res >= 0;
+                break;
+
+                case MDB_IO_READ:
+                    req->got = cqe->res;
+                    req->retry = cqe->res < 0;
+                    mdb_counters()->bytes_read += MAX(cqe->res, 0);
+                break;
+
+                case MDB_IO_CLOSE:
+                    req->fd = -1;
+                break;
+            }
+
+            io_uring_cqe_seen(ring, cqe);
+        }
+    }
+}
+#endif
+
+/*
+ * Read the rest of a file whose first read filled the buffer
+ */
+
+void io_read_rest(struct mdb_io_req *req, struct mdb_arena *arena)
+{
+    for (;;) {
+        if ((gsize) req->got + MDB_IO_READ_SIZE + 1 > req->size) {
+            guint8 *data = mdb_arena_alloc(arena, req->size * 2 + MDB_IO_READ_SIZE);
+
+            memcpy(data, req->data, req->got);
+            req->data = data;
+            req->size = req->size * 2 + MDB_IO_READ_SIZE;
+        }
+
+        ssize_t n = pread(req->fd, req->data + req->got, MDB_IO_READ_SIZE, req->got);
+        if (-1 == n && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            if (-1 == n) {
+                req->got = -1;
+            }
+            return;
+        }
+
+        req->got += n;
+        mdb_counters()->bytes_read += n;
+    }
+}
+
+/*
+ * Open, read and close a request's file without the ring
+ */
+
+void io_read_sync(struct mdb_io_req *req, struct mdb_arena *arena)
+{
+    req->got = -1;
+    req->retry = FALSE;
+
+    req->fd = openat(req->at, req->name, O_RDONLY|O_CLOEXEC);
+    if (-1 == req->fd) {
+        return;
+    }
+
+    ++mdb_counters()->files_opened;
+
+    req->got = 0;
+    io_read_rest(req, arena);
+
+    close(req->fd);
+    req->fd = -1;
+}
+
+/*
+ * Buffers come from arena; a request's data holds got bytes and room
+ * for a NUL after them
+ */
+
+void mdb_io_read_batch(GPtrArray *reqs, struct mdb_arena *arena)
+{
+    for (guint i = 0; i < reqs->len; ++i) {
+        struct mdb_io_req *req = g_ptr_array_index(reqs, i);
+
+        req->fd = -1;
+        req->got = -1;
+        req->size = MDB_IO_READ_SIZE + 1;
+        req->data = mdb_arena_alloc(arena, req->size);
+        req->retry = FALSE;
+    }
+
+#ifdef MDB_HAVE_LIBURING
+    struct io_uring *ring = mdb_ring();
+
+    if (ring) {
+        ring_run(ring, reqs, MDB_IO_OPEN);
+        ring_run(ring, reqs, MDB_IO_READ);
+
+        for (guint i = 0; i < reqs->len; ++i) {
+            struct mdb_io_req *req = g_ptr_array_index(reqs, i);
+
+            if (-1 != req->fd && MDB_IO_READ_SIZE == req->got) {
+                io_read_rest(req, arena);
+            }
+        }
+
+        ring_run(ring, reqs, MDB_IO_CLOSE);
+
+        /* Only ENOENT means the row is gone, anything else is read again */
+        for (guint i = 0; i < reqs->len; ++i) {
+            struct mdb_io_req *req = g_ptr_array_index(reqs, i);
+
+            if (req->retry) {
+                io_read_sync(req, arena);
+            }
+        }
+
+        return;
+    }
+#endif
+
+    for (guint i = 0; i < reqs->len; ++i) {
+        io_read_sync(g_ptr_array_index(reqs, i), arena);
+    }
+}
+
+/*
+ * A random id for the database, made by the first process to want one,
+ * so a buffer pool can tell the database it was filled from has been
+ * removed and made again at the same place.  0 while it is being made.
+ */
+
+guint64 mdb_database_id(void)
+{
+    gchar *path = g_strconcat(MULTIDB_BASEDIR, "/", "id", NULL);
+    gchar buf[17] = { 0 };
+    guint64 id = 0;
+
+    int fd = open(path, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC, 0666);
+    if (-1 != fd) {
+        id = ((guint64) g_random_int() << 32) | g_random_int() | 1;
+        g_snprintf(buf, sizeof(buf), "%016lx", id);
+        write_fd(fd, buf, 16);
+        close(fd);
+    }
+    else if (EEXIST == errno && -1 != (fd = open(path, O_RDONLY|O_CLOEXEC))) {
+        if (16 == read(fd, buf, 16)) {
+            id = g_ascii_strtoull(buf, NULL, 16);
+        }
+        close(fd);
+    }
+
+    g_free(path);
+
+    return(id);
+}
+
+/*
+ * The pool of this database, attached on first use: the shared memory
+ * object is named after a hash of the database's path and sized by
+ * MULTIDB_BUFFER_POOL_MB (default MDB_POOL_DEFAULT_MB, 0 turns the pool
+ * off) by whoever creates it.  A pool left by an earlier database at the
+ * same path is emptied.  NULL when there's no pool to use.
+ */
+
+struct mdb_pool * mdb_pool(void)
+{
+    static struct mdb_pool *pool = NULL;
+    static gboolean attached = FALSE;
+
+    if (attached) {
+        return(pool);
+    }
+
+    attached = TRUE;
+
+    const gchar *env = getenv("MULTIDB_BUFFER_POOL_MB");
+    guint64 mb = env ? g_ascii_strtoull(env, NULL, 10) : MDB_POOL_DEFAULT_MB;
+    guint64 db_id = 0 == mb ? 0 : mdb_database_id();
+
+    if (0 == db_id) {
+        return(NULL);
+    }
+
+    char *real = realpath(MULTIDB_BASEDIR, NULL);
+    gchar *name = g_strdup_printf("/multidb.%016lx", mdb_pool_key(real ? real : MULTIDB_BASEDIR, ""));
+    free(real);
+
+    int fd = shm_open(name, O_CREAT|O_RDWR, 0666);
+    if (-1 == fd) {
+        g_free(name);
+        return(NULL);
+    }
+
+    /* Sized once, under a lock, so nobody maps more than is there */
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0 };
+    struct stat st;
+
+    mdb_lock_wait(fd, &lock, name);
+
+    gboolean sized = -1 != fstat(fd, &st);
+    gsize size = st.st_size;
+
+    if (sized && 0 == size) {
+        guint64 nsets = MAX(1, (mb << 20) / sizeof(struct mdb_pool_set));
+
+        size = sizeof(struct mdb_pool) + nsets * sizeof(struct mdb_pool_set);
+        sized = -1 != ftruncate(fd, size);
+    }
+
+    lock.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &lock);
+
+    void *map = sized && size > sizeof(struct mdb_pool) ? mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+    close(fd);
+    g_free(name);
+
+    if (MAP_FAILED == map) {
+        return(NULL);
+    }
+
+    struct mdb_pool *mapped = map;
+    guint64 state = __atomic_load_n(&mapped->state, __ATOMIC_ACQUIRE);
+
+    if (MDB_POOL_READY == state && db_id == mapped->db_id) {
+        pool = mapped;
+        return(pool);
+    }
+
+    /* Set up by one process; the others go without until it's done */
+    pid_t owner = state >> 32;
+    if (1 == (state & 1) && (owner == getpid() || -1 != kill(owner, 0) || ESRCH != errno)) {
+        munmap(map, size);
+        return(NULL);
+    }
+
+    guint64 mine = ((guint64) getpid() << 32) | 1;
+    if (!__atomic_compare_exchange_n(&mapped->state, &state, mine, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(map, size);
+        return(NULL);
+    }
+
+    mapped->nsets = (size - sizeof(struct mdb_pool)) / sizeof(struct mdb_pool_set);
+
+    /* A new object is zeros already */
+    if (0 != state) {
+        memset(mapped->sets, 0, mapped->nsets * sizeof(struct mdb_pool_set));
+    }
+
+    memcpy(mapped->magic, MDB_POOL_MAGIC, sizeof(mapped->magic));
+    mapped->db_id = db_id;
+    __atomic_store_n(&mapped->state, MDB_POOL_READY, __ATOMIC_RELEASE);
+
+    pool = mapped;
+
+    return(pool);
+}
+
+/* FNV-1a of table and column */
+guint64 mdb_pool_key(const gchar *table, const gchar *col)
+{
+    guint64 hash = 0xcbf29ce484222325ULL;
+
+    for (const gchar *c = table; *c; ++c) {
+        hash = (hash ^ (guchar) *c) * 0x100000001b3ULL;
+    }
+
+    hash = (hash ^ '/') * 0x100000001b3ULL;
+
+    for (const gchar *c = col; *c; ++c) {
+        hash = (hash ^ (guchar) *c) * 0x100000001b3ULL;
+    }
+
+    return(hash);
+}
+
+struct mdb_pool_set * mdb_pool_set(struct mdb_pool *pool, guint64 key, gint64 roid)
+{
+    return(&pool->sets[(key ^ ((guint64) roid * 0x9e3779b97f4a7c15ULL)) % pool->nsets]);
+}
+
+/*
+ * Copy the value of key at roid and version into out (room for
+ * MDB_POOL_VALUE_MAX bytes); its length, or -1 when it isn't pooled
+ */
+
+gssize mdb_pool_get(struct mdb_pool *pool, guint64 key, gint64 roid, guint32 version, guint8 *out)
+{
+    struct mdb_pool_set *set = mdb_pool_set(pool, key, roid);
+
+    for (guint way = 0; way < MDB_POOL_WAYS; ++way) {
+        struct mdb_pool_frame *frame = &set->frames[way];
+        guint64 seq = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+
+        if ((seq & 1) || key != frame->key || roid != frame->roid || version != frame->version) {
+            continue;
+        }
+
+        guint32 len = frame->len;
+        if (len > MDB_POOL_VALUE_MAX) {
+            continue;
+        }
+
+        memcpy(out, frame->data, len);
+
+        /* Refilled while we copied */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != __atomic_load_n(&frame->seq, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        if (!frame->ref) {
+            frame->ref = 1;
+        }
+
+        ++mdb_counters()->pool_hits;
+
+        return(len);
+    }
+
+    ++mdb_counters()->pool_misses;
+
+    return(-1);
+}
+
+/*
+ * An older value of the row's column makes way for the new one;
+ * otherwise the clock hand passes over frames used since it last came
+ * round, and takes the first one that wasn't
+ */
+
+void mdb_pool_put(struct mdb_pool *pool, guint64 key, gint64 roid, guint32 version, const gchar *data, gsize len)
+{
+    if (len > MDB_POOL_VALUE_MAX) {
+        return;
+    }
+
+    struct mdb_pool_set *set = mdb_pool_set(pool, key, roid);
+    struct mdb_pool_frame *victim = NULL;
+    guint64 seq = 0;
+
+    for (guint way = 0; way < MDB_POOL_WAYS && NULL == victim; ++way) {
+        struct mdb_pool_frame *frame = &set->frames[way];
+
+        seq = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+        if (0 == (seq & 1) && key == frame->key && roid == frame->roid) {
+            victim = frame;
+        }
+    }
+
+    for (guint step = 0; step < 2 * MDB_POOL_WAYS && NULL == victim; ++step) {
+        struct mdb_pool_frame *frame = &set->frames[__atomic_fetch_add(&set->hand, 1, __ATOMIC_RELAXED) % MDB_POOL_WAYS];
+
+        seq = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+
+        /* Whoever was filling it died; it's free again */
+        if (seq & 1) {
+            pid_t owner = seq >> 32;
+
+            if (owner != getpid() && -1 == kill(owner, 0) && ESRCH == errno) {
+                __atomic_compare_exchange_n(&frame->seq, &seq, (guint64) ((guint32) seq + 1), FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            }
+            continue;
+        }
+
+        if (frame->ref) {
+            frame->ref = 0;
+            continue;
+        }
+
+        victim = frame;
+    }
+
+    guint64 mine = ((guint64) getpid() << 32) | (guint32) (seq + 1);
+
+    if (NULL == victim || !__atomic_compare_exchange_n(&victim->seq, &seq, mine, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    victim->key = key;
+    victim->roid = roid;
+    victim->version = version;
+    victim->len = len;
+    victim->ref = 1;
+    memcpy(victim->data, data, len);
+
+    __atomic_store_n(&victim->seq, (guint64) (guint32) (seq + 2), __ATOMIC_RELEASE);
+}
+
+/*
+ * Pool a value just read, if its row is still at the version from
+ * before the read: a writer that got in between may have changed it
+ */
+
+void mdb_pool_fill(const gchar *table, gint64 roid, guint64 key, guint32 version, const gchar *data, gsize len)
+{
+    guint32 now;
+
+    if (row_version_peek(table, roid, &now) && now == version) {
+        mdb_pool_put(mdb_pool(), key, roid, version, data, len);
+    }
+}
+
+/*
+ * LSM tables
+ *
+ * engine = files (the default) keeps a directory of column files per
+ * row; engine = lsm the wal and runs described in libmultidb.h.
+ */
+
+gboolean mdb_engine_from_name(const gchar *name, gboolean *lsm)
+{
+    if (0 == g_ascii_strcasecmp("files", name)) {
+        *lsm = FALSE;
+    }
+    else if (0 == g_ascii_strcasecmp("lsm", name)) {
+        *lsm = TRUE;
+    }
+    else {
+        return(FALSE);
+    }
+
+    return(TRUE);
+}
+
+gboolean mdb_memtable_from_name(const gchar *name, gint *kb)
+{
+    gchar *end = NULL;
+    gint64 n = g_ascii_strtoll(name, &end, 10);
+
+    if (end == name || '\0' != *end || n < 1 || n > MDB_LSM_MEMTABLE_KB_MAX) {
+        return(FALSE);
+    }
+
+    *kb = n;
+
+    return(TRUE);
+}
+
+/* How big the wal gets before it's flushed, from metadata/memtable_kb */
+gsize load_table_memtable(gchar *table_path)
+{
+    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "memtable_kb", NULL);
+    gint kb = MDB_LSM_MEMTABLE_KB_DEFAULT;
+    gchar *buf;
+
+    read_first_line(path, &buf);
+    if (buf) {
+        if (!mdb_memtable_from_name(g_strstrip(buf), &kb)) {
+            fprintf(stderr, "error: memtable_kb: invalid size: %s: %s\n", buf, path);
+            exit(EXIT_FAILURE);
+        }
+        g_free(buf);
+    }
+
+    g_free(path);
+
+    return((gsize) kb * 1024);
+}
+
+gchar * lsm_path(const gchar *table, const gchar *name)
+{
+    return(g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "lsm", "/", name, NULL));
+}
+
+/*
+ * NULL for a table of row directories
+ */
+
+struct mdb_lsm_view * lsm_view(const gchar *table)
+{
+    static GHashTable *views = NULL;
+
+    if (NULL == views) {
+        views = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    gpointer found;
+    if (g_hash_table_lookup_extended(views, table, NULL, &found)) {
+        return(found);
+    }
+
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+    gchar *path = g_strconcat(table_path, "/", "metadata", "/", "engine", NULL);
+    struct mdb_lsm_view *view = NULL;
+    gboolean lsm = FALSE;
+    gchar *buf;
+
+    read_first_line(path, &buf);
+    if (buf) {
+        if (!mdb_engine_from_name(g_strstrip(buf), &lsm)) {
+            fprintf(stderr, "error: engine: unknown engine: %s: %s\n", buf, path);
+            exit(EXIT_FAILURE);
+        }
+        g_free(buf);
+    }
+
+    if (lsm) {
+        view = g_malloc0(sizeof(struct mdb_lsm_view));
+        view->table = g_strdup(table);
+        view->memtable_bytes = load_table_memtable(table_path);
+        view->wal_fd = -1;
+        view->runs = g_ptr_array_new_with_free_func((GDestroyNotify) lsm_run_close);
+        view->mem = g_byte_array_new();
+        view->latest = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    g_hash_table_insert(views, g_strdup(table), view);
+
+    g_free(path);
+    g_free(table_path);
+
+    return(view);
+}
+
+/*
+ * lsm/lock: byte 0 is held shared to read the manifest and the wals and
+ * exclusive to change which files they are; byte 1 by whoever is
+ * compacting.  fcntl locks are the process's, so its threads also take
+ * lsm_lock(), and the one fd of each table is never closed.
+ */
+
+GMutex * lsm_lock(void)
+{
+    static GMutex lock;
+
+    return(&lock);
+}
+
+/* Under lsm_lock() */
+int lsm_lock_fd(const gchar *table)
+{
+    static GHashTable *fds = NULL;
+
+    if (NULL == fds) {
+        fds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    gpointer fd = g_hash_table_lookup(fds, table);
+    if (fd) {
+        return(GPOINTER_TO_INT(fd) - 1);
+    }
+
+    gchar *path = lsm_path(table, "lock");
+    int lock_fd = open(path, O_CREAT|O_RDWR|O_CLOEXEC, 0666);
+    if (-1 == lock_fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_hash_table_insert(fds, g_strdup(table), GINT_TO_POINTER(lock_fd + 1));
+    g_free(path);
+
+    return(lock_fd);
+}
+
+void lsm_enter(const gchar *table, short type)
+{
+    struct flock lock = { .l_type = type, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+
+    g_mutex_lock(lsm_lock());
+    mdb_lock_wait(lsm_lock_fd(table), &lock, table);
+}
+
+void lsm_leave(const gchar *table)
+{
+    struct flock lock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+
+    fcntl(lsm_lock_fd(table), F_SETLK, &lock);
+    g_mutex_unlock(lsm_lock());
+}
+
+/* FNV-1a of kind, roid and len, then the payload */
+guint32 lsm_record_sum(const struct mdb_lsm_record *rec, const guint8 *payload)
+{
+    const guint8 *parts[] = { (const guint8 *) &rec->kind, payload };
+    gsize lens[] = { G_STRUCT_OFFSET(struct mdb_lsm_record, sum) - G_STRUCT_OFFSET(struct mdb_lsm_record, kind), rec->len };
+    guint32 sum = 2166136261u;
+
+    for (guint p = 0; p < G_N_ELEMENTS(parts); ++p) {
+        for (gsize i = 0; i < lens[p]; ++i) {
+            sum = (sum ^ parts[p][i]) * 16777619u;
+        }
+    }
+
+    return(sum);
+}
+
+/*
+ * The next whole record of buf from *pos on, which is moved past it.
+ * What isn't a record, as left by a writer that died, is skipped.  NULL,
+ * with *pos at what there is of it, when the next record isn't all
+ * written yet.
+ */
+
+const struct mdb_lsm_record * lsm_next_record(const guint8 *buf, gsize len, gsize *pos)
+{
+    gsize at;
+
+    for (at = *pos; at + sizeof(struct mdb_lsm_record) <= len; at += 8) {
+        const struct mdb_lsm_record *rec = (const struct mdb_lsm_record *) &buf[at];
+
+        if (MDB_LSM_RECORD_MAGIC != rec->magic || rec->len > MDB_LSM_RECORD_MAX) {
+            continue;
+        }
+
+        gsize end = at + sizeof(struct mdb_lsm_record) + MDB_LSM_ALIGN(rec->len);
+
+        if (end > len) {
+            break;
+        }
+
+        if (lsm_record_sum(rec, (const guint8 *) &rec[1]) != rec->sum) {
+            continue;
+        }
+
+        *pos = end;
+
+        return(rec);
+    }
+
+    *pos = at;
+
+    return(NULL);
+}
+
+/*
+ * The column after p (NULL for the first) of a PUT record; NULL after
+ * the last
+ */
+
+const guint8 * lsm_record_next_col(const struct mdb_lsm_record *rec, const guint8 *p, const gchar **name, const guint8 **value, guint32 *len)
+{
+    const guint8 *start = (const guint8 *) &rec[1];
+
+    if (NULL == p) {
+        p = start;
+    }
+
+    if (p >= start + rec->len) {
+        return(NULL);
+    }
+
+    *name = (const gchar *) p;
+    p += strlen(*name) + 1;
+    memcpy(len, p, sizeof(*len));
+    p += sizeof(*len);
+    *value = p;
+
+    return(p + *len);
+}
+
+/* NULL when the record has no such column */
+const guint8 * lsm_record_col(const struct mdb_lsm_record *rec, const gchar *col, guint32 *len)
+{
+    const guint8 *p = NULL;
+    const guint8 *value;
+    const gchar *name;
+
+    while ((p = lsm_record_next_col(rec, p, &name, &value, len))) {
+        if (0 == strcmp(name, col)) {
+            return(value);
+        }
+    }
+
+    return(NULL);
+}
+
+void lsm_payload_add(GByteArray *payload, const gchar *col, const guint8 *data, guint32 len)
+{
+    g_byte_array_append(payload, (const guint8 *) col, strlen(col) + 1);
+    g_byte_array_append(payload, (const guint8 *) &len, sizeof(len));
+    g_byte_array_append(payload, data, len);
+}
+
+/*
+ * The runs of lsm/manifest, oldest first, under byte 0 of lsm/lock.
+ * Before the first flush there's no manifest: generation 0, no runs.
+ */
+
+GPtrArray * lsm_manifest(const gchar *table, guint64 *generation)
+{
+    gchar *path = lsm_path(table, "manifest");
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    gchar *text = NULL;
+
+    *generation = 0;
+
+    if (g_file_get_contents(path, &text, NULL, NULL)) {
+        gchar **lines = g_strsplit(text, "\n", -1);
+
+        for (guint i = 0; lines[i]; ++i) {
+            if (0 == i) {
+                *generation = g_ascii_strtoull(lines[i], NULL, 10);
+            }
+            else if ('\0' != lines[i][0]) {
+                g_ptr_array_add(names, g_strdup(lines[i]));
+            }
+        }
+
+        g_strfreev(lines);
+        g_free(text);
+    }
+
+    g_free(path);
+
+    return(names);
+}
+
+/* Replaced whole, under byte 0 of lsm/lock held exclusive */
+void lsm_write_manifest(const gchar *table, GPtrArray *names, guint64 generation)
+{
+    gchar *path = lsm_path(table, "manifest");
+    gchar *tmp = g_strdup_printf("%s.%d", path, getpid());
+    GString *text = g_string_new(NULL);
+
+    g_string_append_printf(text, "%lu\n", generation);
+    for (guint i = 0; i < names->len; ++i) {
+        g_string_append_printf(text, "%s\n", (gchar *) g_ptr_array_index(names, i));
+    }
+
+    int fd = open(tmp, O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0666);
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", tmp, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    write_fd(fd, text->str, text->len);
+
+    if (-1 == fsync(fd)) {
+        fprintf(stderr, "error: fsync(%s): %s\n", tmp, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+
+    if (-1 == rename(tmp, path)) {
+        fprintf(stderr, "error: rename(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_string_free(text, TRUE);
+    g_free(tmp);
+    g_free(path);
+}
+
+/* One past the highest run number in the manifest */
+gchar * lsm_run_name(GPtrArray *names)
+{
+    guint64 top = 0;
+
+    for (guint i = 0; i < names->len; ++i) {
+        top = MAX(top, g_ascii_strtoull(g_ptr_array_index(names, i), NULL, 10));
+    }
+
+    return(g_strdup_printf("%08lu", top + 1));
+}
+
+/*
+ * Mapped; NULL when it's gone
+ */
+
+struct mdb_lsm_run * lsm_run_open(const gchar *table, const gchar *name)
+{
+    gchar *rel = g_strconcat("runs", "/", name, NULL);
+    gchar *path = lsm_path(table, rel);
+    struct mdb_lsm_run *run = NULL;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (-1 == fd && ENOENT != errno) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (-1 != fd) {
+        if (-1 == fstat(fd, &st)) {
+            fprintf(stderr, "error: fstat(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        guint8 *data = st.st_size < (off_t) sizeof(struct mdb_lsm_run_footer) ? MAP_FAILED :
+            mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        const struct mdb_lsm_run_footer *footer = MAP_FAILED == data ? NULL :
+            (const struct mdb_lsm_run_footer *) (data + st.st_size - sizeof(struct mdb_lsm_run_footer));
+
+        close(fd);
+        ++mdb_counters()->files_opened;
+
+        if (NULL == footer || 0 != memcmp(footer->magic, MDB_LSM_RUN_MAGIC, sizeof(footer->magic)) ||
+            footer->index_offset + footer->count * sizeof(struct mdb_lsm_index_entry) + sizeof(struct mdb_lsm_run_footer) != (guint64) st.st_size
+        ) {
+            fprintf(stderr, "error: %s: not a run\n", path);
+            exit(EXIT_FAILURE);
+        }
+
+        run = g_malloc0(sizeof(struct mdb_lsm_run));
+        run->name = g_strdup(name);
+        run->data = data;
+        run->size = st.st_size;
+        run->index = (const struct mdb_lsm_index_entry *) (data + footer->index_offset);
+        run->count = footer->count;
+    }
+
+    g_free(path);
+    g_free(rel);
+
+    return(run);
+}
+
+void lsm_run_close(struct mdb_lsm_run *run)
+{
+    munmap(run->data, run->size);
+    g_free(run->name);
+    g_free(run);
+}
+
+const struct mdb_lsm_record * lsm_run_find(const struct mdb_lsm_run *run, gint64 roid)
+{
+    guint64 lo = 0;
+    guint64 hi = run->count;
+
+    while (lo < hi) {
+        guint64 mid = lo + (hi - lo) / 2;
+
+        if (run->index[mid].roid < roid) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (lo < run->count && roid == run->index[lo].roid) {
+        return((const struct mdb_lsm_record *) (run->data + run->index[lo].offset));
+    }
+
+    return(NULL);
+}
+
+/*
+ * recs, sorted by roid, as a run in a temporary file of lsm/runs that's
+ * synced before the caller renames it into place
+ */
+
+gchar * lsm_write_run(const gchar *table, GPtrArray *recs, const gchar *tag)
+{
+    gchar *rel = g_strdup_printf("runs/.%s.%d", tag, getpid());
+    gchar *tmp = lsm_path(table, rel);
+    GByteArray *out = g_byte_array_sized_new(MDB_LSM_WRITE_BUFFER);
+    GArray *index = g_array_sized_new(FALSE, FALSE, sizeof(struct mdb_lsm_index_entry), recs->len);
+    guint64 offset = 0;
+
+    int fd = open(tmp, O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0666);
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", tmp, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (guint i = 0; i < recs->len; ++i) {
+        const struct mdb_lsm_record *rec = g_ptr_array_index(recs, i);
+        struct mdb_lsm_index_entry entry = { .roid = rec->roid, .offset = offset };
+        gsize size = sizeof(struct mdb_lsm_record) + MDB_LSM_ALIGN(rec->len);
+
+        g_array_append_val(index, entry);
+        g_byte_array_append(out, (const guint8 *) rec, size);
+        offset += size;
+
+        if (out->len >= MDB_LSM_WRITE_BUFFER) {
+            write_fd(fd, (gchar *) out->data, out->len);
+            g_byte_array_set_size(out, 0);
+        }
+    }
+
+    struct mdb_lsm_run_footer footer = { .count = recs->len, .index_offset = offset };
+    memcpy(footer.magic, MDB_LSM_RUN_MAGIC, sizeof(footer.magic));
+
+    g_byte_array_append(out, (const guint8 *) index->data, index->len * sizeof(struct mdb_lsm_index_entry));
+    g_byte_array_append(out, (const guint8 *) &footer, sizeof(footer));
+    write_fd(fd, (gchar *) out->data, out->len);
+
+    if (-1 == fsync(fd)) {
+        fprintf(stderr, "error: fsync(%s): %s\n", tmp, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+
+    g_array_free(index, TRUE);
+    g_byte_array_free(out, TRUE);
+    g_free(rel);
+
+    return(tmp);
+}
+
+/* What fd holds from off to its end */
+GByteArray * lsm_read_from(int fd, gint64 off)
+{
+    GByteArray *buf = g_byte_array_new();
+    struct stat st;
+    gsize got = 0;
+
+    if (-1 == fstat(fd, &st)) {
+        fprintf(stderr, "error: fstat(%d): %s\n", fd, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (st.st_size <= off) {
+        return(buf);
+    }
+
+    g_byte_array_set_size(buf, st.st_size - off);
+
+    while (got < buf->len) {
+        ssize_t n = pread(fd, buf->data + got, buf->len - got, off + got);
+
+        if (-1 == n && EINTR == errno) {
+            continue;
+        }
+        if (-1 == n) {
+            fprintf(stderr, "error: pread(%d): %s\n", fd, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (0 == n) {
+            break;
+        }
+
+        got += n;
+    }
+
+    g_byte_array_set_size(buf, got);
+    mdb_counters()->bytes_read += got;
+
+    return(buf);
+}
+
+/*
+ * The records of lsm/<name> from *off on into the view's memtable.
+ * *off is left where the next refresh picks up.
+ */
+
+void lsm_read_wal(struct mdb_lsm_view *view, const gchar *name, gint64 *off)
+{
+    gchar *path = lsm_path(view->table, name);
+
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (-1 == fd && ENOENT != errno) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(path);
+
+    if (-1 == fd) {
+        return;
+    }
+
+    GByteArray *buf = lsm_read_from(fd, *off);
+    const struct mdb_lsm_record *rec;
+    gsize pos = 0;
+
+    close(fd);
+
+    while ((rec = lsm_next_record(buf->data, buf->len, &pos))) {
+        g_hash_table_insert(view->latest, GSIZE_TO_POINTER(rec->roid), GSIZE_TO_POINTER(view->mem->len + 1));
+        g_byte_array_append(view->mem, (const guint8 *) rec, sizeof(struct mdb_lsm_record) + MDB_LSM_ALIGN(rec->len));
+    }
+
+    *off += pos;
+
+    g_byte_array_free(buf, TRUE);
+}
+
+/*
+ * Catch the view up.  A flush or a compaction since the last time
+ * means reading the runs and wal.flushing again; otherwise it's only
+ * what has been appended to the wal.
+ */
+
+void lsm_refresh(struct mdb_lsm_view *view)
+{
+    gchar *flushing_path = lsm_path(view->table, "wal.flushing");
+    gchar *wal_path = lsm_path(view->table, "wal");
+    guint64 generation;
+    struct stat st;
+
+    lsm_enter(view->table, F_RDLCK);
+
+    GPtrArray *names = lsm_manifest(view->table, &generation);
+    guint64 flushing_ino = 0 == stat(flushing_path, &st) ? st.st_ino : 0;
+    guint64 wal_ino = 0 == stat(wal_path, &st) ? st.st_ino : 0;
+
+    if (!view->loaded || generation != view->generation || flushing_ino != view->flushing_ino || wal_ino != view->wal_ino) {
+        gint64 off = 0;
+
+        g_ptr_array_set_size(view->runs, 0);
+
+        for (guint i = 0; i < names->len; ++i) {
+            struct mdb_lsm_run *run = lsm_run_open(view->table, g_ptr_array_index(names, i));
+
+            if (NULL == run) {
+                fprintf(stderr, "error: table: %s: run %s of the manifest is missing\n", view->table, (gchar *) g_ptr_array_index(names, i));
+                exit(EXIT_FAILURE);
+            }
+
+            g_ptr_array_add(view->runs, run);
+        }
+
+        g_byte_array_set_size(view->mem, 0);
+        g_hash_table_remove_all(view->latest);
+        lsm_read_wal(view, "wal.flushing", &off);
+
+        view->loaded = TRUE;
+        view->generation = generation;
+        view->flushing_ino = flushing_ino;
+        view->wal_ino = wal_ino;
+        view->wal_off = 0;
+    }
+
+    lsm_read_wal(view, "wal", &view->wal_off);
+
+    lsm_leave(view->table);
+
+    view->cached = NULL;
+
+    g_ptr_array_free(names, TRUE);
+    g_free(flushing_path);
+    g_free(wal_path);
+}
+
+/*
+ * The newest record of roid, a tombstone maybe, as of the last refresh:
+ * the memtable's, else that of the newest run that has one.  NULL if
+ * there's none.
+ */
+
+const struct mdb_lsm_record * lsm_find(struct mdb_lsm_view *view, gint64 roid)
+{
+    if (view->cached && roid == view->cached_roid) {
+        return(view->cached);
+    }
+
+    gsize at = GPOINTER_TO_SIZE(g_hash_table_lookup(view->latest, GSIZE_TO_POINTER(roid)));
+    const struct mdb_lsm_record *rec = at ? (const struct mdb_lsm_record *) (view->mem->data + at - 1) : NULL;
+
+    for (guint i = view->runs->len; NULL == rec && i > 0; --i) {
+        rec = lsm_run_find(g_ptr_array_index(view->runs, i - 1), roid);
+    }
+
+    view->cached_roid = roid;
+    view->cached = rec;
+
+    return(rec);
+}
+
+gint lsm_record_cmp(gconstpointer a, gconstpointer b)
+{
+    const struct mdb_lsm_record *ra = *(const struct mdb_lsm_record **) a;
+    const struct mdb_lsm_record *rb = *(const struct mdb_lsm_record **) b;
+
+    return(ra->roid < rb->roid ? -1 : ra->roid > rb->roid);
+}
+
+gint lsm_roid_cmp(gconstpointer a, gconstpointer b)
+{
+    gint64 ra = *(const gint64 *) a;
+    gint64 rb = *(const gint64 *) b;
+
+    return(ra < rb ? -1 : ra > rb);
+}
+
+/* The roid source is at, G_MAXINT64 once it has run out; runs->len is mem */
+gint64 lsm_merge_key(GPtrArray *runs, GArray *mem, guint source, guint64 at)
+{
+    if (source == runs->len) {
+        return(at < mem->len ? g_array_index(mem, gint64, at) : G_MAXINT64);
+    }
+
+    const struct mdb_lsm_run *run = g_ptr_array_index(runs, source);
+
+    return(at < run->count ? run->index[at].roid : G_MAXINT64);
+}
+
+/*
+ * The newest record of each roid of runs (oldest first) and, given a
+ * view, its memtable, which is newer than any run; in roid order and
+ * without tombstones unless they're wanted
+ */
+
+GPtrArray * lsm_merge(GPtrArray *runs, struct mdb_lsm_view *view, gboolean tombstones)
+{
+    GArray *mem = g_array_new(FALSE, FALSE, sizeof(gint64));
+    guint sources = runs->len + 1;
+    guint64 *pos = g_new0(guint64, sources);
+    GPtrArray *recs = g_ptr_array_new();
+
+    if (view) {
+        GHashTableIter iter;
+        gpointer key;
+
+        g_hash_table_iter_init(&iter, view->latest);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            gint64 roid = GPOINTER_TO_SIZE(key);
+            g_array_append_val(mem, roid);
+        }
+
+        g_array_sort(mem, lsm_roid_cmp);
+    }
+
+    for (;;) {
+        gint64 next = G_MAXINT64;
+
+        for (guint s = 0; s < sources; ++s) {
+            next = MIN(next, lsm_merge_key(runs, mem, s, pos[s]));
+        }
+
+        if (G_MAXINT64 == next) {
+            break;
+        }
+
+        /* Newest first: the first to have it wins */
+        const struct mdb_lsm_record *newest = NULL;
+
+        for (guint s = sources; s > 0; --s) {
+            if (next != lsm_merge_key(runs, mem, s - 1, pos[s - 1])) {
+                continue;
+            }
+
+            if (NULL == newest && s - 1 == runs->len) {
+                gsize at = GPOINTER_TO_SIZE(g_hash_table_lookup(view->latest, GSIZE_TO_POINTER(next)));
+                newest = (const struct mdb_lsm_record *) (view->mem->data + at - 1);
+            }
+            else if (NULL == newest) {
+                const struct mdb_lsm_run *run = g_ptr_array_index(runs, s - 1);
+                newest = (const struct mdb_lsm_record *) (run->data + run->index[pos[s - 1]].offset);
+            }
+
+            ++pos[s - 1];
+        }
+
+        if (tombstones || MDB_LSM_PUT == newest->kind) {
+            g_ptr_array_add(recs, (gpointer) newest);
+        }
+    }
+
+    g_free(pos);
+    g_array_free(mem, TRUE);
+
+    return(recs);
+}
+
+/* What a scan of the table goes through, as of the last refresh */
+GArray * lsm_live_roids(struct mdb_lsm_view *view)
+{
+    GPtrArray *recs = lsm_merge(view->runs, view, FALSE);
+    GArray *roids = g_array_sized_new(FALSE, FALSE, sizeof(gint64), recs->len);
+
+    for (guint i = 0; i < recs->len; ++i) {
+        const struct mdb_lsm_record *rec = g_ptr_array_index(recs, i);
+        g_array_append_val(roids, rec->roid);
+    }
+
+    g_ptr_array_free(recs, TRUE);
+
+    return(roids);
+}
+
+/*
+ * One write of a record to the end of the wal, under a shared lock of
+ * its byte 0; the flush renaming the wal takes it exclusive, so a wal
+ * that was renamed while we waited is reopened.  Past memtable_kb the
+ * writer flushes.
+ */
+
+void lsm_append(const gchar *table, MdbLsmKind kind, gint64 roid, GByteArray *payload)
+{
+    struct mdb_lsm_view *view = lsm_view(table);
+    struct mdb_lsm_record rec = { .magic = MDB_LSM_RECORD_MAGIC, .kind = kind, .roid = roid, .len = payload ? payload->len : 0 };
+    struct flock lock = { .l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+    struct flock unlock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+    gchar *path = lsm_path(table, "wal");
+    struct stat st, fst;
+
+    if (rec.len > MDB_LSM_RECORD_MAX) {
+        fprintf(stderr, "error: table: %s: row of %u bytes is over %u\n", table, rec.len, MDB_LSM_RECORD_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    rec.sum = lsm_record_sum(&rec, payload ? payload->data : NULL);
+
+    GByteArray *buf = g_byte_array_sized_new(sizeof(rec) + MDB_LSM_ALIGN(rec.len));
+    g_byte_array_append(buf, (const guint8 *) &rec, sizeof(rec));
+    if (payload) {
+        g_byte_array_append(buf, payload->data, payload->len);
+    }
+    g_byte_array_set_size(buf, sizeof(rec) + MDB_LSM_ALIGN(rec.len));
+    memset(buf->data + sizeof(rec) + rec.len, 0, buf->len - sizeof(rec) - rec.len);
+
+    for (;;) {
+        if (-1 == view->wal_fd) {
+            view->wal_fd = open(path, O_CREAT|O_RDWR|O_APPEND|O_CLOEXEC, 0666);
+            if (-1 == view->wal_fd) {
+                fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        mdb_lock_wait(view->wal_fd, &lock, path);
+
+        if (0 == fstat(view->wal_fd, &fst) && 0 == stat(path, &st) && fst.st_ino == st.st_ino) {
+            break;
+        }
+
+        /* Flushed meanwhile */
+        close(view->wal_fd);
+        view->wal_fd = -1;
+    }
+
+    write_fd(view->wal_fd, (gchar *) buf->data, buf->len);
+
+    gboolean full = 0 == fstat(view->wal_fd, &fst) && (gsize) fst.st_size >= view->memtable_bytes;
+
+    fcntl(view->wal_fd, F_SETLK, &unlock);
+
+    if (full) {
+        lsm_flush(table);
+    }
+
+    g_byte_array_free(buf, TRUE);
+    g_free(path);
+}
+
+/*
+ * The records of a wal.flushing, open as fd, as a new run at the end of
+ * the manifest; wal.flushing goes in the same change
+ */
+
+void lsm_publish(const gchar *table, int fd)
+{
+    GByteArray *buf = lsm_read_from(fd, 0);
+    GHashTable *newest = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GPtrArray *recs = g_ptr_array_new();
+    const struct mdb_lsm_record *rec;
+    gsize pos = 0;
+    GHashTableIter iter;
+    gpointer value;
+    guint64 generation;
+
+    while ((rec = lsm_next_record(buf->data, buf->len, &pos))) {
+        g_hash_table_insert(newest, GSIZE_TO_POINTER(rec->roid), (gpointer) rec);
+    }
+
+    g_hash_table_iter_init(&iter, newest);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(recs, value);
+    }
+
+    g_ptr_array_sort(recs, lsm_record_cmp);
+
+    gchar *tmp = lsm_write_run(table, recs, "flush");
+    gchar *flushing = lsm_path(table, "wal.flushing");
+
+    lsm_enter(table, F_WRLCK);
+
+    GPtrArray *names = lsm_manifest(table, &generation);
+    gchar *name = lsm_run_name(names);
+    gchar *rel = g_strconcat("runs", "/", name, NULL);
+    gchar *path = lsm_path(table, rel);
+
+    if (-1 == rename(tmp, path)) {
+        fprintf(stderr, "error: rename(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_ptr_array_add(names, name);
+    lsm_write_manifest(table, names, generation + 1);
+
+    if (-1 == unlink(flushing)) {
+        fprintf(stderr, "error: unlink(%s): %s\n", flushing, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    lsm_leave(table);
+
+    ++mdb_counters()->lsm_flushes;
+
+    g_ptr_array_free(names, TRUE);
+    g_ptr_array_free(recs, TRUE);
+    g_hash_table_destroy(newest);
+    g_byte_array_free(buf, TRUE);
+    g_free(flushing);
+    g_free(path);
+    g_free(rel);
+    g_free(tmp);
+}
+
+/*
+ * The wal is renamed to wal.flushing, so rows go to a new wal while it
+ * becomes a run.  Byte 1 of wal.flushing stays locked until then: one
+ * nobody has locked was left by a flush that died, and is finished
+ * first.  One that's being flushed leaves the wal to a later writer.
+ */
+
+void lsm_flush(const gchar *table)
+{
+    struct mdb_lsm_view *view = lsm_view(table);
+    struct flock appenders = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+    struct flock flushing = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 1, .l_len = 1 };
+    struct flock unlock = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+    gchar *wal_path = lsm_path(table, "wal");
+    gchar *flushing_path = lsm_path(table, "wal.flushing");
+    gboolean flushed = FALSE;
+    struct stat st, fst;
+
+    int fd = open(flushing_path, O_RDWR|O_CLOEXEC);
+    if (-1 != fd) {
+        gboolean stale = -1 != fcntl(fd, F_SETLK, &flushing) &&
+            0 == fstat(fd, &fst) && 0 == stat(flushing_path, &st) && fst.st_ino == st.st_ino;
+
+        if (stale) {
+            lsm_publish(table, fd);
+        }
+
+        close(fd);
+
+        if (!stale) {
+            g_free(wal_path);
+            g_free(flushing_path);
+            return;
+        }
+
+        flushed = TRUE;
+    }
+
+    mdb_lock_wait(view->wal_fd, &appenders, wal_path);
+
+    /* Or somebody else flushed it first */
+    gboolean ours = 0 == fstat(view->wal_fd, &fst) && 0 == stat(wal_path, &st) && fst.st_ino == st.st_ino &&
+        (gsize) fst.st_size >= view->memtable_bytes && -1 == access(flushing_path, F_OK);
+
+    if (ours) {
+        fcntl(view->wal_fd, F_SETLK, &flushing);
+
+        lsm_enter(table, F_WRLCK);
+        if (-1 == rename(wal_path, flushing_path)) {
+            fprintf(stderr, "error: rename(%s): %s\n", wal_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        lsm_leave(table);
+    }
+
+    fcntl(view->wal_fd, F_SETLK, &unlock);
+
+    if (ours) {
+        lsm_publish(table, view->wal_fd);
+
+        /* Which lets go of byte 1 */
+        close(view->wal_fd);
+        view->wal_fd = -1;
+
+        flushed = TRUE;
+    }
+
+    if (flushed) {
+        lsm_compact_start(table);
+    }
+
+    g_free(wal_path);
+    g_free(flushing_path);
+}
+
+/* 0 below MDB_LSM_TIER_FACTOR memtables, then one up each time that's multiplied by it */
+guint lsm_tier(gsize size, gsize memtable_bytes)
+{
+    guint tier = 0;
+
+    for (gsize limit = memtable_bytes * MDB_LSM_TIER_FACTOR; size >= limit; limit *= MDB_LSM_TIER_FACTOR) {
+        ++tier;
+    }
+
+    return(tier);
+}
+
+/*
+ * Size tiered: the newest MDB_LSM_MERGE_RUNS or more neighbouring runs
+ * of a tier are merged into one run that takes their place in the
+ * manifest.  A merge that takes in the oldest run drops the tombstones,
+ * as there's nothing older left for them to hide.  FALSE when there's
+ * nothing to merge or another process is compacting.
+ */
+
+gboolean lsm_compact(const gchar *table, gsize memtable_bytes)
+{
+    struct flock compacting = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 1, .l_len = 1 };
+    struct flock done = { .l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 1, .l_len = 1 };
+    GPtrArray *runs = g_ptr_array_new_with_free_func((GDestroyNotify) lsm_run_close);
+    guint64 generation;
+    guint first = 0;
+    guint count = 0;
+
+    g_mutex_lock(lsm_lock());
+    int lock_fd = lsm_lock_fd(table);
+    g_mutex_unlock(lsm_lock());
+
+    if (-1 == fcntl(lock_fd, F_SETLK, &compacting)) {
+        g_ptr_array_free(runs, TRUE);
+        return(FALSE);
+    }
+
+    lsm_enter(table, F_RDLCK);
+
+    GPtrArray *names = lsm_manifest(table, &generation);
+    for (guint i = 0; i < names->len; ++i) {
+        g_ptr_array_add(runs, lsm_run_open(table, g_ptr_array_index(names, i)));
+    }
+
+    lsm_leave(table);
+
+    for (guint end = runs->len; end > 0 && count < MDB_LSM_MERGE_RUNS; end = first) {
+        guint tier = lsm_tier(((struct mdb_lsm_run *) g_ptr_array_index(runs, end - 1))->size, memtable_bytes);
+
+        for (first = end - 1; first > 0; --first) {
+            if (tier != lsm_tier(((struct mdb_lsm_run *) g_ptr_array_index(runs, first - 1))->size, memtable_bytes)) {
+                break;
+            }
+        }
+
+        count = end - first;
+    }
+
+    gboolean merged = count >= MDB_LSM_MERGE_RUNS;
+
+    if (merged) {
+        GPtrArray *window = g_ptr_array_new();
+
+        for (guint i = first; i < first + count; ++i) {
+            g_ptr_array_add(window, g_ptr_array_index(runs, i));
+        }
+
+        GPtrArray *recs = lsm_merge(window, NULL, first > 0);
+        gchar *tmp = lsm_write_run(table, recs, "compact");
+
+        lsm_enter(table, F_WRLCK);
+
+        /* Flushes only add at the end, so the window hasn't moved */
+        GPtrArray *now = lsm_manifest(table, &generation);
+        GPtrArray *next = g_ptr_array_new_with_free_func(g_free);
+        gchar *name = lsm_run_name(now);
+        gchar *rel = g_strconcat("runs", "/", name, NULL);
+        gchar *path = lsm_path(table, rel);
+
+        if (-1 == rename(tmp, path)) {
+            fprintf(stderr, "error: rename(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (guint i = 0; i < now->len; ++i) {
+            if (i == first) {
+                g_ptr_array_add(next, g_strdup(name));
+            }
+            if (i < first || i >= first + count) {
+                g_ptr_array_add(next, g_strdup(g_ptr_array_index(now, i)));
+            }
+        }
+
+        lsm_write_manifest(table, next, generation + 1);
+
+        lsm_leave(table);
+
+        for (guint i = 0; i < window->len; ++i) {
+            gchar *old_rel = g_strconcat("runs", "/", ((struct mdb_lsm_run *) g_ptr_array_index(window, i))->name, NULL);
+            gchar *old = lsm_path(table, old_rel);
+
+            if (-1 == unlink(old)) {
+                fprintf(stderr, "error: unlink(%s): %s\n", old, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            g_free(old);
+            g_free(old_rel);
+        }
+
+        ++mdb_counters()->lsm_compactions;
+
+        g_ptr_array_free(next, TRUE);
+        g_ptr_array_free(now, TRUE);
+        g_ptr_array_free(recs, TRUE);
+        g_ptr_array_free(window, TRUE);
+        g_free(path);
+        g_free(rel);
+        g_free(name);
+        g_free(tmp);
+    }
+
+    fcntl(lock_fd, F_SETLK, &done);
+
+    g_ptr_array_free(names, TRUE);
+    g_ptr_array_free(runs, TRUE);
+
+    return(merged);
+}
+
+gpointer lsm_compact_thread(gpointer data)
+{
+    struct mdb_lsm_compactor *compactor = lsm_compactor();
+
+    while (lsm_compact(compactor->table, compactor->memtable_bytes));
+
+    g_atomic_int_set(&compactor->busy, 0);
+
+    return(NULL);
+}
+
+struct mdb_lsm_compactor * lsm_compactor(void)
+{
+    static struct mdb_lsm_compactor compactor;
+
+    return(&compactor);
+}
+
+/*
+ * A process compacts in one thread at most; a flush while it's busy
+ * leaves the merging to it, or to the next flush
+ */
+
+void lsm_compact_start(const gchar *table)
+{
+    struct mdb_lsm_compactor *compactor = lsm_compactor();
+
+    if (g_atomic_int_get(&compactor->busy)) {
+        return;
+    }
+
+    lsm_compact_wait();
+
+    /* Registered after mdb_stats_flush(), so run before it */
+    if (!compactor->registered) {
+        atexit(lsm_compact_wait);
+        compactor->registered = TRUE;
+    }
+
+    compactor->table = g_strdup(table);
+    compactor->memtable_bytes = lsm_view(table)->memtable_bytes;
+    g_atomic_int_set(&compactor->busy, 1);
+    compactor->thread = g_thread_new("lsm-compact", lsm_compact_thread, NULL);
+}
+
+/* The process waits for a compaction under way before it exits */
+void lsm_compact_wait(void)
+{
+    struct mdb_lsm_compactor *compactor = lsm_compactor();
+
+    if (NULL == compactor->thread || g_thread_self() == compactor->thread) {
+        return;
+    }
+
+    g_thread_join(compactor->thread);
+    compactor->thread = NULL;
+
+    g_free(compactor->table);
+    compactor->table = NULL;
+}
+
+/*
+ * INSERT into an LSM table, outside a transaction: the whole row in one
+ * record.  Serials are filled in and columns left out are NULL, as for
+ * row directories.
+ */
+
+void lsm_insert(gchar *table_path, const gchar *table, GSList *cols, GSList *values)
+{
+    GHashTable *schema = cached_schema(table);
+    GHashTable *given = g_hash_table_new(g_str_hash, g_str_equal);
+    GByteArray *payload = g_byte_array_new();
+    GByteArray *encoded = g_byte_array_new();
+    GHashTable *after = mdb_change_wanted(table) ? mdb_change_cols_new() : NULL;
+    gint64 roid = next_roid(table_path);
+    GHashTableIter iter;
+    gpointer key, type;
+
+    for (; cols && values; cols = cols->next, values = values->next) {
+        g_hash_table_insert(given, cols->data, values->data);
+    }
+
+    g_hash_table_iter_init(&iter, schema);
+    while (g_hash_table_iter_next(&iter, &key, &type)) {
+        const gchar *literal = g_hash_table_lookup(given, key);
+        gchar *serial_file = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", key, NULL);
+        struct mdb_col mdb_col = { .col_type = MDB_COL_TEXT, .null = TRUE };
+        MdbColumnType col_type = MDB_COL_TEXT;
+
+        mdb_col_type_from_name(type, &col_type);
+
+        if (g_file_test(serial_file, G_FILE_TEST_IS_REGULAR) && (NULL == literal || 0 == g_ascii_strncasecmp("0", literal, strlen("0")))) {
+            mdb_col.col_type = MDB_COL_INT64;
+            mdb_col.null = FALSE;
+            mdb_col.v_int64 = next_serial(table_path, serial_file);
+        }
+        else if (literal) {
+            mdb_col_from_literal(col_type, literal, &mdb_col);
+        }
+
+        encode_mdb_col(&mdb_col, encoded);
+        lsm_payload_add(payload, key, encoded->data, encoded->len);
+        mdb_change_add(after, key, &mdb_col);
+
+        g_free(mdb_col.v_text);
+        g_free(serial_file);
+    }
+
+    /* Logged before anybody can change the row */
+    row_version_take(table, roid);
+    lsm_append(table, MDB_LSM_PUT, roid, payload);
+    if (after) {
+        mdb_change_log("INSERT", table, roid, NULL, after);
+    }
+    row_version_release(table, roid);
+
+    g_byte_array_free(encoded, TRUE);
+    g_byte_array_free(payload, TRUE);
+    if (after) {
+        g_hash_table_destroy(after);
+    }
+    g_hash_table_destroy(given);
+}
+
+/*
+ * UPDATE of an LSM row the caller has claimed: the row again, with the
+ * new values of values (column file path -> value)
+ */
+
+void lsm_write_sets(const gchar *table, const gchar *entry_path, GHashTable *values)
+{
+    struct mdb_lsm_view *view = lsm_view(table);
+    gint64 roid = entry_roid(entry_path);
+    const struct mdb_lsm_record *rec = lsm_find(view, roid);
+    GByteArray *payload = g_byte_array_new();
+    GByteArray *encoded = g_byte_array_new();
+    const guint8 *p = NULL;
+    const guint8 *value;
+    const gchar *name;
+    guint32 len;
+
+    if (NULL == rec || MDB_LSM_PUT != rec->kind) {
+        fprintf(stderr, "error: table: %s: row %li not found\n", table, roid);
+        exit(EXIT_FAILURE);
+    }
+
+    while ((p = lsm_record_next_col(rec, p, &name, &value, &len))) {
+        gchar *path = g_strconcat(entry_path, "/", name, NULL);
+        struct mdb_col *set = g_hash_table_lookup(values, path);
+
+        if (set) {
+            encode_mdb_col(set, encoded);
+            lsm_payload_add(payload, name, encoded->data, encoded->len);
+        }
+        else {
+            lsm_payload_add(payload, name, value, len);
+        }
+
+        g_free(path);
+    }
+
+    lsm_append(table, MDB_LSM_PUT, roid, payload);
+
+    g_byte_array_free(encoded, TRUE);
+    g_byte_array_free(payload, TRUE);
+}
+
+/*
+ * Whether a row is still there.  An LSM table is refreshed for it, so
+ * under a row's claim it's the row as its last writer left it.
+ */
+
+gboolean mdb_row_exists(const gchar *table, const gchar *entry_path)
+{
+    struct mdb_lsm_view *view = lsm_view(table);
+
+    if (NULL == view) {
+        return(0 == access(entry_path, F_OK));
+    }
+
+    lsm_refresh(view);
+
+    const struct mdb_lsm_record *rec = lsm_find(view, entry_roid(entry_path));
+
+    return(rec && MDB_LSM_PUT == rec->kind);
+}
+
+/*
+ * entry path/col -> the mdb_io_req that read it.  Keys and requests
+ * belong to the arena of the scan that made them.
+ */
+
+GHashTable * prefetched(void)
+{
+    static GHashTable *cache = NULL;
+
+    if (NULL == cache) {
+        cache = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    return(cache);
+}
+
+/*
+ * NULL if it wasn't prefetched; the request stays valid until its scan
+ * moves on to the next batch
+ */
+
+struct mdb_io_req * take_prefetched(const gchar *entry_path, const gchar *col)
+{
+    GHashTable *cache = prefetched();
+
+    if (0 == g_hash_table_size(cache)) {
+        return(NULL);
+    }
+
+    struct mdb_arena *arena = mdb_stmt_arena();
+    struct mdb_arena_mark mark = mdb_arena_mark(arena);
+    gchar *key = mdb_arena_strconcat(arena, entry_path, "/", col, NULL);
+    struct mdb_io_req *req = g_hash_table_lookup(cache, key);
+
+    if (req) {
+        g_hash_table_remove(cache, key);
+    }
+
+    mdb_arena_reset(arena, mark);
+
+    return(req);
+}
+
+/*
+ * Read the prefetch columns of the rows queued in scan->ahead
+ */
+
+void prefetch_rows(struct mdb_tbl_scanner *scan)
+{
+    GHashTable *cache = prefetched();
+    GPtrArray *reqs = scan->reqs;
+    struct mdb_pool *pool = mdb_pool();
+    guint8 value[MDB_POOL_VALUE_MAX];
+
+    g_ptr_array_set_size(reqs, 0);
+    g_ptr_array_set_size(scan->misses, 0);
+
+    for (guint i = 0; i < scan->ahead->len; ++i) {
+        const gchar *rel = g_ptr_array_index(scan->ahead, i);
+        gint64 roid = entry_roid(rel);
+        guint32 version = 0;
+        gboolean poolable = pool && row_version_peek(scan->table, roid, &version);
+
+        for (guint c = 0; c < scan->prefetch_cols->len; ++c) {
+            struct mdb_io_req *req = mdb_arena_alloc(scan->arena, sizeof(struct mdb_io_req));
+            const gchar *col = g_ptr_array_index(scan->prefetch_cols, c);
+
+            req->at = scan->rows.fd;
+            req->name = mdb_arena_strconcat(scan->arena, rel, "/", col, NULL);
+            req->key = mdb_arena_strconcat(scan->arena, scan->rows_path, "/", req->name, NULL);
+            req->pooled = FALSE;
+            req->poolable = poolable;
+            req->version = version;
+
+            g_ptr_array_add(reqs, req);
+
+            /* Only what the pool doesn't have is read */
+            gssize got = poolable ? mdb_pool_get(pool, mdb_pool_key(scan->table, col), roid, version, value) : -1;
+
+            if (got >= 0) {
+                req->fd = -1;
+                req->got = got;
+                req->size = got + 1;
+                req->data = mdb_arena_alloc(scan->arena, req->size);
+                memcpy(req->data, value, got);
+                req->data[got] = '\0';
+                req->pooled = TRUE;
+            }
+            else {
+                g_ptr_array_add(scan->misses, req);
+            }
+        }
+    }
+
+    mdb_io_read_batch(scan->misses, scan->arena);
+
+    guint ncols = scan->prefetch_cols->len;
+    guint hits = 0;
+
+    for (guint i = 0; i < reqs->len; ++i) {
+        struct mdb_io_req *req = g_ptr_array_index(reqs, i);
+
+        /* A row none of whose files are there has been deleted */
+        if (ncols - 1 == i % ncols) {
+            if (0 == hits + (req->got >= 0)) {
+                g_ptr_array_index(scan->ahead, i / ncols) = NULL;
+            }
+            hits = 0;
+        }
+        else {
+            hits += req->got >= 0;
+        }
+
+        if (req->got >= 0) {
+            g_hash_table_insert(cache, req->key, req);
+        }
+    }
+}
+
+/*
+ * Drop whatever the last batch left unread
+ */
+
+void forget_prefetched(struct mdb_tbl_scanner *scan)
+{
+    GHashTable *cache = prefetched();
+
+    for (guint i = 0; i < scan->reqs->len; ++i) {
+        struct mdb_io_req *req = g_ptr_array_index(scan->reqs, i);
+
+        if (req->got >= 0) {
+            g_hash_table_remove(cache, req->key);
+        }
+    }
+
+    g_ptr_array_set_size(scan->reqs, 0);
+}
+
+void scan_prefetch_col(struct mdb_tbl_scanner *scan, const gchar *col)
+{
+    /* An LSM row is one record, read whole */
+    if (scan->lsm_roids) {
+        return;
+    }
+
+    for (guint i = 0; i < scan->prefetch_cols->len; ++i) {
+        if (0 == g_strcmp0(col, g_ptr_array_index(scan->prefetch_cols, i))) {
+            return;
+        }
+    }
+
+    g_ptr_array_add(scan->prefetch_cols, g_strdup(col));
+}
+
+int gslist_tbl_injoin(gconstpointer data, gconstpointer str)
+{
+    struct ddl_join *join = (struct ddl_join *) data;
+    // g_print("{%s} %s: %d\n", join->tbl_name, str, g_ascii_strncasecmp(data, str, strlen(data)));
+    return (g_ascii_strncasecmp(join->tbl_name, str, strlen(join->tbl_name)));
+}
+
+int gslist_cmp_string(gconstpointer data, gconstpointer str)
+{
+    // g_print("[%s] %s: %d\n", data, str, g_ascii_strncasecmp(data, str, strlen(data)));
+    return (g_ascii_strncasecmp(data, str, strlen(data)));
+}
+
+/*
+ * EXPLAIN [ANALYZE] in front of a SELECT, UPDATE or DELETE
+ */
+
+gchar * parse_explain(gchar *sql, struct mdb_explain *ex)
+{
+    memset(ex, 0, sizeof(struct mdb_explain));
+
+    gchar *p = sql;
+    while (g_ascii_isspace(*p)) {
+        ++p;
+    }
+
+    if (0 != g_ascii_strncasecmp(p, "EXPLAIN", strlen("EXPLAIN")) || !g_ascii_isspace(p[strlen("EXPLAIN")])) {
+        return(sql);
+    }
+
+    ex->mode = MDB_EXPLAIN_PLAN;
+    p += strlen("EXPLAIN");
+    while (g_ascii_isspace(*p)) {
+        ++p;
+    }
+
+    if (0 == g_ascii_strncasecmp(p, "ANALYZE", strlen("ANALYZE")) && g_ascii_isspace(p[strlen("ANALYZE")])) {
+        ex->mode = MDB_EXPLAIN_ANALYZE;
+        ex->started_us = g_get_monotonic_time();
+        p += strlen("ANALYZE");
+    }
+
+    return(p);
+}
+
+/*
+ * Each thread counts into its own block, found through a thread local
+ * and listed in blocks so a reader can add them all up.  A block
+ * outlives its thread so that nothing counted is lost.
+ */
+
+struct mdb_stats * mdb_thread_stats(void)
+{
+    static __thread struct mdb_stats *mine = NULL;
+
+    if (NULL == mine) {
+        mine = g_malloc0(sizeof(struct mdb_stats));
+
+        g_mutex_lock(mdb_stats_lock());
+        g_ptr_array_add(mdb_stats_blocks(), mine);
+        g_mutex_unlock(mdb_stats_lock());
+    }
+
+    return(mine);
+}
+
+struct mdb_counters * mdb_counters(void)
+{
+    return(&mdb_thread_stats()->counters);
+}
+
+GMutex * mdb_stats_lock(void)
+{
+    static GMutex lock;
+
+    return(&lock);
+}
+
+GPtrArray * mdb_stats_blocks(void)
+{
+    static GPtrArray *blocks = NULL;
+
+    if (NULL == blocks) {
+        blocks = g_ptr_array_new();
+    }
+
+    return(blocks);
+}
+
+/*
+ * Every field is a 64 bit count, so stats add up field by field
+ */
+
+void mdb_stats_add(struct mdb_stats *to, const struct mdb_stats *from, gint sign)
+{
+    guint64 *t = (guint64 *) to;
+    const guint64 *f = (const guint64 *) from;
+
+    for (gsize i = 0; i < sizeof(struct mdb_stats) / sizeof(guint64); ++i) {
+        t[i] += sign * f[i];
+    }
+}
+
+void mdb_stats_collect(struct mdb_stats *total)
+{
+    memset(total, 0, sizeof(struct mdb_stats));
+
+    g_mutex_lock(mdb_stats_lock());
+
+    GPtrArray *blocks = mdb_stats_blocks();
+    for (guint i = 0; i < blocks->len; ++i) {
+        mdb_stats_add(total, g_ptr_array_index(blocks, i), 1);
+    }
+
+    g_mutex_unlock(mdb_stats_lock());
+}
+
+guint mdb_latency_bucket(gint64 us)
+{
+    const guint sub = 1 << MDB_LATENCY_SUB_BITS;
+
+    if (us < sub) {
+        return(MAX(us, 0));
+    }
+
+    guint e = 63 - __builtin_clzll(us);
+    guint bucket = (e - MDB_LATENCY_SUB_BITS + 1) * sub + ((us >> (e - MDB_LATENCY_SUB_BITS)) & (sub - 1));
+
+    return(MIN(bucket, MDB_LATENCY_BUCKETS - 1));
+}
+
+/*
+ * The values in a bucket are below this; -1 for the last one
+ */
+
+gint64 mdb_latency_bucket_limit(guint bucket)
+{
+    const guint sub = 1 << MDB_LATENCY_SUB_BITS;
+
+    if (bucket >= MDB_LATENCY_BUCKETS - 1) {
+        return(-1);
+    }
+
+    if (bucket < sub) {
+        return(bucket + 1);
+    }
+
+    guint e = bucket / sub - 1 + MDB_LATENCY_SUB_BITS;
+
+    return((gint64) (sub + bucket % sub + 1) << (e - MDB_LATENCY_SUB_BITS));
+}
+
+/*
+ * Called as each statement finishes.  The totals go to disk at most once
+ * a MDB_STATS_FLUSH_INTERVAL_US, and when the process exits.
+ */
+
+void mdb_stats_statement(MdbStatement type, gint64 started_us)
+{
+    static gint64 flushed_us = 0;
+
+    struct mdb_stats *mine = mdb_thread_stats();
+    gint64 now = g_get_monotonic_time();
+
+    ++mine->latency[type][mdb_latency_bucket(now - started_us)];
+    mine->latency_sum_us[type] += now - started_us;
+
+    if (0 == flushed_us || now - flushed_us >= MDB_STATS_FLUSH_INTERVAL_US) {
+        flushed_us = now;
+        mdb_stats_flush();
+    }
+}
+
+/*
+ * FALSE, and zeros, when the file is empty or not ours
+ */
+
+gboolean mdb_stats_read(int fd, struct mdb_stats *stats)
+{
+    gchar magic[sizeof(MDB_STATS_MAGIC) - 1];
+
+    memset(stats, 0, sizeof(struct mdb_stats));
+
+    if (sizeof(magic) != pread(fd, magic, sizeof(magic), 0) || 0 != memcmp(magic, MDB_STATS_MAGIC, sizeof(magic)) ||
+        sizeof(struct mdb_stats) != pread(fd, stats, sizeof(struct mdb_stats), sizeof(magic))
+    ) {
+        memset(stats, 0, sizeof(struct mdb_stats));
+        return(FALSE);
+    }
+
+    return(TRUE);
+}
+
+/*
+ * Add what this process counted since its last flush to multidb/stats,
+ * under an fcntl lock, and rewrite multidb/metrics.prom from the result.
+ * Statistics are best effort: a stats file that can't be opened is
+ * skipped rather than failing the statement.
+ */
+
+void mdb_stats_flush(void)
+{
+    static struct mdb_stats flushed;
+    static gboolean flushing = FALSE;
+
+    if (NULL == MULTIDB_BASEDIR || flushing) {
+        return;
+    }
+
+    flushing = TRUE;
+
+    gchar *path = g_strconcat(MULTIDB_BASEDIR, "/", "stats", NULL);
+    int fd = open(path, O_CREAT|O_RDWR|O_CLOEXEC, 0666);
+
+    if (-1 == fd) {
+        g_free(path);
+        flushing = FALSE;
+        return;
+    }
+
+    /* Not mdb_lock_wait(): the stats file's own lock isn't counted */
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0 };
+    while (-1 == fcntl(fd, F_SETLKW, &lock) && EINTR == errno) {
+    }
+
+    struct mdb_stats now;
+    struct mdb_stats delta;
+
+    mdb_stats_collect(&now);
+    delta = now;
+    mdb_stats_add(&delta, &flushed, -1);
+    flushed = now;
+
+    struct mdb_stats *total = g_malloc(sizeof(struct mdb_stats));
+
+    mdb_stats_read(fd, total);
+    mdb_stats_add(total, &delta, 1);
+
+    if (sizeof(MDB_STATS_MAGIC) - 1 == pwrite(fd, MDB_STATS_MAGIC, sizeof(MDB_STATS_MAGIC) - 1, 0) &&
+        sizeof(struct mdb_stats) == pwrite(fd, total, sizeof(struct mdb_stats), sizeof(MDB_STATS_MAGIC) - 1)
+    ) {
+        gchar *prom_path = g_strconcat(MULTIDB_BASEDIR, "/", "metrics.prom", NULL);
+        gchar *text = mdb_stats_prometheus(total);
+
+        /* g_file_set_contents() renames a new file over the old one */
+        g_file_set_contents(prom_path, text, -1, NULL);
+
+        g_free(text);
+        g_free(prom_path);
+    }
+
+    lock.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &lock);
+    close(fd);
+
+    g_free(total);
+    g_free(path);
+
+    flushing = FALSE;
+}
+
+/*
+ * Prometheus text exposition format.  Histogram buckets nobody has
+ * landed in are left out; le stays cumulative.
+ */
+
+gchar * mdb_stats_prometheus(const struct mdb_stats *stats)
+{
+    static const struct {
+        const gchar *name;
+        const gchar *help;
+        gsize offset;
+    } counters[] = {
+        { "multidb_rows_scanned_total", "Rows read by table scans.", G_STRUCT_OFFSET(struct mdb_counters, rows_scanned) },
+        { "multidb_rows_returned_total", "Rows returned by SELECT.", G_STRUCT_OFFSET(struct mdb_counters, rows_returned) },
+        { "multidb_files_opened_total", "Column files and directories opened.", G_STRUCT_OFFSET(struct mdb_counters, files_opened) },
+        { "multidb_bytes_read_total", "Bytes read from column files and null bitmaps.", G_STRUCT_OFFSET(struct mdb_counters, bytes_read) },
+        { "multidb_bytes_written_total", "Bytes written.", G_STRUCT_OFFSET(struct mdb_counters, bytes_written) },
+        { "multidb_lock_acquisitions_total", "Table and fcntl locks taken.", G_STRUCT_OFFSET(struct mdb_counters, lock_acquisitions) },
+        { "multidb_roids_allocated_total", "Row ids handed out.", G_STRUCT_OFFSET(struct mdb_counters, roids_allocated) },
+        { "multidb_purgatory_reclaimed_total", "Deleted rows and dropped partitions removed from purgatory.", G_STRUCT_OFFSET(struct mdb_counters, purgatory_reclaimed) },
+        { "multidb_occ_writes_total", "Rows written by optimistic UPDATE and DELETE.", G_STRUCT_OFFSET(struct mdb_counters, occ_writes) },
+        { "multidb_occ_conflicts_total", "Optimistic writes retried because the row changed after it was read.", G_STRUCT_OFFSET(struct mdb_counters, occ_conflicts) },
+        { "multidb_pool_hits_total", "Column values found in the buffer pool.", G_STRUCT_OFFSET(struct mdb_counters, pool_hits) },
+        { "multidb_pool_misses_total", "Column values looked for in the buffer pool and read from their files.", G_STRUCT_OFFSET(struct mdb_counters, pool_misses) },
+        { "multidb_lsm_flushes_total", "Wals of LSM tables written out as sorted runs.", G_STRUCT_OFFSET(struct mdb_counters, lsm_flushes) },
+        { "multidb_lsm_compactions_total", "Runs of LSM tables merged by background compaction.", G_STRUCT_OFFSET(struct mdb_counters, lsm_compactions) },
+        { "multidb_changes_total", "Row changes appended to the change data capture log.", G_STRUCT_OFFSET(struct mdb_counters, changes_logged) },
+        { "multidb_view_rows_refreshed_total", "Rows of materialized views worked out again.", G_STRUCT_OFFSET(struct mdb_counters, view_rows_refreshed) },
+        { "multidb_replica_changes_applied_total", "Changes of the primary's log applied to this replica.", G_STRUCT_OFFSET(struct mdb_counters, replica_changes_applied) },
+        { "multidb_snapshot_files_cloned_total", "Files a snapshot shared the extents of with FICLONE.", G_STRUCT_OFFSET(struct mdb_counters, snapshot_files_cloned) },
+        { "multidb_snapshot_files_linked_total", "Immutable files a snapshot hard linked.", G_STRUCT_OFFSET(struct mdb_counters, snapshot_files_linked) },
+        { "multidb_snapshot_files_copied_total", "Files a snapshot copied.", G_STRUCT_OFFSET(struct mdb_counters, snapshot_files_copied) },
+        { "multidb_copy_rows_in_total", "Rows loaded by COPY FROM.", G_STRUCT_OFFSET(struct mdb_counters, copy_rows_in) },
+        { "multidb_copy_rows_out_total", "Rows written by COPY TO.", G_STRUCT_OFFSET(struct mdb_counters, copy_rows_out) },
+    };
+    static const gchar *statements[MDB_STMT_TYPES] = { "create", "insert", "select", "update", "delete", "alter", "copy" };
+
+    GString *text = g_string_new(NULL);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(counters); ++i) {
+        g_string_append_printf(text, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", counters[i].name, counters[i].help,
+            counters[i].name, counters[i].name, G_STRUCT_MEMBER(guint64, &stats->counters, counters[i].offset));
+    }
+
+    g_string_append_printf(text, "# HELP multidb_lock_wait_seconds_total Time spent waiting for locks.\n"
+        "# TYPE multidb_lock_wait_seconds_total counter\nmultidb_lock_wait_seconds_total %.6f\n",
+        stats->counters.lock_wait_us / (gdouble) G_USEC_PER_SEC);
+
+    gint64 lag_bytes;
+    gdouble lag_seconds;
+
+    if (mdb_replica_lag(&lag_bytes, &lag_seconds)) {
+        g_string_append_printf(text, "# HELP multidb_replica_lag_bytes Change log of the primary not yet applied.\n"
+            "# TYPE multidb_replica_lag_bytes gauge\nmultidb_replica_lag_bytes %li\n", lag_bytes);
+        g_string_append_printf(text, "# HELP multidb_replica_lag_seconds Time since the replica last had all of the primary's change log.\n"
+            "# TYPE multidb_replica_lag_seconds gauge\nmultidb_replica_lag_seconds %.6f\n", lag_seconds);
+    }
+
+    g_string_append(text, "# HELP multidb_statement_duration_seconds Statement latency.\n"
+        "# TYPE multidb_statement_duration_seconds histogram\n");
+
+    for (guint t = 0; t < MDB_STMT_TYPES; ++t) {
+        guint64 count = 0;
+
+        for (guint b = 0; b < MDB_LATENCY_BUCKETS; ++b) {
+            count += stats->latency[t][b];
+
+            if (0 == stats->latency[t][b] || -1 == mdb_latency_bucket_limit(b)) {
+                continue;
+            }
+
+            g_string_append_printf(text, "multidb_statement_duration_seconds_bucket{statement=\"%s\",le=\"%.6f\"} %lu\n",
+                statements[t], mdb_latency_bucket_limit(b) / (gdouble) G_USEC_PER_SEC, count);
+        }
+
+        g_string_append_printf(text, "multidb_statement_duration_seconds_bucket{statement=\"%s\",le=\"+Inf\"} %lu\n", statements[t], count);
+        g_string_append_printf(text, "multidb_statement_duration_seconds_sum{statement=\"%s\"} %.6f\n",
+            statements[t], stats->latency_sum_us[t] / (gdouble) G_USEC_PER_SEC);
+        g_string_append_printf(text, "multidb_statement_duration_seconds_count{statement=\"%s\"} %lu\n", statements[t], count);
+    }
+
+    return(g_string_free(text, FALSE));
+}
+
+/*
+ * --stats: every process's totals, this one's included
+ */
+
+void mdb_stats_print(void)
+{
+    mdb_stats_flush();
+
+    gchar *path = g_strconcat(MULTIDB_BASEDIR, "/", "stats", NULL);
+    struct mdb_stats *total = g_malloc0(sizeof(struct mdb_stats));
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+
+    if (-1 != fd) {
+        struct flock lock = { .l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0 };
+        while (-1 == fcntl(fd, F_SETLKW, &lock) && EINTR == errno) {
+        }
+
+        mdb_stats_read(fd, total);
+        close(fd);
+    }
+
+    gchar *text = mdb_stats_prometheus(total);
+    g_print("%s", text);
+
+    g_free(text);
+    g_free(total);
+    g_free(path);
+}
+
+gint64 mdb_cpu_time(void)
+{
+    struct timespec ts;
+
+    if (-1 == clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)) {
+        return(0);
+    }
+
+    return((gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000);
+}
+
+/*
+ * F_SETLKW, with the time spent waiting counted
+ */
+
+void mdb_lock_wait(int fd, struct flock *lock, const gchar *path)
+{
+    gint64 start = g_get_monotonic_time();
+
+    while (-1 == fcntl(fd, F_SETLKW, lock)) {
+        if (EINTR != errno) {
+            fprintf(stderr, "error: fcntl(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    mdb_counters()->lock_wait_us += g_get_monotonic_time() - start;
+    ++mdb_counters()->lock_acquisitions;
+}
+
+/*
+ * Bracket one call of an operator; nothing is measured without ANALYZE
+ */
+
+void op_probe_start(struct mdb_explain *ex, struct mdb_op_probe *probe)
+{
+    if (MDB_EXPLAIN_ANALYZE != ex->mode) {
+        return;
+    }
+
+    probe->wall_us = g_get_monotonic_time();
+    probe->cpu_us = mdb_cpu_time();
+    probe->counters = *mdb_counters();
+}
+
+void op_probe_stop(struct mdb_explain *ex, struct mdb_op_probe *probe, struct mdb_op_stats *op, gboolean row)
+{
+    if (MDB_EXPLAIN_ANALYZE != ex->mode) {
+        return;
+    }
+
+    struct mdb_counters *now = mdb_counters();
+
+    op->rows += row;
+    op->wall_us += g_get_monotonic_time() - probe->wall_us;
+    op->cpu_us += mdb_cpu_time() - probe->cpu_us;
+    op->counters.files_opened += now->files_opened - probe->counters.files_opened;
+    op->counters.bytes_read += now->bytes_read - probe->counters.bytes_read;
+    op->counters.lock_wait_us += now->lock_wait_us - probe->counters.lock_wait_us;
+}
+
+void print_explain_op(struct mdb_explain *ex, guint depth, const struct mdb_op_stats *op, const gchar *label, const gchar *detail)
+{
+    g_print("%*s%s%s%s", depth * 2, "", depth ? "-> " : "", label, detail ? ": " : "");
+    if (detail) {
+        g_print("%s", detail);
+    }
+
+    if (MDB_EXPLAIN_ANALYZE == ex->mode && op) {
+        g_print("  (rows=%lu wall=%.3fms cpu=%.3fms files=%lu bytes=%lu lock_wait=%.3fms)",
+            op->rows, op->wall_us / 1000.0, op->cpu_us / 1000.0,
+            op->counters.files_opened, op->counters.bytes_read, op->counters.lock_wait_us / 1000.0);
+    }
+
+    g_print("\n");
+}
+
+/*
+ * The scan, the columns read ahead for it and the partitions it skips
+ */
+
+void print_explain_scan(struct mdb_explain *ex, guint depth, struct mdb_tbl_scanner *scan)
+{
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", scan->table, NULL);
+    struct mdb_lsm_view *view = lsm_view(scan->table);
+    gchar *detail = view ?
+        g_strdup_printf("%s (lsm: %u runs, %u rows in the memtable)", scan->table, view->runs->len, g_hash_table_size(view->latest)) :
+        g_strdup_printf("%s (buckets %i)", scan->table, load_table_buckets(table_path));
+
+    print_explain_op(ex, depth, &ex->scan, "Seq Scan", detail);
+    g_free(detail);
+    g_free(table_path);
+
+    if (scan->prefetch_cols->len) {
+        const gchar *io = "read";
+#ifdef MDB_HAVE_LIBURING
+        if (mdb_ring()) {
+            io = "io_uring";
+        }
+#endif
+        GString *cols = g_string_new(NULL);
+
+        for (guint i = 0; i < scan->prefetch_cols->len; ++i) {
+            g_string_append_printf(cols, "%s%s", i ? ", " : "", (gchar *) g_ptr_array_index(scan->prefetch_cols, i));
+        }
+        g_string_append_printf(cols, " (%i rows a batch, %s)", MDB_PREFETCH_ROWS, io);
+
+        print_explain_op(ex, depth + 1, NULL, "Read ahead", cols->str);
+        g_string_free(cols, TRUE);
+    }
+
+    if (scan->partitions) {
+        GString *scanned = g_string_new(NULL);
+        GString *pruned = g_string_new(NULL);
+
+        for (guint i = 0; i < scan->partitions->len; ++i) {
+            struct mdb_partition *part = g_ptr_array_index(scan->partitions, i);
+            GString *list = part->pruned ? pruned : scanned;
+
+            g_string_append_printf(list, "%s%s", list->len ? ", " : "", part->name);
+        }
+
+        gchar *detail = g_strdup_printf("%s on %s; pruned: %s", scanned->len ? scanned->str : "none",
+            scan->partition_col, pruned->len ? pruned->str : "none");
+
+        print_explain_op(ex, depth + 1, NULL, "Partitions", detail);
+
+        g_free(detail);
+        g_string_free(scanned, TRUE);
+        g_string_free(pruned, TRUE);
+    }
+}
+
+void print_explain_total(struct mdb_explain *ex)
+{
+    if (MDB_EXPLAIN_ANALYZE == ex->mode) {
+        g_print("Execution time: %.3fms\n", (g_get_monotonic_time() - ex->started_us) / 1000.0);
+    }
+}
+
+gchar * join_list_text(GSList *list, const gchar *sep)
+{
+    GString *text = g_string_new(NULL);
+
+    for (GSList *iter = list; iter; iter = iter->next) {
+        g_string_append_printf(text, "%s%s", text->len ? sep : "", (gchar *) iter->data);
+    }
+
+    return(g_string_free(text, FALSE));
+}
+
+void execute_ddl_select(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    struct mdb_explain ex;
+    struct ddl_parsed ddl_select = parse_select(parse_explain(sql, &ex));
+    GSList *cols = NULL;
+    GSList *table = NULL;
+
+    /*
+    g_print("WHERE [SELECT]: %s\n", ddl_select.where);
+    for (GSList *iter = ddl_select.cols; iter; iter = iter->next) {
+        g_print("\t[COLS] %s\n", iter->data);
+    }
+    for (GSList *iter = ddl_select.joins; iter; iter = iter->next) {
+        struct ddl_join *join = iter->data;
+        g_print("\t[JOIN] %s ON [%s] [%s]\n", join->tbl_name, join->on_left, join->on_right);
+    }
+    */
+
+    expand_select_star(&ddl_select);
+
+    /* Every table the columns and WHERE may name */
+    GSList *names = g_slist_copy(ddl_select.tables);
+    for (GSList *iter = ddl_select.joins; iter; iter = iter->next) {
+        names = g_slist_append(names, ((struct ddl_join *) iter->data)->tbl_name);
+    }
+
+    GPtrArray *exprs = ddl_select.exprs;
+    for (guint i = 0; i < exprs->len; ++i) {
+        mdb_expr_check_columns(g_ptr_array_index(exprs, i), names, "SELECT");
+    }
+
+    struct mdb_expr *where = compile_where(&ddl_select, names, "SELECT");
+
+    struct mdb_arena *arena = mdb_stmt_arena();
+    mdb_stmt_begin();
+    struct mdb_arena_mark row = mdb_arena_mark(arena);
+
+    /* Print the headers */
+    cols = ddl_select.cols;
+    while (cols && MDB_EXPLAIN_NONE == ex.mode) {
+        g_print("%s%s", cols->data, cols->next ? "\t" : "\n");
+        cols = cols->next;
+    }
+
+    /* No COMMIT lands halfway through the rows */
+    mdb_commits_hold();
+
+    /* Print the rows */
+    for (table = ddl_select.tables; table; table = table->next) {
+        struct mdb_tbl_scanner *scan = NULL;
+        struct mdb_op_probe probe;
+
+        init_scan_table(&scan, table->data);
+
+        for (guint i = 0; i < exprs->len; ++i) {
+            scan_prefetch_expr(scan, g_ptr_array_index(exprs, i));
+        }
+        scan_prefetch_expr(scan, where);
+        scan_prune_partitions(scan, where);
+
+        /* Without joins the one table -> entry path map is reused for every row */
+        GHashTable *row_paths = g_hash_table_new(g_str_hash, g_str_equal);
+
+        /* EXPLAIN alone only plans */
+        while (MDB_EXPLAIN_PLAN != ex.mode) {
+            op_probe_start(&ex, &probe);
+            gboolean more = scan_table(scan);
+            op_probe_stop(&ex, &probe, &ex.scan, more);
+
+            if (!more) {
+                break;
+            }
+
+            GHashTable *join_entry_paths = NULL;
+            
+            mdb_arena_reset(arena, row);
+
+            if (NULL == ddl_select.joins) {
+                join_entry_paths = row_paths;
+                g_hash_table_insert(join_entry_paths, table->data, (gpointer) scan->entry_path);
+            }
+            else {
+                op_probe_start(&ex, &probe);
+                join_entry_paths = included_in_join(scan->entry_path, ddl_select.joins, arena);
+                op_probe_stop(&ex, &probe, &ex.join, 0 != g_hash_table_size(join_entry_paths));
+
+                if (0 == g_hash_table_size(join_entry_paths)) {
+                    g_hash_table_destroy(join_entry_paths);
+                    continue;
+                }
+
+                g_hash_table_insert(join_entry_paths, table->data, (gpointer) scan->entry_path);
+            }
+
+            op_probe_start(&ex, &probe);
+            gboolean matched = row_matches(where, join_entry_paths, table->data);
+            op_probe_stop(&ex, &probe, &ex.filter, matched);
+
+            if (matched) {
+                struct mdb_row_ctx ctx = { .paths = join_entry_paths, .table = table->data };
+
+                op_probe_start(&ex, &probe);
+
+                for (guint i = 0; i < exprs->len; ++i) {
+                    struct mdb_col mdb_col;
+
+                    mdb_expr_eval(g_ptr_array_index(exprs, i), &ctx, &mdb_col);
+
+                    /* ANALYZE runs the statement but keeps its rows to itself */
+                    if (MDB_EXPLAIN_NONE == ex.mode) {
+                        print_mdb_col(&mdb_col);
+                        g_print("%s", i + 1 < exprs->len ? "\t" : "\n");
+                    }
+
+                    mdb_col_clear(&mdb_col);
+                }
+
+                if (MDB_EXPLAIN_NONE == ex.mode) {
+                    ++mdb_counters()->rows_returned;
+                }
+
+                op_probe_stop(&ex, &probe, &ex.output, TRUE);
+            }
+
+            if (row_paths != join_entry_paths) {
+                g_hash_table_destroy(join_entry_paths);
+            }
+        }
+
+        if (MDB_EXPLAIN_NONE != ex.mode) {
+            guint depth = 0;
+            gchar *text = join_list_text(ddl_select.cols, ", ");
+
+            print_explain_op(&ex, depth++, &ex.output, "Project", text);
+            g_free(text);
+
+            if (where) {
+                print_explain_op(&ex, depth++, &ex.filter, "Filter", ddl_select.where);
+            }
+
+            if (ddl_select.joins) {
+                GString *joins = g_string_new(NULL);
+
+                for (GSList *iter = ddl_select.joins; iter; iter = iter->next) {
+                    struct ddl_join *join = iter->data;
+
+                    g_string_append_printf(joins, "%s%s ON %s = %s", joins->len ? ", " : "", join->tbl_name, join->on_left, join->on_right);
+                }
+                g_string_append(joins, " (a scan of each joined table per row)");
+
+                print_explain_op(&ex, depth++, &ex.join, "Nested Loop Join", joins->str);
+                g_string_free(joins, TRUE);
+            }
+
+            print_explain_scan(&ex, depth, scan);
+
+            /* The next table gets its own plan */
+            struct mdb_op_stats zero = { 0 };
+            ex.scan = ex.join = ex.filter = ex.output = zero;
+        }
+
+        g_hash_table_destroy(row_paths);
+        final_scan_table(&scan);
+    }
+
+    mdb_commits_release();
+
+    print_explain_total(&ex);
+
+    mdb_expr_free(where);
+    g_slist_free(names);
+    free_ddl_parsed(&ddl_select);
+
+    mdb_stats_statement(MDB_STMT_SELECT, started_us);
+}
+
+/* Handle the '*' in SELECT: a column of each table for it */
+void expand_select_star(struct ddl_parsed *ddl_select)
+{
+    guint i = 0;
+
+    while (i < ddl_select->exprs->len && g_ptr_array_index(ddl_select->exprs, i)) {
+        ++i;
+    }
+
+    if (i == ddl_select->exprs->len) {
+        return;
+    }
+
+    GSList *cols = NULL;
+    GPtrArray *exprs = g_ptr_array_new_with_free_func((GDestroyNotify) mdb_expr_free);
+
+    i = 0;
+
+    for (GSList *iter = ddl_select->cols; iter; iter = iter->next, ++i) {
+        if (g_ptr_array_index(ddl_select->exprs, i)) {
+            cols = g_slist_prepend(cols, iter->data);
+            g_ptr_array_add(exprs, g_ptr_array_index(ddl_select->exprs, i));
+            ddl_select->exprs->pdata[i] = NULL;
+            continue;
+        }
+
+        for (GSList *table = ddl_select->tables; table; table = table->next) {
+            gchar *cols_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table->data, NULL);
+            GDir *cols_dir = dir_open(cols_path);
+            const gchar *col = g_dir_read_name(cols_dir);
+
+            while (col) {
+                struct mdb_expr *expr = mdb_expr_new(MDB_EXPR_COLUMN);
+
+                expr->table = g_strdup(table->data);
+                expr->col = g_strdup(col);
+
+                cols = g_slist_prepend(cols, g_strconcat(table->data, ".", col, NULL));
+                g_ptr_array_add(exprs, expr);
+                col = g_dir_read_name(cols_dir);
+            }
+
+            g_free(cols_path);
+            g_dir_close(cols_dir);
+        }
+
+        g_free(iter->data);
+    }
+
+    g_slist_free(ddl_select->cols);
+    g_ptr_array_free(ddl_select->exprs, TRUE);
+
+    ddl_select->cols = g_slist_reverse(cols);
+    ddl_select->exprs = exprs;
+}
+
+void free_ddl_parsed(struct ddl_parsed *ddl)
+{
+    for (GSList *iter = ddl->joins; iter; iter = iter->next) {
+        struct ddl_join *join = iter->data;
+
+        g_free(join->tbl_name);
+        g_free(join->on_left);
+        g_free(join->on_right);
+        g_free(join);
+    }
+
+    g_slist_free(ddl->joins);
+    g_slist_free_full(ddl->cols, g_free);
+    g_slist_free_full(ddl->values, g_free);
+    g_slist_free_full(ddl->tables, g_free);
+    g_free(ddl->where);
+    g_free(ddl->tbl_name);
+
+    if (ddl->exprs) {
+        g_ptr_array_free(ddl->exprs, TRUE);
+    }
+    mdb_expr_free(ddl->where_expr);
+}
+
+/*
+ * SELECT * FROM site_key;
+ * SELECT id, site_key, updated FROM site_key;
+ * SELECT upper(site_key) || '!' FROM site_key
+ *     INNER JOIN site_value ON site_key.id = site_value.site_key_id WHERE site_key.id > 1;
+ */
+
+struct ddl_parsed parse_select(const gchar *text)
+{
+    struct mdb_lexer lex;
+    struct ddl_parsed ddl_select = { NULL };
+
+    mdb_lex_init(&lex, text, "SELECT");
+    lex_expect_keyword(&lex, "SELECT");
+
+    /* A column keeps its text as well, for the header */
+    ddl_select.exprs = g_ptr_array_new_with_free_func((GDestroyNotify) mdb_expr_free);
+    do {
+        const gchar *start = lex.next.start;
+
+        if (lex_accept_symbol(&lex, "*")) {
+            g_ptr_array_add(ddl_select.exprs, NULL);
+        }
+        else {
+            g_ptr_array_add(ddl_select.exprs, expr_parse_or(&lex));
+        }
+
+        ddl_select.cols = g_slist_append(ddl_select.cols, lex_text_from(&lex, start));
+    } while (lex_accept_symbol(&lex, ","));
+
+    lex_expect_keyword(&lex, "FROM");
+
+    struct mdb_token table = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a table name");
+    ddl_select.tables = g_slist_append(NULL, lex_token_text(&table));
+
+    while (lex_is_keyword(&lex, "INNER") || lex_is_keyword(&lex, "JOIN")) {
+        struct ddl_join *join = g_malloc0(sizeof(struct ddl_join));
+        struct mdb_token token;
+
+        lex_accept_keyword(&lex, "INNER");
+        lex_expect_keyword(&lex, "JOIN");
+        join->join_type = MDB_JOIN_INNER;
+
+        token = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a table name");
+        join->tbl_name = lex_token_text(&token);
+
+        lex_expect_keyword(&lex, "ON");
+        token = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a column");
+        join->on_left = lex_token_text(&token);
+        lex_expect_symbol(&lex, "=");
+        token = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a column");
+        join->on_right = lex_token_text(&token);
+
+        ddl_select.joins = g_slist_append(ddl_select.joins, join);
+    }
+
+    if (lex_accept_keyword(&lex, "WHERE")) {
+        parse_where(&lex, &ddl_select);
+    }
+
+    lex_expect_end(&lex);
+
+    return(ddl_select);
+}
+
+GHashTable * load_schema(gchar *table)
+{
+    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table, NULL);
+
+    if (!g_file_test(schema_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: schema: %s: does not exist\n", schema_path);
+        exit(EXIT_FAILURE);
+    }
+
+    GDir *schema_dir = dir_open(schema_path);
+    const gchar *schema_entry = g_dir_read_name(schema_dir);
+
+    GHashTable *schema = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    while (schema_entry) {
+        gchar *buf;
+        gchar *file = g_strconcat(schema_path, "/", schema_entry, NULL);
+
+        read_first_line(file, &buf);
+        g_hash_table_insert(schema, g_strdup(schema_entry), g_strdup(buf));
+
+        g_free(file);
+        g_free(buf);
+
+        schema_entry = g_dir_read_name(schema_dir);
+    }
+
+    g_dir_close(schema_dir);
+
+    g_free(schema_path);
+
+    return(schema);
+}
+
+/*
+ * Typed values
+ */
+
+gboolean mdb_col_type_from_name(const gchar *type, MdbColumnType *col_type)
+{
+    static const struct {
+        const gchar *name;
+        MdbColumnType col_type;
+    } types[] = {
+        { "serial", MDB_COL_INT64 },
+        { "integer", MDB_COL_INT64 },
+        { "bigint", MDB_COL_INT64 },
+        { "smallint", MDB_COL_INT64 },
+        { "int", MDB_COL_INT64 },
+        { "int8", MDB_COL_INT64 },
+        { "double", MDB_COL_DOUBLE },
+        { "float", MDB_COL_DOUBLE },
+        { "real", MDB_COL_DOUBLE },
+        { "boolean", MDB_COL_BOOLEAN },
+        { "bool", MDB_COL_BOOLEAN },
+        { "timestamp", MDB_COL_TIMESTAMP },
+        { "text", MDB_COL_TEXT },
+        { "varchar", MDB_COL_TEXT },
+        { "char", MDB_COL_TEXT },
+        { "character", MDB_COL_TEXT },
+    };
+
+    /* Only the type word counts: varchar(255), double precision */
+    gsize len = strspn(type, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+
+    for (guint i = 0; i < G_N_ELEMENTS(types); ++i) {
+        if (len == strlen(types[i].name) && 0 == g_ascii_strncasecmp(types[i].name, type, len)) {
+            *col_type = types[i].col_type;
+            return(TRUE);
+        }
+    }
+
+    return(FALSE);
+}
+
+/*
+ * Schemas and versions don't change under a running statement, so they are
+ * read once per process
+ */
+
+GHashTable * cached_schema(const gchar *table)
+{
+    static GHashTable *schemas = NULL;
+
+    if (NULL == schemas) {
+        schemas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+    }
+
+    GHashTable *schema = g_hash_table_lookup(schemas, table);
+    if (NULL == schema) {
+        schema = load_schema((gchar *) table);
+        g_hash_table_insert(schemas, g_strdup(table), schema);
+    }
+
+    return(schema);
+}
+
+gint table_version(const gchar *table)
+{
+    static GHashTable *versions = NULL;
+
+    if (NULL == versions) {
+        versions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    gpointer version;
+    if (g_hash_table_lookup_extended(versions, table, NULL, &version)) {
+        return(GPOINTER_TO_INT(version));
+    }
+
+    gchar *path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "metadata", "/", "version", NULL);
+    gchar *buf;
+    gint v = 1;
+
+    read_first_line(path, &buf);
+    if (buf) {
+        v = g_ascii_strtoll('v' == buf[0] ? &buf[1] : buf, NULL, 10);
+        g_free(buf);
+    }
+    g_free(path);
+
+    g_hash_table_insert(versions, g_strdup(table), GINT_TO_POINTER(v));
+
+    return(v);
+}
+
+gboolean mdb_parse_timestamp(const gchar *text, gint64 *usec)
+{
+    gint year = 0, month = 0, day = 0, hour = 0, minute = 0;
+    gdouble seconds = 0;
+    gchar sep = 'T';
+
+    gint n = sscanf(text, "%4d-%2d-%2d%c%2d:%2d:%lf", &year, &month, &day, &sep, &hour, &minute, &seconds);
+
+    /* A date, or a date and time with at least hours and minutes */
+    if (n < 3 || 4 == n || 5 == n || ('T' != sep && ' ' != sep)) {
+        return(FALSE);
+    }
+
+    GDateTime *dt = g_date_time_new_utc(year, month, day, hour, minute, seconds);
+    if (NULL == dt) {
+        return(FALSE);
+    }
+
+    *usec = g_date_time_to_unix(dt) * G_USEC_PER_SEC + g_date_time_get_microsecond(dt);
+    g_date_time_unref(dt);
+
+    return(TRUE);
+}
+
+gchar * mdb_format_timestamp(gint64 usec)
+{
+    gint64 secs = usec / G_USEC_PER_SEC;
+    gint64 frac = usec % G_USEC_PER_SEC;
+
+    if (frac < 0) {
+        frac += G_USEC_PER_SEC;
+        secs -= 1;
+    }
+
+    GDateTime *dt = g_date_time_new_from_unix_utc(secs);
+    gchar *date = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%S");
+    gchar *ret = frac ? g_strdup_printf("%s.%06li", date, frac) : g_strdup(date);
+
+    g_free(date);
+    g_date_time_unref(dt);
+
+    return(ret);
+}
+
+/*
+ * Parse a SQL literal (as the parsers hand it to us, strings still quoted)
+ * into a value of the given type
+ */
+
+gboolean mdb_col_from_literal(MdbColumnType col_type, const gchar *literal, struct mdb_col *mdb_col)
+{
+    mdb_col->col_type = col_type;
+    mdb_col->stale = FALSE;
+    mdb_col->null = FALSE;
+    mdb_col->v_text = NULL;
+
+    if (NULL == literal || 0 == g_ascii_strcasecmp("NULL", literal)) {
+        mdb_col->null = TRUE;
+        return(TRUE);
+    }
+
+    if (MDB_COL_TEXT == col_type) {
+        mdb_col->v_text = g_strdup(literal);
+        return(TRUE);
+    }
+
+    /* Quotes are fine around any typed literal: '42', '2014-10-06T21:01' */
+    gsize len = strlen(literal);
+    gchar *unquoted = NULL;
+    if (len >= 2 && '\'' == literal[0] && '\'' == literal[len - 1]) {
+        unquoted = g_strndup(&literal[1], len - 2);
+    }
+    else {
+        unquoted = g_strdup(literal);
+    }
+
+    gboolean ret = FALSE;
+    gchar *end = NULL;
+
+    switch (col_type) {
+        case MDB_COL_INT64:
+            errno = 0;
+            mdb_col->v_int64 = g_ascii_strtoll(unquoted, &end, 10);
+            ret = end != unquoted && '\0' == *end && 0 == errno;
+        break;
+
+        case MDB_COL_DOUBLE:
+            mdb_col->v_double = g_ascii_strtod(unquoted, &end);
+            ret = end != unquoted && '\0' == *end;
+        break;
+
+        case MDB_COL_BOOLEAN:
+            if (0 == g_ascii_strcasecmp("true", unquoted) || 0 == g_ascii_strcasecmp("t", unquoted) || 0 == g_strcmp0("1", unquoted)) {
+                mdb_col->v_bool = TRUE;
+                ret = TRUE;
+            }
+            else if (0 == g_ascii_strcasecmp("false", unquoted) || 0 == g_ascii_strcasecmp("f", unquoted) || 0 == g_strcmp0("0", unquoted)) {
+                mdb_col->v_bool = FALSE;
+                ret = TRUE;
+            }
+        break;
+
+        case MDB_COL_TIMESTAMP:
+            ret = mdb_parse_timestamp(unquoted, &mdb_col->v_int64);
+        break;
+
+        case MDB_COL_TEXT:
+        break;
+    }
+
+    g_free(unquoted);
+
+    return(ret);
+}
+
+/*
+ * The fixed width encodings of a v2 column file; NULL is zero bytes
+ */
+
+void encode_mdb_col(const struct mdb_col *mdb_col, GByteArray *out)
+{
+    g_byte_array_set_size(out, 0);
+
+    if (mdb_col->null) {
+        return;
+    }
+
+    switch (mdb_col->col_type) {
+        case MDB_COL_INT64:
+        case MDB_COL_TIMESTAMP:
+            {
+                gint64 v = GINT64_TO_LE(mdb_col->v_int64);
+                g_byte_array_append(out, (guint8 *) &v, sizeof(v));
+            }
+        break;
+
+        case MDB_COL_DOUBLE:
+            {
+                guint64 v;
+                memcpy(&v, &mdb_col->v_double, sizeof(v));
+                v = GUINT64_TO_LE(v);
+                g_byte_array_append(out, (guint8 *) &v, sizeof(v));
+            }
+        break;
+
+        case MDB_COL_BOOLEAN:
+            {
+                guint8 v = mdb_col->v_bool ? 1 : 0;
+                g_byte_array_append(out, &v, sizeof(v));
+            }
+        break;
+
+        case MDB_COL_TEXT:
+            g_byte_array_append(out, (guint8 *) mdb_col->v_text, strlen(mdb_col->v_text));
+        break;
+    }
+}
+
+gboolean decode_mdb_col(struct mdb_col *mdb_col, const gchar *buf, gsize len)
+{
+    if (0 == len) {
+        mdb_col->null = TRUE;
+        return(TRUE);
+    }
+
+    switch (mdb_col->col_type) {
+        case MDB_COL_INT64:
+        case MDB_COL_TIMESTAMP:
+            if (sizeof(gint64) != len) {
+                return(FALSE);
+            }
+            memcpy(&mdb_col->v_int64, buf, sizeof(gint64));
+            mdb_col->v_int64 = GINT64_FROM_LE(mdb_col->v_int64);
+        break;
+
+        case MDB_COL_DOUBLE:
+            {
+                guint64 v;
+                if (sizeof(v) != len) {
+                    return(FALSE);
+                }
+                memcpy(&v, buf, sizeof(v));
+                v = GUINT64_FROM_LE(v);
+                memcpy(&mdb_col->v_double, &v, sizeof(v));
+            }
+        break;
+
+        case MDB_COL_BOOLEAN:
+            if (1 != len) {
+                return(FALSE);
+            }
+            mdb_col->v_bool = 0 != buf[0];
+        break;
+
+        case MDB_COL_TEXT:
+            mdb_col->v_text = g_strndup(buf, len);
+        break;
+    }
+
+    return(TRUE);
+}
+
+gchar * mdb_col_to_string(const struct mdb_col *mdb_col)
+{
+    if (mdb_col->null) {
+        return(g_strdup("NULL"));
+    }
+
+    switch (mdb_col->col_type) {
+        case MDB_COL_INT64:
+            return(g_strdup_printf("%li", mdb_col->v_int64));
+
+        case MDB_COL_DOUBLE:
+            return(g_strdup_printf("%.15g", mdb_col->v_double));
+
+        case MDB_COL_BOOLEAN:
+            return(g_strdup(mdb_col->v_bool ? "true" : "false"));
+
+        case MDB_COL_TIMESTAMP:
+            {
+                gchar *ts = mdb_format_timestamp(mdb_col->v_int64);
+                gchar *ret = g_strconcat("'", ts, "'", NULL);
+                g_free(ts);
+                return(ret);
+            }
+
+        case MDB_COL_TEXT:
+            return(g_strdup(mdb_col->v_text));
+    }
+
+    return(NULL);
+}
+
+void print_mdb_col(const struct mdb_col *mdb_col)
+{
+    if (mdb_col->stale) {
+        return;
+    }
+
+    /* Same text as mdb_col_to_string(), without the copy */
+    if (mdb_col->null) {
+        g_print("NULL");
+        return;
+    }
+
+    switch (mdb_col->col_type) {
+        case MDB_COL_INT64:
+            g_print("%li", mdb_col->v_int64);
+            return;
+
+        case MDB_COL_DOUBLE:
+            g_print("%.15g", mdb_col->v_double);
+            return;
+
+        case MDB_COL_BOOLEAN:
+            g_print("%s", mdb_col->v_bool ? "true" : "false");
+            return;
+
+        case MDB_COL_TEXT:
+            g_print("%s", mdb_col->v_text);
+            return;
+
+        case MDB_COL_TIMESTAMP:
+            break;
+    }
+
+    gchar *v = mdb_col_to_string(mdb_col);
+    g_print("%s", v);
+    g_free(v);
+}
+
+/*
+ * Text is compared on what is between the quotes
+ */
+
+void unquoted_span(const gchar *text, const gchar **start, gsize *len)
+{
+    gsize n = strlen(text);
+
+    if (n >= 2 && '\'' == text[0] && '\'' == text[n - 1]) {
+        *start = &text[1];
+        *len = n - 2;
+    }
+    else {
+        *start = text;
+        *len = n;
+    }
+}
+
+gint mdb_col_cmp(const struct mdb_col *a, const struct mdb_col *b)
+{
+    gboolean a_number = MDB_COL_INT64 == a->col_type || MDB_COL_DOUBLE == a->col_type;
+    gboolean b_number = MDB_COL_INT64 == b->col_type || MDB_COL_DOUBLE == b->col_type;
+
+    if (a_number && b_number) {
+        if (MDB_COL_INT64 == a->col_type && MDB_COL_INT64 == b->col_type) {
+            return((a->v_int64 > b->v_int64) - (a->v_int64 < b->v_int64));
+        }
+
+        gdouble x = MDB_COL_DOUBLE == a->col_type ? a->v_double : (gdouble) a->v_int64;
+        gdouble y = MDB_COL_DOUBLE == b->col_type ? b->v_double : (gdouble) b->v_int64;
+
+        return((x > y) - (x < y));
+    }
+
+    if (a->col_type == b->col_type && MDB_COL_TIMESTAMP == a->col_type) {
+        return((a->v_int64 > b->v_int64) - (a->v_int64 < b->v_int64));
+    }
+
+    if (a->col_type == b->col_type && MDB_COL_BOOLEAN == a->col_type) {
+        return(a->v_bool - b->v_bool);
+    }
+
+    gchar *x = mdb_col_to_string(a);
+    gchar *y = mdb_col_to_string(b);
+    const gchar *x_start, *y_start;
+    gsize x_len, y_len;
+
+    unquoted_span(x, &x_start, &x_len);
+    unquoted_span(y, &y_start, &y_len);
+
+    gint ret = memcmp(x_start, y_start, MIN(x_len, y_len));
+    if (0 == ret) {
+        ret = (x_len > y_len) - (x_len < y_len);
+    }
+
+    g_free(x);
+    g_free(y);
+
+    return(ret);
+}
+
+void write_bytes_file(gchar *path, const guint8 *data, gsize len)
+{
+    int fd = open(path, O_CREAT|O_WRONLY|O_TRUNC, 0666);
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    write_fd(fd, (gchar *) data, len);
+
+    close(fd);
+}
+
+/*
+ * Write a literal to a v2 column file in its binary encoding
+ */
+
+gboolean write_typed_col_file(gchar *path, MdbColumnType col_type, const gchar *literal, MdbCodec codec)
+{
+    static GByteArray *out = NULL;
+    struct mdb_col mdb_col;
+
+    if (!mdb_col_from_literal(col_type, literal, &mdb_col)) {
+        fprintf(stderr, "error: invalid value for column: %s: %s\n", path, literal);
+        exit(EXIT_FAILURE);
+    }
+
+    if (MDB_COL_TEXT == col_type && !mdb_col.null) {
+        write_col_file(path, mdb_col.v_text, codec);
+        g_free(mdb_col.v_text);
+        return(FALSE);
+    }
+
+    if (NULL == out) {
+        out = g_byte_array_new();
+    }
+
+    encode_mdb_col(&mdb_col, out);
+    write_bytes_file(path, out->data, out->len);
+
+    return(mdb_col.null);
+}
+
+/*
+ * v2 tables also keep the NULLs of a column as one bit per roid in
+ * metadata/nulls/<col>, so IS [NOT] NULL never opens a value file.  A
+ * missing bitmap, or one too short to reach a roid, means not NULL.
+ * roids are never reused, so DELETE leaves the bits alone.
+ */
+
+gchar * null_bitmap_path(const gchar *table, const gchar *col)
+{
+    return(g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "metadata", "/", "nulls", "/", col, NULL));
+}
+
+GHashTable * null_bitmaps(void)
+{
+    static GHashTable *bitmaps = NULL;
+
+    if (NULL == bitmaps) {
+        bitmaps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_bytes_unref);
+    }
+
+    return(bitmaps);
+}
+
+void set_null_bit(const gchar *table, const gchar *col, gint64 roid, gboolean null)
+{
+    gchar *path = null_bitmap_path(table, col);
+    off_t offset = roid / 8;
+    guint8 mask = 1 << (roid % 8);
+    struct stat st;
+
+    /* Nothing to clear in a bitmap that doesn't reach this far */
+    if (!null && (0 != stat(path, &st) || st.st_size <= offset)) {
+        g_free(path);
+        return;
+    }
+
+    int fd = open(path, O_CREAT|O_RDWR, 0666);
+    if (-1 == fd && ENOENT == errno) {
+        gchar *dir = g_path_get_dirname(path);
+        g_mkdir_with_parents(dir, 0775);
+        g_free(dir);
+
+        fd = open(path, O_CREAT|O_RDWR, 0666);
+    }
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Writers of other rows may share the byte */
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = offset, .l_len = 1 };
+    mdb_lock_wait(fd, &lock, path);
+
+    guint8 byte = 0;
+    if (-1 == pread(fd, &byte, 1, offset)) {
+        fprintf(stderr, "error: pread(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    byte = null ? (byte | mask) : (byte & ~mask);
+
+    if (1 != pwrite(fd, &byte, 1, offset)) {
+        fprintf(stderr, "error: pwrite(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    ++mdb_counters()->bytes_written;
+
+    lock.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &lock);
+    close(fd);
+
+    g_hash_table_remove(null_bitmaps(), path);
+    g_free(path);
+}
+
+/*
+ * ORs len bytes of bits into a bitmap from byte offset on, for a run of
+ * new roids; the bytes at either end may be shared with other rows
+ */
+
+void set_null_bits(const gchar *table, const gchar *col, gint64 offset, const guint8 *bits, gsize len)
+{
+    gchar *path = null_bitmap_path(table, col);
+
+    int fd = open(path, O_CREAT|O_RDWR, 0666);
+    if (-1 == fd && ENOENT == errno) {
+        gchar *dir = g_path_get_dirname(path);
+        g_mkdir_with_parents(dir, 0775);
+        g_free(dir);
+
+        fd = open(path, O_CREAT|O_RDWR, 0666);
+    }
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = offset, .l_len = len };
+    mdb_lock_wait(fd, &lock, path);
+
+    guint8 *bytes = g_malloc0(len);
+    if (-1 == pread(fd, bytes, len, offset)) {
+        fprintf(stderr, "error: pread(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (gsize i = 0; i < len; ++i) {
+        bytes[i] |= bits[i];
+    }
+
+    if ((ssize_t) len != pwrite(fd, bytes, len, offset)) {
+        fprintf(stderr, "error: pwrite(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    mdb_counters()->bytes_written += len;
+
+    lock.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &lock);
+    close(fd);
+
+    g_hash_table_remove(null_bitmaps(), path);
+    g_free(bytes);
+    g_free(path);
+}
+
+/*
+ * A bitmap is read once and kept until this process changes it
+ */
+
+gboolean is_null_bit(const gchar *table, const gchar *col, gint64 roid)
+{
+    gchar *path = null_bitmap_path(table, col);
+    GBytes *bitmap = g_hash_table_lookup(null_bitmaps(), path);
+
+    if (NULL == bitmap) {
+        gchar *contents = NULL;
+        gsize len = 0;
+
+        if (!g_file_get_contents(path, &contents, &len, NULL)) {
+            contents = NULL;
+            len = 0;
+        }
+        else {
+            ++mdb_counters()->files_opened;
+            mdb_counters()->bytes_read += len;
+        }
+
+        bitmap = g_bytes_new_take(contents, len);
+        g_hash_table_insert(null_bitmaps(), g_strdup(path), bitmap);
+    }
+
+    g_free(path);
+
+    gsize len;
+    const guint8 *bits = g_bytes_get_data(bitmap, &len);
+
+    if ((gsize) (roid / 8) >= len) {
+        return(FALSE);
+    }
+
+    return(0 != (bits[roid / 8] & (1 << (roid % 8))));
+}
+
+gint64 entry_roid(const gchar *entry_path)
+{
+    const gchar *slash = strrchr(entry_path, '/');
+
+    return(g_ascii_strtoll(slash ? &slash[1] : entry_path, NULL, 10));
+}
+
+struct mdb_col *load_mdb_col(gchar *table, gchar *col_name, GHashTable *schema, const gchar *entry_path)
+{
+    struct mdb_col *mdb_col = g_malloc0(sizeof(struct mdb_col));
+
+    read_mdb_col(table, col_name, schema, entry_path, mdb_col);
+
+    return(mdb_col);
+}
+
+/*
+ * Into a caller's mdb_col, which only holds heap memory (v_text) when
+ * the value is text
+ */
+
+void read_mdb_col(gchar *table, const gchar *col_name, GHashTable *schema, const gchar *entry_path, struct mdb_col *mdb_col)
+{
+    memset(mdb_col, 0, sizeof(struct mdb_col));
+
+    /* 
+     * Support col and table.col
+     */
+
+    const gchar *dot = strchr(col_name, '.');
+    const gchar *col = dot ? &dot[1] : col_name;
+
+    const gchar *type = g_hash_table_lookup(schema, col);
+    if (NULL == type) {
+        fprintf(stderr, "error: schema: [%s]::[%s]: not found\n", table, col);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Unknown v1 types were always treated as text */
+    if (!mdb_col_type_from_name(type, &mdb_col->col_type)) {
+        mdb_col->col_type = MDB_COL_TEXT;
+    }
+
+    /* 
+     * Get the value
+     */
+
+    /* Before read_col_file(), which hands back a shared buffer */
+    gint version = table_version(table);
+
+    gsize len;
+    const gchar *buf = NULL;
+    struct mdb_lsm_view *view = lsm_view(table);
+    struct mdb_io_req *req = view ? NULL : take_prefetched(entry_path, col);
+    gint64 roid = entry_roid(entry_path);
+    guint8 value[MDB_POOL_VALUE_MAX + 1];
+    gboolean poolable = FALSE;
+    guint32 seen = 0;
+
+    if (view) {
+        /* A column the row was written without is NULL */
+        const struct mdb_lsm_record *rec = lsm_find(view, roid);
+        guint32 found = 0;
+
+        if (rec && MDB_LSM_PUT == rec->kind) {
+            buf = (const gchar *) lsm_record_col(rec, col, &found);
+            buf = buf ? buf : "";
+        }
+
+        len = found;
+    }
+    else if (req && req->pooled) {
+        buf = (const gchar *) req->data;
+        len = req->got;
+    }
+    else if (req) {
+        buf = col_file_value(entry_path, req->data, req->got, &len);
+        poolable = req->poolable;
+        seen = req->version;
+    }
+    else if (txn_staged_row(entry_path)) {
+        /* A staged row has no roid to pool it by, nor a lasting fd */
+        gchar *path = g_strconcat(entry_path, "/", col, NULL);
+
+        buf = read_col_file_at(AT_FDCWD, path, &len);
+        g_free(path);
+    }
+    else {
+        poolable = mdb_pool() && row_version_peek(table, roid, &seen);
+
+        gssize got = poolable ? mdb_pool_get(mdb_pool(), mdb_pool_key(table, col), roid, seen, value) : -1;
+
+        if (got >= 0) {
+            value[got] = '\0';
+            buf = (const gchar *) value;
+            len = got;
+            poolable = FALSE;
+        }
+        else {
+            int at = entry_dir_fd(entry_path);
+            buf = -1 == at ? NULL : read_col_file_at(at, col, &len);
+        }
+    }
+
+    if (NULL == buf || (0 == len && version < 2)) {
+        mdb_col->stale = TRUE;
+        return;
+    }
+
+    if (poolable) {
+        mdb_pool_fill(table, roid, mdb_pool_key(table, col), seen, buf, len);
+    }
+
+    if (version >= 2) {
+        if (!decode_mdb_col(mdb_col, buf, len)) {
+            fprintf(stderr, "error: %s/%s: corrupt value (%lu bytes)\n", entry_path, col, len);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        /* v1: everything is text, "NULL" included */
+        gchar *text = g_strndup(buf, len);
+
+        if (!mdb_col_from_literal(mdb_col->col_type, text, mdb_col)) {
+            mdb_col->col_type = MDB_COL_TEXT;
+            mdb_col->null = FALSE;
+            mdb_col->v_text = g_strdup(text);
+        }
+
+        g_free(text);
+    }
+}
+
+void free_mdb_col(struct mdb_col **mdb_col)
+{
+    g_free((*mdb_col)->v_text);
+    g_free(*mdb_col);
+    *mdb_col = NULL;
+}
+
+/* The matching row's entry path, from arena when one is given */
+gchar * sequential_scan(struct ddl_join *join, gchar *entry_path, struct mdb_arena *arena)
+{
+    gchar *left_table = NULL;
+    gchar *right_table = NULL;
+
+    gchar *dot;
+
+    dot = g_strstr_len(join->on_left, strlen(join->on_left), ".");
+    left_table = g_strndup(join->on_left, dot - join->on_left);
+    
+    dot = g_strstr_len(join->on_right, strlen(join->on_right), ".");
+    right_table = g_strndup(join->on_right, dot - join->on_right);
+
+    GHashTable *left_schema = cached_schema(left_table);
+    GHashTable *right_schema = cached_schema(right_table);
+    // g_print("right_schema: %s\n", right_schema_path);
+
+    struct mdb_col left_col;
+    read_mdb_col(left_table, join->on_left, left_schema, entry_path, &left_col);
+
+    struct mdb_tbl_scanner *right = NULL;
+    init_scan_table(&right, join->tbl_name);
+
+    gchar *ret = NULL;
+
+    const gchar *right_col_name = &dot[1];
+    scan_prefetch_col(right, right_col_name);
+
+    while (scan_table(right)) {
+        struct mdb_col right_col;
+        read_mdb_col(right_table, right_col_name, right_schema, right->entry_path, &right_col);
+
+        /* NULL never joins */
+        gboolean matched = !left_col.stale && !right_col.stale && !left_col.null && !right_col.null &&
+            0 == mdb_col_cmp(&left_col, &right_col);
+
+        mdb_col_clear(&right_col);
+
+        if (matched) {
+            ret = arena ? mdb_arena_strdup(arena, right->entry_path) : g_strdup(right->entry_path);
+            break;
+        }
+    }
+
+    mdb_col_clear(&left_col);
+    final_scan_table(&right);
+
+    g_free(left_table);
+    g_free(right_table);
+
+    return ret;
+}
+
+void init_scan_table(struct mdb_tbl_scanner **scan, gchar *table)
+{
+    if (NULL != *scan) {
+        fprintf(stderr, "error: init_scan_table called on already initialized scanner\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *scan = g_malloc0(sizeof(struct mdb_tbl_scanner));
+
+    (*scan)->table = g_strdup(table);
+    (*scan)->bucket.fd = -1;
+    (*scan)->ahead = g_ptr_array_new();
+    (*scan)->prefetch_cols = g_ptr_array_new_with_free_func(g_free);
+    (*scan)->reqs = g_ptr_array_new();
+    (*scan)->misses = g_ptr_array_new();
+    (*scan)->arena = mdb_arena_new();
+    (*scan)->staged = txn_staged_rows(table);
+
+    /* Partitions are opened one after another by scan_next_partition() */
+    /* An LSM table is scanned by roid, as of one refresh */
+    struct mdb_lsm_view *view = lsm_view(table);
+    if (view) {
+        lsm_refresh(view);
+        (*scan)->lsm_roids = lsm_live_roids(view);
+        (*scan)->rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+        (*scan)->rows.fd = -1;
+        return;
+    }
+
+    (*scan)->partition_col = table_partition_col(table);
+    if ((*scan)->partition_col) {
+        (*scan)->partitions = load_partitions(table, (*scan)->partition_col);
+        (*scan)->rows.fd = -1;
+        return;
+    }
+
+    (*scan)->rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "rows", NULL);
+
+    if (!mdb_dir_open_at(&(*scan)->rows, AT_FDCWD, (*scan)->rows_path)) {
+        fprintf(stderr, "error: table: %s: does not exist: %s\n", table, (*scan)->rows_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void final_scan_table(struct mdb_tbl_scanner **scan)
+{
+    forget_prefetched(*scan);
+
+    mdb_dir_close(&(*scan)->bucket);
+    mdb_dir_close(&(*scan)->rows);
+
+    if ((*scan)->partitions) {
+        g_ptr_array_free((*scan)->partitions, TRUE);
+    }
+    if ((*scan)->lsm_roids) {
+        g_array_free((*scan)->lsm_roids, TRUE);
+    }
+    if ((*scan)->staged) {
+        g_ptr_array_free((*scan)->staged, TRUE);
+    }
+    g_free((*scan)->partition_col);
+    g_ptr_array_free((*scan)->ahead, TRUE);
+    g_ptr_array_free((*scan)->prefetch_cols, TRUE);
+    g_ptr_array_free((*scan)->reqs, TRUE);
+    g_ptr_array_free((*scan)->misses, TRUE);
+    mdb_arena_free((*scan)->arena);
+    g_free((*scan)->table);
+    g_free((*scan)->rows_path);
+    g_free((*scan)->bucket_name);
+    g_free(*scan);
+
+    *scan = NULL;
+}
+
+/*
+ * Read the column files of the scan's table from its next rows
+ */
+
+void scan_prefetch_expr(struct mdb_tbl_scanner *scan, struct mdb_expr *expr)
+{
+    if (NULL == expr) {
+        return;
+    }
+
+    if (MDB_EXPR_COLUMN == expr->kind) {
+        if ((NULL == expr->table || 0 == g_strcmp0(expr->table, scan->table)) &&
+            g_hash_table_lookup(cached_schema(scan->table), expr->col)
+        ) {
+            scan_prefetch_col(scan, expr->col);
+        }
+
+        return;
+    }
+
+    /* v2 answers IS NULL from the bitmap */
+    if (MDB_EXPR_IS_NULL == expr->kind && table_version(scan->table) >= 2 &&
+        MDB_EXPR_COLUMN == ((struct mdb_expr *) g_ptr_array_index(expr->args, 0))->kind
+    ) {
+        return;
+    }
+
+    for (guint i = 0; i < expr->args->len; ++i) {
+        scan_prefetch_expr(scan, g_ptr_array_index(expr->args, i));
+    }
+}
+
+/*
+ * bucket/entry of the next row on disk, NULL after the last.  It's in
+ * scan->arena, which is reset for every batch.
+ */
+
+gchar * next_scan_entry(struct mdb_tbl_scanner *scan)
+{
+    if (scan->lsm_roids) {
+        if (scan->lsm_pos >= scan->lsm_roids->len) {
+            return(NULL);
+        }
+
+        gchar roid[24];
+        g_snprintf(roid, sizeof(roid), "%li", g_array_index(scan->lsm_roids, gint64, scan->lsm_pos++));
+
+        return(mdb_arena_strconcat(scan->arena, "lsm", "/", roid, NULL));
+    }
+
+    if (-1 == scan->rows.fd) {
+        return(NULL);
+    }
+
+    for (;;) {
+        /* 
+         * Remeber, a bucket can have multiple entries (rows)
+         */
+
+        if (-1 == scan->bucket.fd) {
+            const gchar *bucket = mdb_dir_read(&scan->rows);
+
+            if (NULL == bucket) {
+                return(NULL);
+            }
+
+            if (!mdb_dir_open_at(&scan->bucket, scan->rows.fd, bucket)) {
+                continue;
+            }
+
+            g_free(scan->bucket_name);
+            scan->bucket_name = g_strdup(bucket);
+        }
+
+        const gchar *entry = mdb_dir_read(&scan->bucket);
+        if (NULL == entry) {
+            mdb_dir_close(&scan->bucket);
+            continue;
+        }
+
+        /* Without a prefetch, open the row now to check it's still there */
+        if (0 == scan->prefetch_cols->len) {
+            struct mdb_arena_mark mark = mdb_arena_mark(scan->arena);
+            gchar *entry_path = mdb_arena_strconcat(scan->arena, scan->rows_path, "/", scan->bucket_name, "/", entry, NULL);
+
+            if (!g_hash_table_contains(entry_fds(), entry_path)) {
+                int fd = openat(scan->bucket.fd, entry, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+                /* could have been deleted */
+                if (-1 == fd) {
+                    mdb_arena_reset(scan->arena, mark);
+                    continue;
+                }
+
+                ++mdb_counters()->files_opened;
+
+                remember_entry_fd(entry_path, fd);
+            }
+
+            mdb_arena_reset(scan->arena, mark);
+        }
+
+        return(mdb_arena_strconcat(scan->arena, scan->bucket_name, "/", entry, NULL));
+    }
+}
+
+/*
+ * Move a partitioned scan on to the rows of its next unpruned partition
+ */
+
+gboolean scan_next_partition(struct mdb_tbl_scanner *scan)
+{
+    if (NULL == scan->partitions) {
+        return(FALSE);
+    }
+
+    mdb_dir_close(&scan->bucket);
+    mdb_dir_close(&scan->rows);
+
+    while (scan->partition_pos < scan->partitions->len) {
+        struct mdb_partition *part = g_ptr_array_index(scan->partitions, scan->partition_pos++);
+
+        if (part->pruned) {
+            continue;
+        }
+
+        g_free(scan->rows_path);
+        scan->rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", scan->table, "/", "partitions", "/", part->name, "/", "rows", NULL);
+
+        /* could have been dropped */
+        if (mdb_dir_open_at(&scan->rows, AT_FDCWD, scan->rows_path)) {
+            return(TRUE);
+        }
+    }
+
+    return(FALSE);
+}
+
+/*
+ * Skip the partitions whose range can't satisfy where
+ */
+
+void scan_prune_partitions(struct mdb_tbl_scanner *scan, struct mdb_expr *where)
+{
+    if (NULL == scan->partitions) {
+        return;
+    }
+
+    const struct mdb_col *lo = NULL;
+
+    for (guint i = 0; i < scan->partitions->len; ++i) {
+        struct mdb_partition *part = g_ptr_array_index(scan->partitions, i);
+
+        part->pruned = !partition_may_match(where, scan->table, scan->partition_col, lo, part);
+        lo = &part->bound;
+    }
+}
+
+/*
+ * One row at a time: entry (the row directory's name), entry_rel
+ * (bucket/entry, relative to rows.fd) and entry_path describe the current
+ * row until the next call.  FALSE after the last row.  They live in
+ * scan->arena, so copy them to keep them.
+ */
+
+gboolean scan_table(struct mdb_tbl_scanner *scan)
+{
+    struct mdb_arena_mark empty = { 0, 0 };
+
+    scan->entry_path = NULL;
+    scan->entry_rel = NULL;
+    scan->entry = NULL;
+
+    if (scan->rows_done) {
+        return(scan_staged_row(scan));
+    }
+
+    for (;;) {
+        if (scan->ahead_pos >= scan->ahead->len) {
+            guint want = scan->prefetch_cols->len ? MDB_PREFETCH_ROWS : 1;
+            gchar *rel;
+
+            forget_prefetched(scan);
+            g_ptr_array_set_size(scan->ahead, 0);
+            scan->ahead_pos = 0;
+            mdb_arena_reset(scan->arena, empty);
+
+            while (scan->ahead->len < want && (rel = next_scan_entry(scan))) {
+                g_ptr_array_add(scan->ahead, rel);
+            }
+
+            if (0 == scan->ahead->len) {
+                if (scan_next_partition(scan)) {
+                    continue;
+                }
+
+                scan->rows_done = TRUE;
+
+                return(scan_staged_row(scan));
+            }
+
+            if (scan->prefetch_cols->len) {
+                prefetch_rows(scan);
+            }
+        }
+
+        const gchar *rel = g_ptr_array_index(scan->ahead, scan->ahead_pos++);
+
+        /* could have been deleted */
+        if (NULL == rel) {
+            continue;
+        }
+
+        scan->entry_rel = rel;
+        scan->entry_path = mdb_arena_strconcat(scan->arena, scan->rows_path, "/", rel, NULL);
+        scan->entry = strrchr(rel, '/') + 1;
+
+        ++mdb_counters()->rows_scanned;
+
+        return(TRUE);
+    }
+}
+
+/*
+ * After the table's rows, the ones this process's transaction has
+ * inserted so far.  They have no roid yet, and entry_rel is only the
+ * staged name.
+ */
+
+gboolean scan_staged_row(struct mdb_tbl_scanner *scan)
+{
+    struct mdb_arena_mark empty = { 0, 0 };
+
+    while (scan->staged && scan->staged_pos < scan->staged->len) {
+        const gchar *staged = g_ptr_array_index(scan->staged, scan->staged_pos++);
+
+        /* Deleted by the transaction since */
+        if (-1 == access(staged, F_OK)) {
+            continue;
+        }
+
+        mdb_arena_reset(scan->arena, empty);
+
+        scan->entry_path = mdb_arena_strdup(scan->arena, staged);
+        scan->entry = strrchr(scan->entry_path, '/') + 1;
+        scan->entry_rel = scan->entry;
+
+        ++mdb_counters()->rows_scanned;
+
+        return(TRUE);
+    }
+
+    return(FALSE);
+}
+
+/*
+ * With an arena the paths are allocated from it, and the table frees
+ * nothing of them
+ */
+
+GHashTable * included_in_join(gchar *entry_path, GSList *joins, struct mdb_arena *arena)
+{
+    if (NULL == joins) {
+        return(NULL);
+    }
+
+    // gchar *ret = NULL;
+    GHashTable *paths = arena ? g_hash_table_new(g_str_hash, g_str_equal) : g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    for (GSList *iter = joins; iter; iter = iter->next) {
+        struct ddl_join *join = iter->data;
+        gchar *ret;
+
+        if ((ret = sequential_scan(join, entry_path, arena))) {
+            // g_print("\t%s ON [%s]=[%s] [%s]\n", join->tbl_name, join->on_left, join->on_right, ret);
+            // g_print("paths: %s: %s [%s]\n", join->tbl_name, ret, entry_path);
+            g_hash_table_insert(paths, arena ? join->tbl_name : g_strdup(join->tbl_name), ret);
+        }
+    }
+
+    return(paths);
+}
+
+/*
+ * Expressions
+ *
+ * WHERE clauses, SET values and SELECT columns are compiled once per
+ * statement into a tree of struct mdb_expr and evaluated per row to a
+ * struct mdb_col.  Precedence, lowest first: OR, AND, NOT, comparisons
+ * and IS [NOT] NULL, ||, + and -, * / and %, unary minus.
+ */
+
+static const struct {
+    const gchar *name;
+    guint min_args;
+    guint max_args;
+} mdb_functions[] = {
+    { "lower", 1, 1 },
+    { "upper", 1, 1 },
+    { "length", 1, 1 },
+    { "abs", 1, 1 },
+    { "round", 1, 1 },
+    { "substr", 2, 3 },
+    { "coalesce", 1, G_MAXUINT },
+};
+
+struct mdb_expr * mdb_expr_new(MdbExprKind kind)
+{
+    struct mdb_expr *expr = g_malloc0(sizeof(struct mdb_expr));
+
+    expr->kind = kind;
+    expr->args = g_ptr_array_new_with_free_func((GDestroyNotify) mdb_expr_free);
+
+    return(expr);
+}
+
+void mdb_expr_free(struct mdb_expr *expr)
+{
+    if (NULL == expr) {
+        return;
+    }
+
+    g_free(expr->value.v_text);
+    g_free(expr->table);
+    g_free(expr->col);
+    g_free(expr->func);
+    g_ptr_array_free(expr->args, TRUE);
+    g_free(expr);
+}
+
+struct mdb_expr * mdb_expr_binary(MdbExprOp op, struct mdb_expr *left, struct mdb_expr *right)
+{
+    struct mdb_expr *expr = mdb_expr_new(MDB_EXPR_BINARY);
+
+    expr->op = op;
+    g_ptr_array_add(expr->args, left);
+    g_ptr_array_add(expr->args, right);
+
+    return(expr);
+}
+
+/*
+ * The statement lexer, for SELECT, INSERT, UPDATE, DELETE and the
+ * expressions in them.  The parsers copy out only what they keep.
+ */
+
+void mdb_lex_init(struct mdb_lexer *lex, const gchar *text, const gchar *input_name)
+{
+    lex->text = text;
+    lex->input_name = input_name;
+    lex->pos = text;
+    lex->end = text;
+
+    lex_scan(lex);
+}
+
+gboolean lex_is_ident_char(guchar c, gboolean first)
+{
+    return(g_ascii_isalpha(c) || '_' == c || c >= 0x80 || (!first && (g_ascii_isdigit(c) || '.' == c)));
+}
+
+void lex_scan(struct mdb_lexer *lex)
+{
+    struct mdb_token *token = &lex->next;
+    const gchar *p = lex->pos;
+
+    for (;;) {
+        while (g_ascii_isspace(*p)) {
+            ++p;
+        }
+
+        if ('-' == p[0] && '-' == p[1]) {
+            while ('\0' != *p && '\n' != *p) {
+                ++p;
+            }
+        }
+        else if ('/' == p[0] && '*' == p[1]) {
+            const gchar *close = strstr(&p[2], "*/");
+
+            if (NULL == close) {
+                token->start = p;
+                lex_syntax_error(lex, "*/");
+            }
+            p = &close[2];
+        }
+        else {
+            break;
+        }
+    }
+
+    token->start = p;
+    token->v_int = 0;
+    token->v_float = 0;
+
+    if ('\0' == *p) {
+        token->kind = MDB_TOKEN_EOF;
+    }
+    else if (lex_is_ident_char(*p, TRUE)) {
+        token->kind = MDB_TOKEN_IDENTIFIER;
+        while (lex_is_ident_char(*p, FALSE)) {
+            ++p;
+        }
+    }
+    else if (g_ascii_isdigit(p[0]) || ('.' == p[0] && g_ascii_isdigit(p[1]))) {
+        token->kind = MDB_TOKEN_INT;
+        while (g_ascii_isdigit(*p)) {
+            ++p;
+        }
+
+        if ('.' == *p) {
+            token->kind = MDB_TOKEN_FLOAT;
+            for (++p; g_ascii_isdigit(*p); ++p);
+        }
+
+        if (('e' == p[0] || 'E' == p[0]) &&
+            (g_ascii_isdigit(p[1]) || (('+' == p[1] || '-' == p[1]) && g_ascii_isdigit(p[2])))
+        ) {
+            token->kind = MDB_TOKEN_FLOAT;
+            for (p += 2; g_ascii_isdigit(*p); ++p);
+        }
+
+        if (MDB_TOKEN_FLOAT == token->kind) {
+            token->v_float = g_ascii_strtod(token->start, NULL);
+        }
+        else {
+            errno = 0;
+            token->v_int = g_ascii_strtoll(token->start, NULL, 10);
+
+            /* Past 64 bits, the same error as 'abc' compared with an integer */
+            if (ERANGE == errno) {
+                fprintf(stderr, "error: invalid %s literal: %.*s\n", mdb_col_type_name(MDB_COL_INT64), (int) (p - token->start), token->start);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    else if ('\'' == *p || '"' == *p) {
+        /* 'it''s' or "it's", the second with \ escapes */
+        gchar quote = *p++;
+
+        for (;;) {
+            if ('\0' == *p) {
+                lex_syntax_error(lex, "a closing quote");
+            }
+            else if ('"' == quote && '\\' == p[0] && '\0' != p[1]) {
+                p += 2;
+            }
+            else if (quote == p[0] && '\'' == quote && '\'' == p[1]) {
+                p += 2;
+            }
+            else if (quote == *p++) {
+                break;
+            }
+        }
+
+        token->kind = MDB_TOKEN_STRING;
+    }
+    else {
+        static const gchar *pairs[] = { "<=", ">=", "<>", "!=", "||" };
+
+        token->kind = MDB_TOKEN_SYMBOL;
+        ++p;
+
+        for (guint i = 0; i < G_N_ELEMENTS(pairs); ++i) {
+            if (pairs[i][0] == p[-1] && pairs[i][1] == p[0]) {
+                ++p;
+                break;
+            }
+        }
+    }
+
+    token->len = p - token->start;
+    lex->pos = p;
+}
+
+/* The next token, moving on past it */
+struct mdb_token lex_take(struct mdb_lexer *lex)
+{
+    struct mdb_token token = lex->next;
+
+    lex->end = &token.start[token.len];
+    lex_scan(lex);
+
+    return(token);
+}
+
+void lex_syntax_error(struct mdb_lexer *lex, const gchar *expected)
+{
+    fprintf(stderr, "error: %s: expected %s at position %u\n", lex->input_name, expected, (guint) (lex->next.start - lex->text) + 1);
+    exit(EXIT_FAILURE);
+}
+
+gboolean lex_is_keyword(struct mdb_lexer *lex, const gchar *word)
+{
+    return(MDB_TOKEN_IDENTIFIER == lex->next.kind && strlen(word) == lex->next.len &&
+        0 == g_ascii_strncasecmp(word, lex->next.start, lex->next.len));
+}
+
+gboolean lex_is_symbol(struct mdb_lexer *lex, const gchar *symbol)
+{
+    return(MDB_TOKEN_SYMBOL == lex->next.kind && strlen(symbol) == lex->next.len &&
+        0 == strncmp(symbol, lex->next.start, lex->next.len));
+}
+
+gboolean lex_accept_keyword(struct mdb_lexer *lex, const gchar *word)
+{
+    if (!lex_is_keyword(lex, word)) {
+        return(FALSE);
+    }
+
+    lex_take(lex);
+
+    return(TRUE);
+}
+
+gboolean lex_accept_symbol(struct mdb_lexer *lex, const gchar *symbol)
+{
+    if (!lex_is_symbol(lex, symbol)) {
+        return(FALSE);
+    }
+
+    lex_take(lex);
+
+    return(TRUE);
+}
+
+void lex_expect_keyword(struct mdb_lexer *lex, const gchar *word)
+{
+    if (!lex_accept_keyword(lex, word)) {
+        lex_syntax_error(lex, word);
+    }
+}
+
+void lex_expect_symbol(struct mdb_lexer *lex, const gchar *symbol)
+{
+    if (!lex_accept_symbol(lex, symbol)) {
+        lex_syntax_error(lex, symbol);
+    }
+}
+
+struct mdb_token lex_expect(struct mdb_lexer *lex, MdbTokenKind kind, const gchar *expected)
+{
+    if (kind != lex->next.kind) {
+        lex_syntax_error(lex, expected);
+    }
+
+    return(lex_take(lex));
+}
+
+/* Any number of ; and nothing after them: one statement at a time */
+void lex_expect_end(struct mdb_lexer *lex)
+{
+    gboolean ended = FALSE;
+
+    while (lex_accept_symbol(lex, ";")) {
+        ended = TRUE;
+    }
+
+    if (MDB_TOKEN_EOF == lex->next.kind) {
+        return;
+    }
+
+    if (ended) {
+        fprintf(stderr, "error: %s: one statement only, another starts at position %u (give --sql once for each)\n", lex->input_name, (guint) (lex->next.start - lex->text) + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    lex_syntax_error(lex, "end of statement");
+}
+
+gchar * lex_token_text(const struct mdb_token *token)
+{
+    return(g_strndup(token->start, token->len));
+}
+
+/* A string the way text values are kept: in single quotes, unescaped */
+gchar * lex_string_literal(const struct mdb_token *token)
+{
+    const gchar *last = &token->start[token->len - 1];
+    gchar quote = token->start[0];
+
+    /* Mostly the token is already that */
+    if ('\'' == quote && NULL == memchr(&token->start[1], '\'', token->len - 2)) {
+        return(lex_token_text(token));
+    }
+
+    GString *literal = g_string_sized_new(token->len);
+    g_string_append_c(literal, '\'');
+
+    for (const gchar *p = &token->start[1]; p < last; ++p) {
+        if ('\'' == quote && '\'' == *p) {
+            ++p;
+        }
+        else if ('"' == quote && '\\' == *p) {
+            switch (*++p) {
+                case 'n': g_string_append_c(literal, '\n'); continue;
+                case 't': g_string_append_c(literal, '\t'); continue;
+                case 'r': g_string_append_c(literal, '\r'); continue;
+            }
+        }
+
+        g_string_append_c(literal, *p);
+    }
+
+    g_string_append_c(literal, '\'');
+
+    return(g_string_free(literal, FALSE));
+}
+
+/* The statement's text from start to the end of the last token taken */
+gchar * lex_text_from(struct mdb_lexer *lex, const gchar *start)
+{
+    return(g_strndup(start, lex->end - start));
+}
+
+gboolean expr_peek_keyword(GScanner *scanner, const gchar *word)
+{
+    return(G_TOKEN_IDENTIFIER == g_scanner_peek_next_token(scanner) &&
+        0 == g_ascii_strcasecmp(word, scanner->next_value.v_identifier));
+}
+
+void expr_need_operand(struct mdb_lexer *lex)
+{
+    if (MDB_TOKEN_EOF == lex->next.kind || lex_is_symbol(lex, ")") || lex_is_symbol(lex, ";") ||
+        lex_is_keyword(lex, "AND") || lex_is_keyword(lex, "OR")
+    ) {
+        fprintf(stderr, "error: Incomplete AND or OR expression\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+struct mdb_expr * expr_parse_or(struct mdb_lexer *lex)
+{
+    struct mdb_expr *left = expr_parse_and(lex);
+
+    while (lex_accept_keyword(lex, "OR")) {
+        expr_need_operand(lex);
+        left = mdb_expr_binary(MDB_OP_OR, left, expr_parse_and(lex));
+    }
+
+    return(left);
+}
+
+struct mdb_expr * expr_parse_and(struct mdb_lexer *lex)
+{
+    struct mdb_expr *left = expr_parse_not(lex);
+
+    while (lex_accept_keyword(lex, "AND")) {
+        expr_need_operand(lex);
+        left = mdb_expr_binary(MDB_OP_AND, left, expr_parse_not(lex));
+    }
+
+    return(left);
+}
+
+struct mdb_expr * expr_parse_not(struct mdb_lexer *lex)
+{
+    if (lex_accept_keyword(lex, "NOT")) {
+        struct mdb_expr *expr = mdb_expr_new(MDB_EXPR_NOT);
+        g_ptr_array_add(expr->args, expr_parse_not(lex));
+
+        return(expr);
+    }
+
+    return(expr_parse_cmp(lex));
+}
+
+struct mdb_expr * expr_parse_cmp(struct mdb_lexer *lex)
+{
+    struct mdb_expr *left = expr_parse_concat(lex);
+    MdbExprOp op;
+
+    if (lex_accept_keyword(lex, "IS")) {
+        struct mdb_expr *expr = mdb_expr_new(MDB_EXPR_IS_NULL);
+        g_ptr_array_add(expr->args, left);
+
+        expr->not_null = lex_accept_keyword(lex, "NOT");
+        lex_expect_keyword(lex, "NULL");
+
+        return(expr);
+    }
+
+    if (lex_accept_symbol(lex, "=")) {
+        op = MDB_OP_EQ;
+    }
+    else if (lex_accept_symbol(lex, "!=") || lex_accept_symbol(lex, "<>")) {
+        op = MDB_OP_NE;
+    }
+    else if (lex_accept_symbol(lex, "<=")) {
+        op = MDB_OP_LE;
+    }
+    else if (lex_accept_symbol(lex, ">=")) {
+        op = MDB_OP_GE;
+    }
+    else if (lex_accept_symbol(lex, "<")) {
+        op = MDB_OP_LT;
+    }
+    else if (lex_accept_symbol(lex, ">")) {
+        op = MDB_OP_GT;
+    }
+    else {
+        return(left);
+    }
+
+    return(mdb_expr_binary(op, left, expr_parse_concat(lex)));
+}
+
+struct mdb_expr * expr_parse_concat(struct mdb_lexer *lex)
+{
+    struct mdb_expr *left = expr_parse_add(lex);
+
+    while (lex_accept_symbol(lex, "||")) {
+        left = mdb_expr_binary(MDB_OP_CONCAT, left, expr_parse_add(lex));
+    }
+
+    return(left);
+}
+
+struct mdb_expr * expr_parse_add(struct mdb_lexer *lex)
+{
+    struct mdb_expr *left = expr_parse_mul(lex);
+
+    for (;;) {
+        MdbExprOp op;
+
+        if (lex_accept_symbol(lex, "+")) {
+            op = MDB_OP_ADD;
+        }
+        else if (lex_accept_symbol(lex, "-")) {
+            op = MDB_OP_SUB;
+        }
+        else {
+            return(left);
+        }
+
+        left = mdb_expr_binary(op, left, expr_parse_mul(lex));
+    }
+}
+
+struct mdb_expr * expr_parse_mul(struct mdb_lexer *lex)
+{
+    struct mdb_expr *left = expr_parse_unary(lex);
+
+    for (;;) {
+        MdbExprOp op;
+
+        if (lex_accept_symbol(lex, "*")) {
+            op = MDB_OP_MUL;
+        }
+        else if (lex_accept_symbol(lex, "/")) {
+            op = MDB_OP_DIV;
+        }
+        else if (lex_accept_symbol(lex, "%")) {
+            op = MDB_OP_MOD;
+        }
+        else {
+            return(left);
+        }
+
+        left = mdb_expr_binary(op, left, expr_parse_unary(lex));
+    }
+}
+
+struct mdb_expr * expr_parse_unary(struct mdb_lexer *lex)
+{
+    if (lex_accept_symbol(lex, "-")) {
+        struct mdb_expr *expr = mdb_expr_new(MDB_EXPR_NEGATE);
+        g_ptr_array_add(expr->args, expr_parse_unary(lex));
+
+        return(expr);
+    }
+
+    if (lex_accept_symbol(lex, "+")) {
+        return(expr_parse_unary(lex));
+    }
+
+    return(expr_parse_primary(lex));
+}
+
+struct mdb_expr * expr_parse_primary(struct mdb_lexer *lex)
+{
+    struct mdb_expr *expr = NULL;
+
+    if (lex_accept_symbol(lex, "(")) {
+        expr = expr_parse_or(lex);
+        lex_expect_symbol(lex, ")");
+
+        return(expr);
+    }
+
+    if (lex_accept_keyword(lex, "NULL")) {
+        expr = mdb_expr_new(MDB_EXPR_LITERAL);
+        expr->value.null = TRUE;
+
+        return(expr);
+    }
+
+    if (lex_is_keyword(lex, "TRUE") || lex_is_keyword(lex, "FALSE")) {
+        expr = mdb_expr_new(MDB_EXPR_LITERAL);
+        expr->value.col_type = MDB_COL_BOOLEAN;
+        expr->value.v_bool = lex_is_keyword(lex, "TRUE");
+        lex_take(lex);
+
+        return(expr);
+    }
+
+    struct mdb_token token = lex->next;
+
+    switch (token.kind) {
+        case MDB_TOKEN_INT:
+            expr = mdb_expr_new(MDB_EXPR_LITERAL);
+            expr->value.col_type = MDB_COL_INT64;
+            expr->value.v_int64 = token.v_int;
+        break;
+
+        case MDB_TOKEN_FLOAT:
+            expr = mdb_expr_new(MDB_EXPR_LITERAL);
+            expr->value.col_type = MDB_COL_DOUBLE;
+            expr->value.v_double = token.v_float;
+        break;
+
+        case MDB_TOKEN_STRING:
+            expr = mdb_expr_new(MDB_EXPR_LITERAL);
+            expr->value.col_type = MDB_COL_TEXT;
+            expr->value.v_text = lex_string_literal(&token);
+        break;
+
+        case MDB_TOKEN_IDENTIFIER:
+            lex_take(lex);
+
+            if (lex_accept_symbol(lex, "(")) {
+                expr = mdb_expr_new(MDB_EXPR_FUNCTION);
+                expr->func = g_ascii_strdown(token.start, token.len);
+
+                if (!lex_is_symbol(lex, ")")) {
+                    do {
+                        g_ptr_array_add(expr->args, expr_parse_or(lex));
+                    } while (lex_accept_symbol(lex, ","));
+                }
+                lex_expect_symbol(lex, ")");
+
+                expr_check_function(expr);
+            }
+            else {
+                /* col or table.col */
+                const gchar *dot = memchr(token.start, '.', token.len);
+
+                expr = mdb_expr_new(MDB_EXPR_COLUMN);
+                if (dot) {
+                    expr->table = g_strndup(token.start, dot - token.start);
+                    expr->col = g_strndup(&dot[1], &token.start[token.len] - &dot[1]);
+                }
+                else {
+                    expr->col = lex_token_text(&token);
+                }
+            }
+        return(expr);
+
+        default:
+            lex_syntax_error(lex, "a value, column or (");
+        break;
+    }
+
+    lex_take(lex);
+
+    return(expr);
+}
+
+void expr_check_function(struct mdb_expr *expr)
+{
+    for (guint i = 0; i < G_N_ELEMENTS(mdb_functions); ++i) {
+        if (0 == g_strcmp0(mdb_functions[i].name, expr->func)) {
+            if (expr->args->len < mdb_functions[i].min_args || expr->args->len > mdb_functions[i].max_args) {
+                fprintf(stderr, "error: expression: %s(): wrong number of arguments: %u\n", expr->func, expr->args->len);
+                exit(EXIT_FAILURE);
+            }
+
+            return;
+        }
+    }
+
+    fprintf(stderr, "error: expression: %s(): unknown function\n", expr->func);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Every column must belong to a table of the statement and exist in its
+ * schema; a column without a table may be in any of them
+ */
+
+void mdb_expr_check_columns(struct mdb_expr *expr, GSList *tables, const gchar *stmt)
+{
+    if (MDB_EXPR_COLUMN == expr->kind && expr->table) {
+        if (NULL == g_slist_find_custom(tables, expr->table, (GCompareFunc) g_strcmp0)) {
+            fprintf(stderr, "error: table [%s] not in %s statement\n", expr->table, stmt);
+            exit(EXIT_FAILURE);
+        }
+
+        if (NULL == g_hash_table_lookup(cached_schema(expr->table), expr->col)) {
+            fprintf(stderr, "error: schema: [%s]::[%s]: not found\n", expr->table, expr->col);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (MDB_EXPR_COLUMN == expr->kind) {
+        GSList *table = tables;
+
+        while (table && NULL == g_hash_table_lookup(cached_schema(table->data), expr->col)) {
+            table = table->next;
+        }
+
+        if (NULL == table) {
+            fprintf(stderr, "error: schema: [%s]::[%s]: not found\n", (gchar *) tables->data, expr->col);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (guint i = 0; i < expr->args->len; ++i) {
+        mdb_expr_check_columns(g_ptr_array_index(expr->args, i), tables, stmt);
+    }
+}
+
+gboolean mdb_expr_is_constant(struct mdb_expr *expr)
+{
+    if (MDB_EXPR_COLUMN == expr->kind) {
+        return(FALSE);
+    }
+
+    for (guint i = 0; i < expr->args->len; ++i) {
+        if (!mdb_expr_is_constant(g_ptr_array_index(expr->args, i))) {
+            return(FALSE);
+        }
+    }
+
+    return(TRUE);
+}
+
+const gchar * mdb_col_type_name(MdbColumnType col_type)
+{
+    switch (col_type) {
+        case MDB_COL_TEXT:      return("text");
+        case MDB_COL_INT64:     return("integer");
+        case MDB_COL_DOUBLE:    return("double");
+        case MDB_COL_BOOLEAN:   return("boolean");
+        case MDB_COL_TIMESTAMP: return("timestamp");
+    }
+
+    return("unknown");
+}
+
+void mdb_col_clear(struct mdb_col *mdb_col)
+{
+    g_free(mdb_col->v_text);
+    mdb_col->v_text = NULL;
+}
+
+void mdb_col_set_null(struct mdb_col *mdb_col)
+{
+    memset(mdb_col, 0, sizeof(struct mdb_col));
+    mdb_col->null = TRUE;
+}
+
+void mdb_col_set_bool(struct mdb_col *mdb_col, gboolean v)
+{
+    memset(mdb_col, 0, sizeof(struct mdb_col));
+    mdb_col->col_type = MDB_COL_BOOLEAN;
+    mdb_col->v_bool = v;
+}
+
+gboolean mdb_col_truth(const struct mdb_col *mdb_col)
+{
+    if (mdb_col->null || mdb_col->stale) {
+        return(FALSE);
+    }
+
+    switch (mdb_col->col_type) {
+        case MDB_COL_BOOLEAN:   return(mdb_col->v_bool);
+        case MDB_COL_INT64:     return(0 != mdb_col->v_int64);
+        case MDB_COL_DOUBLE:    return(0 != mdb_col->v_double);
+        default:                return(FALSE);
+    }
+}
+
+/*
+ * The value without SQL quoting, for || and the string functions
+ */
+
+gchar * mdb_col_to_plain(const struct mdb_col *mdb_col)
+{
+    if (MDB_COL_TEXT == mdb_col->col_type && !mdb_col->null) {
+        const gchar *start;
+        gsize len;
+
+        unquoted_span(mdb_col->v_text, &start, &len);
+        return(g_strndup(start, len));
+    }
+
+    if (MDB_COL_TIMESTAMP == mdb_col->col_type && !mdb_col->null) {
+        return(mdb_format_timestamp(mdb_col->v_int64));
+    }
+
+    return(mdb_col_to_string(mdb_col));
+}
+
+void mdb_col_set_plain(struct mdb_col *mdb_col, gchar *plain)
+{
+    memset(mdb_col, 0, sizeof(struct mdb_col));
+    mdb_col->col_type = MDB_COL_TEXT;
+    mdb_col->v_text = g_strconcat("'", plain, "'", NULL);
+    g_free(plain);
+}
+
+/*
+ * Convert a value to a column's type, the way a literal for that column
+ * would be read
+ */
+
+gboolean mdb_col_cast(struct mdb_col *mdb_col, MdbColumnType col_type)
+{
+    if (mdb_col->null || col_type == mdb_col->col_type) {
+        mdb_col->col_type = col_type;
+        return(TRUE);
+    }
+
+    if (MDB_COL_DOUBLE == col_type && MDB_COL_INT64 == mdb_col->col_type) {
+        mdb_col->v_double = mdb_col->v_int64;
+        mdb_col->col_type = col_type;
+        return(TRUE);
+    }
+
+    if (MDB_COL_INT64 == col_type && MDB_COL_DOUBLE == mdb_col->col_type) {
+        gdouble v = mdb_col->v_double;
+        mdb_col->v_int64 = (gint64) (v < 0 ? v - 0.5 : v + 0.5);
+        mdb_col->col_type = col_type;
+        return(TRUE);
+    }
+
+    struct mdb_col cast;
+    gchar *text = MDB_COL_TEXT == col_type ? NULL : mdb_col_to_string(mdb_col);
+
+    if (MDB_COL_TEXT == col_type) {
+        mdb_col_set_plain(&cast, mdb_col_to_plain(mdb_col));
+    }
+    else if (!mdb_col_from_literal(col_type, text, &cast)) {
+        g_free(text);
+        return(FALSE);
+    }
+
+    g_free(text);
+    g_free(mdb_col->v_text);
+    *mdb_col = cast;
+
+    return(TRUE);
+}
+
+void expr_eval_column(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out)
+{
+    const gchar *table = expr->table ? expr->table : ctx->table;
+
+    if (ctx->override && 0 == g_strcmp0(table, ctx->table) && 0 == g_strcmp0(expr->col, ctx->override_col)) {
+        *out = *ctx->override;
+        out->v_text = g_strdup(ctx->override->v_text);
+        return;
+    }
+
+    const gchar *entry_path = g_hash_table_lookup(ctx->paths, table);
+    if (NULL == entry_path) {
+        ctx->stale = TRUE;
+        mdb_col_set_null(out);
+        out->stale = TRUE;
+        return;
+    }
+
+    if (ctx->pending) {
+        gchar *path = g_strconcat(entry_path, "/", expr->col, NULL);
+        struct mdb_col *pending = g_hash_table_lookup(ctx->pending, path);
+
+        g_free(path);
+
+        if (pending) {
+            *out = *pending;
+            out->v_text = g_strdup(pending->v_text);
+            return;
+        }
+    }
+
+    read_mdb_col((gchar *) table, expr->col, cached_schema(table), entry_path, out);
+
+    if (out->stale) {
+        ctx->stale = TRUE;
+    }
+}
+
+void expr_eval_is_null(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out)
+{
+    struct mdb_expr *arg = g_ptr_array_index(expr->args, 0);
+
+    /* A v2 column answers from its null bitmap without reading the value */
+    if (MDB_EXPR_COLUMN == arg->kind) {
+        const gchar *table = arg->table ? arg->table : ctx->table;
+        const gchar *entry_path = g_hash_table_lookup(ctx->paths, table);
+        gboolean overridden = ctx->override && 0 == g_strcmp0(table, ctx->table) && 0 == g_strcmp0(arg->col, ctx->override_col);
+
+        /* A transaction's own SETs and rows aren't in the bitmap yet */
+        if (entry_path && !overridden && !ctx->pending && table_version(table) >= 2 && !lsm_view(table) && !txn_staged_row(entry_path)) {
+            mdb_col_set_bool(out, is_null_bit(table, arg->col, entry_roid(entry_path)) != expr->not_null);
+
+            /* Gone meanwhile, as reading the value would have found */
+            if (!mdb_row_exists(table, entry_path)) {
+                ctx->stale = TRUE;
+                out->stale = TRUE;
+            }
+            return;
+        }
+    }
+
+    struct mdb_col v;
+    mdb_expr_eval(arg, ctx, &v);
+    mdb_col_set_bool(out, v.null != expr->not_null);
+    mdb_col_clear(&v);
+}
+
+/*
+ * Text compared with a typed value is read as that type, '2014-10-06'
+ * as a timestamp say.  A literal that can't be is an error; a text
+ * column that can't be is compared as text.
+ */
+
+gint expr_compare(struct mdb_expr *expr, struct mdb_col *a, struct mdb_col *b)
+{
+    if (a->col_type != b->col_type && (MDB_COL_TEXT == a->col_type || MDB_COL_TEXT == b->col_type)) {
+        gboolean a_text = MDB_COL_TEXT == a->col_type;
+        struct mdb_col *text = a_text ? a : b;
+        struct mdb_col *typed = a_text ? b : a;
+        struct mdb_expr *text_expr = g_ptr_array_index(expr->args, a_text ? 0 : 1);
+
+        if (!mdb_col_cast(text, typed->col_type) && MDB_EXPR_LITERAL == text_expr->kind) {
+            fprintf(stderr, "error: invalid %s literal: %s\n", mdb_col_type_name(typed->col_type), text->v_text);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return(mdb_col_cmp(a, b));
+}
+
+void expr_arith(MdbExprOp op, struct mdb_col *a, struct mdb_col *b, struct mdb_col *out)
+{
+    gboolean a_number = MDB_COL_INT64 == a->col_type || MDB_COL_DOUBLE == a->col_type;
+    gboolean b_number = MDB_COL_INT64 == b->col_type || MDB_COL_DOUBLE == b->col_type;
+
+    if (!a_number || !b_number) {
+        gchar *v = mdb_col_to_string(a_number ? b : a);
+        fprintf(stderr, "error: expression: not a number: %s\n", v);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(out, 0, sizeof(struct mdb_col));
+
+    if (MDB_COL_INT64 == a->col_type && MDB_COL_INT64 == b->col_type) {
+        out->col_type = MDB_COL_INT64;
+
+        if ((MDB_OP_DIV == op || MDB_OP_MOD == op) && 0 == b->v_int64) {
+            fprintf(stderr, "error: expression: division by zero\n");
+            exit(EXIT_FAILURE);
+        }
+
+        switch (op) {
+            case MDB_OP_ADD: out->v_int64 = a->v_int64 + b->v_int64; break;
+            case MDB_OP_SUB: out->v_int64 = a->v_int64 - b->v_int64; break;
+            case MDB_OP_MUL: out->v_int64 = a->v_int64 * b->v_int64; break;
+            case MDB_OP_DIV: out->v_int64 = a->v_int64 / b->v_int64; break;
+            case MDB_OP_MOD: out->v_int64 = a->v_int64 % b->v_int64; break;
+            default: break;
+        }
+
+        return;
+    }
+
+    gdouble x = MDB_COL_DOUBLE == a->col_type ? a->v_double : (gdouble) a->v_int64;
+    gdouble y = MDB_COL_DOUBLE == b->col_type ? b->v_double : (gdouble) b->v_int64;
+
+    out->col_type = MDB_COL_DOUBLE;
+
+    switch (op) {
+        case MDB_OP_ADD: out->v_double = x + y; break;
+        case MDB_OP_SUB: out->v_double = x - y; break;
+        case MDB_OP_MUL: out->v_double = x * y; break;
+        case MDB_OP_DIV:
+            if (0 == y) {
+                fprintf(stderr, "error: expression: division by zero\n");
+                exit(EXIT_FAILURE);
+            }
+            out->v_double = x / y;
+        break;
+        case MDB_OP_MOD:
+            fprintf(stderr, "error: expression: %% needs integers\n");
+            exit(EXIT_FAILURE);
+        default: break;
+    }
+}
+
+void expr_eval_binary(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out)
+{
+    struct mdb_col a, b;
+
+    mdb_expr_eval(g_ptr_array_index(expr->args, 0), ctx, &a);
+
+    /* AND and OR are three valued and stop early */
+    if (MDB_OP_AND == expr->op || MDB_OP_OR == expr->op) {
+        gboolean is_and = MDB_OP_AND == expr->op;
+
+        if (!a.null && mdb_col_truth(&a) != is_and) {
+            mdb_col_set_bool(out, !is_and);
+            mdb_col_clear(&a);
+            return;
+        }
+
+        mdb_expr_eval(g_ptr_array_index(expr->args, 1), ctx, &b);
+
+        if (!b.null && mdb_col_truth(&b) != is_and) {
+            mdb_col_set_bool(out, !is_and);
+        }
+        else if (a.null || b.null) {
+            mdb_col_set_null(out);
+        }
+        else {
+            mdb_col_set_bool(out, is_and);
+        }
+
+        mdb_col_clear(&a);
+        mdb_col_clear(&b);
+        return;
+    }
+
+    mdb_expr_eval(g_ptr_array_index(expr->args, 1), ctx, &b);
+
+    if (a.null || b.null) {
+        mdb_col_set_null(out);
+    }
+    else {
+        switch (expr->op) {
+            case MDB_OP_EQ: mdb_col_set_bool(out, 0 == expr_compare(expr, &a, &b)); break;
+            case MDB_OP_NE: mdb_col_set_bool(out, 0 != expr_compare(expr, &a, &b)); break;
+            case MDB_OP_LT: mdb_col_set_bool(out, 0 > expr_compare(expr, &a, &b)); break;
+            case MDB_OP_LE: mdb_col_set_bool(out, 0 >= expr_compare(expr, &a, &b)); break;
+            case MDB_OP_GT: mdb_col_set_bool(out, 0 < expr_compare(expr, &a, &b)); break;
+            case MDB_OP_GE: mdb_col_set_bool(out, 0 <= expr_compare(expr, &a, &b)); break;
+
+            case MDB_OP_CONCAT:
+                {
+                    gchar *x = mdb_col_to_plain(&a);
+                    gchar *y = mdb_col_to_plain(&b);
+
+                    mdb_col_set_plain(out, g_strconcat(x, y, NULL));
+                    g_free(x);
+                    g_free(y);
+                }
+            break;
+
+            default:
+                expr_arith(expr->op, &a, &b, out);
+            break;
+        }
+    }
+
+    mdb_col_clear(&a);
+    mdb_col_clear(&b);
+}
+
+void expr_eval_function(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out)
+{
+    struct mdb_col v;
+
+    if (0 == g_strcmp0("coalesce", expr->func)) {
+        for (guint i = 0; i < expr->args->len; ++i) {
+            mdb_expr_eval(g_ptr_array_index(expr->args, i), ctx, out);
+            if (!out->null) {
+                return;
+            }
+            mdb_col_clear(out);
+        }
+
+        mdb_col_set_null(out);
+        return;
+    }
+
+    mdb_expr_eval(g_ptr_array_index(expr->args, 0), ctx, &v);
+
+    if (v.null) {
+        mdb_col_set_null(out);
+        mdb_col_clear(&v);
+        return;
+    }
+
+    if (0 == g_strcmp0("lower", expr->func) || 0 == g_strcmp0("upper", expr->func)) {
+        gchar *plain = mdb_col_to_plain(&v);
+
+        mdb_col_set_plain(out, 'l' == expr->func[0] ? g_utf8_strdown(plain, -1) : g_utf8_strup(plain, -1));
+        g_free(plain);
+    }
+    else if (0 == g_strcmp0("length", expr->func)) {
+        gchar *plain = mdb_col_to_plain(&v);
+
+        memset(out, 0, sizeof(struct mdb_col));
+        out->col_type = MDB_COL_INT64;
+        out->v_int64 = g_utf8_strlen(plain, -1);
+        g_free(plain);
+    }
+    else if (0 == g_strcmp0("substr", expr->func)) {
+        gchar *plain = mdb_col_to_plain(&v);
+        glong len = g_utf8_strlen(plain, -1);
+        struct mdb_col start, count;
+
+        mdb_expr_eval(g_ptr_array_index(expr->args, 1), ctx, &start);
+        if (3 == expr->args->len) {
+            mdb_expr_eval(g_ptr_array_index(expr->args, 2), ctx, &count);
+        }
+        else {
+            memset(&count, 0, sizeof(count));
+            count.col_type = MDB_COL_INT64;
+            count.v_int64 = len;
+        }
+
+        if (start.null || count.null) {
+            mdb_col_set_null(out);
+        }
+        else if (!mdb_col_cast(&start, MDB_COL_INT64) || !mdb_col_cast(&count, MDB_COL_INT64)) {
+            fprintf(stderr, "error: expression: substr(): positions must be integers\n");
+            exit(EXIT_FAILURE);
+        }
+        else {
+            /* 1 based, like SQL */
+            glong from = CLAMP(start.v_int64 - 1, 0, len);
+            glong to = CLAMP(start.v_int64 - 1 + count.v_int64, from, len);
+
+            mdb_col_set_plain(out, g_utf8_substring(plain, from, to));
+        }
+
+        mdb_col_clear(&start);
+        mdb_col_clear(&count);
+        g_free(plain);
+    }
+    else {
+        /* abs and round */
+        struct mdb_col zero = { .col_type = MDB_COL_INT64 };
+
+        *out = v;
+        v.v_text = NULL;
+
+        if (MDB_COL_INT64 != out->col_type && MDB_COL_DOUBLE != out->col_type) {
+            expr_arith(MDB_OP_ADD, out, &zero, out);
+        }
+
+        if (0 == g_strcmp0("abs", expr->func)) {
+            out->v_int64 = out->v_int64 < 0 ? -out->v_int64 : out->v_int64;
+            out->v_double = out->v_double < 0 ? -out->v_double : out->v_double;
+        }
+        else if (MDB_COL_DOUBLE == out->col_type) {
+            gdouble d = out->v_double;
+            out->v_double = (gdouble) (gint64) (d < 0 ? d - 0.5 : d + 0.5);
+        }
+    }
+
+    mdb_col_clear(&v);
+}
+
+/*
+ * The caller owns out and frees it with mdb_col_clear()
+ */
+
+void mdb_expr_eval(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out)
+{
+    switch (expr->kind) {
+        case MDB_EXPR_LITERAL:
+            *out = expr->value;
+            out->v_text = g_strdup(expr->value.v_text);
+        break;
+
+        case MDB_EXPR_COLUMN:
+            expr_eval_column(expr, ctx, out);
+        break;
+
+        case MDB_EXPR_NEGATE:
+            {
+                struct mdb_col zero = { .col_type = MDB_COL_INT64 };
+                struct mdb_col v;
+
+                mdb_expr_eval(g_ptr_array_index(expr->args, 0), ctx, &v);
+                if (v.null) {
+                    *out = v;
+                }
+                else {
+                    expr_arith(MDB_OP_SUB, &zero, &v, out);
+                    mdb_col_clear(&v);
+                }
+            }
+        break;
+
+        case MDB_EXPR_NOT:
+            {
+                struct mdb_col v;
+
+                mdb_expr_eval(g_ptr_array_index(expr->args, 0), ctx, &v);
+                if (v.null) {
+                    mdb_col_set_null(out);
+                }
+                else {
+                    mdb_col_set_bool(out, !mdb_col_truth(&v));
+                }
+                mdb_col_clear(&v);
+            }
+        break;
+
+        case MDB_EXPR_IS_NULL:
+            expr_eval_is_null(expr, ctx, out);
+        break;
+
+        case MDB_EXPR_BINARY:
+            expr_eval_binary(expr, ctx, out);
+        break;
+
+        case MDB_EXPR_FUNCTION:
+            expr_eval_function(expr, ctx, out);
+        break;
+    }
+}
+
+/*
+ * A row is in when the WHERE is true and every column it read was there
+ */
+
+gboolean row_matches(struct mdb_expr *where, GHashTable *paths, const gchar *table)
+{
+    if (NULL == where) {
+        return(TRUE);
+    }
+
+    struct mdb_row_ctx ctx = { .paths = paths, .table = table };
+    struct mdb_col result;
+
+    mdb_expr_eval(where, &ctx, &result);
+
+    gboolean ret = !ctx.stale && mdb_col_truth(&result);
+    mdb_col_clear(&result);
+
+    return(ret);
+}
+
+/*
+ * WHERE expression, up to the end of the statement
+ */
+
+void parse_where(struct mdb_lexer *lex, struct ddl_parsed *ddl)
+{
+    const gchar *start = lex->next.start;
+
+    ddl->where_expr = expr_parse_or(lex);
+    ddl->where = lex_text_from(lex, start);
+}
+
+/*
+ * The parsed WHERE, handed to the caller once its columns are checked;
+ * NULL when there is no WHERE
+ */
+
+struct mdb_expr * compile_where(struct ddl_parsed *ddl, GSList *tables, const gchar *stmt)
+{
+    struct mdb_expr *where = ddl->where_expr;
+
+    if (NULL == where) {
+        return(NULL);
+    }
+
+    ddl->where_expr = NULL;
+    mdb_expr_check_columns(where, tables, stmt);
+
+    return(where);
+}
+
+/*
+ * DELETE FROM site_key WHERE id = 3;
+ */
+
+struct ddl_parsed parse_delete(const gchar *text)
+{
+    struct mdb_lexer lex;
+    struct ddl_parsed ddl_delete = { NULL };
+
+    mdb_lex_init(&lex, text, "DELETE");
+    lex_expect_keyword(&lex, "DELETE");
+    lex_expect_keyword(&lex, "FROM");
+
+    struct mdb_token table = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a table name");
+    ddl_delete.tables = g_slist_append(NULL, lex_token_text(&table));
+
+    if (lex_accept_keyword(&lex, "WHERE")) {
+        parse_where(&lex, &ddl_delete);
+    }
+
+    lex_expect_end(&lex);
+
+    return(ddl_delete);
+}
+
+void execute_ddl_delete(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    struct mdb_explain ex;
+    struct ddl_parsed ddl_delete = parse_delete(parse_explain(sql, &ex));
+
+    mdb_refuse_replica("DELETE");
+    mdb_quiesce_enter();
+
+    GSList *table = NULL;
+    GSList *purgatory = NULL;
+
+    // g_print("WHERE [DELETE]: %s\n", ddl_delete.where);
+
+    /* Delete the rows */
+    table = ddl_delete.tables;
+
+    struct mdb_expr *where = compile_where(&ddl_delete, ddl_delete.tables, "DELETE");
+
+    mdb_refuse_view(table->data, "DELETE");
+
+    /* In a transaction the rows are only noted; COMMIT removes them */
+    struct mdb_txn_op *op = NULL;
+    if (mdb_txn()->active) {
+        op = mdb_txn_op_new(MDB_TXN_DELETE, table->data);
+    }
+
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, NULL);
+    gboolean optimistic = load_table_optimistic(table_path);
+    g_free(table_path);
+
+    struct mdb_tbl_scanner *scan = NULL;
+    init_scan_table(&scan, table->data);
+    scan_prefetch_expr(scan, where);
+    scan_prune_partitions(scan, where);
+
+    /* Per process, so concurrent DELETEs don't remove each other's */
+    gchar *purgatory_path = g_strdup_printf("%s/%s.%d", MULTIDB_PURGATORYDIR, (gchar *) table->data, getpid());
+    int purgatory_fd = -1;
+
+    struct mdb_arena *arena = mdb_stmt_arena();
+    mdb_stmt_begin();
+    struct mdb_arena_mark row = mdb_arena_mark(arena);
+    GHashTable *paths = g_hash_table_new(g_str_hash, g_str_equal);
+    struct mdb_op_probe probe;
+
+    /* EXPLAIN alone only plans */
+    while (MDB_EXPLAIN_PLAN != ex.mode) {
+        op_probe_start(&ex, &probe);
+        gboolean more = scan_table(scan);
+        op_probe_stop(&ex, &probe, &ex.scan, more);
+
+        if (!more) {
+            break;
+        }
+
+        mdb_arena_reset(arena, row);
+        g_hash_table_insert(paths, table->data, (gpointer) scan->entry_path);
+
+        op_probe_start(&ex, &probe);
+        gboolean matched = row_matches(where, paths, table->data);
+        op_probe_stop(&ex, &probe, &ex.filter, matched);
+
+        if (!matched) {
+            continue;
+        }
+
+        op_probe_start(&ex, &probe);
+
+        struct mdb_txn_op *insert = op ? txn_staged_op(scan->entry_path) : NULL;
+
+        if (insert) {
+            txn_delete_staged(insert);
+        }
+        else if (op) {
+            op->entries = g_slist_prepend(op->entries, g_strdup(scan->entry_path));
+        }
+
+        if (op) {
+            op_probe_stop(&ex, &probe, &ex.output, TRUE);
+            continue;
+        }
+
+        /* Not while someone is updating it */
+        gboolean locked = TRUE;
+        gboolean claimed = optimistic ? occ_matching_row(scan, where, paths, NULL, NULL, &locked) : lock_matching_row(scan, where, paths);
+
+        if (!claimed) {
+            op_probe_stop(&ex, &probe, &ex.output, FALSE);
+            continue;
+        }
+
+        /* Only read for someone who wants the row as it was */
+        gboolean logged = mdb_change_wanted(table->data);
+        GHashTable *before = logged && mdb_change_wants_before(table->data) ? mdb_change_cols_new() : NULL;
+
+        if (before) {
+            mdb_change_read_row(before, table->data, scan->entry_path);
+        }
+
+        /* An LSM row goes with a tombstone */
+        if (lsm_view(table->data)) {
+            lsm_append(table->data, MDB_LSM_DELETE, entry_roid(scan->entry_path), NULL);
+        }
+        else {
+            if (-1 == purgatory_fd) {
+                if (0 != g_mkdir_with_parents(purgatory_path, 0775)) {
+                    fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", purgatory_path, g_strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+
+                purgatory_fd = open(purgatory_path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                if (-1 == purgatory_fd) {
+                    fprintf(stderr, "error: open(%s): %s\n", purgatory_path, g_strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            if (-1 == renameat(scan->rows.fd, scan->entry_rel, purgatory_fd, scan->entry)) {
+                fprintf(stderr, "error: renameat: %s -> %s: %s\n", scan->entry_path, purgatory_path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            purgatory = g_slist_prepend(purgatory, g_strdup(scan->entry));
+        }
+
+        if (logged) {
+            mdb_change_log("DELETE", table->data, entry_roid(scan->entry_path), before, NULL);
+        }
+        if (before) {
+            g_hash_table_destroy(before);
+        }
+
+        if (locked) {
+            row_unlock(table->data, entry_roid(scan->entry_path));
+        }
+        else {
+            row_version_release(table->data, entry_roid(scan->entry_path));
+        }
+
+        op_probe_stop(&ex, &probe, &ex.output, TRUE);
+    }
+
+    g_hash_table_destroy(paths);
+
+    /* 
+     * Remove the files of each row, then the rows
+     */
+
+    GHashTable *schema = cached_schema(table->data);
+
+    op_probe_start(&ex, &probe);
+
+    for (GSList *iterator = purgatory; iterator; iterator = iterator->next) {
+        int entry_fd = openat(purgatory_fd, iterator->data, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (-1 == entry_fd) {
+            fprintf(stderr, "error: open: %s/%s: %s\n", purgatory_path, (gchar *) iterator->data, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        GHashTableIter cols;
+        gpointer col;
+
+        g_hash_table_iter_init(&cols, schema);
+        while (g_hash_table_iter_next(&cols, &col, NULL)) {
+            if (-1 == unlinkat(entry_fd, col, 0) && ENOENT != errno) {
+                fprintf(stderr, "error: unlink: %s/%s/%s: %s\n", purgatory_path, (gchar *) iterator->data, col, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        close(entry_fd);
+
+        if (-1 == unlinkat(purgatory_fd, iterator->data, AT_REMOVEDIR)) {
+            fprintf(stderr, "error: rmdir: %s/%s: %s\n", purgatory_path, (gchar *) iterator->data, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        ++mdb_counters()->purgatory_reclaimed;
+    }
+
+    if (-1 != purgatory_fd) {
+        close(purgatory_fd);
+
+        if (0 != g_remove(purgatory_path)) {
+            fprintf(stderr, "error: g_remove: %s: %s\n", purgatory_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    op_probe_stop(&ex, &probe, &ex.output, FALSE);
+
+    if (MDB_EXPLAIN_NONE != ex.mode) {
+        guint depth = 0;
+
+        print_explain_op(&ex, depth++, &ex.output, "Delete", table->data);
+        if (where) {
+            print_explain_op(&ex, depth++, &ex.filter, "Filter", ddl_delete.where);
+        }
+        print_explain_scan(&ex, depth, scan);
+        print_explain_total(&ex);
+    }
+
+    final_scan_table(&scan);
+
+    /* COMMIT looks at the rows again */
+    if (op) {
+        op->entries = g_slist_reverse(op->entries);
+        op->where = where;
+        where = NULL;
+    }
+
+    g_free(purgatory_path);
+    g_slist_free_full(purgatory, g_free);
+    mdb_expr_free(where);
+    free_ddl_parsed(&ddl_delete);
+
+    mdb_quiesce_leave();
+
+    mdb_stats_statement(MDB_STMT_DELETE, started_us);
+}
+
+/*
+ * UPDATE site_key SET id = 4 WHERE id = 3;
+ */
+
+struct ddl_parsed parse_update(const gchar *text)
+{
+    struct mdb_lexer lex;
+    struct ddl_parsed ddl_update = { NULL };
+
+    mdb_lex_init(&lex, text, "UPDATE");
+    lex_expect_keyword(&lex, "UPDATE");
+
+    struct mdb_token table = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a table name");
+    ddl_update.tables = g_slist_append(NULL, lex_token_text(&table));
+
+    lex_expect_keyword(&lex, "SET");
+
+    /* cols[i] = values[i], the value's text beside its expression */
+    ddl_update.exprs = g_ptr_array_new_with_free_func((GDestroyNotify) mdb_expr_free);
+    do {
+        struct mdb_token col = lex_expect(&lex, MDB_TOKEN_IDENTIFIER, "a column name");
+
+        lex_expect_symbol(&lex, "=");
+
+        const gchar *start = lex.next.start;
+        g_ptr_array_add(ddl_update.exprs, expr_parse_or(&lex));
+
+        ddl_update.cols = g_slist_append(ddl_update.cols, lex_token_text(&col));
+        ddl_update.values = g_slist_append(ddl_update.values, lex_text_from(&lex, start));
+    } while (lex_accept_symbol(&lex, ","));
+
+    /* No WHERE: every row */
+    if (lex_accept_keyword(&lex, "WHERE")) {
+        parse_where(&lex, &ddl_update);
+    }
+
+    lex_expect_end(&lex);
+
+    return(ddl_update);
+}
+
+void execute_ddl_update(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    struct mdb_explain ex;
+    struct ddl_parsed ddl_update = parse_update(parse_explain(sql, &ex));
+
+    mdb_refuse_replica("UPDATE");
+    mdb_quiesce_enter();
+
+    GSList *table = NULL;
+
+    // g_print("WHERE [UPDATE]: %s\n", ddl_update.where);
+    /*
+    for (GSList *iterator = ddl_update.cols; iterator; iterator = iterator->next) {
+        g_print("\t%s\n", iterator->data);
+    }
+    */
+
+    /* Update the rows */
+    table = ddl_update.tables;
+
+    struct mdb_expr *where = compile_where(&ddl_update, ddl_update.tables, "UPDATE");
+
+    mdb_refuse_view(table->data, "UPDATE");
+
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, NULL);
+    MdbCodec codec = load_table_codec(table_path);
+    gboolean optimistic = load_table_optimistic(table_path);
+    g_free(table_path);
+
+    /* The SET list is parsed and checked once, before touching any row */
+    GSList *sets = compile_set_list(table->data, &ddl_update);
+
+    /* Rows don't move between partitions */
+    gchar *partition_col = table_partition_col(table->data);
+    for (GSList *iterator = sets; iterator && partition_col; iterator = iterator->next) {
+        if (0 == g_strcmp0(partition_col, ((struct mdb_set *) iterator->data)->col)) {
+            fprintf(stderr, "error: [%s]::[%s]: partition key can't be updated\n", (gchar *) table->data, partition_col);
+            exit(EXIT_FAILURE);
+        }
+    }
+    g_free(partition_col);
+
+    /* In a transaction the rows are only noted; COMMIT sets them */
+    struct mdb_txn_op *op = NULL;
+    if (mdb_txn()->active) {
+        op = mdb_txn_op_new(MDB_TXN_UPDATE, table->data);
+        op->codec = codec;
+        op->sets = sets;
+    }
+
+    struct mdb_tbl_scanner *scan = NULL;
+    init_scan_table(&scan, table->data);
+
+    /* SET reads its rows itself, under the lock where it matters */
+    scan_prefetch_expr(scan, where);
+    scan_prune_partitions(scan, where);
+
+    struct mdb_arena *arena = mdb_stmt_arena();
+    mdb_stmt_begin();
+    struct mdb_arena_mark row = mdb_arena_mark(arena);
+    GHashTable *paths = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, mdb_col_destroy);
+    struct mdb_op_probe probe;
+
+    /* EXPLAIN alone only plans */
+    while (MDB_EXPLAIN_PLAN != ex.mode) {
+        op_probe_start(&ex, &probe);
+        gboolean more = scan_table(scan);
+        op_probe_stop(&ex, &probe, &ex.scan, more);
+
+        if (!more) {
+            break;
+        }
+
+        mdb_arena_reset(arena, row);
+        g_hash_table_insert(paths, table->data, (gpointer) scan->entry_path);
+
+        op_probe_start(&ex, &probe);
+        gboolean matched = row_matches(where, paths, table->data);
+        op_probe_stop(&ex, &probe, &ex.filter, matched);
+
+        struct mdb_txn_op *insert = matched && op ? txn_staged_op(scan->entry_path) : NULL;
+
+        if (insert) {
+            compute_sets(table->data, paths, sets, values);
+            txn_update_staged(insert, sets, values, codec);
+        }
+        else if (matched && op) {
+            op->entries = g_slist_prepend(op->entries, g_strdup(scan->entry_path));
+        }
+        else if (matched) {
+            op_probe_start(&ex, &probe);
+
+            /* The whole row claimed, so concurrent SETs of it queue up or retry */
+            gboolean locked = TRUE;
+            gboolean claimed;
+
+            if (optimistic) {
+                claimed = occ_matching_row(scan, where, paths, sets, values, &locked);
+            }
+            else if ((claimed = lock_matching_row(scan, where, paths))) {
+                compute_sets(table->data, paths, sets, values);
+            }
+
+            if (claimed) {
+                write_sets(table->data, scan->entry_path, sets, values, codec);
+
+                if (locked) {
+                    row_unlock(table->data, entry_roid(scan->entry_path));
+                }
+                else {
+                    row_version_release(table->data, entry_roid(scan->entry_path));
+                }
+            }
+
+            op_probe_stop(&ex, &probe, &ex.output, claimed);
+        }
+    }
+
+    g_hash_table_destroy(values);
+    g_hash_table_destroy(paths);
+
+    if (MDB_EXPLAIN_NONE != ex.mode) {
+        guint depth = 0;
+        GString *detail = g_string_new(NULL);
+
+        g_string_append_printf(detail, "%s SET ", (gchar *) table->data);
+        for (GSList *col = ddl_update.cols, *value = ddl_update.values; col && value; col = col->next, value = value->next) {
+            g_string_append_printf(detail, "%s%s = %s", col == ddl_update.cols ? "" : ", ", (gchar *) col->data, (gchar *) value->data);
+        }
+
+        print_explain_op(&ex, depth++, &ex.output, "Update", detail->str);
+        if (where) {
+            print_explain_op(&ex, depth++, &ex.filter, "Filter", ddl_update.where);
+        }
+        print_explain_scan(&ex, depth, scan);
+        print_explain_total(&ex);
+
+        g_string_free(detail, TRUE);
+    }
+
+    final_scan_table(&scan);
+
+    if (op) {
+        op->entries = g_slist_reverse(op->entries);
+        op->where = where;
+        where = NULL;
+    }
+    else {
+        g_slist_free_full(sets, (GDestroyNotify) free_mdb_set);
+    }
+    mdb_expr_free(where);
+    free_ddl_parsed(&ddl_update);
+
+    mdb_quiesce_leave();
+
+    mdb_stats_statement(MDB_STMT_UPDATE, started_us);
+}
+
+/*
+ * SET col = expression.  A value that doesn't depend on the row is
+ * computed and checked once; anything else is evaluated per row.
+ */
+
+GSList * compile_set_list(const gchar *table, struct ddl_parsed *ddl_update)
+{
+    GHashTable *schema = cached_schema(table);
+    gint version = table_version(table);
+    GSList *tables = g_slist_append(NULL, (gpointer) table);
+    GSList *sets = NULL;
+    GSList *col = ddl_update->cols;
+    GSList *value = ddl_update->values;
+
+    for (guint i = 0; i < ddl_update->exprs->len; ++i, col = col->next, value = value->next) {
+        struct mdb_set *set = g_malloc0(sizeof(struct mdb_set));
+
+        const gchar *type = g_hash_table_lookup(schema, col->data);
+        if (NULL == type) {
+            fprintf(stderr, "error: schema: [%s]::[%s]: not found\n", table, (gchar *) col->data);
+            exit(EXIT_FAILURE);
+        }
+
+        set->col = g_strdup(col->data);
+        set->rhs = g_strdup(value->data);
+        set->col_type = MDB_COL_TEXT;
+        set->fixed = FALSE;
+
+        if (version >= 2) {
+            mdb_col_type_from_name(type, &set->col_type);
+            set->fixed = MDB_COL_TEXT != set->col_type;
+        }
+
+        /* The set owns the parsed expression from here on */
+        set->expr = g_ptr_array_index(ddl_update->exprs, i);
+        ddl_update->exprs->pdata[i] = NULL;
+
+        mdb_expr_check_columns(set->expr, tables, "UPDATE");
+        set->constant = mdb_expr_is_constant(set->expr);
+
+        if (set->constant) {
+            struct mdb_row_ctx ctx = { .table = table };
+
+            mdb_expr_eval(set->expr, &ctx, &set->value);
+            set_value_literal(table, set, &set->value);
+
+            if (set->fixed) {
+                set->encoded = g_byte_array_new();
+                encode_mdb_col(&set->value, set->encoded);
+            }
+        }
+
+        sets = g_slist_append(sets, set);
+    }
+
+    g_slist_free(tables);
+
+    return(sets);
+}
+
+void free_mdb_set(struct mdb_set *set)
+{
+    g_free(set->col);
+    g_free(set->rhs);
+    g_free(set->literal);
+    g_free(set->value.v_text);
+    mdb_expr_free(set->expr);
+    if (set->encoded) {
+        g_byte_array_free(set->encoded, TRUE);
+    }
+    g_free(set);
+}
+
+/*
+ * Give a SET value the column's type and keep its literal form for the
+ * text writers; v1 columns take the value as it prints
+ */
+
+void set_value_literal(const gchar *table, struct mdb_set *set, struct mdb_col *value)
+{
+    if (table_version(table) >= 2 && !mdb_col_cast(value, set->col_type)) {
+        gchar *v = mdb_col_to_string(value);
+        fprintf(stderr, "error: [%s]::[%s]: invalid value: %s\n", table, set->col, v);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(set->literal);
+    set->literal = mdb_col_to_string(value);
+}
+
+/*
+ * Every SET of a row is worked out before any is written.  A SET sees
+ * the values of those before it, as if each had been written in turn.
+ * values maps a column file to its new value.
+ */
+
+void compute_sets(const gchar *table, GHashTable *paths, GSList *sets, GHashTable *values)
+{
+    const gchar *entry_path = g_hash_table_lookup(paths, table);
+    struct mdb_row_ctx ctx = { .paths = paths, .table = table, .pending = values };
+
+    g_hash_table_remove_all(values);
+
+    for (GSList *iterator = sets; iterator; iterator = iterator->next) {
+        struct mdb_set *set = iterator->data;
+        struct mdb_col *value = g_new(struct mdb_col, 1);
+
+        if (set->constant) {
+            *value = set->value;
+            value->v_text = g_strdup(set->value.v_text);
+        }
+        else {
+            mdb_expr_eval(set->expr, &ctx, value);
+            set_value_literal(table, set, value);
+        }
+
+        g_hash_table_insert(values, g_strconcat(entry_path, "/", set->col, NULL), value);
+    }
+}
+
+/*
+ * The caller has claimed the row, so nobody writes it in between the
+ * reads of compute_sets() and these writes.  Fixed width values are
+ * patched in place; text is written next to the old value and renamed
+ * over it.  The change is logged before the caller lets go of the row.
+ */
+
+void write_sets(const gchar *table, const gchar *entry_path, GSList *sets, GHashTable *values, MdbCodec codec)
+{
+    /* The old values are read only for someone who wants them */
+    GHashTable *after = mdb_change_wanted(table) ? mdb_change_cols_new() : NULL;
+    GHashTable *before = after && mdb_change_wants_before(table) ? mdb_change_cols_new() : NULL;
+
+    for (GSList *iterator = sets; iterator && after; iterator = iterator->next) {
+        struct mdb_set *set = iterator->data;
+        gchar *path = g_strconcat(entry_path, "/", set->col, NULL);
+
+        mdb_change_read(before, table, entry_path, set->col);
+        mdb_change_add(after, set->col, g_hash_table_lookup(values, path));
+
+        g_free(path);
+    }
+
+    if (lsm_view(table)) {
+        lsm_write_sets(table, entry_path, values);
+    }
+
+    for (GSList *iterator = sets; iterator && !lsm_view(table); iterator = iterator->next) {
+        struct mdb_set *set = iterator->data;
+        /* UPDATE resets the statement arena for every row */
+        gchar *path = mdb_arena_strconcat(mdb_stmt_arena(), entry_path, "/", set->col, NULL);
+        struct mdb_col *value = g_hash_table_lookup(values, path);
+
+        if (!set->fixed) {
+            gchar *tmp = g_strdup_printf("%s/.%s.%d", entry_path, set->col, getpid());
+
+            if (-1 == access(path, F_OK)) {
+                fprintf(stderr, "error: table: [%s]::[%s]: not found: %s\n", table, set->col, path);
+                exit(EXIT_FAILURE);
+            }
+
+            if (table_version(table) >= 2) {
+                set_null_bit(table, set->col, entry_roid(entry_path), write_typed_col_file(tmp, set->col_type, set->literal, codec));
+            }
+            else {
+                write_col_file(tmp, set->literal, codec);
+            }
+
+            if (-1 == rename(tmp, path)) {
+                fprintf(stderr, "error: rename(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            g_free(tmp);
+            continue;
+        }
+
+        int at = entry_dir_fd(entry_path);
+        int fd = -1 == at ? -1 : openat(at, set->col, O_WRONLY|O_CLOEXEC);
+        if (-1 == fd) {
+            fprintf(stderr, "error: table: [%s]::[%s]: not found: %s\n", table, set->col, path);
+            exit(EXIT_FAILURE);
+        }
+
+        ++mdb_counters()->files_opened;
+
+        /* A fixed width file is empty when NULL, so a value over a value leaves its NULL bit be */
+        struct stat st;
+        gboolean bit_changes = value->null || -1 == fstat(fd, &st) || 0 == st.st_size;
+
+        if (value->null) {
+            if (-1 == ftruncate(fd, 0)) {
+                fprintf(stderr, "error: ftruncate(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            GByteArray *encoded = set->encoded;
+
+            if (!set->constant) {
+                encoded = g_byte_array_sized_new(sizeof(gint64));
+                encode_mdb_col(value, encoded);
+            }
+
+            if ((ssize_t) encoded->len != pwrite(fd, encoded->data, encoded->len, 0)) {
+                fprintf(stderr, "error: pwrite(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            mdb_counters()->bytes_written += encoded->len;
+
+            if (!set->constant) {
+                g_byte_array_free(encoded, TRUE);
+            }
+        }
+
+        close(fd);
+
+        if (bit_changes) {
+            set_null_bit(table, set->col, entry_roid(entry_path), value->null);
+        }
+    }
+
+    if (after) {
+        mdb_change_log("UPDATE", table, entry_roid(entry_path), before, after);
+        g_hash_table_destroy(after);
+    }
+    if (before) {
+        g_hash_table_destroy(before);
+    }
+}
+
+/*
+ * Run one statement of any kind, BEGIN, COMMIT and ROLLBACK included,
+ * picked by its first word (after EXPLAIN [ANALYZE])
+ */
+
+void execute_sql(gchar *sql)
+{
+    const gchar *p = sql;
+    gchar *word = NULL;
+
+    do {
+        g_free(word);
+
+        while (g_ascii_isspace(*p)) {
+            ++p;
+        }
+
+        const gchar *start = p;
+        while (g_ascii_isalpha(*p)) {
+            ++p;
+        }
+
+        word = g_ascii_strup(start, p - start);
+    } while (0 == g_strcmp0(word, "EXPLAIN") || 0 == g_strcmp0(word, "ANALYZE"));
+
+    if ((0 == g_strcmp0(word, "CREATE") || 0 == g_strcmp0(word, "ALTER") || 0 == g_strcmp0(word, "REFRESH") || 0 == g_strcmp0(word, "COPY")) && mdb_txn()->active) {
+        fprintf(stderr, "error: %s: not allowed in a transaction\n", word);
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == g_strcmp0(word, "BEGIN")) {
+        mdb_begin();
+    }
+    else if (0 == g_strcmp0(word, "COMMIT")) {
+        mdb_commit();
+    }
+    else if (0 == g_strcmp0(word, "ROLLBACK")) {
+        mdb_rollback();
+    }
+    else if (0 == g_strcmp0(word, "CREATE")) {
+        execute_ddl_create(sql);
+    }
+    else if (0 == g_strcmp0(word, "INSERT")) {
+        execute_ddl_insert(sql);
+    }
+    else if (0 == g_strcmp0(word, "SELECT")) {
+        execute_ddl_select(sql);
+    }
+    else if (0 == g_strcmp0(word, "UPDATE")) {
+        execute_ddl_update(sql);
+    }
+    else if (0 == g_strcmp0(word, "DELETE")) {
+        execute_ddl_delete(sql);
+    }
+    else if (0 == g_strcmp0(word, "ALTER")) {
+        execute_ddl_alter(sql);
+    }
+    else if (0 == g_strcmp0(word, "REFRESH")) {
+        execute_refresh_view(sql);
+    }
+    else if (0 == g_strcmp0(word, "COPY")) {
+        execute_copy(sql);
+    }
+    else {
+        fprintf(stderr, "error: unknown statement: %s\n", sql);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(word);
+}
+
+/*
+ * Transactions
+ *
+ * Statements between BEGIN and COMMIT read the tables as committed,
+ * plus the rows the transaction has inserted.  INSERT writes its row
+ * under data/txn/<pid>, where the transaction's UPDATEs and DELETEs
+ * change it at once; of committed rows they note the ones they
+ * matched.  COMMIT takes the lock of each table written once, hands out
+ * the roids and serials, locks the rows it SETs or deletes until it's
+ * done (skipping those the WHERE no longer picks), computes the SET
+ * values and writes a log of what to rename and patch.  One sync makes
+ * the log and everything it names durable; then the log is played,
+ * with SELECTs held off by mdb_commits_exclude().  mdb_txn_recover()
+ * plays the complete logs of processes that died doing that and drops
+ * everything else.
+ */
+
+struct mdb_txn * mdb_txn(void)
+{
+    static struct mdb_txn txn;
+
+    if (NULL == txn.ops) {
+        txn.ops = g_ptr_array_new_with_free_func((GDestroyNotify) free_mdb_txn_op);
+        txn.locked = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        txn.roids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        txn.pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, mdb_col_destroy);
+        txn.dropped = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    return(&txn);
+}
+
+void mdb_begin(void)
+{
+    struct mdb_txn *txn = mdb_txn();
+
+    if (txn->active) {
+        fprintf(stderr, "error: BEGIN: already in a transaction\n");
+        exit(EXIT_FAILURE);
+    }
+
+    txn->path = g_strdup_printf("%s/%d", MULTIDB_TXNDIR, getpid());
+
+    if (0 != g_mkdir_with_parents(txn->path, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", txn->path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    txn->active = TRUE;
+}
+
+void mdb_commit(void)
+{
+    struct mdb_txn *txn = mdb_txn();
+
+    if (!txn->active) {
+        fprintf(stderr, "error: COMMIT: not in a transaction\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == txn->ops->len) {
+        mdb_txn_end(txn);
+        return;
+    }
+
+    mdb_quiesce_enter();
+
+    /* In name order, so two commits can't each hold what the other wants */
+    GHashTable *inserts = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (guint i = 0; i < txn->ops->len; ++i) {
+        struct mdb_txn_op *op = g_ptr_array_index(txn->ops, i);
+        gint count = GPOINTER_TO_INT(g_hash_table_lookup(inserts, op->table));
+
+        g_hash_table_insert(inserts, op->table, GINT_TO_POINTER(MDB_TXN_INSERT == op->kind ? count + 1 : count));
+    }
+
+    GList *tables = g_list_sort(g_hash_table_get_keys(inserts), (GCompareFunc) g_strcmp0);
+
+    for (GList *iterator = tables; iterator; iterator = iterator->next) {
+        gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", iterator->data, NULL);
+        gint count = GPOINTER_TO_INT(g_hash_table_lookup(inserts, iterator->data));
+
+        get_table_lock(table_path);
+        g_hash_table_add(txn->locked, table_path);
+
+        if (count) {
+            g_hash_table_insert(txn->roids, g_strdup(iterator->data), GINT_TO_POINTER(next_roids(table_path, count)));
+        }
+    }
+
+    /* Whoever plays the log after we die can break our locks */
+    txn->log = g_string_new(NULL);
+
+    for (GList *iterator = tables; iterator; iterator = iterator->next) {
+        mdb_txn_log(txn, "lock", iterator->data, NULL);
+    }
+
+    g_list_free(tables);
+    g_hash_table_destroy(inserts);
+
+    for (guint i = 0; i < txn->ops->len; ++i) {
+        struct mdb_txn_op *op = g_ptr_array_index(txn->ops, i);
+
+        if (MDB_TXN_INSERT == op->kind) {
+            txn_resolve_insert(txn, op);
+            continue;
+        }
+
+        for (GSList *entry = op->entries; entry; entry = entry->next) {
+            if (MDB_TXN_DELETE == op->kind) {
+                txn_resolve_delete(txn, op, entry->data);
+                continue;
+            }
+
+            if (!txn_lock_matching_row(txn, op, entry->data)) {
+                continue;
+            }
+
+            GHashTable *after = mdb_change_wanted(op->table) ? mdb_change_cols_new() : NULL;
+            GHashTable *before = after && mdb_change_wants_before(op->table) ? mdb_change_cols_new() : NULL;
+
+            for (GSList *set = op->sets; set; set = set->next) {
+                txn_resolve_set(txn, op, entry->data, set->data, before, after);
+            }
+
+            if (after && g_hash_table_size(after)) {
+                txn_log_change(txn, "UPDATE", op->table, entry_roid(entry->data), before, after);
+            }
+
+            if (after) {
+                g_hash_table_destroy(after);
+            }
+            if (before) {
+                g_hash_table_destroy(before);
+            }
+        }
+    }
+
+    mdb_txn_log(txn, MDB_TXN_LOG_END, NULL);
+
+    /* The one durability point: the log and every file it names */
+    gchar *log_path = g_strconcat(txn->path, "/", "commit", NULL);
+    write_file(log_path, txn->log->str);
+    mdb_sync();
+    g_free(log_path);
+
+    txn->committing = TRUE;
+
+    txn_publish(txn->path, txn->log->str, FALSE);
+
+    mdb_txn_unlock(txn);
+    mdb_txn_end(txn);
+
+    mdb_quiesce_leave();
+}
+
+void mdb_rollback(void)
+{
+    struct mdb_txn *txn = mdb_txn();
+
+    if (!txn->active) {
+        fprintf(stderr, "error: ROLLBACK: not in a transaction\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mdb_txn_end(txn);
+}
+
+void mdb_txn_unlock(struct mdb_txn *txn)
+{
+    GHashTableIter iter;
+    gpointer table_path;
+
+    /* Out of the table first, or free_table_lock() thinks it's still held */
+    g_hash_table_iter_init(&iter, txn->locked);
+    while (g_hash_table_iter_next(&iter, &table_path, NULL)) {
+        g_hash_table_iter_steal(&iter);
+        free_table_lock(table_path);
+        g_free(table_path);
+    }
+}
+
+void mdb_txn_end(struct mdb_txn *txn)
+{
+    if (txn->path && g_file_test(txn->path, G_FILE_TEST_IS_DIR)) {
+        remove_tree(txn->path);
+    }
+
+    row_unlock_all();
+
+    g_ptr_array_set_size(txn->ops, 0);
+    g_hash_table_remove_all(txn->roids);
+    g_hash_table_remove_all(txn->pending);
+    g_hash_table_remove_all(txn->dropped);
+
+    if (txn->log) {
+        g_string_free(txn->log, TRUE);
+        txn->log = NULL;
+    }
+
+    g_free(txn->path);
+    txn->path = NULL;
+    txn->staged = 0;
+    txn->active = FALSE;
+    txn->committing = FALSE;
+}
+
+/*
+ * At exit a transaction that wasn't committed is rolled back; one that
+ * got as far as its synced log is left for mdb_txn_recover()
+ */
+
+void mdb_txn_exit(void)
+{
+    struct mdb_txn *txn = mdb_txn();
+
+    mdb_txn_unlock(txn);
+
+    if (txn->active && !txn->committing) {
+        mdb_txn_end(txn);
+    }
+}
+
+void mdb_txn_recover(void)
+{
+    GDir *dir = dir_open(MULTIDB_TXNDIR);
+    GSList *names = NULL;
+    const gchar *name;
+
+    if (NULL == dir) {
+        return;
+    }
+
+    /* Renaming while reading the directory could show us an entry twice */
+    while ((name = g_dir_read_name(dir))) {
+        names = g_slist_prepend(names, g_strdup(name));
+    }
+
+    g_dir_close(dir);
+
+    for (GSList *iterator = names; iterator; iterator = iterator->next) {
+        /* <pid>, or <pid>.<pid of the process recovering it> */
+        name = iterator->data;
+        const gchar *dot = strrchr(name, '.');
+        pid_t owner = g_ascii_strtoll(dot ? &dot[1] : name, NULL, 10);
+
+        if (owner != getpid() && (0 == kill(owner, 0) || EPERM == errno)) {
+            continue;
+        }
+
+        gchar *path = g_strconcat(MULTIDB_TXNDIR, "/", name, NULL);
+        gchar *claimed = g_strdup_printf("%s/%.*s.%d", MULTIDB_TXNDIR, (int) (dot ? dot - name : strlen(name)), name, getpid());
+
+        /* Whoever renames it first recovers it */
+        if (0 == g_strcmp0(path, claimed) || 0 == rename(path, claimed)) {
+            gchar *log_path = g_strconcat(claimed, "/", "commit", NULL);
+            gchar *log = NULL;
+
+            if (g_file_get_contents(log_path, &log, NULL, NULL) && g_str_has_suffix(log, MDB_TXN_LOG_END "\n")) {
+                mdb_quiesce_enter();
+                txn_publish(claimed, log, TRUE);
+                mdb_quiesce_leave();
+            }
+
+            remove_tree(claimed);
+
+            g_free(log);
+            g_free(log_path);
+        }
+
+        g_free(claimed);
+        g_free(path);
+    }
+
+    g_slist_free_full(names, g_free);
+}
+
+struct mdb_txn_op * mdb_txn_op_new(MdbTxnOpKind kind, const gchar *table)
+{
+    if (lsm_view(table)) {
+        fprintf(stderr, "error: table: %s: lsm tables don't take part in transactions\n", table);
+        exit(EXIT_FAILURE);
+    }
+
+    struct mdb_txn_op *op = g_malloc0(sizeof(struct mdb_txn_op));
+
+    op->kind = kind;
+    op->table = g_strdup(table);
+    op->codec = MDB_CODEC_NONE;
+
+    g_ptr_array_add(mdb_txn()->ops, op);
+
+    return(op);
+}
+
+void free_mdb_txn_op(struct mdb_txn_op *op)
+{
+    g_free(op->table);
+    g_free(op->staged);
+    g_free(op->partition);
+    g_slist_free_full(op->serials, g_free);
+    g_slist_free_full(op->nulls, g_free);
+    g_slist_free_full(op->entries, g_free);
+    g_slist_free_full(op->sets, (GDestroyNotify) free_mdb_set);
+    mdb_expr_free(op->where);
+    if (op->after) {
+        g_hash_table_destroy(op->after);
+    }
+    g_free(op);
+}
+
+gchar * mdb_txn_stage(struct mdb_txn *txn)
+{
+    return(g_strdup_printf("%s/%u", txn->path, ++txn->staged));
+}
+
+/* A row this process's open transaction inserted, not yet published */
+gboolean txn_staged_row(const gchar *entry_path)
+{
+    struct mdb_txn *txn = mdb_txn();
+    gsize len = txn->path ? strlen(txn->path) : 0;
+
+    return(txn->active && !txn->committing && len && 0 == strncmp(entry_path, txn->path, len) && '/' == entry_path[len]);
+}
+
+struct mdb_txn_op * txn_staged_op(const gchar *entry_path)
+{
+    struct mdb_txn *txn = mdb_txn();
+
+    if (!txn_staged_row(entry_path)) {
+        return(NULL);
+    }
+
+    for (guint i = 0; i < txn->ops->len; ++i) {
+        struct mdb_txn_op *op = g_ptr_array_index(txn->ops, i);
+
+        if (MDB_TXN_INSERT == op->kind && 0 == g_strcmp0(op->staged, entry_path)) {
+            return(op);
+        }
+    }
+
+    return(NULL);
+}
+
+/* What a scan of the table adds to its rows; NULL when nothing */
+GPtrArray * txn_staged_rows(const gchar *table)
+{
+    struct mdb_txn *txn = mdb_txn();
+    GPtrArray *rows = NULL;
+
+    for (guint i = 0; txn->active && !txn->committing && i < txn->ops->len; ++i) {
+        struct mdb_txn_op *op = g_ptr_array_index(txn->ops, i);
+
+        if (MDB_TXN_INSERT == op->kind && 0 == g_strcmp0(op->table, table)) {
+            rows = rows ? rows : g_ptr_array_new_with_free_func(g_free);
+            g_ptr_array_add(rows, g_strdup(op->staged));
+        }
+    }
+
+    return(rows);
+}
+
+/*
+ * An UPDATE of a row the transaction inserted.  Nobody else can see it
+ * yet, so its files are written over and the INSERT takes the values;
+ * a serial given a value isn't handed one at COMMIT.
+ */
+
+void txn_update_staged(struct mdb_txn_op *insert, GSList *sets, GHashTable *values, MdbCodec codec)
+{
+    for (GSList *iterator = sets; iterator; iterator = iterator->next) {
+        struct mdb_set *set = iterator->data;
+        gchar *path = g_strconcat(insert->staged, "/", set->col, NULL);
+        GSList *serial = g_slist_find_custom(insert->serials, set->col, (GCompareFunc) g_strcmp0);
+        GSList *null = g_slist_find_custom(insert->nulls, set->col, (GCompareFunc) g_strcmp0);
+        gboolean is_null = FALSE;
+
+        if (table_version(insert->table) >= 2) {
+            is_null = write_typed_col_file(path, set->col_type, set->literal, codec);
+        }
+        else {
+            write_col_file(path, set->literal, codec);
+        }
+
+        if (serial) {
+            g_free(serial->data);
+            insert->serials = g_slist_delete_link(insert->serials, serial);
+        }
+
+        if (is_null && !null) {
+            insert->nulls = g_slist_append(insert->nulls, g_strdup(set->col));
+        }
+        else if (!is_null && null) {
+            g_free(null->data);
+            insert->nulls = g_slist_delete_link(insert->nulls, null);
+        }
+
+        mdb_change_add(insert->after, set->col, g_hash_table_lookup(values, path));
+
+        g_free(path);
+    }
+}
+
+/* A DELETE of a row the transaction inserted: it's as if it never was */
+void txn_delete_staged(struct mdb_txn_op *insert)
+{
+    remove_tree(insert->staged);
+    g_ptr_array_remove(mdb_txn()->ops, insert);
+}
+
+/*
+ * The log names staged files from the transaction's directory and the
+ * rest from the data directory, so it can be played after either moves
+ */
+
+const gchar * data_relative(const gchar *path)
+{
+    gsize len = strlen(MULTIDB_DATADIR);
+
+    if (0 == strncmp(path, MULTIDB_DATADIR, len) && '/' == path[len]) {
+        return(&path[len + 1]);
+    }
+
+    return(path);
+}
+
+/* One line of tab separated fields */
+void mdb_txn_log(struct mdb_txn *txn, const gchar *first, ...)
+{
+    va_list args;
+    const gchar *field = first;
+
+    va_start(args, first);
+    while (field) {
+        g_string_append(txn->log, field);
+
+        field = va_arg(args, const gchar *);
+        g_string_append_c(txn->log, field ? '\t' : '\n');
+    }
+    va_end(args);
+}
+
+void txn_resolve_insert(struct mdb_txn *txn, struct mdb_txn_op *op)
+{
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", op->table, NULL);
+    gint roid = GPOINTER_TO_INT(g_hash_table_lookup(txn->roids, op->table));
+    gchar *entry_path = row_entry_path(table_path, op->partition, roid);
+    gchar *roid_text = g_strdup_printf("%i", roid);
+
+    g_hash_table_insert(txn->roids, g_strdup(op->table), GINT_TO_POINTER(roid + 1));
+
+    for (GSList *col = op->serials; col; col = col->next) {
+        gchar *serial_file = g_strconcat(table_path, "/", "metadata", "/", "serial", "/", col->data, NULL);
+        gchar *staged_file = g_strconcat(op->staged, "/", col->data, NULL);
+        gchar *buf = g_strdup_printf("%i", next_serial(table_path, serial_file));
+
+        if (table_version(op->table) >= 2) {
+            write_typed_col_file(staged_file, MDB_COL_INT64, buf, MDB_CODEC_NONE);
+        }
+        else {
+            write_file(staged_file, buf);
+        }
+
+        mdb_change_add_literal(op->after, op->table, col->data, buf);
+
+        g_free(buf);
+        g_free(staged_file);
+        g_free(serial_file);
+    }
+
+    /* NULL bits of a roid nobody has yet are harmless, so they go first */
+    for (GSList *col = op->nulls; col; col = col->next) {
+        mdb_txn_log(txn, "null", op->table, col->data, roid_text, "1", NULL);
+    }
+
+    mdb_txn_log(txn, "row", strrchr(op->staged, '/') + 1, data_relative(entry_path), NULL);
+    if (mdb_change_wanted(op->table)) {
+        txn_log_change(txn, "INSERT", op->table, roid, NULL, op->after);
+    }
+
+    g_free(roid_text);
+    g_free(entry_path);
+    g_free(table_path);
+}
+
+/* A column as this transaction has left it so far */
+void txn_read_col(struct mdb_txn *txn, const gchar *table, const gchar *entry_path, const gchar *col, struct mdb_col *out)
+{
+    gchar *path = g_strconcat(entry_path, "/", col, NULL);
+    struct mdb_col *pending = g_hash_table_lookup(txn->pending, path);
+
+    if (pending) {
+        *out = *pending;
+        out->v_text = g_strdup(pending->v_text);
+    }
+    else {
+        read_mdb_col((gchar *) table, col, cached_schema(table), entry_path, out);
+    }
+
+    g_free(path);
+}
+
+/* A change record goes in the commit log, and out once it's published */
+void txn_log_change(struct mdb_txn *txn, const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after)
+{
+    g_string_append(txn->log, "change\t");
+    mdb_change_record(txn->log, kind, table, roid, before, after);
+}
+
+/*
+ * Like compute_sets() and write_sets(), except that the value goes to
+ * a file of the transaction and is published later.  The column's
+ * values go in before (the first time) and after.
+ */
+
+/*
+ * Like lock_matching_row(), for a row an UPDATE or DELETE of the
+ * transaction noted: the lock is held until the commit is done, so
+ * nobody else's SET lands in between.  Rows deleted since, by this
+ * transaction or anyone else, and rows that no longer match the WHERE,
+ * as committed or as this transaction has set them, are skipped.
+ */
+
+gboolean txn_lock_matching_row(struct mdb_txn *txn, struct mdb_txn_op *op, const gchar *entry_path)
+{
+    row_lock(op->table, entry_roid(entry_path));
+
+    if (g_hash_table_contains(txn->dropped, entry_path) || -1 == access(entry_path, F_OK)) {
+        return(FALSE);
+    }
+
+    if (NULL == op->where) {
+        return(TRUE);
+    }
+
+    GHashTable *paths = g_hash_table_new(g_str_hash, g_str_equal);
+    struct mdb_row_ctx ctx = { .paths = paths, .table = op->table, .pending = txn->pending };
+    struct mdb_col result;
+
+    g_hash_table_insert(paths, op->table, (gpointer) entry_path);
+
+    mdb_expr_eval(op->where, &ctx, &result);
+
+    gboolean ret = !ctx.stale && mdb_col_truth(&result);
+    mdb_col_clear(&result);
+    g_hash_table_destroy(paths);
+
+    return(ret);
+}
+
+/* The caller has the row from txn_lock_matching_row() */
+void txn_resolve_set(struct mdb_txn *txn, struct mdb_txn_op *op, const gchar *entry_path, struct mdb_set *set, GHashTable *before, GHashTable *after)
+{
+    gchar *path = g_strconcat(entry_path, "/", set->col, NULL);
+    gchar *staged = mdb_txn_stage(txn);
+    gchar *roid = g_strdup_printf("%li", entry_roid(entry_path));
+    GHashTable *paths = g_hash_table_new(g_str_hash, g_str_equal);
+    struct mdb_row_ctx ctx = { .paths = paths, .table = op->table, .pending = txn->pending };
+    struct mdb_col value;
+    gboolean null = FALSE;
+
+    g_hash_table_insert(paths, op->table, (gpointer) entry_path);
+
+    if (-1 == access(path, F_OK)) {
+        fprintf(stderr, "error: table: [%s]::[%s]: not found: %s\n", op->table, set->col, path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (before && !g_hash_table_contains(before, set->col)) {
+        struct mdb_col old;
+
+        txn_read_col(txn, op->table, entry_path, set->col, &old);
+        if (!old.stale) {
+            mdb_change_add(before, set->col, &old);
+        }
+        mdb_col_clear(&old);
+    }
+
+    if (set->fixed) {
+        if (set->constant) {
+            value = set->value;
+        }
+        else {
+            struct mdb_col cur = { .col_type = set->col_type };
+            struct mdb_col *pending = g_hash_table_lookup(txn->pending, path);
+
+            if (pending) {
+                cur = *pending;
+            }
+            else {
+                gchar buf[sizeof(gint64)];
+                int fd = open(path, O_RDONLY|O_CLOEXEC);
+                ssize_t got = -1 == fd ? -1 : pread(fd, buf, sizeof(buf), 0);
+
+                if (-1 == got) {
+                    fprintf(stderr, "error: read(%s): %s\n", path, g_strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+
+                close(fd);
+
+                ++mdb_counters()->files_opened;
+                mdb_counters()->bytes_read += got;
+
+                if (!decode_mdb_col(&cur, buf, got)) {
+                    fprintf(stderr, "error: %s: corrupt value (%li bytes)\n", path, got);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            ctx.override_col = set->col;
+            ctx.override = &cur;
+
+            mdb_expr_eval(set->expr, &ctx, &value);
+            set_value_literal(op->table, set, &value);
+        }
+
+        GByteArray *encoded = g_byte_array_new();
+
+        if (!value.null) {
+            encode_mdb_col(&value, encoded);
+        }
+
+        write_bytes_file(staged, encoded->data, encoded->len);
+        g_byte_array_free(encoded, TRUE);
+
+        null = value.null;
+        mdb_txn_log(txn, "patch", strrchr(staged, '/') + 1, data_relative(path), NULL);
+    }
+    else {
+        if (set->constant) {
+            value = set->value;
+            value.v_text = g_strdup(set->value.v_text);
+        }
+        else {
+            mdb_expr_eval(set->expr, &ctx, &value);
+            set_value_literal(op->table, set, &value);
+        }
+
+        if (table_version(op->table) >= 2) {
+            null = write_typed_col_file(staged, set->col_type, set->literal, op->codec);
+        }
+        else {
+            write_col_file(staged, set->literal, op->codec);
+        }
+
+        mdb_txn_log(txn, "put", strrchr(staged, '/') + 1, data_relative(path), NULL);
+    }
+
+    if (table_version(op->table) >= 2) {
+        mdb_txn_log(txn, "null", op->table, set->col, roid, null ? "1" : "0", NULL);
+    }
+
+    mdb_change_add(after, set->col, &value);
+
+    /* Later SETs of this transaction read it from here */
+    struct mdb_col *pending = g_new(struct mdb_col, 1);
+    *pending = value;
+    g_hash_table_insert(txn->pending, g_strdup(path), pending);
+
+    g_hash_table_destroy(paths);
+    g_free(roid);
+    g_free(staged);
+    g_free(path);
+}
+
+void txn_resolve_delete(struct mdb_txn *txn, struct mdb_txn_op *op, const gchar *entry_path)
+{
+    const gchar *table = op->table;
+
+    if (!txn_lock_matching_row(txn, op, entry_path)) {
+        return;
+    }
+
+    gboolean logged = mdb_change_wanted(table);
+    GHashTable *before = logged && mdb_change_wants_before(table) ? mdb_change_cols_new() : NULL;
+    GHashTableIter iter;
+    gpointer col;
+
+    g_hash_table_iter_init(&iter, cached_schema(table));
+    while (before && g_hash_table_iter_next(&iter, &col, NULL)) {
+        struct mdb_col old;
+
+        txn_read_col(txn, table, entry_path, col, &old);
+        if (!old.stale) {
+            mdb_change_add(before, col, &old);
+        }
+        mdb_col_clear(&old);
+    }
+
+    g_hash_table_add(txn->dropped, g_strdup(entry_path));
+    mdb_txn_log(txn, "drop", data_relative(entry_path), NULL);
+
+    if (logged) {
+        txn_log_change(txn, "DELETE", table, entry_roid(entry_path), before, NULL);
+    }
+    if (before) {
+        g_hash_table_destroy(before);
+    }
+}
+
+/*
+ * Play a commit log.  Every line can be played again: whatever was
+ * already moved, or has gone since, is skipped.  Change records are
+ * the exception, appended again by a recovery after a crash that came
+ * after they were.
+ */
+
+void txn_publish(const gchar *txn_path, const gchar *log, gboolean recovery)
+{
+    gchar **lines = g_strsplit(log, "\n", -1);
+    gchar *purgatory = g_strdup_printf("%s/txn.%d", MULTIDB_PURGATORYDIR, getpid());
+    GString *changes = g_string_new(NULL);
+    guint dropped = 0;
+
+    mdb_commits_exclude();
+
+    for (gchar **line = lines; *line && **line; ++line) {
+        gchar **fields = g_strsplit(*line, "\t", -1);
+
+        txn_apply(fields, txn_path, purgatory, &dropped, recovery, changes);
+        g_strfreev(fields);
+    }
+
+    mdb_commits_release();
+
+    mdb_changes_append(changes->str, changes->len);
+    mdb_views_apply_changes(changes->str);
+    g_string_free(changes, TRUE);
+
+    if (dropped) {
+        remove_tree(purgatory);
+        mdb_counters()->purgatory_reclaimed += dropped;
+    }
+
+    g_free(purgatory);
+    g_strfreev(lines);
+}
+
+void txn_apply(gchar **fields, const gchar *txn_path, const gchar *purgatory, guint *dropped, gboolean recovery, GString *changes)
+{
+    const gchar *kind = fields[0];
+
+    if (0 == g_strcmp0(kind, MDB_TXN_LOG_END)) {
+        return;
+    }
+
+    if (0 == g_strcmp0(kind, "change") && fields[1]) {
+        gchar *record = g_strjoinv("\t", &fields[1]);
+
+        g_string_append_printf(changes, "%s\n", record);
+        g_free(record);
+        return;
+    }
+
+    /* Only a dead committer's lock is broken */
+    if (0 == g_strcmp0(kind, "lock") && fields[1]) {
+        gchar *lock_file = g_strconcat(MULTIDB_TABLESDIR, "/", fields[1], "/", "tbl_lock", NULL);
+        gchar *buf = NULL;
+
+        if (recovery && g_file_get_contents(lock_file, &buf, NULL, NULL)) {
+            pid_t owner = g_ascii_strtoll(buf, NULL, 10);
+
+            if (owner > 0 && -1 == kill(owner, 0) && ESRCH == errno) {
+                g_remove(lock_file);
+            }
+        }
+
+        g_free(buf);
+        g_free(lock_file);
+        return;
+    }
+
+    if (0 == g_strcmp0(kind, "null") && g_strv_length(fields) == 5) {
+        set_null_bit(fields[1], fields[2], g_ascii_strtoll(fields[3], NULL, 10), '1' == *fields[4]);
+        return;
+    }
+
+    gchar *from = NULL;
+
+    if (fields[1]) {
+        from = 0 == g_strcmp0(kind, "drop") ?
+            g_strconcat(MULTIDB_DATADIR, "/", fields[1], NULL) :
+            g_strconcat(txn_path, "/", fields[1], NULL);
+    }
+
+    gchar *to = from && fields[2] ? g_strconcat(MULTIDB_DATADIR, "/", fields[2], NULL) : NULL;
+
+    /*
+     * COMMIT holds its rows' locks already; a recovery takes them, which
+     * also moves the rows' versions on past anything pooled meanwhile
+     */
+    gboolean drop = 0 == g_strcmp0(kind, "drop");
+    gchar **parts = NULL;
+    gint64 roid = 0;
+
+    if (recovery && (drop || 0 == g_strcmp0(kind, "put") || 0 == g_strcmp0(kind, "patch")) && fields[1] && (drop || fields[2])) {
+        parts = g_strsplit(drop ? fields[1] : fields[2], "/", 3);
+
+        if (parts[1]) {
+            gchar *entry_path = drop ? g_strdup(fields[1]) : g_path_get_dirname(fields[2]);
+
+            roid = entry_roid(entry_path);
+            row_lock(parts[1], roid);
+            g_free(entry_path);
+        }
+    }
+
+    if (0 == g_strcmp0(kind, "row") && to) {
+        gchar *bucket = g_path_get_dirname(to);
+
+        if (0 != g_mkdir_with_parents(bucket, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", bucket, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (-1 == rename(from, to) && ENOENT != errno) {
+            fprintf(stderr, "error: rename: %s -> %s: %s\n", from, to, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        g_free(bucket);
+    }
+    else if (0 == g_strcmp0(kind, "put") && to) {
+        if (-1 == rename(from, to) && ENOENT != errno) {
+            fprintf(stderr, "error: rename: %s -> %s: %s\n", from, to, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (0 == g_strcmp0(kind, "patch") && to) {
+        gchar *data = NULL;
+        gsize len = 0;
+
+        /* Gone when it was played before */
+        int fd = g_file_get_contents(from, &data, &len, NULL) ? open(to, O_RDWR|O_CLOEXEC) : -1;
+
+        if (-1 == fd && data && ENOENT != errno) {
+            fprintf(stderr, "error: open(%s): %s\n", to, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (-1 != fd) {
+            if (0 == len ? -1 == ftruncate(fd, 0) : (gssize) len != pwrite(fd, data, len, 0)) {
+                fprintf(stderr, "error: patch(%s): %s\n", to, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            mdb_counters()->bytes_written += len;
+            close(fd);
+            g_remove(from);
+        }
+
+        g_free(data);
+    }
+    else if (0 == g_strcmp0(kind, "drop") && from) {
+        gchar *name = g_strdup_printf("%s/%u", purgatory, *dropped);
+
+        if (0 != g_mkdir_with_parents(purgatory, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", purgatory, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (0 == rename(from, name)) {
+            ++*dropped;
+        }
+        else if (ENOENT != errno) {
+            fprintf(stderr, "error: rename: %s -> %s: %s\n", from, name, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        g_free(name);
+    }
+    else {
+        fprintf(stderr, "error: commit log: bad entry: %s\n", kind);
+        exit(EXIT_FAILURE);
+    }
+
+    if (parts && parts[1]) {
+        row_unlock(parts[1], roid);
+    }
+
+    g_strfreev(parts);
+    g_free(to);
+    g_free(from);
+}
+
+/*
+ * Flush everything written to the file system the data directory is on
+ */
+
+void mdb_sync(void)
+{
+#ifdef __linux__
+    int fd = open(MULTIDB_DATADIR, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+    if (-1 == fd || -1 == syscall(SYS_syncfs, fd)) {
+        fprintf(stderr, "error: syncfs(%s): %s\n", MULTIDB_DATADIR, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+#else
+    sync();
+#endif
+}
+
+/*
+ * Change data capture
+ *
+ * While a consumer is registered, each row an INSERT, UPDATE or DELETE
+ * changes is a line of data/changes:
+ *
+ *     UPDATE<tab>events<tab>3<tab>-score=3<tab>+score=1003
+ *
+ * kind, table and roid, then the values before (-) and after (+) as SQL
+ * literals, columns in name order: the whole of an inserted row, the
+ * SET columns of an updated one.  CREATE and ALTER of a table or view
+ * are lines of their own, with roid 0 and no values.  The values before, the whole of a
+ * deleted row, are only there when a consumer asked for them (or a
+ * view joins the table).  Backslash, tab, newline and carriage return
+ * in a value are escaped with a backslash.  A line's LSN is its offset
+ * in the file.  Lines are appended in one write while the row is still
+ * claimed, so a row's changes are in the order they were made; a
+ * transaction's go in its commit log and are appended together once
+ * it's published.
+ *
+ * data/consumers/<name> holds the LSN a consumer has acknowledged and
+ * whether it wants the values before.  The log before the oldest
+ * acknowledged LSN is punched out of the file, so LSNs stay offsets;
+ * data/changes.start says where what's left begins.
+ */
+
+struct mdb_changes * mdb_changes(void)
+{
+    static struct mdb_changes changes;
+
+    if (!changes.loaded) {
+        changes.viewed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        changes.joined = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        changes.loaded = TRUE;
+        mdb_changes_refresh();
+    }
+
+    return(&changes);
+}
+
+/*
+ * At the start of each write: registering a consumer holds writers off,
+ * so none that started before it can miss logging a change it wants
+ */
+
+void mdb_changes_refresh(void)
+{
+    struct mdb_changes *changes = mdb_changes();
+    gchar *dir_path = g_strconcat(MULTIDB_DATADIR, "/", "consumers", NULL);
+    GDir *dir = dir_open(dir_path);
+    GPtrArray *views = mdb_views();
+    const gchar *name;
+
+    changes->mode = MDB_CHANGES_OFF;
+
+    while (dir && (name = g_dir_read_name(dir))) {
+        gchar *path = g_strconcat(dir_path, "/", name, NULL);
+        MdbChangesMode mode;
+        gint64 lsn;
+
+        if ('.' != *name && changes_consumer_load(path, &lsn, &mode)) {
+            changes->mode = MAX(changes->mode, mode);
+        }
+
+        g_free(path);
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+
+    g_hash_table_remove_all(changes->viewed);
+    g_hash_table_remove_all(changes->joined);
+
+    for (guint i = 0; i < views->len; ++i) {
+        struct mdb_view *view = g_ptr_array_index(views, i);
+
+        for (GSList *iter = view->tables; iter; iter = iter->next) {
+            g_hash_table_add(changes->viewed, g_strdup(iter->data));
+        }
+        for (GSList *iter = view->select.joins; iter; iter = iter->next) {
+            g_hash_table_add(changes->joined, g_strdup(((struct ddl_join *) iter->data)->tbl_name));
+        }
+    }
+
+    g_free(dir_path);
+}
+
+/* Whether a change to the table is logged or applied to a view */
+gboolean mdb_change_wanted(const gchar *table)
+{
+    struct mdb_changes *changes = mdb_changes();
+
+    return(MDB_CHANGES_OFF != changes->mode || g_hash_table_contains(changes->viewed, table));
+}
+
+/* Whether its values from before the change are */
+gboolean mdb_change_wants_before(const gchar *table)
+{
+    struct mdb_changes *changes = mdb_changes();
+
+    return(MDB_CHANGES_FULL == changes->mode || g_hash_table_contains(changes->joined, table));
+}
+
+gchar * changes_consumer_path(const gchar *datadir, const gchar *name)
+{
+    if ('\0' == *name || '.' == *name || strchr(name, '/')) {
+        fprintf(stderr, "error: consumer: %s: invalid name\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    return(g_strconcat(datadir, "/", "consumers", "/", name, NULL));
+}
+
+/* "<lsn> after" or "<lsn> full"; FALSE when there's no such consumer */
+gboolean changes_consumer_load(const gchar *path, gint64 *lsn, MdbChangesMode *mode)
+{
+    gchar *contents = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        return(FALSE);
+    }
+
+    gchar **fields = g_strsplit(g_strstrip(contents), " ", -1);
+
+    if (2 != g_strv_length(fields)) {
+        fprintf(stderr, "error: consumer: %s: not a consumer's state\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    *lsn = g_ascii_strtoll(fields[0], NULL, 10);
+    *mode = 0 == g_strcmp0(fields[1], "full") ? MDB_CHANGES_FULL : MDB_CHANGES_AFTER;
+
+    g_strfreev(fields);
+    g_free(contents);
+
+    return(TRUE);
+}
+
+void changes_consumer_save(const gchar *path, gint64 lsn, MdbChangesMode mode)
+{
+    gchar *text = g_strdup_printf("%li %s\n", lsn, MDB_CHANGES_FULL == mode ? "full" : "after");
+    GError *error = NULL;
+
+    /* g_file_set_contents() renames a new file over the old one */
+    if (!g_file_set_contents(path, text, -1, &error)) {
+        fprintf(stderr, "error: consumer: %s: %s\n", path, error->message);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(text);
+}
+
+/*
+ * mdb_quiesce_writers() for the database at datadir, which is a
+ * replica's primary unless it's this one.  -1 for this one.
+ */
+
+int changes_writers_hold(const gchar *datadir)
+{
+    if (0 == g_strcmp0(datadir, MULTIDB_DATADIR)) {
+        mdb_quiesce_writers();
+        return(-1);
+    }
+
+    gchar *path = g_strconcat(datadir, "/", "quiesce", NULL);
+    int fd = open(path, O_CREAT|O_RDWR|O_CLOEXEC, 0666);
+
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (gint64 byte = 1; byte >= 0; --byte) {
+        struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = byte, .l_len = 1 };
+
+        mdb_lock_wait(fd, &lock, path);
+    }
+
+    g_free(path);
+
+    return(fd);
+}
+
+void changes_writers_release(int fd)
+{
+    if (-1 == fd) {
+        mdb_quiesce_leave();
+    }
+    else {
+        close(fd);
+    }
+}
+
+/*
+ * --add-consumer: keep the log from its end on for name, with the values
+ * from before each change when before is set.  The LSN it starts at;
+ * one already registered stays as it is.
+ */
+
+gint64 mdb_changes_register(const gchar *datadir, const gchar *name, gboolean before)
+{
+    gchar *path = changes_consumer_path(datadir, name);
+    gchar *dir = g_path_get_dirname(path);
+    gchar *log_path = g_strconcat(datadir, "/", "changes", NULL);
+    MdbChangesMode mode = before ? MDB_CHANGES_FULL : MDB_CHANGES_AFTER;
+    struct stat st;
+    gint64 lsn;
+
+    if (0 != g_mkdir_with_parents(dir, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", dir, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* No write is under way, so everything after this LSN is logged for it */
+    int fd = changes_writers_hold(datadir);
+
+    if (!changes_consumer_load(path, &lsn, &mode)) {
+        lsn = 0 == stat(log_path, &st) ? st.st_size : 0;
+        changes_consumer_save(path, lsn, mode);
+    }
+
+    changes_writers_release(fd);
+
+    g_free(log_path);
+    g_free(dir);
+    g_free(path);
+
+    return(lsn);
+}
+
+/* --ack-changes: the consumer is done with the log before lsn */
+void mdb_changes_ack(const gchar *datadir, const gchar *name, gint64 lsn)
+{
+    gchar *path = changes_consumer_path(datadir, name);
+    gchar *log_path = g_strconcat(datadir, "/", "changes", NULL);
+    MdbChangesMode mode;
+    struct stat st;
+    gint64 acked;
+
+    if (!changes_consumer_load(path, &acked, &mode)) {
+        fprintf(stderr, "error: consumer: %s: not registered\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (lsn < acked || lsn > (0 == stat(log_path, &st) ? st.st_size : 0)) {
+        fprintf(stderr, "error: consumer: %s: can't acknowledge %li, it's at %li\n", name, lsn, acked);
+        exit(EXIT_FAILURE);
+    }
+
+    if (lsn > acked) {
+        changes_consumer_save(path, lsn, mode);
+        changes_trim(datadir);
+    }
+
+    g_free(log_path);
+    g_free(path);
+}
+
+/* --drop-consumer: nothing more is kept for it */
+void mdb_changes_drop(const gchar *datadir, const gchar *name)
+{
+    gchar *path = changes_consumer_path(datadir, name);
+
+    if (-1 == unlink(path)) {
+        fprintf(stderr, "error: consumer: %s: %s\n", name, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    changes_trim(datadir);
+
+    g_free(path);
+}
+
+/*
+ * Let go of the log every consumer is done with; with none left, all
+ * of it.  data/changes.start has the first LSN kept, and on Linux the
+ * space before it is punched out of the file, which reads as zeros
+ * from then on, so the LSNs of the rest don't move.
+ */
+
+void changes_trim(const gchar *datadir)
+{
+    gchar *log_path = g_strconcat(datadir, "/", "changes", NULL);
+    gchar *dir_path = g_strconcat(datadir, "/", "consumers", NULL);
+    GDir *dir = dir_open(dir_path);
+    const gchar *name;
+    struct stat st;
+    gint64 keep = 0 == stat(log_path, &st) ? st.st_size : 0;
+
+    while (dir && (name = g_dir_read_name(dir))) {
+        gchar *path = g_strconcat(dir_path, "/", name, NULL);
+        MdbChangesMode mode;
+        gint64 lsn;
+
+        if ('.' != *name && changes_consumer_load(path, &lsn, &mode)) {
+            keep = MIN(keep, lsn);
+        }
+
+        g_free(path);
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+
+    if (keep > mdb_changes_start(datadir)) {
+        gchar *start_path = g_strconcat(log_path, ".start", NULL);
+        gchar *text = g_strdup_printf("%li\n", keep);
+        GError *error = NULL;
+
+        if (!g_file_set_contents(start_path, text, -1, &error)) {
+            fprintf(stderr, "error: %s: %s\n", start_path, error->message);
+            exit(EXIT_FAILURE);
+        }
+
+#ifdef __linux__
+        int fd = open(log_path, O_WRONLY|O_CLOEXEC);
+        off_t len = keep - keep % MDB_CHANGES_TRIM;
+
+        if (-1 == fd || (len > 0 && -1 == syscall(SYS_fallocate, fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, (off_t) 0, len) && EOPNOTSUPP != errno)) {
+            fprintf(stderr, "error: fallocate(%s): %s\n", log_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        close(fd);
+#endif
+
+        g_free(text);
+        g_free(start_path);
+    }
+
+    g_free(dir_path);
+    g_free(log_path);
+}
+
+/* The first LSN of the log still kept; everything before was trimmed */
+gint64 mdb_changes_start(const gchar *datadir)
+{
+    gchar *path = g_strconcat(datadir, "/", "changes.start", NULL);
+    gchar *contents = NULL;
+    gint64 start = 0;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        start = g_ascii_strtoll(contents, NULL, 10);
+    }
+
+    g_free(contents);
+    g_free(path);
+
+    return(start);
+}
+
+GHashTable * mdb_change_cols_new(void)
+{
+    return(g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free));
+}
+
+/* cols is NULL when nobody wants the change */
+void mdb_change_add(GHashTable *cols, const gchar *col, const struct mdb_col *value)
+{
+    if (NULL == cols) {
+        return;
+    }
+
+    g_hash_table_insert(cols, g_strdup(col), mdb_col_to_string(value));
+}
+
+/* A value as INSERT was given it */
+void mdb_change_add_literal(GHashTable *cols, const gchar *table, const gchar *col, const gchar *literal)
+{
+    struct mdb_col value = { .col_type = MDB_COL_TEXT };
+    MdbColumnType col_type = MDB_COL_TEXT;
+
+    if (NULL == cols) {
+        return;
+    }
+    if (table_version(table) < 2) {
+        g_hash_table_insert(cols, g_strdup(col), g_strdup(literal));
+        return;
+    }
+
+    mdb_col_type_from_name(g_hash_table_lookup(cached_schema(table), col), &col_type);
+    mdb_col_from_literal(col_type, literal, &value);
+    mdb_change_add(cols, col, &value);
+    g_free(value.v_text);
+}
+
+void mdb_change_read(GHashTable *cols, const gchar *table, const gchar *entry_path, const gchar *col)
+{
+    struct mdb_col value;
+
+    if (NULL == cols) {
+        return;
+    }
+
+    read_mdb_col((gchar *) table, col, cached_schema(table), entry_path, &value);
+
+    if (!value.stale) {
+        mdb_change_add(cols, col, &value);
+    }
+
+    mdb_col_clear(&value);
+}
+
+void mdb_change_read_row(GHashTable *cols, const gchar *table, const gchar *entry_path)
+{
+    GHashTableIter iter;
+    gpointer col;
+
+    g_hash_table_iter_init(&iter, cached_schema(table));
+    while (g_hash_table_iter_next(&iter, &col, NULL)) {
+        mdb_change_read(cols, table, entry_path, col);
+    }
+}
+
+void mdb_change_escape(GString *out, const gchar *text)
+{
+    for (const gchar *c = text; *c; ++c) {
+        switch (*c) {
+            case '\\': g_string_append(out, "\\\\"); break;
+            case '\t': g_string_append(out, "\\t"); break;
+            case '\n': g_string_append(out, "\\n"); break;
+            case '\r': g_string_append(out, "\\r"); break;
+            default: g_string_append_c(out, *c); break;
+        }
+    }
+}
+
+void mdb_change_record(GString *out, const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after)
+{
+    GHashTable *sides[] = { before, after };
+    const gchar *signs[] = { "-", "+" };
+
+    g_string_append_printf(out, "%s\t%s\t%li", kind, table, roid);
+
+    for (guint i = 0; i < G_N_ELEMENTS(sides); ++i) {
+        if (NULL == sides[i]) {
+            continue;
+        }
+
+        GList *cols = g_list_sort(g_hash_table_get_keys(sides[i]), (GCompareFunc) g_strcmp0);
+
+        for (GList *col = cols; col; col = col->next) {
+            g_string_append_printf(out, "\t%s%s=", signs[i], (gchar *) col->data);
+            mdb_change_escape(out, g_hash_table_lookup(sides[i], col->data));
+        }
+
+        g_list_free(cols);
+    }
+
+    g_string_append_c(out, '\n');
+}
+
+/* Whole lines, in one write */
+void mdb_changes_append(const gchar *text, gsize len)
+{
+    static int fd = -1;
+
+    if (0 == len || MDB_CHANGES_OFF == mdb_changes()->mode) {
+        return;
+    }
+
+    if (-1 == fd) {
+        gchar *path = g_strconcat(MULTIDB_DATADIR, "/", "changes", NULL);
+
+        fd = open(path, O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0666);
+        if (-1 == fd) {
+            fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        g_free(path);
+    }
+
+    write_fd(fd, (gchar *) text, len);
+
+    for (gsize i = 0; i < len; ++i) {
+        mdb_counters()->changes_logged += '\n' == text[i];
+    }
+}
+
+void mdb_change_log(const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after)
+{
+    GString *record = g_string_new(NULL);
+
+    mdb_change_record(record, kind, table, roid, before, after);
+    mdb_changes_append(record->str, record->len);
+
+    if (g_hash_table_contains(mdb_changes()->viewed, table)) {
+        mdb_views_apply(kind, table, roid, before, after);
+    }
+
+    g_string_free(record, TRUE);
+}
+
+/*
+ * CREATE or ALTER of a table or view, with no values: what it made is
+ * there by then, so a replica brings its definition across from it
+ */
+
+void mdb_change_log_ddl(const gchar *kind, const gchar *table)
+{
+    GString *record = g_string_new(NULL);
+
+    mdb_change_record(record, kind, table, 0, NULL, NULL);
+    mdb_changes_append(record->str, record->len);
+
+    g_string_free(record, TRUE);
+}
+
+/*
+ * Until the change log may have grown: an inotify event on Linux (the
+ * data directory's until the log exists), a tenth of a second elsewhere.
+ * FALSE when there's no waiting.
+ */
+
+gboolean mdb_tail_wait(int notify_fd, const gchar *path, gboolean exists)
+{
+#ifdef __linux__
+    static gboolean watching = FALSE;
+    gchar events[4096];
+
+    if (exists && !watching) {
+        if (-1 == inotify_add_watch(notify_fd, path, IN_MODIFY)) {
+            fprintf(stderr, "error: inotify_add_watch(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        /* Set up after the last read, so look once more before blocking */
+        watching = TRUE;
+        return(TRUE);
+    }
+
+    while (-1 == read(notify_fd, events, sizeof(events))) {
+        if (EINTR != errno) {
+            return(FALSE);
+        }
+    }
+#else
+    g_usleep(G_USEC_PER_SEC / 10);
+#endif
+
+    return(TRUE);
+}
+
+/*
+ * --tail-changes: the change log from the line at or after from on,
+ * each line after its LSN and a tab, waiting for more at the end.
+ * Stops after count lines unless that's 0.
+ */
+
+void mdb_tail_changes(gint64 from, gint64 count)
+{
+    gchar *path = g_strconcat(MULTIDB_DATADIR, "/", "changes", NULL);
+    GByteArray *buf = g_byte_array_new();
+    guint8 chunk[64 * 1024];
+    gint64 pos = from;
+    gint64 lsn = from;
+    gint64 printed = 0;
+    gboolean skip = FALSE;
+    int notify_fd = -1;
+    int fd = -1;
+
+    if (from < 0) {
+        fprintf(stderr, "error: --from: invalid LSN: %li\n", from);
+        exit(EXIT_FAILURE);
+    }
+
+    /* 0 is wherever the log starts now */
+    gint64 start = mdb_changes_start(MULTIDB_DATADIR);
+
+    if (0 == from) {
+        pos = lsn = from = start;
+    }
+    else if (from < start) {
+        fprintf(stderr, "error: --from: LSN %li was trimmed, the log starts at %li\n", from, start);
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef __linux__
+    notify_fd = inotify_init1(IN_CLOEXEC);
+    if (-1 == notify_fd || -1 == inotify_add_watch(notify_fd, MULTIDB_DATADIR, IN_CREATE|IN_MOVED_TO)) {
+        fprintf(stderr, "error: inotify(%s): %s\n", MULTIDB_DATADIR, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    for (;;) {
+        if (-1 == fd) {
+            fd = open(path, O_RDONLY|O_CLOEXEC);
+            if (-1 == fd && ENOENT != errno) {
+                fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            /* An LSN in the middle of a line starts at the next one; a trimmed byte ends one */
+            gchar before = '\n';
+            skip = -1 != fd && from > 0 && 1 == pread(fd, &before, 1, from - 1) && '\n' != before && '\0' != before;
+        }
+
+        gssize got = 0;
+
+        while (-1 != fd && 0 != (got = pread(fd, chunk, sizeof(chunk), pos))) {
+            if (-1 == got && EINTR == errno) {
+                continue;
+            }
+            if (-1 == got) {
+                fprintf(stderr, "error: pread(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            g_byte_array_append(buf, chunk, got);
+            pos += got;
+        }
+
+        guint8 *start = buf->data;
+        guint8 *nl;
+
+        while (buf->len && (nl = memchr(start, '\n', buf->data + buf->len - start))) {
+            if (!skip) {
+                g_print("%li\t%.*s\n", lsn, (int) (nl - start), start);
+                ++printed;
+            }
+
+            skip = FALSE;
+            lsn += nl + 1 - start;
+            start = nl + 1;
+
+            if (count && printed >= count) {
+                break;
+            }
+        }
+
+        g_byte_array_remove_range(buf, 0, start - buf->data);
+        fflush(stdout);
+
+        if (count && printed >= count) {
+            break;
+        }
+
+        if (!mdb_tail_wait(notify_fd, path, -1 != fd)) {
+            fprintf(stderr, "error: waiting for %s: %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (-1 != fd) {
+        close(fd);
+    }
+    if (-1 != notify_fd) {
+        close(notify_fd);
+    }
+
+    g_byte_array_free(buf, TRUE);
+    g_free(path);
+}
+
+gchar * mdb_change_unescape(const gchar *text)
+{
+    GString *out = g_string_sized_new(strlen(text));
+
+    for (const gchar *c = text; *c; ++c) {
+        if ('\\' != *c || '\0' == c[1]) {
+            g_string_append_c(out, *c);
+            continue;
+        }
+
+        switch (*++c) {
+            case 't': g_string_append_c(out, '\t'); break;
+            case 'n': g_string_append_c(out, '\n'); break;
+            case 'r': g_string_append_c(out, '\r'); break;
+            default: g_string_append_c(out, *c); break;
+        }
+    }
+
+    return(g_string_free(out, FALSE));
+}
+
+/* A line of the change log, without its newline; before and after can be NULL */
+gboolean mdb_change_parse(const gchar *line, gchar **kind, gchar **table, gint64 *roid, GHashTable *before, GHashTable *after)
+{
+    gchar **fields = g_strsplit(line, "\t", -1);
+
+    if (g_strv_length(fields) < 3) {
+        g_strfreev(fields);
+        return(FALSE);
+    }
+
+    for (guint i = 3; fields[i]; ++i) {
+        gchar *eq = strchr(fields[i], '=');
+        GHashTable *side = '-' == fields[i][0] ? before : after;
+
+        if (NULL == eq || ('-' != fields[i][0] && '+' != fields[i][0])) {
+            g_strfreev(fields);
+            return(FALSE);
+        }
+
+        if (side) {
+            g_hash_table_insert(side, g_strndup(&fields[i][1], eq - &fields[i][1]), mdb_change_unescape(&eq[1]));
+        }
+    }
+
+    *kind = g_strdup(fields[0]);
+    *table = g_strdup(fields[1]);
+    *roid = g_ascii_strtoll(fields[2], NULL, 10);
+
+    g_strfreev(fields);
+
+    return(TRUE);
+}
+
+/*
+ * Materialized views
+ *
+ * A view is a table of its own, filled from its SELECT and defined by
+ * data/views/<name>: the view's column names on the first line and the
+ * SELECT, with * spelled out, on the second.  Each row of the FROM
+ * table gives at most one row of the view, stored under the same roid,
+ * so a change is applied by working out again only the view rows it
+ * can touch: the row itself for a change to the FROM table, the rows
+ * joined on the old and new key for a change to a joined table.  Each
+ * view has its own table lock, held while its rows are worked out.
+ */
+
+/*
+ *  CREATE MATERIALIZED VIEW site_report (site, setting) AS SELECT ...;
+ */
+
+struct ddl_parsed parse_create_view(const gchar *text)
+{
+    GScanner *scanner;
+
+    scanner = g_scanner_new(NULL);
+
+    /* feed in the text */
+    g_scanner_input_text(scanner, text, strlen(text));
+
+    /* give the error handler an idea on how the input is named */
+    scanner->input_name = "CREATE MATERIALIZED VIEW";
+
+    struct ddl_parsed ddl_view = {NULL, NULL};
+
+    ddl_expect_keyword(scanner, "CREATE");
+    ddl_expect_keyword(scanner, "MATERIALIZED");
+    ddl_expect_keyword(scanner, "VIEW");
+    ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a view name");
+    ddl_view.tbl_name = g_strdup(scanner->value.v_identifier);
+
+    if (G_TOKEN_LEFT_PAREN == g_scanner_peek_next_token(scanner)) {
+        g_scanner_get_next_token(scanner);
+
+        do {
+            ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a column name");
+            ddl_view.cols = g_slist_append(ddl_view.cols, g_strdup(scanner->value.v_identifier));
+        } while (G_TOKEN_COMMA == g_scanner_get_next_token(scanner));
+
+        if (G_TOKEN_RIGHT_PAREN != scanner->token) {
+            ddl_syntax_error(scanner, ", or )");
+        }
+    }
+
+    /* The rest, as it was written, is the SELECT */
+    ddl_expect_keyword(scanner, "AS");
+    ddl_view.query = g_strstrip(g_strdup(scanner->text));
+
+    g_scanner_destroy(scanner);
+
+    return(ddl_view);
+}
+
+void execute_create_view(gchar *sql)
+{
+    struct ddl_parsed ddl_view = parse_create_view(sql);
+    struct ddl_parsed select = parse_select(ddl_view.query);
+    GString *create = g_string_new(NULL);
+    GString *definition = g_string_new(NULL);
+    GSList *names = NULL;
+    GSList *col = ddl_view.cols;
+
+    expand_select_star(&select);
+
+    names = g_slist_copy(select.tables);
+    for (GSList *iter = select.joins; iter; iter = iter->next) {
+        names = g_slist_append(names, ((struct ddl_join *) iter->data)->tbl_name);
+    }
+
+    for (GSList *iter = names; iter; iter = iter->next) {
+        if (mdb_is_view(iter->data)) {
+            fprintf(stderr, "error: view: %s: can't read another view: %s\n", ddl_view.tbl_name, (gchar *) iter->data);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (ddl_view.cols && g_slist_length(ddl_view.cols) != g_slist_length(select.cols)) {
+        fprintf(stderr, "error: view: %s: %u column names for %u columns\n", ddl_view.tbl_name, g_slist_length(ddl_view.cols), g_slist_length(select.cols));
+        exit(EXIT_FAILURE);
+    }
+
+    g_string_append_printf(create, "CREATE TABLE %s (", ddl_view.tbl_name);
+
+    /* A column is named after the one it reads, unless the view names it */
+    guint i = 0;
+    for (GSList *iter = select.cols; iter; iter = iter->next, ++i) {
+        struct mdb_expr *expr = g_ptr_array_index(select.exprs, i);
+        MdbColumnType col_type = MDB_COL_TEXT;
+        const gchar *name = col ? col->data : NULL;
+
+        mdb_expr_check_columns(expr, names, "SELECT");
+
+        if (MDB_EXPR_COLUMN == expr->kind) {
+            const gchar *table = expr->table ? expr->table : select.tables->data;
+
+            mdb_col_type_from_name(g_hash_table_lookup(cached_schema(table), expr->col), &col_type);
+            name = name ? name : expr->col;
+        }
+
+        if (NULL == name) {
+            fprintf(stderr, "error: view: %s: %s needs a column name\n", ddl_view.tbl_name, (gchar *) iter->data);
+            exit(EXIT_FAILURE);
+        }
+
+        g_string_append_printf(create, "%s%s %s", iter == select.cols ? "" : ", ", name, mdb_col_type_name(col_type));
+        g_string_append_printf(definition, "%s%s", iter == select.cols ? "" : "\t", name);
+
+        col = col ? col->next : NULL;
+    }
+
+    g_string_append(create, ");");
+
+    gchar *cols_text = join_list_text(select.cols, ", ");
+    g_string_append_printf(definition, "\nSELECT %s FROM %s", cols_text, (gchar *) select.tables->data);
+    g_free(cols_text);
+
+    for (GSList *iter = select.joins; iter; iter = iter->next) {
+        struct ddl_join *join = iter->data;
+
+        g_string_append_printf(definition, " INNER JOIN %s ON %s = %s", join->tbl_name, join->on_left, join->on_right);
+    }
+    if (select.where) {
+        g_string_append_printf(definition, " WHERE %s", select.where);
+    }
+    g_string_append(definition, ";\n");
+
+    /* Checks the names are new and unique, and makes the table */
+    execute_ddl_create(create->str);
+
+    /* Defined before it's filled, so no change made meanwhile is missed */
+    gchar *views_path = g_strconcat(MULTIDB_DATADIR, "/", "views", NULL);
+    gchar *tmp = g_strdup_printf("%s/.%s.%d", views_path, ddl_view.tbl_name, getpid());
+    gchar *path = g_strconcat(views_path, "/", ddl_view.tbl_name, NULL);
+
+    if (0 != g_mkdir_with_parents(views_path, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", views_path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    write_file(tmp, definition->str);
+    if (-1 == rename(tmp, path)) {
+        fprintf(stderr, "error: rename(%s): %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    mdb_change_log_ddl("CREATE", ddl_view.tbl_name);
+
+    struct mdb_view *view = mdb_view_load(ddl_view.tbl_name, definition->str);
+    gchar *view_path = g_strconcat(MULTIDB_TABLESDIR, "/", view->name, NULL);
+
+    get_table_lock(view_path);
+    view_refresh_all(view);
+    free_table_lock(view_path);
+
+    free_mdb_view(view);
+    g_free(view_path);
+    g_free(path);
+    g_free(tmp);
+    g_free(views_path);
+    g_slist_free(names);
+    free_ddl_parsed(&select);
+    g_string_free(definition, TRUE);
+    g_string_free(create, TRUE);
+    g_slist_free_full(ddl_view.cols, g_free);
+    g_free(ddl_view.query);
+    g_free(ddl_view.tbl_name);
+}
+
+/*
+ *  REFRESH MATERIALIZED VIEW site_report;
+ */
+
+void execute_refresh_view(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    GScanner *scanner = g_scanner_new(NULL);
+
+    mdb_refuse_replica("REFRESH");
+    mdb_quiesce_enter();
+
+    g_scanner_input_text(scanner, sql, strlen(sql));
+    scanner->input_name = "REFRESH MATERIALIZED VIEW";
+
+    ddl_expect_keyword(scanner, "REFRESH");
+    ddl_expect_keyword(scanner, "MATERIALIZED");
+    ddl_expect_keyword(scanner, "VIEW");
+    ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a view name");
+
+    gchar *name = g_strdup(scanner->value.v_identifier);
+
+    GTokenType token = g_scanner_get_next_token(scanner);
+    if (';' == token) {
+        token = g_scanner_get_next_token(scanner);
+    }
+    if (G_TOKEN_EOF != token) {
+        ddl_syntax_error(scanner, "end of statement");
+    }
+
+    g_scanner_destroy(scanner);
+
+    struct mdb_view *view = NULL;
+    GPtrArray *views = mdb_views();
+
+    for (guint i = 0; i < views->len; ++i) {
+        if (0 == g_strcmp0(name, ((struct mdb_view *) g_ptr_array_index(views, i))->name)) {
+            view = g_ptr_array_index(views, i);
+        }
+    }
+
+    if (NULL == view) {
+        fprintf(stderr, "error: view: %s: does not exist\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    gchar *view_path = g_strconcat(MULTIDB_TABLESDIR, "/", view->name, NULL);
+
+    get_table_lock(view_path);
+    view_refresh_all(view);
+    free_table_lock(view_path);
+
+    g_free(view_path);
+    g_free(name);
+
+    /* Counted with the other statements that change a table's definition */
+    mdb_quiesce_leave();
+    mdb_stats_statement(MDB_STMT_ALTER, started_us);
+}
+
+struct mdb_view * mdb_view_load(const gchar *name, const gchar *definition)
+{
+    struct mdb_view *view = g_malloc0(sizeof(struct mdb_view));
+    gchar **lines = g_strsplit(definition, "\n", 3);
+
+    if (NULL == lines[0] || NULL == lines[1]) {
+        fprintf(stderr, "error: view: %s: corrupt definition\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    view->name = g_strdup(name);
+    view->cols = g_strsplit(lines[0], "\t", -1);
+    view->select = parse_select(lines[1]);
+    view->exprs = view->select.exprs;
+    view->select.exprs = NULL;
+    view->col_types = g_new0(MdbColumnType, g_strv_length(view->cols));
+
+    view->tables = g_slist_copy(view->select.tables);
+    for (GSList *iter = view->select.joins; iter; iter = iter->next) {
+        view->tables = g_slist_append(view->tables, ((struct ddl_join *) iter->data)->tbl_name);
+    }
+
+    for (guint i = 0; i < view->exprs->len; ++i) {
+        mdb_expr_check_columns(g_ptr_array_index(view->exprs, i), view->tables, "SELECT");
+    }
+
+    if (view->exprs->len != g_strv_length(view->cols)) {
+        fprintf(stderr, "error: view: %s: corrupt definition\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (guint i = 0; view->cols[i]; ++i) {
+        mdb_col_type_from_name(g_hash_table_lookup(cached_schema(name), view->cols[i]), &view->col_types[i]);
+    }
+
+    view->where = compile_where(&view->select, view->tables, "SELECT");
+
+    g_strfreev(lines);
+
+    return(view);
+}
+
+void free_mdb_view(struct mdb_view *view)
+{
+    g_free(view->name);
+    g_strfreev(view->cols);
+    g_free(view->col_types);
+    g_slist_free(view->tables);
+    g_ptr_array_free(view->exprs, TRUE);
+    mdb_expr_free(view->where);
+    free_ddl_parsed(&view->select);
+    g_free(view);
+}
+
+/*
+ * Every view, each loaded once.  The directory is listed on every call,
+ * so a view made by another process is kept up from its next change on.
+ */
+
+GPtrArray * mdb_views(void)
+{
+    static GPtrArray *views = NULL;
+    static GHashTable *loaded = NULL;
+
+    if (NULL == views) {
+        views = g_ptr_array_new();
+        loaded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) free_mdb_view);
+    }
+
+    gchar *views_path = g_strconcat(MULTIDB_DATADIR, "/", "views", NULL);
+    GDir *dir = g_dir_open(views_path, 0, NULL);
+    const gchar *name;
+
+    g_ptr_array_set_size(views, 0);
+
+    while (dir && (name = g_dir_read_name(dir))) {
+        if ('.' == *name) {
+            continue;
+        }
+
+        struct mdb_view *view = g_hash_table_lookup(loaded, name);
+
+        if (NULL == view) {
+            gchar *path = g_strconcat(views_path, "/", name, NULL);
+            gchar *definition = NULL;
+
+            if (!g_file_get_contents(path, &definition, NULL, NULL)) {
+                fprintf(stderr, "error: view: %s: can't be read\n", path);
+                exit(EXIT_FAILURE);
+            }
+
+            view = mdb_view_load(name, definition);
+            g_hash_table_insert(loaded, g_strdup(name), view);
+
+            g_free(definition);
+            g_free(path);
+        }
+
+        g_ptr_array_add(views, view);
+    }
+
+    if (dir) {
+        g_dir_close(dir);
+    }
+
+    g_free(views_path);
+
+    return(views);
+}
+
+gboolean mdb_is_view(const gchar *table)
+{
+    gchar *path = g_strconcat(MULTIDB_DATADIR, "/", "views", "/", table, NULL);
+    gboolean ret = g_file_test(path, G_FILE_TEST_IS_REGULAR);
+
+    g_free(path);
+
+    return(ret);
+}
+
+/* Only the view's own upkeep writes its rows */
+void mdb_refuse_view(const gchar *table, const gchar *stmt)
+{
+    if (mdb_is_view(table)) {
+        fprintf(stderr, "error: table: %s: is a materialized view, %s can't change it\n", table, stmt);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Where a table keeps a roid's row, NULL if it has none */
+gchar * mdb_row_entry(const gchar *table, gint64 roid)
+{
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+    gchar *partition_col = table_partition_col(table);
+    gchar *entry_path = NULL;
+
+    if (lsm_view(table)) {
+        entry_path = g_strdup_printf("lsm/%li", roid);
+    }
+    else if (partition_col) {
+        GPtrArray *parts = load_partitions(table, partition_col);
+
+        for (guint i = 0; i < parts->len && NULL == entry_path; ++i) {
+            gchar *path = row_entry_path(table_path, ((struct mdb_partition *) g_ptr_array_index(parts, i))->name, roid);
+
+            if (0 == access(path, F_OK)) {
+                entry_path = path;
+            }
+            else {
+                g_free(path);
+            }
+        }
+
+        g_ptr_array_free(parts, TRUE);
+    }
+    else {
+        entry_path = row_entry_path(table_path, NULL, roid);
+    }
+
+    if (entry_path && !mdb_row_exists(table, entry_path)) {
+        g_free(entry_path);
+        entry_path = NULL;
+    }
+
+    g_free(partition_col);
+    g_free(table_path);
+
+    return(entry_path);
+}
+
+/* Whether expr reads any of cols of table; unqualified columns are from's */
+gboolean mdb_expr_uses(struct mdb_expr *expr, const gchar *from, const gchar *table, GHashTable *cols)
+{
+    if (NULL == expr) {
+        return(FALSE);
+    }
+
+    if (MDB_EXPR_COLUMN == expr->kind) {
+        return(0 == g_strcmp0(expr->table ? expr->table : from, table) && g_hash_table_contains(cols, expr->col));
+    }
+
+    for (guint i = 0; i < expr->args->len; ++i) {
+        if (mdb_expr_uses(g_ptr_array_index(expr->args, i), from, table, cols)) {
+            return(TRUE);
+        }
+    }
+
+    return(FALSE);
+}
+
+gboolean view_uses(struct mdb_view *view, const gchar *table, GHashTable *cols)
+{
+    const gchar *from = view->select.tables->data;
+
+    for (guint i = 0; i < view->exprs->len; ++i) {
+        if (mdb_expr_uses(g_ptr_array_index(view->exprs, i), from, table, cols)) {
+            return(TRUE);
+        }
+    }
+
+    if (mdb_expr_uses(view->where, from, table, cols)) {
+        return(TRUE);
+    }
+
+    for (GSList *iter = view->select.joins; iter; iter = iter->next) {
+        struct ddl_join *join = iter->data;
+        const gchar *on[] = { join->on_left, join->on_right };
+
+        for (guint i = 0; i < G_N_ELEMENTS(on); ++i) {
+            const gchar *dot = strchr(on[i], '.');
+
+            if (dot && 0 == strncmp(on[i], table, dot - on[i]) && '\0' == table[dot - on[i]] && g_hash_table_contains(cols, &dot[1])) {
+                return(TRUE);
+            }
+        }
+    }
+
+    return(FALSE);
+}
+
+/* A row directory out of the way in one rename, then removed from purgatory */
+void mdb_purge_row(const gchar *table, gint64 roid, const gchar *row_path)
+{
+    if (0 != access(row_path, F_OK)) {
+        return;
+    }
+
+    gchar *purgatory = g_strdup_printf("%s/%s.%li.%d", MULTIDB_PURGATORYDIR, table, roid, getpid());
+
+    if (0 != g_mkdir_with_parents(MULTIDB_PURGATORYDIR, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", MULTIDB_PURGATORYDIR, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (-1 == rename(row_path, purgatory)) {
+        fprintf(stderr, "error: rename: %s -> %s: %s\n", row_path, purgatory, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    remove_tree(purgatory);
+    ++mdb_counters()->purgatory_reclaimed;
+    g_free(purgatory);
+}
+
+/*
+ * Work out the view's row for roid of the FROM table again, from the
+ * row at entry_path (gone if NULL).  The caller holds the view's lock.
+ */
+
+void view_refresh_row(struct mdb_view *view, gint64 roid, const gchar *entry_path)
+{
+    const gchar *from = view->select.tables->data;
+    gchar *view_path = g_strconcat(MULTIDB_TABLESDIR, "/", view->name, NULL);
+    gchar *row_path = row_entry_path(view_path, NULL, roid);
+    GHashTable *paths = NULL;
+    gboolean matched = FALSE;
+
+    /* Readers that pooled the old row's values see its version move */
+    row_version_take(view->name, roid);
+
+    mdb_purge_row(view->name, roid, row_path);
+
+    /* Joined and filtered just as the SELECT would */
+    if (entry_path && mdb_row_exists(from, entry_path)) {
+        if (view->select.joins) {
+            paths = included_in_join((gchar *) entry_path, view->select.joins, NULL);
+            matched = 0 != g_hash_table_size(paths);
+        }
+        else {
+            paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+            matched = TRUE;
+        }
+
+        g_hash_table_insert(paths, g_strdup(from), g_strdup(entry_path));
+        matched = matched && row_matches(view->where, paths, from);
+    }
+
+    if (matched) {
+        struct mdb_row_ctx ctx = { .paths = paths, .table = from };
+        gchar *tmp = g_strdup_printf("%s/.%li.%d", view_path, roid, getpid());
+        gchar *bucket = g_path_get_dirname(row_path);
+
+        if (0 != g_mkdir_with_parents(tmp, 0775) || 0 != g_mkdir_with_parents(bucket, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", tmp, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (guint i = 0; i < view->exprs->len; ++i) {
+            struct mdb_col value;
+
+            mdb_expr_eval(g_ptr_array_index(view->exprs, i), &ctx, &value);
+
+            gchar *literal = value.stale ? g_strdup("NULL") : mdb_col_to_string(&value);
+            gchar *file = g_strconcat(tmp, "/", view->cols[i], NULL);
+
+            set_null_bit(view->name, view->cols[i], roid, write_typed_col_file(file, view->col_types[i], literal, MDB_CODEC_NONE));
+
+            g_free(file);
+            g_free(literal);
+            mdb_col_clear(&value);
+        }
+
+        if (-1 == rename(tmp, row_path)) {
+            fprintf(stderr, "error: rename: %s -> %s: %s\n", tmp, row_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        g_free(bucket);
+        g_free(tmp);
+    }
+
+    ++mdb_counters()->view_rows_refreshed;
+
+    row_version_release(view->name, roid);
+
+    if (paths) {
+        g_hash_table_destroy(paths);
+    }
+    g_free(row_path);
+    g_free(view_path);
+}
+
+/* The view's rows all go, then every row of the FROM table is worked out again */
+void view_refresh_all(struct mdb_view *view)
+{
+    GArray *roids = g_array_new(FALSE, FALSE, sizeof(gint64));
+    struct mdb_tbl_scanner *scan = NULL;
+
+    init_scan_table(&scan, view->name);
+    while (scan_table(scan)) {
+        gint64 roid = entry_roid(scan->entry_path);
+        g_array_append_val(roids, roid);
+    }
+    final_scan_table(&scan);
+
+    for (guint i = 0; i < roids->len; ++i) {
+        view_refresh_row(view, g_array_index(roids, gint64, i), NULL);
+    }
+
+    init_scan_table(&scan, view->select.tables->data);
+    while (scan_table(scan)) {
+        view_refresh_row(view, entry_roid(scan->entry_path), scan->entry_path);
+    }
+    final_scan_table(&scan);
+
+    g_array_free(roids, TRUE);
+}
+
+/*
+ * A joined row with one of keys (literals of its ON column) changed:
+ * the FROM rows that join on them are worked out again
+ */
+
+void view_refresh_joined(struct mdb_view *view, struct ddl_join *join, GSList *keys)
+{
+    const gchar *from = view->select.tables->data;
+    const gchar *left_col = strchr(join->on_left, '.') + 1;
+    const gchar *right_col = strchr(join->on_right, '.') + 1;
+    MdbColumnType right_type = MDB_COL_TEXT;
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(struct mdb_col));
+    GArray *roids = g_array_new(FALSE, FALSE, sizeof(gint64));
+    GPtrArray *entries = g_ptr_array_new_with_free_func(g_free);
+
+    mdb_col_type_from_name(g_hash_table_lookup(cached_schema(join->tbl_name), right_col), &right_type);
+
+    /* NULL never joins */
+    for (GSList *key = keys; key; key = key->next) {
+        struct mdb_col value;
+
+        if (mdb_col_from_literal(right_type, key->data, &value) && !value.null) {
+            g_array_append_val(values, value);
+        }
+        else {
+            mdb_col_clear(&value);
+        }
+    }
+
+    struct mdb_tbl_scanner *scan = NULL;
+
+    init_scan_table(&scan, (gchar *) from);
+    scan_prefetch_col(scan, left_col);
+
+    while (values->len && scan_table(scan)) {
+        struct mdb_col left;
+        gboolean matched = FALSE;
+
+        read_mdb_col((gchar *) from, left_col, cached_schema(from), scan->entry_path, &left);
+
+        for (guint i = 0; i < values->len && !left.stale && !left.null && !matched; ++i) {
+            matched = 0 == mdb_col_cmp(&left, &g_array_index(values, struct mdb_col, i));
+        }
+
+        if (matched) {
+            gint64 roid = entry_roid(scan->entry_path);
+
+            g_array_append_val(roids, roid);
+            g_ptr_array_add(entries, g_strdup(scan->entry_path));
+        }
+
+        mdb_col_clear(&left);
+    }
 
-            case STATE_START_VALUES: 
-                if (G_TOKEN_LEFT_PAREN == tokenType) {
-                    state = STATE_PROCESS_VALUES;
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    final_scan_table(&scan);
 
-            case STATE_PROCESS_VALUES: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    // g_print("value: %s\n", scanner->value.v_identifier);
-                    if (_buf) {
-                        gchar *t = _buf;
-                        _buf = g_strconcat(_buf, scanner->value.v_identifier, NULL);
-                        g_free(t);
-                    }
-                    else {
-                        _buf = g_strdup(scanner->value.v_identifier);
-                    }
-                }
-                else if ('\'' == tokenType) {
-                    if (_buf) {
-                        gchar *t = _buf;
-                        _buf = g_strconcat(_buf, "'", NULL);
-                        g_free(t);
-                    }
-                    else {
-                        _buf = g_strdup("'");
-                    }
-                }
-                else if (G_TOKEN_COMMA == tokenType) {
-                    ddl_create.values = g_slist_append(ddl_create.values, g_strdup(_buf));
-                    g_free(_buf);
-                    _buf = NULL;
-                }
-                else if (G_TOKEN_RIGHT_PAREN == tokenType) {
-                    GTokenType nextToken = g_scanner_peek_next_token(scanner);
+    for (guint i = 0; i < roids->len; ++i) {
+        view_refresh_row(view, g_array_index(roids, gint64, i), g_ptr_array_index(entries, i));
+    }
 
-                    if (';' == nextToken) {
-                        state = STATE_END_VALUES;
+    for (guint i = 0; i < values->len; ++i) {
+        mdb_col_clear(&g_array_index(values, struct mdb_col, i));
+    }
 
-                        ddl_create.values = g_slist_append(ddl_create.values, g_strdup(_buf));
-                        g_free(_buf);
-                        _buf = NULL;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else if (G_TOKEN_INT == tokenType) {
-                    if (_buf) {
-                        gchar *t = _buf;
-                        gchar *converted = g_strdup_printf("%li", scanner->value.v_int);
-                        _buf = g_strconcat(_buf, converted, NULL);
-                        g_free(t);
-                        g_free(converted);
-                    }
-                    else {
-                        gchar *converted = g_strdup_printf("%li", scanner->value.v_int);
-                        _buf = g_strdup(converted);
-                        g_free(converted);
-                    }
-                }
-                else if (G_TOKEN_STRING == tokenType) {
-                    if (_buf) {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                    else {
-                        _buf = g_strconcat("'", scanner->value.v_string, "'", NULL);
-                    }
+    g_array_free(values, TRUE);
+    g_array_free(roids, TRUE);
+    g_ptr_array_free(entries, TRUE);
+}
+
+/* One row change, as logged, applied to every view that reads the table */
+void mdb_views_apply(const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after)
+{
+    GPtrArray *views = mdb_views();
+
+    for (guint i = 0; i < views->len; ++i) {
+        struct mdb_view *view = g_ptr_array_index(views, i);
+
+        if (NULL == g_slist_find_custom(view->tables, table, (GCompareFunc) g_strcmp0)) {
+            continue;
+        }
+
+        /* An UPDATE of columns the view doesn't read changes nothing */
+        if (0 == g_strcmp0("UPDATE", kind) && !view_uses(view, table, after)) {
+            continue;
+        }
+
+        gchar *view_path = g_strconcat(MULTIDB_TABLESDIR, "/", view->name, NULL);
+
+        get_table_lock(view_path);
+
+        if (0 == g_strcmp0(view->select.tables->data, table)) {
+            gchar *entry_path = mdb_row_entry(table, roid);
+
+            view_refresh_row(view, roid, entry_path);
+            g_free(entry_path);
+        }
+
+        for (GSList *iter = view->select.joins; iter; iter = iter->next) {
+            struct ddl_join *join = iter->data;
+            const gchar *col = strchr(join->on_right, '.') + 1;
+            GHashTable *current = mdb_change_cols_new();
+            GSList *keys = NULL;
+
+            if (0 != g_strcmp0(join->tbl_name, table)) {
+                g_hash_table_destroy(current);
+                continue;
+            }
+
+            if (before && g_hash_table_lookup(before, col)) {
+                keys = g_slist_append(keys, g_hash_table_lookup(before, col));
+            }
+
+            /* An UPDATE that left the key alone still changed what joins on it */
+            if (after && g_hash_table_lookup(after, col)) {
+                keys = g_slist_append(keys, g_hash_table_lookup(after, col));
+            }
+            else if (0 == g_strcmp0("UPDATE", kind)) {
+                gchar *entry_path = mdb_row_entry(table, roid);
+
+                if (entry_path) {
+                    mdb_change_read(current, table, entry_path, col);
                 }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
+                if (g_hash_table_lookup(current, col)) {
+                    keys = g_slist_append(keys, g_hash_table_lookup(current, col));
                 }
-            break;
+
+                g_free(entry_path);
+            }
+
+            view_refresh_joined(view, join, keys);
+
+            g_slist_free(keys);
+            g_hash_table_destroy(current);
+        }
+
+        free_table_lock(view_path);
+        g_free(view_path);
+    }
+}
+
+/* Lines of the change log, as a transaction publishes them */
+void mdb_views_apply_changes(const gchar *text)
+{
+    gchar **lines = g_strsplit(text, "\n", -1);
+
+    for (gchar **line = lines; *line && **line; ++line) {
+        GHashTable *before = mdb_change_cols_new();
+        GHashTable *after = mdb_change_cols_new();
+        gchar *kind = NULL;
+        gchar *table = NULL;
+        gint64 roid;
+
+        if (mdb_change_parse(*line, &kind, &table, &roid, before, after)) {
+            mdb_views_apply(kind, table, roid, before, after);
+        }
+
+        g_free(kind);
+        g_free(table);
+        g_hash_table_destroy(before);
+        g_hash_table_destroy(after);
+    }
+
+    g_strfreev(lines);
+}
+
+/*
+ * Replicas
+ *
+ * A replica is a database of its own, in another MULTIDB_PREFIX, that
+ * --replica keeps a copy of a primary in.  It starts as a copy of the
+ * primary's data directory, taken after registering as a consumer of
+ * its change log, and then follows the log from there: each change's
+ * values are written to the row in log order, by the same writers as
+ * the primary's, which keep the replica's own views, NULL bits and LSM
+ * runs.  Writing a row again is harmless, so the copy and the log can
+ * overlap.  A CREATE or ALTER line brings the table's definition and
+ * metadata across; nothing else is read from the primary's files.
+ *
+ * multidb/replica holds the primary, the LSN of the first change not
+ * yet applied and when the follower last had all of the log.  Nothing
+ * but the follower writes to a replica.
+ */
+
+/*
+ * Make to a copy of from, a file or a directory tree.  Files of the
+ * same size and mtime are left alone unless that mtime is too recent to
+ * tell a write in the same second apart, and names from lacks go.  Dot
+ * files, somebody's unfinished write, are neither copied nor removed;
+ * nor are the names in skip, which is for from's top level only.
+ */
+
+void mdb_mirror(const gchar *from, const gchar *to, const gchar * const *skip)
+{
+    struct stat from_st;
+    struct stat to_st;
+    gboolean have_to = 0 == lstat(to, &to_st);
+
+    /* Gone from under us: what removed it comes later in the log */
+    if (0 != stat(from, &from_st)) {
+        if (have_to) {
+            remove_tree(to);
+        }
+        return;
+    }
+
+    if (S_ISDIR(from_st.st_mode)) {
+        GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        const gchar *name;
+
+        if (have_to && !S_ISDIR(to_st.st_mode)) {
+            remove_tree(to);
+        }
+
+        if (0 != g_mkdir_with_parents(to, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", to, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        GDir *dir = dir_open((gchar *) from);
+        while (dir && (name = g_dir_read_name(dir))) {
+            if ('.' == *name || (skip && g_strv_contains(skip, name))) {
+                continue;
+            }
+
+            gchar *from_child = g_strconcat(from, "/", name, NULL);
+            gchar *to_child = g_strconcat(to, "/", name, NULL);
+
+            mdb_mirror(from_child, to_child, NULL);
+            g_hash_table_add(names, g_strdup(name));
+
+            g_free(from_child);
+            g_free(to_child);
+        }
+        if (dir) {
+            g_dir_close(dir);
+        }
+
+        dir = dir_open((gchar *) to);
+        while (dir && (name = g_dir_read_name(dir))) {
+            if ('.' == *name || (skip && g_strv_contains(skip, name)) || g_hash_table_contains(names, name)) {
+                continue;
+            }
+
+            gchar *to_child = g_strconcat(to, "/", name, NULL);
+            remove_tree(to_child);
+            g_free(to_child);
+        }
+        if (dir) {
+            g_dir_close(dir);
+        }
+
+        g_hash_table_destroy(names);
+        return;
+    }
+
+    if (have_to && S_ISREG(to_st.st_mode) && from_st.st_size == to_st.st_size &&
+        from_st.st_mtime == to_st.st_mtime && from_st.st_mtime < time(NULL) - 1) {
+        return;
+    }
+
+    gchar *contents = NULL;
+    gsize len = 0;
+
+    if (!g_file_get_contents(from, &contents, &len, NULL)) {
+        g_free(contents);
+        return;
+    }
+
+    ++mdb_counters()->files_opened;
+    mdb_counters()->bytes_read += len;
+
+    gchar *dir = g_path_get_dirname(to);
+    gchar *base = g_path_get_basename(to);
+    gchar *tmp = g_strdup_printf("%s/.%s.%d", dir, base, getpid());
+    struct utimbuf times = { .actime = from_st.st_atime, .modtime = from_st.st_mtime };
+
+    /* The mtime seen before reading, so a write since makes it differ */
+    write_bytes_file(tmp, (guint8 *) contents, len);
+    utime(tmp, &times);
+
+    if (have_to && S_ISDIR(to_st.st_mode)) {
+        remove_tree(to);
+    }
+
+    if (-1 == rename(tmp, to)) {
+        fprintf(stderr, "error: rename: %s -> %s: %s\n", tmp, to, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(tmp);
+    g_free(base);
+    g_free(dir);
+    g_free(contents);
+}
+
+/* FALSE when this database isn't a replica */
+gboolean mdb_replica_load(struct mdb_replica *replica)
+{
+    gchar *path = g_strconcat(MULTIDB_BASEDIR, "/", "replica", NULL);
+    gchar *contents = NULL;
+
+    memset(replica, 0, sizeof(struct mdb_replica));
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        g_free(path);
+        return(FALSE);
+    }
+
+    gchar **lines = g_strsplit(contents, "\n", -1);
+
+    if (g_strv_length(lines) < 3) {
+        fprintf(stderr, "error: replica: %s: not a replica's state\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    replica->primary = g_strdup(lines[0]);
+    replica->datadir = g_strconcat(replica->primary, "/", "multidb", "/", "data", NULL);
+    replica->lsn = g_ascii_strtoll(lines[1], NULL, 10);
+    replica->caught_up_us = g_ascii_strtoll(lines[2], NULL, 10);
+
+    g_strfreev(lines);
+    g_free(contents);
+    g_free(path);
+
+    return(TRUE);
+}
+
+void mdb_replica_save(struct mdb_replica *replica)
+{
+    gchar *path = g_strconcat(MULTIDB_BASEDIR, "/", "replica", NULL);
+    gchar *text = g_strdup_printf("%s\n%li\n%li\n", replica->primary, replica->lsn, replica->caught_up_us);
+    GError *error = NULL;
+
+    /* g_file_set_contents() renames a new file over the old one */
+    if (!g_file_set_contents(path, text, -1, &error)) {
+        fprintf(stderr, "error: replica: %s: %s\n", path, error->message);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(text);
+    g_free(path);
+}
+
+void free_mdb_replica(struct mdb_replica *replica)
+{
+    g_free(replica->primary);
+    g_free(replica->datadir);
+}
+
+void mdb_refuse_replica(const gchar *stmt)
+{
+    static gint replica = -1;
+
+    if (-1 == replica) {
+        gchar *path = g_strconcat(MULTIDB_BASEDIR, "/", "replica", NULL);
+        replica = g_file_test(path, G_FILE_TEST_EXISTS);
+        g_free(path);
+    }
+
+    if (replica) {
+        fprintf(stderr, "error: %s: this database is a replica, only its follower writes to it\n", stmt);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * How far behind its primary a replica is: the bytes of change log it
+ * has yet to apply and, if any, the time since it last had them all.
+ * FALSE when this database isn't a replica.
+ */
+
+gboolean mdb_replica_lag(gint64 *bytes, gdouble *seconds)
+{
+    struct mdb_replica replica;
+    struct stat st;
+
+    if (!mdb_replica_load(&replica)) {
+        return(FALSE);
+    }
+
+    gchar *path = g_strconcat(replica.datadir, "/", "changes", NULL);
+    gint64 size = 0 == stat(path, &st) ? st.st_size : 0;
+
+    *bytes = MAX(0, size - replica.lsn);
+    *seconds = *bytes ? MAX(0, g_get_real_time() - replica.caught_up_us) / (gdouble) G_USEC_PER_SEC : 0;
+
+    g_free(path);
+    free_mdb_replica(&replica);
+
+    return(TRUE);
+}
+
+/*
+ * One table's files but for its locks.  Rows only when the replica is
+ * made; after that they come with the log, which also keeps the NULL
+ * bits, and a partitioned table's partitions are only made and dropped.
+ */
+
+void replica_sync_table(struct mdb_replica *replica, const gchar *table, gboolean rows)
+{
+    static const gchar *seed_skip[] = { "row_locks", "row_versions", NULL };
+    static const gchar *metadata_skip[] = { "row_locks", "row_versions", "nulls", NULL };
+    static const gchar *lsm_skip[] = { "lock", NULL };
+
+    gchar *from = g_strconcat(replica->datadir, "/", "tables", "/", table, NULL);
+    gchar *to = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+    gchar *from_sub = g_strconcat(from, "/", "metadata", NULL);
+    gchar *to_sub = g_strconcat(to, "/", "metadata", NULL);
+
+    mdb_mirror(from_sub, to_sub, rows ? seed_skip : metadata_skip);
+
+    g_free(from_sub);
+    g_free(to_sub);
+
+    from_sub = g_strconcat(from, "/", "rows", NULL);
+    to_sub = g_strconcat(to, "/", "rows", NULL);
+
+    if (rows) {
+        mdb_mirror(from_sub, to_sub, NULL);
+    }
+    else if (0 != g_mkdir_with_parents(to_sub, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", to_sub, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(from_sub);
+    g_free(to_sub);
+
+    from_sub = g_strconcat(from, "/", "partitions", NULL);
+    to_sub = g_strconcat(to, "/", "partitions", NULL);
+
+    if (rows) {
+        mdb_mirror(from_sub, to_sub, NULL);
+    }
+    else if (g_file_test(from_sub, G_FILE_TEST_IS_DIR)) {
+        GDir *dir = dir_open(from_sub);
+        const gchar *name;
+
+        while (dir && (name = g_dir_read_name(dir))) {
+            gchar *path = g_strconcat(to_sub, "/", name, "/", "rows", NULL);
+
+            if (0 != g_mkdir_with_parents(path, 0775)) {
+                fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            g_free(path);
+        }
+        if (dir) {
+            g_dir_close(dir);
+        }
+
+        dir = dir_open(to_sub);
+        while (dir && (name = g_dir_read_name(dir))) {
+            gchar *path = g_strconcat(from_sub, "/", name, NULL);
+
+            if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                g_free(path);
+                path = g_strconcat(to_sub, "/", name, NULL);
+                remove_tree(path);
+            }
+
+            g_free(path);
+        }
+        if (dir) {
+            g_dir_close(dir);
+        }
+    }
+
+    g_free(from_sub);
+    g_free(to_sub);
+
+    /* An LSM table's own flushes and compactions shape its runs from here on */
+    from_sub = g_strconcat(from, "/", "lsm", NULL);
+    to_sub = g_strconcat(to, "/", "lsm", NULL);
+
+    if (rows && g_file_test(from_sub, G_FILE_TEST_IS_DIR)) {
+        mdb_mirror(from_sub, to_sub, lsm_skip);
+    }
+
+    g_free(from_sub);
+    g_free(to_sub);
+
+    from_sub = g_strconcat(from, "/", "lsm", "/", "runs", NULL);
+    to_sub = g_strconcat(to, "/", "lsm", "/", "runs", NULL);
+
+    if (g_file_test(from_sub, G_FILE_TEST_IS_DIR) && 0 != g_mkdir_with_parents(to_sub, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", to_sub, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(from_sub);
+    g_free(to_sub);
+    g_free(from);
+    g_free(to);
+}
+
+/*
+ * When the replica is made: the primary's tables and views as they are
+ * now.  A view new to the replica is worked out from scratch: its rows
+ * were copied while the primary may have been filling them.
+ */
+
+void replica_sync_tables(struct mdb_replica *replica)
+{
+    gchar *from_views = g_strconcat(replica->datadir, "/", "views", NULL);
+    gchar *to_views = g_strconcat(MULTIDB_DATADIR, "/", "views", NULL);
+    gchar *schema = g_strconcat(replica->datadir, "/", "schema", NULL);
+    GSList *fresh_views = NULL;
+    const gchar *name;
+    GDir *dir;
+
+    dir = dir_open(from_views);
+    while (dir && (name = g_dir_read_name(dir))) {
+        if ('.' != *name && !mdb_is_view(name)) {
+            fresh_views = g_slist_append(fresh_views, g_strdup(name));
+        }
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+
+    if (g_file_test(from_views, G_FILE_TEST_IS_DIR)) {
+        mdb_mirror(from_views, to_views, NULL);
+    }
+
+    dir = dir_open(schema);
+    while (dir && (name = g_dir_read_name(dir))) {
+        gchar *from_schema = g_strconcat(schema, "/", name, NULL);
+        gchar *to_schema = g_strconcat(MULTIDB_SCHEMADIR, "/", name, NULL);
+        gchar *from_table = g_strconcat(replica->datadir, "/", "tables", "/", name, NULL);
+        gchar *to_table = g_strconcat(MULTIDB_TABLESDIR, "/", name, NULL);
+
+        /* A CREATE TABLE halfway done is picked up next time */
+        if ('.' != *name && g_file_test(from_table, G_FILE_TEST_IS_DIR)) {
+            gboolean fresh = !g_file_test(to_table, G_FILE_TEST_IS_DIR);
+
+            mdb_mirror(from_schema, to_schema, NULL);
+            replica_sync_table(replica, name, fresh);
+        }
+
+        g_free(from_schema);
+        g_free(to_schema);
+        g_free(from_table);
+        g_free(to_table);
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+
+    for (GSList *iter = fresh_views; iter; iter = iter->next) {
+        GPtrArray *views = mdb_views();
+
+        for (guint i = 0; i < views->len; ++i) {
+            struct mdb_view *view = g_ptr_array_index(views, i);
+
+            if (0 == g_strcmp0(view->name, iter->data)) {
+                gchar *view_path = g_strconcat(MULTIDB_TABLESDIR, "/", view->name, NULL);
+
+                get_table_lock(view_path);
+                view_refresh_all(view);
+                free_table_lock(view_path);
+
+                g_free(view_path);
+            }
         }
     }
 
-    g_free(_buf);
+    /* Bitmaps read before their files were replaced */
+    g_hash_table_remove_all(null_bitmaps());
 
-    return(ddl_create);
+    g_slist_free_full(fresh_views, g_free);
+    g_free(schema);
+    g_free(from_views);
+    g_free(to_views);
 }
 
-GDir * dir_open(gchar *path)
+/*
+ * CREATE or ALTER of a table or view: its definition and metadata as
+ * the primary has them, which is at least as its record left them.  A
+ * view new to the replica is worked out from the replica's own tables.
+ */
+
+void replica_sync_ddl(struct mdb_replica *replica, const gchar *table)
 {
-    GError *error = NULL;
-    GDir *dir = g_dir_open(path, 0, &error);
-    if (error) {
-        return(NULL);
-        // fprintf(stderr, "error: g_dir_open [%s]: %s\n", path, error->message);
-        // exit(EXIT_FAILURE);
+    gchar *from_schema = g_strconcat(replica->datadir, "/", "schema", "/", table, NULL);
+    gchar *to_schema = g_strconcat(MULTIDB_SCHEMADIR, "/", table, NULL);
+    gchar *from_table = g_strconcat(replica->datadir, "/", "tables", "/", table, NULL);
+    gchar *from_view = g_strconcat(replica->datadir, "/", "views", "/", table, NULL);
+    gchar *to_views = g_strconcat(MULTIDB_DATADIR, "/", "views", NULL);
+    gchar *to_view = g_strconcat(to_views, "/", table, NULL);
+
+    if (g_file_test(from_table, G_FILE_TEST_IS_DIR)) {
+        mdb_mirror(from_schema, to_schema, NULL);
+        replica_sync_table(replica, table, FALSE);
     }
 
-    return(dir);
-}
+    if (g_file_test(from_view, G_FILE_TEST_IS_REGULAR) && !mdb_is_view(table)) {
+        if (0 != g_mkdir_with_parents(to_views, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", to_views, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-int gslist_tbl_injoin(gconstpointer data, gconstpointer str)
-{
-    struct ddl_join *join = (struct ddl_join *) data;
-    // g_print("{%s} %s: %d\n", join->tbl_name, str, g_ascii_strncasecmp(data, str, strlen(data)));
-    return (g_ascii_strncasecmp(join->tbl_name, str, strlen(join->tbl_name)));
-}
+        mdb_mirror(from_view, to_view, NULL);
 
-int gslist_cmp_string(gconstpointer data, gconstpointer str)
-{
-    // g_print("[%s] %s: %d\n", data, str, g_ascii_strncasecmp(data, str, strlen(data)));
-    return (g_ascii_strncasecmp(data, str, strlen(data)));
+        GPtrArray *views = mdb_views();
+
+        for (guint i = 0; i < views->len; ++i) {
+            struct mdb_view *view = g_ptr_array_index(views, i);
+
+            if (0 == g_strcmp0(view->name, table)) {
+                gchar *view_path = g_strconcat(MULTIDB_TABLESDIR, "/", view->name, NULL);
+
+                get_table_lock(view_path);
+                view_refresh_all(view);
+                free_table_lock(view_path);
+
+                g_free(view_path);
+            }
+        }
+    }
+
+    /* Which tables the replica's views read may have changed */
+    mdb_changes_refresh();
+
+    g_free(from_schema);
+    g_free(to_schema);
+    g_free(from_table);
+    g_free(from_view);
+    g_free(to_views);
+    g_free(to_view);
 }
 
-void execute_ddl_select(gchar *sql)
+/*
+ * The partition an INSERT record's row goes in.  An INSERT into a new
+ * partition can be logged before the ALTER that added it.
+ */
+
+gchar * replica_partition(struct mdb_replica *replica, const gchar *table, GHashTable *after)
 {
-    struct ddl_parsed ddl_select = parse_select(sql);
-    GSList *cols = NULL;
-    GSList *table = NULL;
-    GSList *asterisk = NULL;
+    gchar *col = table_partition_col(table);
+    gchar *name = NULL;
 
-    /*
-    g_print("WHERE [SELECT]: %s\n", ddl_select.where);
-    for (GSList *iter = ddl_select.cols; iter; iter = iter->next) {
-        g_print("\t[COLS] %s\n", iter->data);
+    if (NULL == col) {
+        return(NULL);
     }
-    for (GSList *iter = ddl_select.joins; iter; iter = iter->next) {
-        struct ddl_join *join = iter->data;
-        g_print("\t[JOIN] %s ON [%s] [%s]\n", join->tbl_name, join->on_left, join->on_right);
+
+    name = partition_for(table, col, g_hash_table_lookup(after, col));
+
+    if (NULL == name) {
+        replica_sync_ddl(replica, table);
+        name = partition_for(table, col, g_hash_table_lookup(after, col));
     }
-    */
 
-    /* Handle the '*' in SELECT */
-    while ((asterisk = g_slist_find_custom(ddl_select.cols, "*", gslist_cmp_string))) {
-        table = ddl_select.tables;
-        while (table) {
-            gchar *cols_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table->data, NULL);
-            GDir *cols_dir = dir_open(cols_path);
-            const gchar *col = g_dir_read_name(cols_dir);
+    if (NULL == name) {
+        fprintf(stderr, "error: replica: [%s]::[%s]: no partition for %s\n", table, col, (gchar *) g_hash_table_lookup(after, col));
+        exit(EXIT_FAILURE);
+    }
 
-            while (col) {
-                ddl_select.cols = g_slist_insert_before(ddl_select.cols, asterisk, g_strconcat(table->data, ".", col, NULL));
-                col = g_dir_read_name(cols_dir);
+    g_free(col);
+
+    return(name);
+}
+
+/*
+ * An INSERT record's row, written whole next to where it goes and
+ * renamed there: the copy the replica started from may have it already
+ */
+
+void replica_insert(struct mdb_replica *replica, const gchar *table, gint64 roid, GHashTable *after)
+{
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+    GHashTable *schema = cached_schema(table);
+    GHashTableIter iter;
+    gpointer col, literal;
+
+    if (lsm_view(table)) {
+        GByteArray *payload = g_byte_array_new();
+        GByteArray *encoded = g_byte_array_new();
+        gpointer type;
+
+        g_hash_table_iter_init(&iter, schema);
+        while (g_hash_table_iter_next(&iter, &col, &type)) {
+            struct mdb_col value = { .col_type = MDB_COL_TEXT, .null = TRUE };
+            MdbColumnType col_type = MDB_COL_TEXT;
+
+            mdb_col_type_from_name(type, &col_type);
+
+            if ((literal = g_hash_table_lookup(after, col))) {
+                mdb_col_from_literal(col_type, literal, &value);
             }
 
-            table = table->next;
-            g_free(cols_path);
-            g_dir_close(cols_dir);
+            encode_mdb_col(&value, encoded);
+            lsm_payload_add(payload, col, encoded->data, encoded->len);
+
+            g_free(value.v_text);
         }
 
-        gpointer data = asterisk->data;
-        ddl_select.cols = g_slist_remove(ddl_select.cols, data);
-        g_free(data);
+        lsm_append(table, MDB_LSM_PUT, roid, payload);
+
+        g_byte_array_free(encoded, TRUE);
+        g_byte_array_free(payload, TRUE);
     }
+    else {
+        gchar *partition = replica_partition(replica, table, after);
+        gchar *to = row_entry_path(table_path, partition, roid);
+        gchar *tmp = g_strdup_printf("%s/.%li.%d", table_path, roid, getpid());
+        gchar *bucket = g_path_get_dirname(to);
+        MdbCodec codec = load_table_codec(table_path);
+        gint version = table_version(table);
+        GSList *nulls = NULL;
+
+        if (0 != g_mkdir_with_parents(tmp, 0775) || 0 != g_mkdir_with_parents(bucket, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", to, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-    /* Verify table is in SELECT stmt */
-    cols = ddl_select.cols;
-    while (cols) {
-        if (g_strstr_len(cols->data, strlen(cols->data), ".")) {
-            gchar *tbl = g_strdup(cols->data);
-            gchar *dot = g_strstr_len(tbl, strlen(tbl), ".");
+        g_hash_table_iter_init(&iter, after);
+        while (g_hash_table_iter_next(&iter, &col, &literal)) {
+            gchar *path = g_strconcat(tmp, "/", col, NULL);
+            MdbColumnType col_type = MDB_COL_TEXT;
 
-            tbl[dot - tbl] = '\0';
+            if (version >= 2) {
+                mdb_col_type_from_name(g_hash_table_lookup(schema, col), &col_type);
 
-            if (NULL == g_slist_find_custom(ddl_select.tables, tbl, gslist_cmp_string) &&
-                NULL == g_slist_find_custom(ddl_select.joins, tbl, gslist_tbl_injoin)
-            ) {
-                fprintf(stderr, "error: table [%s] not in SELECT statement\n", tbl);
-                exit(EXIT_FAILURE);
+                if (write_typed_col_file(path, col_type, literal, codec)) {
+                    nulls = g_slist_prepend(nulls, col);
+                }
+            }
+            else {
+                write_col_file(path, literal, codec);
             }
 
-            g_free(tbl);
+            g_free(path);
         }
-        cols = cols->next;
+
+        mdb_purge_row(table, roid, to);
+
+        if (-1 == rename(tmp, to)) {
+            fprintf(stderr, "error: rename: %s -> %s: %s\n", tmp, to, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        /* An fd of the old directory would still read the row as it was */
+        g_hash_table_remove(entry_fds(), to);
+
+        /* The copy may have had a later UPDATE's NULLs */
+        g_hash_table_iter_init(&iter, after);
+        while (version >= 2 && g_hash_table_iter_next(&iter, &col, NULL)) {
+            set_null_bit(table, col, roid, NULL != g_slist_find(nulls, col));
+        }
+
+        g_slist_free(nulls);
+        g_free(bucket);
+        g_free(tmp);
+        g_free(to);
+        g_free(partition);
     }
 
-    /* Print the headers */
-    cols = ddl_select.cols;
-    while (cols) {
-        g_print("%s%s", cols->data, cols->next ? "\t" : "\n");
-        cols = cols->next;
+    if (mdb_change_wanted(table)) {
+        mdb_change_log("INSERT", table, roid, NULL, after);
     }
 
-    /* Print the rows */
-    table = ddl_select.tables;
-    while (table) {
-        gchar *rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", NULL);
-        GDir *rows;
-        const gchar *bucket;
-        if (!g_file_test(rows_path, G_FILE_TEST_IS_DIR)) {
-            fprintf(stderr, "error: table: %s: does not exist: %s\n", table->data, rows_path);
-            exit(EXIT_FAILURE);
-        }
-
-        rows = dir_open(rows_path);
-        bucket = g_dir_read_name(rows);
-
-        while (bucket) {
-            gchar *row_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", "/", bucket, NULL);
-            gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table->data, NULL);
-            GDir *row = dir_open(row_path);
-            gchar *entry_path;
-
-            const gchar *entry = g_dir_read_name(row);
-            while (entry) {
-                entry_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", "/", bucket, "/", entry, NULL);
-
-                GHashTable *join_entry_paths = NULL;
-                
-                if (NULL == ddl_select.joins) {
-                     // g_print("[DEFAULT] included_in_join\n");
-                    join_entry_paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-                    g_hash_table_insert(join_entry_paths, g_strdup(table->data), g_strdup(entry_path));
-                }
-                else {
-                    join_entry_paths = included_in_join(entry_path, ddl_select.joins);
-                    guint size = g_hash_table_size(join_entry_paths);
-                    if (0 == size) {
-                        entry = g_dir_read_name(row);
-                        g_free(entry_path);
-                        // g_print("join_entry_paths: %p\n", join_entry_paths);
-                        g_hash_table_destroy(join_entry_paths);
-                        // g_print("[FALSE] included_in_join\n");
-                        continue;
-                    }
-                    else {
-                        g_hash_table_insert(join_entry_paths, g_strdup(table->data), g_strdup(entry_path));
-                    }
-                }
+    g_free(table_path);
+}
 
-                if (FALSE == included_in_where(join_entry_paths, table->data, ddl_select.where)) {
-                    entry = g_dir_read_name(row);
-                    g_free(entry_path);
-                    // g_print("[FALSE] included_in_where\n");
-                    continue;
-                }
-                else {
-                    // g_print("[TRUE] included_in_where\n");
-                }
+/*
+ * An UPDATE record's values, as constant SETs through write_sets(),
+ * which also reads the replica's values before for its views.  A row
+ * that isn't there was deleted further on in the log before the copy
+ * was taken.
+ */
 
-                GDir *entry_dir = dir_open(entry_path);
-                if (NULL != entry_dir) {
-                    GSList *col = ddl_select.cols;
-                    while (col) {
-                        struct mdb_col *mdb_col;
-
-                        if (g_strstr_len(col->data, strlen(col->data), ".")) {
-                            gchar *filename = g_strdup(col->data);
-                            gchar *dot = g_strstr_len(filename, strlen(filename), ".");
-
-                            filename[dot - filename] = '\0';
-                            gchar *left = filename;
-                            gchar *right = &filename[dot - filename + 1];
-
-                            /* 
-                             * Is this col for the current table?
-                             */
-
-                            if (NULL == g_strstr_len(left, strlen(left), table->data)) {
-                                GHashTable *schema = load_schema(left);
-                                const gchar *path = g_hash_table_lookup(join_entry_paths, left);
-                                mdb_col = load_mdb_col(left, right, schema, path); /* needs to be a hash lookup */
-                                g_hash_table_destroy(schema);
-                            }
-                            else {
-                                GHashTable *schema = load_schema(left);
-                                mdb_col = load_mdb_col(left, right, schema, entry_path);
-                                g_hash_table_destroy(schema);
-                            }
+void replica_update(const gchar *table, gint64 roid, GHashTable *after)
+{
+    gchar *entry_path = mdb_row_entry(table, roid);
 
-                            g_free(filename);
-                        }
-                        else {
-                            GHashTable *schema = load_schema(table->data);
-                            mdb_col = load_mdb_col(table->data, col->data, schema, entry_path);
-                            g_hash_table_destroy(schema);
-                        }
+    if (NULL == entry_path) {
+        return;
+    }
 
-                        if (MDB_COL_TEXT == mdb_col->col_type) {
-                            g_print("%s", mdb_col->v_text);
-                        }
-                        else if (MDB_COL_INT64 == mdb_col->col_type) {
-                            g_print("%ld", mdb_col->v_int64);
-                        }
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+    GHashTable *schema = cached_schema(table);
+    gint version = table_version(table);
+    GHashTable *paths = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, mdb_col_destroy);
+    struct mdb_arena_mark mark = mdb_arena_mark(mdb_stmt_arena());
+    GSList *sets = NULL;
+    GHashTableIter iter;
+    gpointer col, literal;
+
+    g_hash_table_iter_init(&iter, after);
+    while (g_hash_table_iter_next(&iter, &col, &literal)) {
+        struct mdb_set *set = g_malloc0(sizeof(struct mdb_set));
+
+        set->col = g_strdup(col);
+        set->literal = g_strdup(literal);
+        set->col_type = MDB_COL_TEXT;
+        set->constant = TRUE;
+
+        if (version >= 2) {
+            mdb_col_type_from_name(g_hash_table_lookup(schema, col), &set->col_type);
+            set->fixed = MDB_COL_TEXT != set->col_type;
+        }
 
-                        free_mdb_col(&mdb_col);
+        if (!mdb_col_from_literal(set->col_type, literal, &set->value)) {
+            fprintf(stderr, "error: replica: [%s]::[%s]: invalid value: %s\n", table, set->col, set->literal);
+            exit(EXIT_FAILURE);
+        }
 
-                        col = col->next;
-                        if (col) {
-                            g_print("\t");
-                        }
-                        else {
-                            g_print("\n");
-                        }
-                    }
+        if (set->fixed) {
+            set->encoded = g_byte_array_new();
+            encode_mdb_col(&set->value, set->encoded);
+        }
 
-                    g_dir_close(entry_dir);
-                }
+        sets = g_slist_append(sets, set);
+    }
 
-                if (NULL != join_entry_paths) {
-                    g_hash_table_destroy(join_entry_paths);
-                }
-                g_free(entry_path);
-                entry = g_dir_read_name(row);
-            }
+    g_hash_table_insert(paths, (gpointer) table, entry_path);
+    compute_sets(table, paths, sets, values);
+    write_sets(table, entry_path, sets, values, load_table_codec(table_path));
 
-            g_dir_close(row);
-            g_free(row_path);
-            g_free(schema_path);
+    mdb_arena_reset(mdb_stmt_arena(), mark);
 
-            bucket = g_dir_read_name(rows);
-        }
+    g_slist_free_full(sets, (GDestroyNotify) free_mdb_set);
+    g_hash_table_destroy(values);
+    g_hash_table_destroy(paths);
+    g_free(table_path);
+    g_free(entry_path);
+}
 
-        g_dir_close(rows);
-        g_free(rows_path);
+void replica_delete(const gchar *table, gint64 roid)
+{
+    gchar *entry_path = mdb_row_entry(table, roid);
+
+    if (NULL == entry_path) {
+        return;
+    }
+
+    gboolean logged = mdb_change_wanted(table);
+    GHashTable *before = logged && mdb_change_wants_before(table) ? mdb_change_cols_new() : NULL;
 
-        table = table->next;
+    mdb_change_read_row(before, table, entry_path);
+
+    if (lsm_view(table)) {
+        lsm_append(table, MDB_LSM_DELETE, roid, NULL);
+    }
+    else {
+        mdb_purge_row(table, roid, entry_path);
+        g_hash_table_remove(entry_fds(), entry_path);
+    }
+
+    if (logged) {
+        mdb_change_log("DELETE", table, roid, before, NULL);
+    }
+    if (before) {
+        g_hash_table_destroy(before);
     }
 
-    g_slist_free_full(ddl_select.cols, g_free);
-    g_slist_free_full(ddl_select.tables, g_free);
+    g_free(entry_path);
 }
 
 /*
- * SELECT * FROM site_key;
- * SELECT id, site_key, updated FROM site_key;
- * SELECT site_key FROM site_key;
+ * A line of the primary's change log, without its newline.  Rows are
+ * written from the values it carries, so applying the log in order
+ * leaves them as the primary had them at that LSN; the replica's views
+ * and own change log are kept up as the primary's write would.
  */
 
-struct ddl_parsed parse_select(const gchar *text)
+void replica_apply(struct mdb_replica *replica, const gchar *line)
 {
-    GScanner *scanner;
+    GHashTable *before = mdb_change_cols_new();
+    GHashTable *after = mdb_change_cols_new();
+    gchar *kind = NULL;
+    gchar *table = NULL;
+    gint64 roid;
+
+    if (!mdb_change_parse(line, &kind, &table, &roid, before, after)) {
+        fprintf(stderr, "error: replica: not a change: %s\n", line);
+        exit(EXIT_FAILURE);
+    }
 
-    scanner = g_scanner_new(NULL);
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, NULL);
+    gboolean ddl = 0 == g_strcmp0("CREATE", kind) || 0 == g_strcmp0("ALTER", kind);
 
-    scanner->config->scan_identifier_1char = TRUE;
-    scanner->config->cset_identifier_nth = G_CSET_a_2_z "_0123456789." G_CSET_A_2_Z G_CSET_LATINS G_CSET_LATINC;
+    /* A row can be logged before the CREATE of its table */
+    if (ddl || !g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
+        replica_sync_ddl(replica, table);
+    }
 
-    /* feed in the text */
-    g_scanner_input_text(scanner, text, strlen(text));
-    
-    /* give the error handler an idea on how the input is named */
-    scanner->input_name = "SELECT";
+    if (!ddl && g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
+        /* Readers that pooled the old row's values see its version move */
+        row_version_take(table, roid);
 
-    int state = STATE_START;
-    gchar *_buf = NULL;
+        if (0 == g_strcmp0("INSERT", kind)) {
+            replica_insert(replica, table, roid, after);
+        }
+        else if (0 == g_strcmp0("UPDATE", kind)) {
+            replica_update(table, roid, after);
+        }
+        else if (0 == g_strcmp0("DELETE", kind)) {
+            replica_delete(table, roid);
+        }
 
-    struct ddl_parsed ddl_select = {NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+        row_version_release(table, roid);
 
-    while (!g_scanner_eof(scanner))
-    {
-        static int nested = 0;
-        GTokenType tokenType = g_scanner_get_next_token(scanner);
-        GTokenType nextToken;
+        ++mdb_counters()->replica_changes_applied;
+    }
 
-        gchar *converted = NULL;
-        gchar *t = NULL;
+    g_free(table_path);
+    g_free(kind);
+    g_free(table);
+    g_hash_table_destroy(before);
+    g_hash_table_destroy(after);
+}
 
-        // g_print("%s %s [%d]\n", tickGTokenType(tokenType), G_TOKEN_IDENTIFIER == tokenType ? scanner->value.v_identifier : "", state);
+/* The start of a replica: a copy of the primary from an LSN on */
+void replica_seed(struct mdb_replica *replica, const gchar *primary)
+{
+    gchar *real = realpath(primary, NULL);
 
-        if (G_TOKEN_ERROR == tokenType) {
-            g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-            exit(EXIT_FAILURE);
-        }
+    if (NULL == real) {
+        fprintf(stderr, "error: replica: %s: %s\n", primary, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-        switch (state) {
-            case STATE_START: 
-                if (G_TOKEN_IDENTIFIER != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
+    replica->primary = g_strdup(real);
+    replica->datadir = g_strconcat(real, "/", "multidb", "/", "data", NULL);
+    free(real);
 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 != g_ascii_strncasecmp("SELECT", scanner->value.v_identifier, strlen("SELECT"))) {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
+    gchar *ours = realpath(MULTIDB_DATADIR, NULL);
+    gchar *theirs = realpath(replica->datadir, NULL);
 
-                    nextToken = g_scanner_peek_next_token(scanner);
+    if (NULL == theirs) {
+        fprintf(stderr, "error: replica: %s: no database there\n", primary);
+        exit(EXIT_FAILURE);
+    }
+    if (0 == g_strcmp0(ours, theirs)) {
+        fprintf(stderr, "error: replica: %s: is this database\n", primary);
+        exit(EXIT_FAILURE);
+    }
 
-                    if ('*' == nextToken || G_TOKEN_IDENTIFIER == nextToken) {
-                        state = STATE_PROCESS_COLS;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            break;
+    free(ours);
+    free(theirs);
 
-            case STATE_PROCESS_COLS: 
-                if ('*' == tokenType) {
-                    ddl_select.cols = g_slist_append(ddl_select.cols, g_strdup("*"));
-                }
-                else if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (NULL == _buf) {
-                        _buf = g_strdup(scanner->value.v_identifier);
-                    }
-                } 
-                else if (G_TOKEN_COMMA == tokenType) {
-                    if (_buf) {
-                        ddl_select.cols = g_slist_append(ddl_select.cols, g_strdup(_buf));
-                        g_free(_buf);
-                        _buf = NULL;
-                    }
-                }
-                else if ('.' == tokenType) {
-                    if (_buf) {
-                        gchar *t = _buf;
-                        _buf = g_strconcat(_buf, ".", NULL);
-                        g_free(t);
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
+    GDir *dir = dir_open(MULTIDB_SCHEMADIR);
+    const gchar *name = dir ? g_dir_read_name(dir) : NULL;
 
-                nextToken = g_scanner_peek_next_token(scanner);
-                if (G_TOKEN_IDENTIFIER == nextToken) {
-                    if (0 == g_ascii_strncasecmp("FROM", scanner->next_value.v_identifier, strlen("FROM"))) {
-                        if (_buf) {
-                            ddl_select.cols = g_slist_append(ddl_select.cols, g_strdup(_buf));
-                            g_free(_buf);
-                            _buf = NULL;
-                        }
+    if (dir) {
+        g_dir_close(dir);
+    }
+    if (name) {
+        fprintf(stderr, "error: replica: %s: has tables of its own\n", MULTIDB_DATADIR);
+        exit(EXIT_FAILURE);
+    }
 
-                        state = STATE_FROM;
-                    }
-                }
-            break;
+    /* Whatever the copy misses is written after this, so it's in the log from here */
+    gchar *consumer = replica_consumer_name();
+
+    replica->lsn = mdb_changes_register(replica->datadir, consumer, FALSE);
+    replica->caught_up_us = g_get_real_time();
+
+    replica_sync_tables(replica);
+    mdb_replica_save(replica);
+
+    g_free(consumer);
+}
+
+/* What the primary keeps its log for this replica as */
+gchar * replica_consumer_name(void)
+{
+    gchar *real = realpath(MULTIDB_BASEDIR, NULL);
+    gchar *name = g_strconcat("replica", real ? real : MULTIDB_BASEDIR, NULL);
+
+    g_strdelimit(name, "/", '_');
+    free(real);
+
+    return(name);
+}
+
+/*
+ * --replica: make this database a replica of the one at primary, or
+ * carry on following it, applying its change log as it grows.  The log
+ * is looked at as soon as it changes and at least once a second, which
+ * keeps the state's caught up time fresh.  With once, stops when it has
+ * applied all of the log.
+ */
+
+void mdb_replica_follow(const gchar *primary, gboolean once)
+{
+    struct mdb_replica replica;
+    gchar *real = realpath(primary, NULL);
+    int notify_fd = -1;
+
+    if (!mdb_replica_load(&replica)) {
+        replica_seed(&replica, primary);
+    }
+    else if (NULL == real || 0 != g_strcmp0(real, replica.primary)) {
+        fprintf(stderr, "error: replica: already follows %s\n", replica.primary);
+        exit(EXIT_FAILURE);
+    }
+
+    free(real);
+
+    gchar *consumer = replica_consumer_name();
+
+    if (replica.lsn < mdb_changes_start(replica.datadir)) {
+        fprintf(stderr, "error: replica: the primary's log before %li is gone, make the replica again\n", mdb_changes_start(replica.datadir));
+        exit(EXIT_FAILURE);
+    }
 
-            case STATE_FROM: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("FROM", scanner->next_value.v_identifier, strlen("FROM"))) {
-                        state = STATE_TABLENAME;
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    gchar *path = g_strconcat(replica.datadir, "/", "changes", NULL);
+    GByteArray *buf = g_byte_array_new();
+    guint8 chunk[64 * 1024];
 
-            case STATE_TABLENAME: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    ddl_select.tables = g_slist_append(ddl_select.tables, g_strdup(scanner->value.v_identifier));
+#ifdef __linux__
+    /* A directory's watch also sees its files written */
+    notify_fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+    if (-1 == notify_fd || -1 == inotify_add_watch(notify_fd, replica.datadir, IN_CREATE|IN_MODIFY|IN_MOVED_TO)) {
+        fprintf(stderr, "error: inotify(%s): %s\n", replica.datadir, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+#endif
 
-                    nextToken = g_scanner_peek_next_token(scanner);
+    for (;;) {
+        int fd = open(path, O_RDONLY|O_CLOEXEC);
+        gboolean end = TRUE;
+        gssize got = 0;
 
-                    if (';' == nextToken) {
-                        state = STATE_END;
-                    }
-                    else if (G_TOKEN_IDENTIFIER == nextToken) {
-                        if (0 == g_ascii_strncasecmp("WHERE", scanner->next_value.v_identifier, strlen("WHERE"))) {
-                            state = STATE_WHERE;
-                        }
-                        else if (0 == g_ascii_strncasecmp("INNER", scanner->next_value.v_identifier, strlen("INNER"))) {
-                            state = STATE_INNER_JOIN;
-                        }
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+        if (-1 == fd && ENOENT != errno) {
+            fprintf(stderr, "error: open(%s): %s\n", path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-            case STATE_INNER_JOIN:
-                if (NULL == _buf && G_TOKEN_IDENTIFIER == tokenType && 0 == g_ascii_strncasecmp("INNER", scanner->value.v_identifier, strlen("INNER"))) {
-                    continue;
-                }
-                else if (NULL == _buf && G_TOKEN_IDENTIFIER == tokenType && 0 == g_ascii_strncasecmp("JOIN", scanner->value.v_identifier, strlen("JOIN"))) {
-                    continue;
-                }
+        g_byte_array_set_size(buf, 0);
 
-                nextToken = g_scanner_peek_next_token(scanner);
+        while (-1 != fd && 0 != (got = pread(fd, chunk, sizeof(chunk), replica.lsn + buf->len))) {
+            if (-1 == got && EINTR == errno) {
+                continue;
+            }
+            if (-1 == got) {
+                fprintf(stderr, "error: pread(%s): %s\n", path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
 
-                if (';' == nextToken) {
-                    state = STATE_END;
-                }
+            g_byte_array_append(buf, chunk, got);
 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("WHERE", scanner->value.v_identifier, strlen("WHERE"))) {
-                        state = STATE_WHERE;
-                        continue;
-                    }
-                }
+            if (buf->len >= MDB_REPLICA_BATCH) {
+                end = FALSE;
+                break;
+            }
+        }
 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 != g_ascii_strncasecmp("ON", scanner->value.v_identifier, strlen("ON"))) {
-                        GSList *cur_join = g_slist_last(ddl_select.joins);
+        if (-1 != fd) {
+            close(fd);
+        }
 
-                        if (NULL == ddl_select.joins) {
-                            ddl_select.joins = g_slist_append(ddl_select.joins, g_malloc0(sizeof(struct ddl_join)));
+        mdb_quiesce_enter();
 
-                            ((struct ddl_join *) ddl_select.joins->data)->join_type = MDB_JOIN_INNER;
+        guint8 *start = buf->data;
+        guint8 *nl;
 
-                            cur_join = g_slist_last(ddl_select.joins);
-                        }
-                        else if (NULL != ((struct ddl_join *) cur_join->data)->on_right) {
-                            ddl_select.joins = g_slist_append(ddl_select.joins, g_malloc0(sizeof(struct ddl_join)));
+        while (buf->len && (nl = memchr(start, '\n', buf->data + buf->len - start))) {
+            gchar *line = g_strndup((gchar *) start, nl - start);
 
-                            ((struct ddl_join *) ddl_select.joins->data)->join_type = MDB_JOIN_INNER;
+            replica_apply(&replica, line);
+            replica.lsn += nl + 1 - start;
+            start = nl + 1;
 
-                            cur_join = g_slist_last(ddl_select.joins);
-                        }
+            g_free(line);
+        }
 
-                        struct ddl_join *join = cur_join->data;
+        /* A line still being written doesn't count */
+        if (end && start == buf->data + buf->len) {
+            replica.caught_up_us = g_get_real_time();
+        }
 
-                        if (NULL == join->tbl_name) {
-                            join->tbl_name = g_strdup(scanner->value.v_identifier);
-                        }
-                        else if (NULL == join->on_left) {
-                            join->on_left = g_strdup(scanner->value.v_identifier);
-                        }
-                        else if (NULL == join->on_right) {
-                            join->on_right = g_strdup(scanner->value.v_identifier);
-                        }
-                    }
-                }
-            break;
+        mdb_replica_save(&replica);
+        mdb_quiesce_leave();
+        mdb_stats_flush();
 
-            case STATE_WHERE:
-                extract_where(scanner, tokenType, &_buf, &state);
+        /* Saved first: the primary may let go of what was acknowledged */
+        mdb_changes_ack(replica.datadir, consumer, replica.lsn);
+
+        if (once && end) {
             break;
+        }
+        if (!end) {
+            continue;
+        }
 
-            case STATE_END:
-                if (';' == tokenType) {
-                    if (_buf) {
-                        ddl_select.where = g_strdup(_buf);
-                        g_free(_buf);
-                        _buf = NULL;
-                    }
-                }
+#ifdef __linux__
+        struct pollfd pfd = { .fd = notify_fd, .events = POLLIN };
+        gchar events[4096];
 
-                if (';' != tokenType && G_TOKEN_EOF != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+        if (1 == poll(&pfd, 1, 1000)) {
+            while (0 < read(notify_fd, events, sizeof(events))) {
+            }
         }
+#else
+        g_usleep(G_USEC_PER_SEC / 10);
+#endif
     }
 
-    g_free(_buf);
+    if (-1 != notify_fd) {
+        close(notify_fd);
+    }
 
-    return(ddl_select);
+    g_byte_array_free(buf, TRUE);
+    g_free(path);
+    g_free(consumer);
+    free_mdb_replica(&replica);
 }
 
-gboolean is_precedence_less_or_equal(gchar *a, GList *elem)
+/*
+ * Snapshots
+ *
+ * --snapshot makes a copy of the data directory as of one moment, with
+ * writers held off while it's made.  Each file is cloned with FICLONE
+ * where the filesystem can share its extents; failing that the runs of
+ * LSM tables, never written again once they're in place, are hard
+ * linked and everything else is copied: column files are patched in
+ * place, and bitmaps, wals and the change log change too.  Locks,
+ * purgatory and the directories of transactions stay behind.  The copy
+ * is made in dir/.multidb.<pid> and renamed to dir/multidb once it's
+ * synced, after the writers are let go, so dir is a MULTIDB_PREFIX.
+ */
+
+gboolean snapshot_matches(const gchar *rel, const gchar * const *patterns)
 {
-    gchar *b = elem->data;
-    // "not" always comes first
-    if (0 == g_ascii_strncasecmp("not", b, strlen("not"))) {
-        return TRUE;
+    for (guint i = 0; patterns[i]; ++i) {
+        if (0 == fnmatch(patterns[i], rel, FNM_PATHNAME)) {
+            return(TRUE);
+        }
     }
 
-    if (0 == g_ascii_strncasecmp("not", a, strlen("not"))) {
-        return FALSE;
+    return(FALSE);
+}
+
+void snapshot_file(const gchar *from, const gchar *to, gboolean immutable)
+{
+    gboolean done = FALSE;
+    struct stat st;
+
+    int in = open(from, O_RDONLY|O_CLOEXEC);
+    if (-1 == in || -1 == fstat(in, &st)) {
+        fprintf(stderr, "error: open(%s): %s\n", from, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    if (0 == g_ascii_strncasecmp("or", a, strlen("or")) && 
-        0 == g_ascii_strncasecmp("and", b, strlen("and"))) {
-        return TRUE;
+    int out = open(to, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC, st.st_mode & 0777);
+    if (-1 == out) {
+        fprintf(stderr, "error: open(%s): %s\n", to, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    if (0 == g_ascii_strncasecmp("and", a, strlen("and")) && 
-        0 == g_ascii_strncasecmp("or", b, strlen("or"))) {
-        return FALSE;
+#ifdef FICLONE
+    if (0 == ioctl(out, FICLONE, in)) {
+        ++mdb_counters()->snapshot_files_cloned;
+        done = TRUE;
     }
+#endif
 
-    // otherwise they're equal
-    return TRUE;
-}
+    /* Across filesystems too a copy is all there is */
+    if (!done && immutable) {
+        close(out);
+        unlink(to);
 
-gboolean is_operator(gchar *cmp)
-{
-    if (0 == g_ascii_strncasecmp("not", cmp, strlen("not"))) {
-        return TRUE;
-    }
+        out = -1;
 
-    if (0 == g_ascii_strncasecmp("and", cmp, strlen("and"))) {
-        return TRUE;
+        if (0 == link(from, to)) {
+            ++mdb_counters()->snapshot_files_linked;
+            done = TRUE;
+        }
+        else {
+            out = open(to, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC, st.st_mode & 0777);
+            if (-1 == out) {
+                fprintf(stderr, "error: open(%s): %s\n", to, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
     }
 
-    if (0 == g_ascii_strncasecmp("or", cmp, strlen("or"))) {
-        return TRUE;
+    if (!done) {
+        gchar chunk[64 * 1024];
+        gssize got;
+
+        while (0 != (got = read(in, chunk, sizeof(chunk)))) {
+            if (-1 == got && EINTR == errno) {
+                continue;
+            }
+            if (-1 == got) {
+                fprintf(stderr, "error: read(%s): %s\n", from, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            mdb_counters()->bytes_read += got;
+            write_fd(out, chunk, got);
+        }
+
+        ++mdb_counters()->snapshot_files_copied;
     }
 
-    return FALSE;
-}
+    ++mdb_counters()->files_opened;
 
-void iterator(gpointer key, gpointer value, gpointer user_data)
-{
-    g_print(user_data, key, value);
+    if (-1 != out) {
+        close(out);
+    }
+    close(in);
 }
 
-gboolean eval_where_expression(GHashTable *paths, const gchar *def_tbl, const gchar *ex, gboolean *stale)
+/* rel is from's path in the data directory, "" for the directory itself */
+void snapshot_tree(const gchar *from, const gchar *to, const gchar *rel)
 {
-    gchar *entry_path = g_hash_table_lookup(paths, def_tbl);
+    static const gchar *skip[] = {
+        "purgatory", "txn", "quiesce", "tables/*/tbl_lock",
+        "tables/*/metadata/row_locks", "tables/*/metadata/row_versions", "tables/*/lsm/lock", NULL
+    };
+    static const gchar *immutable[] = { "tables/*/lsm/runs/*", NULL };
+    static const gchar *lsm[] = { "tables/*/lsm", NULL };
+
+    GDir *dir = dir_open((gchar *) from);
+    const gchar *name;
+
+    if (0 != g_mkdir_with_parents(to, 0775)) {
+        fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", to, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-    // g_print("ex: %s: entry_path: %s\n", ex, entry_path);
+    while (dir && (name = g_dir_read_name(dir))) {
+        gchar *child_rel = *rel ? g_strconcat(rel, "/", name, NULL) : g_strdup(name);
 
-    if (0 == g_ascii_strncasecmp("0", ex, strlen("0"))) {
-        return FALSE;
-    }
-    else if (0 == g_ascii_strncasecmp("1", ex, strlen("1"))) {
-        return TRUE;
+        /* Dot files are somebody's unfinished write */
+        if ('.' == *name || snapshot_matches(child_rel, skip)) {
+            g_free(child_rel);
+            continue;
+        }
+
+        gchar *child_from = g_strconcat(from, "/", name, NULL);
+        gchar *child_to = g_strconcat(to, "/", name, NULL);
+        struct stat st;
+
+        if (0 != lstat(child_from, &st)) {
+            fprintf(stderr, "error: lstat(%s): %s\n", child_from, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (S_ISDIR(st.st_mode) && snapshot_matches(child_rel, lsm)) {
+            /* Compactions can't swap the runs while they're read */
+            gchar **parts = g_strsplit(child_rel, "/", 3);
+
+            lsm_enter(parts[1], F_RDLCK);
+            snapshot_tree(child_from, child_to, child_rel);
+            lsm_leave(parts[1]);
+
+            g_strfreev(parts);
+        }
+        else if (S_ISDIR(st.st_mode)) {
+            snapshot_tree(child_from, child_to, child_rel);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            snapshot_file(child_from, child_to, snapshot_matches(child_rel, immutable));
+        }
+
+        g_free(child_rel);
+        g_free(child_from);
+        g_free(child_to);
     }
 
-    const gchar *table = NULL;
-    gchar *dot = g_strstr_len(ex, strlen(ex), ".");
-    gchar *t;
-    if (dot) {
-        t = g_strdup(&ex[dot - ex + 1]);
-        table = g_strndup(ex, dot - ex);
-        // g_print("table: %s\n", table);
+    if (dir) {
+        g_dir_close(dir);
     }
-    else {
-        table = def_tbl;
-        t = g_strdup(ex);
+}
+
+void mdb_snapshot(const gchar *dir)
+{
+    gchar *final = g_strconcat(dir, "/", "multidb", NULL);
+    gchar *tmp = g_strdup_printf("%s/.multidb.%d", dir, getpid());
+    gchar *data = g_strconcat(tmp, "/", "data", NULL);
+
+    if (0 == access(final, F_OK)) {
+        fprintf(stderr, "error: snapshot: %s: already exists\n", final);
+        exit(EXIT_FAILURE);
     }
-    gchar *not_equals = g_strstr_len(t, strlen(t), "!=");
-    gchar *less_than_equals = g_strstr_len(t, strlen(t), "<=");
-    gchar *greater_than_equals = g_strstr_len(t, strlen(t), ">=");
-    gchar *equals = g_strstr_len(t, strlen(t), "=");
-    gchar *greater_than = g_strstr_len(t, strlen(t), ">");
-    gchar *less_than = g_strstr_len(t, strlen(t), "<");
-    gchar *is_null = g_strstr_len(t, strlen(t), "IS NULL");
 
-    gboolean ret = FALSE;
+    mdb_quiesce_writers();
 
-    *stale = FALSE;
+    /* Commits of processes that died since this one started */
+    mdb_txn_recover();
+    snapshot_tree(MULTIDB_DATADIR, data, "");
 
-    /*
-    gchar *col = NULL;
-    if (g_strstr_len(col_name, strlen(col_name), ".")) {
-        gchar *dot = g_strstr_len(col_name, strlen(col_name), ".");
-        col = g_strdup(&col_name[dot - col_name + 1]);
-    }
-    else {
-        col = g_strdup(col_name);
+    mdb_quiesce_leave();
+
+#ifdef __linux__
+    int fd = open(tmp, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+    if (-1 == fd || -1 == syscall(SYS_syncfs, fd)) {
+        fprintf(stderr, "error: syncfs(%s): %s\n", tmp, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
-    */
 
-    /* REFACTOR - consolidate */
+    close(fd);
+#else
+    sync();
+#endif
 
-    if (less_than_equals) {
-        t[less_than_equals - t] = '\0';
-        gchar *left = t;
-        gchar *right = &t[less_than_equals - t + 2];
-        
-        // g_print("left[%s]: %s: right: %s\n", g_hash_table_lookup(schema, left), left, right);
+    if (-1 == rename(tmp, final)) {
+        fprintf(stderr, "error: rename: %s -> %s: %s\n", tmp, final, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-        gchar *buf;
-        gchar *file = g_strconcat(entry_path, "/", left, NULL);
+    g_free(data);
+    g_free(tmp);
+    g_free(final);
+}
 
-        read_first_line(file, &buf);
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
-        }
+/*
+ * COPY FROM
+ *
+ * The file is mapped and cut, on row boundaries, into chunks of about
+ * a quarter of what each worker gets.  Finding those boundaries counts
+ * the rows too, so one block of roids, and one of serials for each
+ * serial column, is taken for the whole load before any work is handed
+ * out.  Then the workers take chunks in turn and stage their rows under
+ * data/txn/<pid>/copy/<chunk>, splitting fields with SIMD compares, and
+ * write each chunk's change records to a file beside them; NULL bits
+ * go in as each chunk is done, harmless for roids nobody can see yet.
+ * Only once every row is staged are they renamed into place, chunk by
+ * chunk, each chunk's changes logged and applied to views after its
+ * rows, so a bad value fails the load before any of it shows.
+ */
 
-        if (0 == g_ascii_strncasecmp("'", right, strlen("'"))) { /* string */
-            if (0 >= g_ascii_strncasecmp(right, buf, strlen(left))) {
-                ret = TRUE;
-            }
+gsize copy_find_scalar(const gchar *p, gsize len, gchar a, gchar b)
+{
+    for (gsize i = 0; i < len; ++i) {
+        if (a == p[i] || b == p[i]) {
+            return(i);
         }
-        else {  /* number */
-            gint64 r_number = g_ascii_strtoll(right, NULL, 10);
-            gint64 db_number = g_ascii_strtoll(buf, NULL, 10);
+    }
 
-            if (r_number >= db_number) {
-                ret = TRUE;
-            }
+    return(len);
+}
+
+/* Where the first a or b is in p, len when there's none */
+gsize copy_find_sse2(const gchar *p, gsize len, gchar a, gchar b)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &p[i]);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+
+        if (mask) {
+            return(i + __builtin_ctz(mask));
         }
     }
-    else if (greater_than_equals) {
-        t[greater_than_equals - t] = '\0';
-        gchar *left = t;
-        gchar *right = &t[greater_than_equals - t + 2];
-        
-        // g_print("left[%s]: %s: right: %s\n", g_hash_table_lookup(schema, left), left, right);
+#endif
 
-        gchar *buf;
-        gchar *file = g_strconcat(entry_path, "/", left, NULL);
+    return(i + copy_find_scalar(&p[i], len - i, a, b));
+}
 
-        read_first_line(file, &buf);
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
-        }
+#ifdef __SSE2__
+__attribute__((target("avx2")))
+#endif
+gsize copy_find_avx2(const gchar *p, gsize len, gchar a, gchar b)
+{
+    gsize i = 0;
 
-        if (0 == g_ascii_strncasecmp("'", right, strlen("'"))) { /* string */
-            if (0 <= g_ascii_strncasecmp(right, buf, strlen(left))) {
-                ret = TRUE;
-            }
-        }
-        else {  /* number */
-            gint64 r_number = g_ascii_strtoll(right, NULL, 10);
-            gint64 db_number = g_ascii_strtoll(buf, NULL, 10);
+#ifdef __SSE2__
+    __m256i va = _mm256_set1_epi8(a);
+    __m256i vb = _mm256_set1_epi8(b);
 
-            if (r_number <= db_number) {
-                ret = TRUE;
-            }
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) &p[i]);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+
+        if (mask) {
+            return(i + __builtin_ctz(mask));
         }
     }
-    else if (not_equals) {
-        t[not_equals - t] = '\0';
-        gchar *left = t;
-        gchar *right = &t[not_equals - t + 2];
-        
-        // g_print("left[%s]: %s: right: %s\n", g_hash_table_lookup(schema, left), left, right);
+#endif
 
-        gchar *buf;
-        gchar *file = g_strconcat(entry_path, "/", left, NULL);
+    return(i + copy_find_sse2(&p[i], len - i, a, b));
+}
 
-        read_first_line(file, &buf);
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
-        }
+/* The widest the CPU has; picked by the first call, made before any workers start */
+gsize copy_find(const gchar *p, gsize len, gchar a, gchar b)
+{
+    static gsize (*find)(const gchar *, gsize, gchar, gchar) = NULL;
+
+    if (NULL == find) {
+#ifdef __SSE2__
+        __builtin_cpu_init();
+        find = __builtin_cpu_supports("avx2") ? copy_find_avx2 : copy_find_sse2;
+#else
+        find = copy_find_scalar;
+#endif
+    }
 
-        if (0 == g_ascii_strncasecmp("'", right, strlen("'"))) { /* string */
-            if (0 != g_ascii_strncasecmp(right, buf, strlen(left))) {
-                ret = TRUE;
-            }
+    return(find(p, len, a, b));
+}
+
+/* The newline that ends the row at pos, or len; a quoted field can hold newlines */
+gsize copy_row_end(const gchar *data, gsize pos, gsize len, gboolean csv)
+{
+    for (;;) {
+        pos += copy_find(&data[pos], len - pos, '\n', csv ? '"' : '\n');
+
+        if (pos == len || '\n' == data[pos]) {
+            return(pos);
         }
-        else {  /* number */
-            gint64 r_number = g_ascii_strtoll(right, NULL, 10);
-            gint64 db_number = g_ascii_strtoll(buf, NULL, 10);
 
-            if (r_number != db_number) {
-                ret = TRUE;
-            }
+        /* Past the closing quote; "" inside is a closing and an opening one */
+        ++pos;
+        pos += copy_find(&data[pos], len - pos, '"', '"');
+        if (pos < len) {
+            ++pos;
         }
     }
-    else if (greater_than) {
-        t[greater_than - t] = '\0';
-        gchar *left = t;
-        gchar *right = &t[greater_than - t + 1];
-        
-        // g_print("left[%s]: %s: right: %s\n", g_hash_table_lookup(schema, left), left, right);
+}
 
-        gchar *buf;
-        gchar *file = g_strconcat(entry_path, "/", left, NULL);
+gboolean copy_row_empty(const gchar *data, gsize start, gsize end)
+{
+    return(end == start || (end == start + 1 && '\r' == data[start]));
+}
 
-        read_first_line(file, &buf);
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
-        }
+/*
+ * The fields of a row, each NUL terminated in buf, and where each one
+ * starts in offsets, -1 for NULL.  csv: fields may be quoted, "" is a
+ * quote inside them and an empty field that isn't quoted is NULL.  tsv:
+ * \t, \n, \r and \\ are escapes and \N is NULL.
+ */
 
-        if (0 == g_ascii_strncasecmp("'", right, strlen("'"))) { /* string */
-            if (0 < g_ascii_strncasecmp(right, buf, strlen(left))) {
-                ret = TRUE;
-            }
-        }
-        else {  /* number */
-            gint64 r_number = g_ascii_strtoll(right, NULL, 10);
-            gint64 db_number = g_ascii_strtoll(buf, NULL, 10);
+guint copy_split_row(struct mdb_copy *copy, gsize start, gsize end, GString *buf, GArray *offsets)
+{
+    const gchar *data = copy->data;
+    gchar delim = copy->csv ? ',' : '\t';
+    gchar special = copy->csv ? '"' : '\\';
+    gsize pos = start;
 
-            if (r_number < db_number) {
-                ret = TRUE;
-            }
-        }
+    g_string_truncate(buf, 0);
+    g_array_set_size(offsets, 0);
+
+    if (end > start && '\r' == data[end - 1]) {
+        --end;
     }
-    else if (less_than) {
-        t[less_than - t] = '\0';
-        gchar *left = t;
-        gchar *right = &t[less_than - t + 1];
-        
-        // g_print("left[%s]: %s: right: %s\n", g_hash_table_lookup(schema, left), left, right);
 
-        gchar *buf;
-        gchar *file = g_strconcat(entry_path, "/", left, NULL);
+    for (;;) {
+        gint offset = buf->len;
+        gboolean quoted = FALSE;
+        gboolean escaped_null = FALSE;
 
-        read_first_line(file, &buf);
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
-        }
+        for (;;) {
+            gsize n = copy_find(&data[pos], end - pos, delim, special);
 
-        if (0 == g_ascii_strncasecmp("'", right, strlen("'"))) { /* string */
-            if (0 > g_ascii_strncasecmp(right, buf, strlen(left))) {
-                ret = TRUE;
-            }
-        }
-        else {  /* number */
-            gint64 r_number = g_ascii_strtoll(right, NULL, 10);
-            gint64 db_number = g_ascii_strtoll(buf, NULL, 10);
+            g_string_append_len(buf, &data[pos], n);
+            pos += n;
 
-            if (r_number > db_number) {
-                ret = TRUE;
+            if (pos == end || delim == data[pos]) {
+                break;
             }
-        }
-    }
-    else if (equals) {
-        t[equals - t] = '\0';
-        gchar *left = t;
-        gchar *right = &t[equals - t + 1];
-        
-        // g_print("left[%s]: %s: right: %s\n", g_hash_table_lookup(schema, left), left, right);
 
-        gchar *buf;
-        gchar *file = g_strconcat(entry_path, "/", left, NULL);
+            ++pos;
 
-        read_first_line(file, &buf);
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
-        }
+            if (copy->csv) {
+                quoted = TRUE;
 
-        if (0 == g_ascii_strncasecmp("'", right, strlen("'"))) { /* string */
-            if (0 == g_ascii_strncasecmp(right, buf, strlen(left))) {
-                ret = TRUE;
+                for (;;) {
+                    n = copy_find(&data[pos], end - pos, '"', '"');
+                    g_string_append_len(buf, &data[pos], n);
+                    pos += n;
+
+                    if (pos == end) {
+                        fprintf(stderr, "error: COPY: %s: unterminated quoted field at byte %lu\n", copy->table, start);
+                        exit(EXIT_FAILURE);
+                    }
+
+                    ++pos;
+                    if (pos == end || '"' != data[pos]) {
+                        break;
+                    }
+
+                    g_string_append_c(buf, '"');
+                    ++pos;
+                }
             }
-        }
-        else {  /* number */
-            gint64 r_number = g_ascii_strtoll(right, NULL, 10);
-            gint64 db_number = g_ascii_strtoll(buf, NULL, 10);
+            else if (pos < end) {
+                switch (data[pos]) {
+                    case 'n': g_string_append_c(buf, '\n'); break;
+                    case 't': g_string_append_c(buf, '\t'); break;
+                    case 'r': g_string_append_c(buf, '\r'); break;
+                    case 'N': escaped_null = TRUE; break;
+                    default: g_string_append_c(buf, data[pos]); break;
+                }
 
-            if (r_number == db_number) {
-                ret = TRUE;
+                ++pos;
+            }
+            else {
+                g_string_append_c(buf, '\\');
             }
         }
+
+        if (copy->csv ? !quoted && (gint) buf->len == offset : escaped_null && (gint) buf->len == offset) {
+            offset = -1;
+        }
+
+        g_string_append_c(buf, '\0');
+        g_array_append_val(offsets, offset);
+
+        if (pos == end) {
+            break;
+        }
+
+        ++pos;
     }
-    else if (is_null) {
-        t[(is_null - 1) - t] = '\0';  /* Just the col that is null */
 
+    return(offsets->len);
+}
+
+/*
+ *  COPY stock (sku, qty) FROM '/tmp/stock.csv' (FORMAT csv, HEADER, PARALLEL 4);
+ *
+ *  Each option is kept as name=value; an option without a value is true.
+ */
+
+struct ddl_parsed parse_copy(const gchar *text)
+{
+    GScanner *scanner;
+
+    scanner = g_scanner_new(NULL);
+
+    /* feed in the text */
+    g_scanner_input_text(scanner, text, strlen(text));
+
+    /* give the error handler an idea on how the input is named */
+    scanner->input_name = "COPY";
+
+    struct ddl_parsed ddl_copy = {NULL, NULL};
+
+    ddl_expect_keyword(scanner, "COPY");
+    ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a table name");
+    ddl_copy.tbl_name = g_strdup(scanner->value.v_identifier);
+
+    if (G_TOKEN_LEFT_PAREN == g_scanner_peek_next_token(scanner)) {
+        g_scanner_get_next_token(scanner);
 
-        gchar *buf;
-        gchar *file = g_strconcat(g_hash_table_lookup(paths, table), "/", t, NULL);
-        read_first_line(file, &buf);
+        do {
+            ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a column name");
+            ddl_copy.cols = g_slist_append(ddl_copy.cols, g_strdup(scanner->value.v_identifier));
+        } while (G_TOKEN_COMMA == g_scanner_get_next_token(scanner));
 
-        if (NULL == buf) {
-            *stale = TRUE;
-            g_free(t);
-            return(FALSE);
+        if (G_TOKEN_RIGHT_PAREN != scanner->token) {
+            ddl_syntax_error(scanner, ", or )");
         }
+    }
 
-        if (0 == g_ascii_strncasecmp(buf, "NULL", strlen(buf))) { /* string */
-            ret = TRUE;
-        }
+    if (expr_peek_keyword(scanner, "TO")) {
+        g_scanner_get_next_token(scanner);
+        ddl_copy.action = g_strdup("TO");
+
+        ddl_expect(scanner, G_TOKEN_STRING, "a quoted directory name");
     }
     else {
-        fprintf(stderr, "error: invalid expresstion: %s\n", ex);
-        exit(EXIT_FAILURE);
-    }
-
-    g_free(t);
+        ddl_expect_keyword(scanner, "FROM");
+        ddl_copy.action = g_strdup("FROM");
 
-    return(ret);
-}
+        ddl_expect(scanner, G_TOKEN_STRING, "a quoted file name");
+    }
+    ddl_copy.file = g_strdup(scanner->value.v_string);
+
+    if (G_TOKEN_LEFT_PAREN == g_scanner_peek_next_token(scanner)) {
+        g_scanner_get_next_token(scanner);
+
+        do {
+            ddl_expect(scanner, G_TOKEN_IDENTIFIER, "a COPY option");
+            gchar *name = g_strdup(scanner->value.v_identifier);
+            gchar *value = NULL;
+
+            switch (g_scanner_peek_next_token(scanner)) {
+                case G_TOKEN_IDENTIFIER:
+                    g_scanner_get_next_token(scanner);
+                    value = g_strdup(scanner->value.v_identifier);
+                break;
+
+                case G_TOKEN_INT:
+                    g_scanner_get_next_token(scanner);
+                    value = g_strdup_printf("%li", scanner->value.v_int);
+                break;
+
+                case G_TOKEN_STRING:
+                    g_scanner_get_next_token(scanner);
+                    value = g_strdup(scanner->value.v_string);
+                break;
+
+                default:
+                    value = g_strdup("true");
+                break;
+            }
 
-GHashTable * load_schema(gchar *table)
-{
-    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table, NULL);
+            ddl_copy.options = g_slist_append(ddl_copy.options, g_strconcat(name, "=", value, NULL));
+            g_free(value);
+            g_free(name);
+        } while (G_TOKEN_COMMA == g_scanner_get_next_token(scanner));
 
-    if (!g_file_test(schema_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: schema: %s: does not exist\n", schema_path);
-        exit(EXIT_FAILURE);
+        if (G_TOKEN_RIGHT_PAREN != scanner->token) {
+            ddl_syntax_error(scanner, ", or )");
+        }
     }
 
-    GDir *schema_dir = dir_open(schema_path);
-    const gchar *schema_entry = g_dir_read_name(schema_dir);
-
-    GHashTable *schema = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    GTokenType token = g_scanner_get_next_token(scanner);
+    if (';' != token && G_TOKEN_EOF != token) {
+        ddl_syntax_error(scanner, "the end of the statement");
+    }
 
-    while (schema_entry) {
-        gchar *buf;
-        gchar *file = g_strconcat(schema_path, "/", schema_entry, NULL);
+    g_scanner_destroy(scanner);
 
-        read_first_line(file, &buf);
-        g_hash_table_insert(schema, g_strdup(schema_entry), g_strdup(buf));
+    return(ddl_copy);
+}
 
-        g_free(file);
-        g_free(buf);
+void free_mdb_copy(struct mdb_copy *copy)
+{
+    g_free(copy->table);
+    g_free(copy->table_path);
+    g_free(copy->staging);
+    g_strfreev(copy->cols);
+    g_free(copy->col_types);
+    g_free(copy->field);
+    g_free(copy->serial);
+
+    if (copy->partitions) {
+        g_ptr_array_free(copy->partitions, TRUE);
+    }
 
-        schema_entry = g_dir_read_name(schema_dir);
+    if (copy->chunks) {
+        g_array_free(copy->chunks, TRUE);
     }
 
-    g_dir_close(schema_dir);
+    if (copy->units) {
+        g_ptr_array_free(copy->units, TRUE);
+    }
 
-    g_free(schema_path);
+    for (gint w = 0; w < copy->started; ++w) {
+        g_free(copy->parts[w].name);
+    }
 
-    return(schema);
+    g_free(copy->parts);
+    g_free(copy->dir);
+    g_mutex_clear(&copy->lock);
+    g_free(copy);
 }
 
-struct mdb_col *load_mdb_col(gchar *table, gchar *col_name, GHashTable *schema, const gchar *entry_path)
+gboolean copy_option_true(const gchar *value)
 {
-    struct mdb_col *mdb_col = g_malloc0(sizeof(struct mdb_col));
-    
-    /* 
-     * Support col and table.col
-     */
+    return(0 == g_ascii_strcasecmp("true", value) || 0 == g_ascii_strcasecmp("on", value) || 0 == g_strcmp0("1", value));
+}
 
-    gchar *col = NULL;
-    if (g_strstr_len(col_name, strlen(col_name), ".")) {
-        gchar *dot = g_strstr_len(col_name, strlen(col_name), ".");
-        col = g_strdup(&col_name[dot - col_name + 1]);
-    }
-    else {
-        col = g_strdup(col_name);
+/* A field as its column takes it: text is quoted as INSERT stores it */
+gboolean copy_col_from_field(MdbColumnType col_type, const gchar *text, struct mdb_col *mdb_col)
+{
+    if (NULL == text || MDB_COL_TEXT != col_type) {
+        return(mdb_col_from_literal(col_type, text, mdb_col));
     }
 
-    /* 
-     * Get the value
-     */
+    mdb_col->col_type = col_type;
+    mdb_col->stale = FALSE;
+    mdb_col->null = FALSE;
+    mdb_col->v_text = g_strconcat("'", text, "'", NULL);
 
-    gchar *buf;
-    gchar *file = g_strconcat(entry_path, "/", col, NULL);
+    return(TRUE);
+}
 
-    read_first_line(file, &buf);
-    if (NULL == buf) {
-        mdb_col->stale = TRUE;
-        g_free(col);
+/* write_typed_col_file() for a worker: its own buffer, and a file under dirfd */
+void copy_write_col(int dirfd, const gchar *col, const struct mdb_col *value, MdbCodec codec, GByteArray *out)
+{
+    gsize len;
 
-        return(mdb_col);
+    if (MDB_COL_TEXT == value->col_type && !value->null) {
+        len = pack_col_text(value->v_text, strlen(value->v_text), codec, out);
     }
     else {
-        mdb_col->stale = FALSE;
+        encode_mdb_col(value, out);
+        len = out->len;
     }
 
-    // g_print("[%s]: %s: %s\n", g_hash_table_lookup(schema, col), col, buf);
-    const gchar *type = g_hash_table_lookup(schema, col);
+    /* Text not worth compressing goes as it is */
+    const gchar *bytes = (const gchar *) out->data;
 
-    if (0 == g_ascii_strncasecmp("serial", type, strlen("serial"))) {
-        gint64 serial = g_ascii_strtoll(buf, NULL, 10);
-        mdb_col->v_int64 = serial;
-        mdb_col->col_type = MDB_COL_INT64;
-    }
-    else if (0 == g_ascii_strncasecmp("integer", type, strlen("integer"))) {
-        gint64 integer = g_ascii_strtoll(buf, NULL, 10);
-        mdb_col->v_int64 = integer;
-        mdb_col->col_type = MDB_COL_INT64;
-    }
-    else if (0 == g_ascii_strncasecmp("text", type, strlen("text"))) {
-        mdb_col->v_text = g_strdup(buf);
-        mdb_col->col_type = MDB_COL_TEXT;
+    if (MDB_COL_TEXT == value->col_type && !value->null && 0 == len) {
+        bytes = value->v_text;
+        len = strlen(value->v_text);
     }
 
-    if (buf) {
-        g_free(buf);
+    int fd = openat(dirfd, col, O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0666);
+    if (-1 == fd) {
+        fprintf(stderr, "error: openat(%s): %s\n", col, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
-    g_free(col);
 
-    return(mdb_col);
+    write_fd(fd, (gchar *) bytes, len);
+
+    close(fd);
 }
 
-void free_mdb_col(struct mdb_col **mdb_col)
+void copy_stage_chunk(struct mdb_copy *copy, guint c)
 {
-    if ((*mdb_col)->stale) {
-        g_free(*mdb_col);
-        *mdb_col = NULL;
-        return;
-    }
+    struct mdb_copy_chunk *chunk = &g_array_index(copy->chunks, struct mdb_copy_chunk, c);
+    guint parts = copy->partitions ? copy->partitions->len : 1;
+    gchar *dir = g_strdup_printf("%s/%u", copy->staging, c);
+    GString *buf = g_string_new(NULL);
+    GArray *offsets = g_array_new(FALSE, FALSE, sizeof(gint));
+    GString *changes = g_string_new(NULL);
+    GHashTable *after = copy->logged ? mdb_change_cols_new() : NULL;
+    GByteArray *out = g_byte_array_new();
+    guint8 **nulls = g_new0(guint8 *, copy->ncols);
+    gint64 first_byte = (copy->roid + chunk->first) / 8;
+    gsize null_bytes = (copy->roid + chunk->first + chunk->rows + 7) / 8 - first_byte;
+    gint64 row = 0;
+
+    for (guint p = 0; p < parts; ++p) {
+        gchar *part_dir = g_strdup_printf("%s/%u", dir, p);
+
+        if (0 != g_mkdir_with_parents(part_dir, 0775)) {
+            fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", part_dir, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-    if (MDB_COL_TEXT == (*mdb_col)->col_type) {
-        g_free((*mdb_col)->v_text);
-        g_free(*mdb_col);
-        *mdb_col = NULL;
-        return;
+        g_free(part_dir);
     }
 
-    if (MDB_COL_INT64 == (*mdb_col)->col_type) {
-        g_free(*mdb_col);
-        *mdb_col = NULL;
-        return;
+    gchar *changes_path = g_strconcat(dir, "/", "changes", NULL);
+    int changes_fd = open(changes_path, O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0666);
+    if (-1 == changes_fd) {
+        fprintf(stderr, "error: open(%s): %s\n", changes_path, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
-}
 
-gchar * sequential_scan(struct ddl_join *join, gchar *entry_path)
-{
-    gchar *left_table = NULL;
-    gchar *right_table = NULL;
+    for (gsize pos = chunk->start; pos < chunk->end; ) {
+        gsize start = pos;
+        gsize end = copy_row_end(copy->data, pos, copy->len, copy->csv);
 
-    gchar *dot;
+        pos = end + 1;
 
-    dot = g_strstr_len(join->on_left, strlen(join->on_left), ".");
-    left_table = g_strndup(join->on_left, dot - join->on_left);
-    
-    dot = g_strstr_len(join->on_right, strlen(join->on_right), ".");
-    right_table = g_strndup(join->on_right, dot - join->on_right);
+        if (copy_row_empty(copy->data, start, end)) {
+            continue;
+        }
 
-    GHashTable *left_schema = load_schema(left_table);
-    GHashTable *right_schema = load_schema(right_table);
-    // g_print("right_schema: %s\n", right_schema_path);
+        gint64 index = chunk->first + row++;
+        gint64 roid = copy->roid + index;
+        guint fields = copy_split_row(copy, start, end, buf, offsets);
 
-    struct mdb_col *left_col = load_mdb_col(left_table, join->on_left, left_schema, entry_path);
+        if (fields != copy->fields) {
+            fprintf(stderr, "error: COPY: %s: row %li: %u fields, expected %u\n", copy->table, index + 1, fields, copy->fields);
+            exit(EXIT_FAILURE);
+        }
 
-    struct mdb_tbl_scanner *right = NULL;
-    init_scan_table(&right, join->tbl_name);
+        /* Like insert_partition(), against the partitions as the load started */
+        guint part = 0;
+        if (copy->partitions) {
+            gint offset = g_array_index(offsets, gint, copy->field[copy->partition]);
+            const gchar *text = -1 == offset ? NULL : &buf->str[offset];
+            struct mdb_col key;
 
-    gchar *ret = NULL;
+            if (!copy_col_from_field(copy->col_types[copy->partition], text, &key) || key.null) {
+                fprintf(stderr, "error: [%s]::[%s]: row %li: partition key can't be NULL\n", copy->table, copy->cols[copy->partition], index + 1);
+                exit(EXIT_FAILURE);
+            }
 
-    while (scan_table(right)) {
-        for (GSList *iter = right->cols; iter; iter = iter->next) {
-            gchar *right_name = g_strconcat(right_table, ".", basename(iter->data), NULL);
-            
-            if (0 == g_ascii_strncasecmp(right_name, join->on_right, strlen(right_name))) {
-                struct mdb_col *right_col = load_mdb_col(right_table, basename(iter->data), right_schema, dirname(iter->data));
+            for (part = 0; part < copy->partitions->len; ++part) {
+                struct mdb_partition *partition = g_ptr_array_index(copy->partitions, part);
 
-                // g_print("scan_table: %s: %s\n", right_name, join->on_right);
+                if (partition->max || mdb_col_cmp(&key, &partition->bound) < 0) {
+                    break;
+                }
+            }
 
-                if (MDB_COL_TEXT == left_col->col_type) {
-                    // g_print("[%s]=[%s] {%s}\n", left_col->v_text, right_col->v_text, right->entry_path);
-                    if (0 == g_ascii_strncasecmp(left_col->v_text, right_col->v_text, strlen(left_col->v_text))) {
-                        ret = g_strdup(right->entry_path);
-                        free_mdb_col(&right_col);
-                        g_free(right_name);
+            if (part == copy->partitions->len) {
+                fprintf(stderr, "error: [%s]::[%s]: no partition for %s\n", copy->table, copy->cols[copy->partition], text);
+                exit(EXIT_FAILURE);
+            }
 
-                        break;
-                    }
-                }
-                else if (MDB_COL_INT64 == left_col->col_type) {
-                    // g_print("[%ld]=[%ld] {%s}\n", left_col->v_int64, right_col->v_int64, right->entry_path);
-                    if (left_col->v_int64 == right_col->v_int64) {
-                        ret = g_strdup(right->entry_path);
-                        free_mdb_col(&right_col);
-                        g_free(right_name);
+            g_free(key.v_text);
+        }
 
-                        break;
-                    }
+        gchar *row_path = g_strdup_printf("%s/%u/%li", dir, part, roid);
+
+        if (0 != mkdir(row_path, 0775)) {
+            fprintf(stderr, "error: mkdir(%s): %s\n", row_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        int dirfd = open(row_path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (-1 == dirfd) {
+            fprintf(stderr, "error: open(%s): %s\n", row_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (after) {
+            g_hash_table_remove_all(after);
+        }
+
+        for (guint i = 0; i < copy->ncols; ++i) {
+            gint offset = -1 == copy->field[i] ? -1 : g_array_index(offsets, gint, copy->field[i]);
+            const gchar *text = -1 == offset ? NULL : &buf->str[offset];
+            struct mdb_col value;
+
+            if (copy->serial[i] && (NULL == text || 0 == g_strcmp0("0", text))) {
+                value.col_type = MDB_COL_INT64;
+                value.stale = FALSE;
+                value.null = FALSE;
+                value.v_text = NULL;
+                value.v_int64 = copy->serial[i] + index;
+            }
+            else if (!copy_col_from_field(copy->col_types[i], text, &value)) {
+                fprintf(stderr, "error: [%s]::[%s]: row %li: invalid value: %s\n", copy->table, copy->cols[i], index + 1, text);
+                exit(EXIT_FAILURE);
+            }
+
+            copy_write_col(dirfd, copy->cols[i], &value, copy->codec, out);
+
+            if (value.null) {
+                if (NULL == nulls[i]) {
+                    nulls[i] = g_malloc0(null_bytes);
                 }
 
-                free_mdb_col(&right_col);
+                nulls[i][roid / 8 - first_byte] |= 1 << (roid % 8);
             }
 
-            g_free(right_name);
+            mdb_change_add(after, copy->cols[i], &value);
+            g_free(value.v_text);
         }
 
-        if (right->cols) {
-            g_slist_free_full(right->cols, g_free);
-            right->cols = NULL;
-        }
+        close(dirfd);
+        g_free(row_path);
 
-        if (right->entry_path) {
-            g_free(right->entry_path);
-            right->entry_path = NULL;
+        if (after) {
+            mdb_change_record(changes, "INSERT", copy->table, roid, NULL, after);
         }
 
-        if (ret) {
-            break;
+        if (changes->len >= MDB_COPY_BATCH) {
+            write_fd(changes_fd, changes->str, changes->len);
+            g_string_truncate(changes, 0);
         }
     }
 
-    free_mdb_col(&left_col);
-    final_scan_table(&right);
+    write_fd(changes_fd, changes->str, changes->len);
+    close(changes_fd);
 
-    g_hash_table_destroy(left_schema);
-    g_hash_table_destroy(right_schema);
+    /* Other workers may share the bytes at either end */
+    g_mutex_lock(&copy->lock);
 
-    return ret;
+    for (guint i = 0; i < copy->ncols; ++i) {
+        if (nulls[i]) {
+            set_null_bits(copy->table, copy->cols[i], first_byte, nulls[i], null_bytes);
+            g_free(nulls[i]);
+        }
+    }
+
+    g_mutex_unlock(&copy->lock);
+
+    g_free(nulls);
+    g_byte_array_free(out, TRUE);
+    if (after) {
+        g_hash_table_destroy(after);
+    }
+    g_string_free(changes, TRUE);
+    g_array_free(offsets, TRUE);
+    g_string_free(buf, TRUE);
+    g_free(changes_path);
+    g_free(dir);
 }
 
-void init_scan_table(struct mdb_tbl_scanner **scan, gchar *table)
+void copy_publish_chunk(struct mdb_copy *copy, guint c)
 {
-    if (NULL == *scan) {
-        *scan = g_malloc0(sizeof(struct mdb_tbl_scanner));
+    guint parts = copy->partitions ? copy->partitions->len : 1;
+    gchar *dir = g_strdup_printf("%s/%u", copy->staging, c);
+
+    for (guint p = 0; p < parts; ++p) {
+        gchar *part_dir = g_strdup_printf("%s/%u", dir, p);
+        gchar *rows_path = copy->partitions ?
+            g_strconcat(copy->table_path, "/", "partitions", "/", ((struct mdb_partition *) g_ptr_array_index(copy->partitions, p))->name, "/", "rows", NULL) :
+            g_strconcat(copy->table_path, "/", "rows", NULL);
+        GDir *staged = dir_open(part_dir);
+        const gchar *name;
+
+        while ((name = g_dir_read_name(staged))) {
+            gint64 roid = g_ascii_strtoll(name, NULL, 10);
+            gchar *bucket_path = g_strdup_printf("%s/%04li", rows_path, roid % copy->buckets);
+            gchar *from = g_strconcat(part_dir, "/", name, NULL);
+            gchar *to = g_strconcat(bucket_path, "/", name, NULL);
+
+            /* could have been dropped */
+            if (0 != mkdir(bucket_path, 0775) && EEXIST != errno) {
+                fprintf(stderr, "error: mkdir(%s): %s\n", bucket_path, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
 
-        (*scan)->table = g_strdup(table);
+            if (0 != rename(from, to)) {
+                fprintf(stderr, "error: rename(%s, %s): %s\n", from, to, g_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
 
-        gchar *rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", table, "/", "rows", NULL);
+            ++mdb_counters()->copy_rows_in;
 
-        if (!g_file_test(rows_path, G_FILE_TEST_IS_DIR)) {
-            fprintf(stderr, "error: table: %s: does not exist: %s\n", table, rows_path);
-            exit(EXIT_FAILURE);
+            g_free(to);
+            g_free(from);
+            g_free(bucket_path);
         }
 
-        (*scan)->rows = dir_open(rows_path);
-        (*scan)->cols = NULL;
-        (*scan)->bucket_dir = NULL;
-        (*scan)->entry_path = NULL;
-        
+        g_dir_close(staged);
         g_free(rows_path);
+        g_free(part_dir);
     }
-    else {
-        fprintf(stderr, "error: init_scan_table called on already initialized scanner\n");
-        exit(EXIT_FAILURE);
-    }
-}
 
-void final_scan_table(struct mdb_tbl_scanner **scan)
-{
-    g_free((*scan)->table);
-    if ((*scan)->entry_path) {
-        g_free((*scan)->entry_path);
+    /* The chunk's changes, whole lines at a time, once its rows are there to read */
+    gchar *changes_path = g_strconcat(dir, "/", "changes", NULL);
+    int fd = open(changes_path, O_RDONLY|O_CLOEXEC);
+    if (-1 == fd) {
+        fprintf(stderr, "error: open(%s): %s\n", changes_path, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
-    g_dir_close((*scan)->rows);
-    g_free(*scan);
-
-    *scan = NULL;
-}
 
-/*
- * One row at a time
- */
+    GString *pending = g_string_new(NULL);
+    GHashTable *after = mdb_change_cols_new();
+    gchar *block = g_malloc(MDB_COPY_BATCH);
+    ssize_t got;
 
-gboolean scan_table(struct mdb_tbl_scanner *scan)
-{
-    /* 
-     * Remeber, a bucket can have multiple entries (rows)
-     */
+    while (0 != (got = read(fd, block, MDB_COPY_BATCH))) {
+        if (-1 == got) {
+            fprintf(stderr, "error: read(%s): %s\n", changes_path, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-    const gchar *bucket = NULL;
-    if (NULL == scan->bucket_dir) {
-        bucket = g_dir_read_name(scan->rows);
+        g_string_append_len(pending, block, got);
 
-        if (NULL == bucket) {
-            return FALSE;
+        gchar *last = g_strrstr_len(pending->str, pending->len, "\n");
+        if (NULL == last) {
+            continue;
         }
 
-        gchar *bucket_path = g_strconcat(MULTIDB_TABLESDIR, "/", scan->table, "/", "rows", "/", bucket, NULL);
-        scan->bucket_dir = dir_open(bucket_path);
-        g_free(bucket_path);
+        gsize len = last - pending->str + 1;
 
-        if (NULL == scan->bucket_dir) {
-            fprintf(stderr, "error: dir_open: %s: %d\n", bucket_path, __LINE__);
-            exit(EXIT_FAILURE);
-        }
-    }
+        g_mutex_lock(&copy->lock);
+
+        mdb_changes_append(pending->str, len);
 
-    const gchar *entry = g_dir_read_name(scan->bucket_dir);
-    if (entry) {
-        scan->entry_path = g_strconcat(MULTIDB_TABLESDIR, "/", scan->table, "/", "rows", "/", bucket, "/", entry, NULL);
+        for (gchar *line = pending->str; copy->views && line < pending->str + len; ) {
+            gchar *eol = strchr(line, '\n');
+            gchar *text = g_strndup(line, eol - line);
+            gchar *kind, *table;
+            gint64 roid;
 
-        GDir *entry_dir = dir_open(scan->entry_path);
-        if (NULL != entry_dir) { /* could have been deleted */
-            const gchar *col;
+            g_hash_table_remove_all(after);
 
-            while ((col = g_dir_read_name(entry_dir))) {
-                scan->cols = g_slist_append(scan->cols, g_strconcat(MULTIDB_TABLESDIR, "/", scan->table, "/", "rows", "/", bucket, "/", entry, "/", col, NULL));
+            if (mdb_change_parse(text, &kind, &table, &roid, NULL, after)) {
+                mdb_views_apply(kind, table, roid, NULL, after);
+                g_free(kind);
+                g_free(table);
             }
 
-            g_dir_close(entry_dir);
+            g_free(text);
+            line = eol + 1;
         }
-    }
-    else {
-        g_dir_close(scan->bucket_dir);
-        scan->bucket_dir = NULL;
+
+        g_mutex_unlock(&copy->lock);
+
+        g_string_erase(pending, 0, len);
     }
 
-    return TRUE;
+    close(fd);
+
+    g_free(block);
+    g_hash_table_destroy(after);
+    g_string_free(pending, TRUE);
+    g_free(changes_path);
+    g_free(dir);
 }
 
-GHashTable * included_in_join(gchar *entry_path, GSList *joins)
+gpointer copy_stage_thread(gpointer data)
 {
-    if (NULL == joins) {
-        return(NULL);
+    struct mdb_copy *copy = data;
+    guint c;
+
+    while ((c = g_atomic_int_add(&copy->next, 1)) < copy->chunks->len) {
+        copy_stage_chunk(copy, c);
     }
 
-    // gchar *ret = NULL;
-    GHashTable *paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    return(NULL);
+}
 
-    for (GSList *iter = joins; iter; iter = iter->next) {
-        struct ddl_join *join = iter->data;
-        gchar *ret;
+gpointer copy_publish_thread(gpointer data)
+{
+    struct mdb_copy *copy = data;
+    guint c;
 
-        if ((ret = sequential_scan(join, entry_path))) {
-            // g_print("\t%s ON [%s]=[%s] [%s]\n", join->tbl_name, join->on_left, join->on_right, ret);
-            // g_print("paths: %s: %s [%s]\n", join->tbl_name, ret, entry_path);
-            g_hash_table_insert(paths, g_strdup(join->tbl_name), g_strdup(ret));
-            g_free(ret);
-        }
+    while ((c = g_atomic_int_add(&copy->next, 1)) < copy->chunks->len) {
+        copy_publish_chunk(copy, c);
     }
 
-    return(paths);
+    return(NULL);
 }
 
-gboolean included_in_where(GHashTable *paths, gchar *table, gchar *where_clause)
+/* As many workers as there are chunks (or units), at most, each taking the next one */
+void copy_run(struct mdb_copy *copy, guint workers, GThreadFunc func)
 {
-    if (NULL == where_clause) {
-        return TRUE;
-    }
+    GPtrArray *threads = g_ptr_array_new();
+    guint jobs = copy->units ? copy->units->len : copy->chunks->len;
 
-    GSList *rpn = parse_where(where_clause);
+    copy->next = 0;
 
-    // g_print("schema_path: %s\n", schema_path);
-    // g_print("entry_path: %s\n", g_hash_table_lookup(paths, table));
-    // g_print("where_clause: %s\n", where_clause);
-    // g_hash_table_foreach(paths, (GHFunc)iterator, "%s -> %s\n");
+    for (guint i = 0; i < MIN(workers, jobs); ++i) {
+        g_ptr_array_add(threads, g_thread_new("copy", func, copy));
+    }
 
-    // GHashTable *schema = load_schema(table);
+    for (guint i = 0; i < threads->len; ++i) {
+        g_thread_join(g_ptr_array_index(threads, i));
+    }
 
-    /* 
-     * Eval the RPN from db values
-     */
+    g_ptr_array_free(threads, TRUE);
+}
 
-    GList *stack = NULL;
+void execute_copy_from(struct ddl_parsed *ddl_copy)
+{
+    struct mdb_copy *copy = g_malloc0(sizeof(struct mdb_copy));
+    gboolean header = FALSE;
+    guint workers = g_get_num_processors();
 
-    gboolean stale;
+    copy->csv = TRUE;
 
-    // No AND, OR, or ?NOT? in the where clause
-    if (1 == g_slist_length(rpn)) {
-        gboolean ans = eval_where_expression(paths, table, rpn->data, &stale);
-        if (stale) {
-            g_slist_free_full(rpn, g_free);
+    for (GSList *iterator = ddl_copy->options; iterator; iterator = iterator->next) {
+        gchar **items = g_strsplit(iterator->data, "=", 2);
 
-            return(FALSE);
+        if (0 == g_ascii_strcasecmp("format", items[0]) && (0 == g_ascii_strcasecmp("csv", items[1]) || 0 == g_ascii_strcasecmp("tsv", items[1]))) {
+            copy->csv = 0 == g_ascii_strcasecmp("csv", items[1]);
         }
-
-        rpn = g_slist_remove(rpn, rpn->data);
-
-        if (ans) {
-            stack = g_list_append(stack, g_strdup("1"));
+        else if (0 == g_ascii_strcasecmp("header", items[0])) {
+            header = copy_option_true(items[1]);
+        }
+        else if (0 == g_ascii_strcasecmp("parallel", items[0]) && g_ascii_strtoll(items[1], NULL, 10) > 0) {
+            workers = g_ascii_strtoll(items[1], NULL, 10);
         }
         else {
-            stack = g_list_append(stack, g_strdup("0"));
+            fprintf(stderr, "error: COPY FROM: option: %s %s: unknown (FORMAT csv|tsv, HEADER, PARALLEL n)\n", items[0], items[1]);
+            exit(EXIT_FAILURE);
         }
-    }
-
-    GSList *iter_slist;
-    for (iter_slist = rpn; iter_slist; iter_slist = iter_slist->next) {
-        if (0 == g_ascii_strncasecmp("AND", iter_slist->data, strlen("AND")) ||
-            0 == g_ascii_strncasecmp("OR", iter_slist->data, strlen("OR"))
-        ) {
-            GList *elem = NULL;
-            gchar *left;
-            gchar *right;
-
-            if (NULL == stack) {
-                fprintf(stderr, "error: Incomplete AND or OR expression\n");
-                exit(EXIT_FAILURE);
-            }
-            elem = g_list_last(stack);
-            left = g_strdup(elem->data);
-            stack = g_list_remove(stack, elem->data);
-
-            if (NULL == stack) {
-                fprintf(stderr, "error: Incomplete AND or OR expression\n");
-                exit(EXIT_FAILURE);
-            }
-            elem = g_list_last(stack);
-            right = g_strdup(elem->data);
-            stack = g_list_remove(stack, elem->data);
-
-            gboolean ans_left = eval_where_expression(paths, table, left, &stale);
-            if (stale) {
-                g_slist_free_full(rpn, g_free);
-
-                return(FALSE);
-            }
 
-            gboolean ans_right = eval_where_expression(paths, table, right, &stale);
-            if (stale) {
-                g_slist_free_full(rpn, g_free);
+        g_strfreev(items);
+    }
 
-                return(FALSE);
-            }
+    copy->table = g_strdup(ddl_copy->tbl_name);
+    copy->table_path = g_strconcat(MULTIDB_TABLESDIR, "/", copy->table, NULL);
 
-            if (0 == g_ascii_strncasecmp("AND", iter_slist->data, strlen("AND"))) {
-                if (ans_left && ans_right) {
-                    stack = g_list_append(stack, g_strdup("1"));
-                }
-                else {
-                    stack = g_list_append(stack, g_strdup("0"));
-                }
-            }
-            else if (0 == g_ascii_strncasecmp("OR", iter_slist->data, strlen("OR"))) {
-                if (ans_left || ans_right) {
-                    stack = g_list_append(stack, g_strdup("1"));
-                }
-                else {
-                    stack = g_list_append(stack, g_strdup("0"));
-                }
-            }
-        }
-        else if (0 == g_ascii_strncasecmp("NOT", iter_slist->data, strlen("NOT"))) {
-            GSList *right = NULL;
-            fprintf(stderr, "error: NOT isn't implemented\n");
-            exit(EXIT_FAILURE);
-        }
-        else {
-            stack = g_list_append(stack, g_strdup(iter_slist->data));
-        }
-        // g_print("%s\n", iter_slist->data);
+    if (table_version(copy->table) < 2) {
+        fprintf(stderr, "error: COPY FROM: %s: needs a v%d table\n", copy->table, MDB_TABLE_VERSION);
+        exit(EXIT_FAILURE);
     }
 
-    if (1 != g_list_length(stack)) {
-        fprintf(stderr, "error: RPN not evaluated correctly: %s\n", g_hash_table_lookup(paths, table));
+    if (lsm_view(copy->table)) {
+        fprintf(stderr, "error: COPY FROM: %s: is an LSM table, INSERT its rows instead\n", copy->table);
         exit(EXIT_FAILURE);
     }
 
-    gboolean ret = FALSE;
-    if (0 == g_ascii_strncasecmp("1", stack->data, strlen("1"))) {
-        ret = TRUE;
+    int fd = open(ddl_copy->file, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+
+    if (-1 == fd || -1 == fstat(fd, &st)) {
+        fprintf(stderr, "error: COPY FROM: open(%s): %s\n", ddl_copy->file, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    // g_hash_table_foreach(schema, (GHFunc)iterator, "%s is a %s\n");
+    copy->len = st.st_size;
+    copy->data = "";
 
-    // g_print("\n");
-    // g_print("%s\n", g_hash_table_lookup(schema, "id"));
+    if (copy->len) {
+        copy->data = mmap(NULL, copy->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == copy->data) {
+            fprintf(stderr, "error: mmap(%s): %s\n", ddl_copy->file, g_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-    g_slist_free_full(rpn, g_free);
-    // g_hash_table_destroy(schema);
+        madvise((gpointer) copy->data, copy->len, MADV_SEQUENTIAL);
+    }
 
-    return(ret);
-}
+    /* The columns: as listed, or as the header names them */
+    GSList *names = g_slist_copy_deep(ddl_copy->cols, (GCopyFunc) g_strdup, NULL);
+    gsize pos = 0;
 
-GSList * parse_where(gchar *where_clause)
-{
-    GScanner *scanner;
-    
-    scanner = g_scanner_new(NULL);
-    scanner->config->scan_identifier_1char = TRUE;
-    scanner->config->cset_identifier_nth = G_CSET_a_2_z "_0123456789." G_CSET_A_2_Z G_CSET_LATINS G_CSET_LATINC;
+    if (header) {
+        GString *buf = g_string_new(NULL);
+        GArray *offsets = g_array_new(FALSE, FALSE, sizeof(gint));
 
-    // g_print("%s\n", where_clause);
-    
-    /* feed in the text */
-    g_scanner_input_text(scanner, where_clause, strlen(where_clause));
-    
-    /* give the error handler an idea on how the input is named */
-    scanner->input_name = "WHERE";
+        pos = copy_row_end(copy->data, 0, copy->len, copy->csv);
 
-    gchar *_buf = NULL;
+        if (NULL == names) {
+            copy_split_row(copy, 0, pos, buf, offsets);
 
-    struct ddl_parsed ddl_select = {NULL, NULL, NULL, NULL};
+            for (guint i = 0; i < offsets->len; ++i) {
+                gint offset = g_array_index(offsets, gint, i);
 
-    // http://en.wikipedia.org/wiki/Shunting-yard_algorithm (sort of)
+                names = g_slist_append(names, g_strstrip(g_strdup(-1 == offset ? "" : &buf->str[offset])));
+            }
+        }
 
-    GSList *output = NULL;
-    GList *stack = NULL;
+        pos = MIN(pos + 1, copy->len);
 
-    gchar *converted = NULL;
+        g_array_free(offsets, TRUE);
+        g_string_free(buf, TRUE);
+    }
 
-    while (!g_scanner_eof(scanner))
-    {
-        static int nested = 0;
-        GTokenType tokenType = g_scanner_get_next_token(scanner);
-        GTokenType nextToken;
+    if (NULL == names) {
+        fprintf(stderr, "error: COPY FROM: %s: name the columns, or take them from a HEADER\n", copy->table);
+        exit(EXIT_FAILURE);
+    }
 
-        gchar *t = NULL;
+    GHashTable *schema = cached_schema(copy->table);
+    GList *keys = g_list_sort(g_hash_table_get_keys(schema), (GCompareFunc) g_strcmp0);
+    gchar *partition_col = table_partition_col(copy->table);
+
+    copy->fields = g_slist_length(names);
+    copy->ncols = g_list_length(keys);
+    copy->cols = g_new0(gchar *, copy->ncols + 1);
+    copy->col_types = g_new0(MdbColumnType, copy->ncols);
+    copy->field = g_new0(gint, copy->ncols);
+    copy->serial = g_new0(gint64, copy->ncols);
+    copy->partition = -1;
+
+    for (GSList *name = names; name; name = name->next) {
+        if (!g_hash_table_contains(schema, name->data)) {
+            fprintf(stderr, "error: schema: [%s]::[%s]: not found\n", copy->table, (gchar *) name->data);
+            exit(EXIT_FAILURE);
+        }
 
-        // g_print("%s %s\n", tickGTokenType(tokenType), G_TOKEN_IDENTIFIER == tokenType ? scanner->value.v_identifier : "");
+        if (g_slist_find_custom(name->next, name->data, (GCompareFunc) g_strcmp0)) {
+            fprintf(stderr, "error: COPY FROM: [%s]::[%s]: named twice\n", copy->table, (gchar *) name->data);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-        switch ((int)tokenType) {
-            case G_TOKEN_IDENTIFIER: 
-                if (NULL == _buf && !is_operator(scanner->value.v_identifier)) {
-                    _buf = g_strconcat(scanner->value.v_identifier, NULL);
-                }
-                else if (is_operator(scanner->value.v_identifier)) {
-                    if (_buf) {
-                        output = g_slist_append(output, g_strdup(_buf));
-                        g_free(_buf);
-                        _buf = NULL;
-                    }
+    guint i = 0;
+    for (GList *key = keys; key; key = key->next, ++i) {
+        copy->cols[i] = g_strdup(key->data);
+        copy->col_types[i] = MDB_COL_TEXT;
+        GSList *named = g_slist_find_custom(names, key->data, (GCompareFunc) g_strcmp0);
+        copy->field[i] = named ? g_slist_position(names, named) : -1;
 
-                    GList *elem = g_list_last(stack);
-                    while (elem && is_operator(elem->data) && 
-                        is_precedence_less_or_equal(scanner->value.v_identifier, elem))
-                    {
-                        output = g_slist_append(output, g_strdup(elem->data));
- 
-                        gpointer data = elem->data;
-                        stack = g_list_remove(stack, elem->data);
-                        g_free(data);
-
-                        elem = g_list_last(stack);
-                    }
+        mdb_col_type_from_name(g_hash_table_lookup(schema, key->data), &copy->col_types[i]);
 
-                    stack = g_list_append(stack, g_strdup(scanner->value.v_identifier));
-                }
-                else {
-                    if (0 == g_ascii_strncasecmp("IS", scanner->value.v_identifier, strlen("IS")) ||
-                        0 == g_ascii_strncasecmp("NULL", scanner->value.v_identifier, strlen("NULL")))
-                    {
-                        t = _buf;
-                        _buf = g_strconcat(_buf, " ", scanner->value.v_identifier, NULL);
-                        g_free(t);
-                    }
-                    else {
-                        t = _buf;
-                        _buf = g_strconcat(_buf, scanner->value.v_identifier, NULL);
-                        g_free(t);
-                    }
-                }
-            break;
+        if (0 == g_strcmp0(partition_col, key->data)) {
+            copy->partition = i;
+        }
+    }
 
-            case G_TOKEN_LEFT_PAREN: 
-                if (NULL == converted) {
-                    stack = g_list_append(stack, g_strdup("("));
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    if (partition_col) {
+        if (-1 == copy->field[copy->partition]) {
+            fprintf(stderr, "error: [%s]::[%s]: partition key can't be NULL\n", copy->table, partition_col);
+            exit(EXIT_FAILURE);
+        }
 
-            case G_TOKEN_RIGHT_PAREN: 
-                {
-                    if (_buf) {
-                        output = g_slist_append(output, g_strdup(_buf));
-                        g_free(_buf);
-                        _buf = NULL;
-                    }
+        copy->partitions = load_partitions(copy->table, partition_col);
+    }
 
-                    GList *elem = g_list_last(stack);
-                    while (elem && 0 != g_ascii_strncasecmp("(", elem->data, strlen("("))) {
-                        output = g_slist_append(output, g_strdup(elem->data));
+    GPtrArray *views = mdb_views();
+    for (guint v = 0; v < views->len; ++v) {
+        struct mdb_view *view = g_ptr_array_index(views, v);
 
-                        gpointer data = elem->data;
-                        stack = g_list_remove(stack, elem->data);
-                        g_free(data);
+        copy->views |= NULL != g_slist_find_custom(view->tables, copy->table, (GCompareFunc) g_strcmp0);
+    }
 
-                        elem = g_list_last(stack);
-                    }
+    copy->logged = mdb_change_wanted(copy->table);
 
-                    if (NULL == elem) {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                    else if (0 == g_ascii_strncasecmp("(", elem->data, strlen("("))) {
-                        gpointer data = elem->data;
-                        stack = g_list_remove(stack, elem->data);
-                        g_free(data);
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            break;
+    /* Count the rows, cutting them into chunks on the way */
+    gsize target = MAX(copy->len / (workers * 4), MDB_COPY_CHUNK_MIN);
+    struct mdb_copy_chunk chunk = { pos, pos, 0, 0 };
 
-            case G_TOKEN_STRING: 
-                if (NULL == converted) {
-                    converted = g_strdup_printf("'%s'", scanner->value.v_string);
-                }
-                else {
-                    gchar *t = converted;
-                    converted = g_strdup_printf("%s'%s'", t, scanner->value.v_string);
-                    g_free(t);
-                }
+    copy->chunks = g_array_new(FALSE, FALSE, sizeof(struct mdb_copy_chunk));
 
-                if (NULL == _buf) {
-                    _buf = g_strconcat(converted, NULL);
-                }
-                else {
-                    t = _buf;
-                    _buf = g_strconcat(_buf, converted, NULL);
-                    g_free(t);
-                }
-                g_free(converted);
-                converted = NULL;
-            break;
+    while (pos < copy->len) {
+        gsize end = copy_row_end(copy->data, pos, copy->len, copy->csv);
 
-            case G_TOKEN_EQUAL_SIGN: 
-                if (NULL == converted) {
-                    converted = g_strdup_printf("%s", "=");
-                }
-                else {
-                    gchar *t = converted;
-                    converted = g_strdup_printf("%s%s", t, "=");
-                    g_free(t);
-                }
+        chunk.rows += !copy_row_empty(copy->data, pos, end);
+        pos = MIN(end + 1, copy->len);
 
-                if (NULL == _buf) {
-                    _buf = g_strconcat(converted, NULL);
-                }
-                else {
-                    t = _buf;
-                    _buf = g_strconcat(_buf, converted, NULL);
-                    g_free(t);
-                }
-                g_free(converted);
-                converted = NULL;
-            break;
+        if (pos - chunk.start >= target || pos == copy->len) {
+            chunk.end = pos;
+            g_array_append_val(copy->chunks, chunk);
 
-            case '>': 
-                if (NULL == converted) {
-                    converted = g_strdup_printf("%s", ">");
-                }
+            chunk.start = pos;
+            chunk.first += chunk.rows;
+            chunk.rows = 0;
+        }
+    }
 
-                nextToken = g_scanner_peek_next_token(scanner);
-                if (G_TOKEN_EQUAL_SIGN != nextToken) {
-                    if (NULL == _buf) {
-                        _buf = g_strconcat(converted, NULL);
-                    }
-                    else {
-                        t = _buf;
-                        _buf = g_strconcat(_buf, converted, NULL);
-                        g_free(t);
-                    }
-                    g_free(converted);
-                    converted = NULL;
-                }
-            break;
+    gint64 rows = chunk.first;
 
-            case '<': 
-                if (NULL == converted) {
-                    converted = g_strdup_printf("%s", "<");
-                }
+    if (rows) {
+        copy->roid = next_roids(copy->table_path, rows);
 
-                nextToken = g_scanner_peek_next_token(scanner);
-                if (G_TOKEN_EQUAL_SIGN != nextToken) {
-                    if (NULL == _buf) {
-                        _buf = g_strconcat(converted, NULL);
-                    }
-                    else {
-                        t = _buf;
-                        _buf = g_strconcat(_buf, converted, NULL);
-                        g_free(t);
-                    }
-                    g_free(converted);
-                    converted = NULL;
-                }
-            break;
+        for (i = 0; i < copy->ncols; ++i) {
+            gchar *serial_file = g_strconcat(copy->table_path, "/", "metadata", "/", "serial", "/", copy->cols[i], NULL);
 
-            case '!': 
-                if (NULL == converted) {
-                    converted = g_strdup_printf("%s", "!");
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+            if (g_file_test(serial_file, G_FILE_TEST_IS_REGULAR)) {
+                copy->serial[i] = next_serials(copy->table_path, serial_file, rows);
+            }
 
-            case G_TOKEN_INT: 
-                converted = g_strdup_printf("%li", scanner->value.v_int);
-                t = _buf;
-                _buf = g_strconcat(_buf, converted, NULL);
-                g_free(t);
-                g_free(converted);
-                converted = NULL;
-            break;
+            g_free(serial_file);
         }
     }
 
-    if (_buf) {
-        output = g_slist_append(output, g_strdup(_buf));
-        g_free(_buf);
-        _buf = NULL;
-    }
+    copy->codec = load_table_codec(copy->table_path);
+    copy->buckets = load_table_buckets(copy->table_path);
+    copy->staging = g_strdup_printf("%s/%d/copy", MULTIDB_TXNDIR, getpid());
+    g_mutex_init(&copy->lock);
 
-    GList *iter_list;
-    for (iter_list = g_list_last(stack); iter_list; iter_list = iter_list->prev) {
-        if (0 == g_ascii_strncasecmp("(", iter_list->data, strlen("("))) {
-            g_scanner_unexp_token(scanner, G_TOKEN_LEFT_PAREN, NULL, "symbol", NULL, NULL, TRUE);
-            exit(EXIT_FAILURE);
-        }
-        output = g_slist_append(output, g_strdup(iter_list->data));
-    }
+    copy_run(copy, workers, copy_stage_thread);
+    copy_run(copy, workers, copy_publish_thread);
 
-    g_list_free_full(stack, g_free);
+    if (g_file_test(copy->staging, G_FILE_TEST_IS_DIR)) {
+        gchar *txn_path = g_path_get_dirname(copy->staging);
 
-    /*
-    GSList *iter_slist;
-    for (iter_slist = output; iter_slist; iter_slist = iter_slist->next) {
-        g_print("output: %s\n", iter_slist->data);
+        remove_tree(copy->staging);
+        g_rmdir(txn_path);
+        g_free(txn_path);
     }
-    */
 
-    return(output);
+    if (copy->len) {
+        munmap((gpointer) copy->data, copy->len);
+    }
+    close(fd);
+
+    g_slist_free_full(names, g_free);
+    g_list_free(keys);
+    g_free(partition_col);
+    free_mdb_copy(copy);
 }
 
 /*
- * DELETE FROM site_key WHERE id = 3;
+ * COPY TO
+ *
+ * Every bucket directory of the table (of each of its partitions, when
+ * it has them) is a unit of work.  Each worker takes the next unit
+ * until there are none left, reading its rows with buffers of its own
+ * and formatting them into a file of its own, part-<worker>, written a
+ * batch at a time; nothing orders the rows of one file against another.
+ * The directory is filled under a temporary name, a manifest listing
+ * the files written last, and renamed into place.  LSM and v1 tables,
+ * which aren't read a column file at a time, are exported by this
+ * thread alone.
  */
 
-struct ddl_parsed parse_delete(const gchar *text)
+const gchar * copy_format_ext(struct mdb_copy *copy)
 {
-    GScanner *scanner;
-    
-    scanner = g_scanner_new(NULL);
-    
-    /* feed in the text */
-    g_scanner_input_text(scanner, text, strlen(text));
-    
-    /* give the error handler an idea on how the input is named */
-    scanner->input_name = "DELETE";
+    return(copy->binary ? "bin" : copy->csv ? "csv" : "tsv");
+}
 
-    int state = STATE_START;
-    gchar *_buf = NULL;
+/*
+ * Text leaves its quotes behind, so COPY FROM takes the file back.
+ * Binary: a little endian guint32 length, G_MAXUINT32 for NULL, then
+ * the value as a v2 table stores it.
+ */
 
-    struct ddl_parsed ddl_delete = {NULL, NULL, NULL, NULL};
+void copy_format_value(struct mdb_copy *copy, const struct mdb_col *value, GString *out, GByteArray *scratch)
+{
+    const gchar *text = NULL;
+    gsize len = 0;
 
-    while (!g_scanner_eof(scanner))
-    {
-        GTokenType tokenType = g_scanner_get_next_token(scanner);
-        GTokenType nextToken;
+    if (!value->null && MDB_COL_TEXT == value->col_type) {
+        text = value->v_text;
+        len = strlen(text);
 
-        gchar *converted = NULL;
-        gchar *t = NULL;
+        if (len >= 2 && '\'' == text[0] && '\'' == text[len - 1]) {
+            ++text;
+            len -= 2;
+        }
+    }
 
-        // g_print("%s %s\n", tickGTokenType(tokenType), G_TOKEN_IDENTIFIER == tokenType ? scanner->value.v_identifier : "");
+    if (copy->binary) {
+        guint32 size = G_MAXUINT32;
 
-        switch (state) {
-            case STATE_START: 
-                if (G_TOKEN_IDENTIFIER != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
+        if (!value->null && NULL == text) {
+            encode_mdb_col(value, scratch);
+            text = (const gchar *) scratch->data;
+            len = scratch->len;
+        }
 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 != g_ascii_strncasecmp("DELETE", scanner->value.v_identifier, strlen("DELETE"))) {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
+        if (!value->null) {
+            size = len;
+        }
 
-                    nextToken = g_scanner_peek_next_token(scanner);
+        size = GUINT32_TO_LE(size);
+        g_string_append_len(out, (const gchar *) &size, sizeof(size));
+        g_string_append_len(out, text, len);
 
-                    if (G_TOKEN_IDENTIFIER == nextToken) {
-                        state = STATE_FROM;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            break;
+        return;
+    }
 
-            case STATE_FROM: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("FROM", scanner->next_value.v_identifier, strlen("FROM"))) {
-                        state = STATE_TABLENAME;
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    if (value->null) {
+        if (!copy->csv) {
+            g_string_append(out, "\\N");
+        }
 
-            case STATE_TABLENAME: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    ddl_delete.tables = g_slist_append(ddl_delete.tables, g_strdup(scanner->value.v_identifier));
+        return;
+    }
 
-                    nextToken = g_scanner_peek_next_token(scanner);
+    switch (value->col_type) {
+        case MDB_COL_INT64:
+            g_string_append_printf(out, "%li", value->v_int64);
+        break;
 
-                    if (';' == nextToken) {
-                        state = STATE_END;
-                    }
-                    else if (G_TOKEN_IDENTIFIER == nextToken) {
-                        if (0 == g_ascii_strncasecmp("WHERE", scanner->next_value.v_identifier, strlen("WHERE"))) {
-                            state = STATE_WHERE;
-                        }
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+        case MDB_COL_DOUBLE:
+            g_string_append_printf(out, "%.15g", value->v_double);
+        break;
 
-            case STATE_WHERE:
-                extract_where(scanner, tokenType, &_buf, &state);
-            break;
+        case MDB_COL_BOOLEAN:
+            g_string_append(out, value->v_bool ? "true" : "false");
+        break;
 
-            case STATE_END:
-                if (';' == tokenType) {
-                    if (_buf) {
-                        ddl_delete.where = g_strdup(_buf);
-                        g_free(_buf);
-                        _buf = NULL;
+        case MDB_COL_TIMESTAMP:
+            {
+                gchar *ts = mdb_format_timestamp(value->v_int64);
+                g_string_append(out, ts);
+                g_free(ts);
+            }
+        break;
+
+        case MDB_COL_TEXT:
+            /* An empty field is NULL, so an empty string is quoted */
+            if (copy->csv && (0 == len || NULL != strpbrk(text, ",\"\r\n"))) {
+                g_string_append_c(out, '"');
+                for (gsize i = 0; i < len; ++i) {
+                    if ('"' == text[i]) {
+                        g_string_append_c(out, '"');
                     }
+                    g_string_append_c(out, text[i]);
                 }
-
-                if (';' != tokenType && G_TOKEN_EOF != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
+                g_string_append_c(out, '"');
+            }
+            else if (copy->csv) {
+                g_string_append_len(out, text, len);
+            }
+            else {
+                for (gsize i = 0; i < len; ++i) {
+                    switch (text[i]) {
+                        case '\t': g_string_append(out, "\\t"); break;
+                        case '\n': g_string_append(out, "\\n"); break;
+                        case '\r': g_string_append(out, "\\r"); break;
+                        case '\\': g_string_append(out, "\\\\"); break;
+                        default: g_string_append_c(out, text[i]); break;
+                    }
                 }
-            break;
-        }
+            }
+        break;
     }
-
-    g_free(_buf);
-
-    return(ddl_delete);
 }
 
-void execute_ddl_delete(gchar *sql)
+/*
+ * Worker w's file, and its header: the column names for HEADER, or for
+ * binary the magic, a guint16 column count and each column's type and
+ * guint16 length prefixed name
+ */
+
+struct mdb_copy_part * copy_part_open(struct mdb_copy *copy, guint w)
 {
-    struct ddl_parsed ddl_delete = parse_delete(sql);
+    struct mdb_copy_part *part = &copy->parts[w];
 
-    GSList *table = NULL;
-    GSList *purgatory = NULL;
+    part->name = g_strdup_printf("part-%05u.%s", w, copy_format_ext(copy));
+    part->out = g_string_sized_new(MDB_COPY_BATCH);
 
-    // g_print("WHERE [DELETE]: %s\n", ddl_delete.where);
+    gchar *path = g_strconcat(copy->dir, "/", part->name, NULL);
 
-    /* Delete the rows */
-    table = ddl_delete.tables;
-    
-    gchar *rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", NULL);
-    if (!g_file_test(rows_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: table: %s: does not exist: %s\n", table->data, rows_path);
+    part->fd = open(path, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC, 0666);
+    if (-1 == part->fd) {
+        fprintf(stderr, "error: COPY TO: open(%s): %s\n", path, g_strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    GDir *rows = dir_open(rows_path);
-    const gchar *bucket = g_dir_read_name(rows);
-
-    gboolean found_one_entry = FALSE;
+    if (copy->binary) {
+        guint16 ncols = GUINT16_TO_LE(copy->ncols);
 
-    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table->data, NULL);
+        g_string_append(part->out, MDB_COPY_BINARY_MAGIC);
+        g_string_append_len(part->out, (const gchar *) &ncols, sizeof(ncols));
 
-    while (bucket) {
-        gchar *row_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", "/", bucket, NULL);
-        GDir *row = dir_open(row_path);
+        for (guint i = 0; i < copy->ncols; ++i) {
+            guint16 len = GUINT16_TO_LE(strlen(copy->cols[i]));
 
-        gchar *purgatory_path = g_strconcat(MULTIDB_PURGATORYDIR, "/", table->data, NULL);
-
-        const gchar *entry = g_dir_read_name(row);
-
-        while (entry) {
-            gchar *entry_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", "/", bucket, "/", entry, NULL);
-            gchar *purgatory_entry = g_strconcat(purgatory_path, "/", entry, NULL);
-
-            GHashTable *paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-            g_hash_table_insert(paths, g_strdup(table->data), g_strdup(entry_path));
-
-            if (FALSE == included_in_where(paths, table->data, ddl_delete.where)) {
-                entry = g_dir_read_name(row);
-                g_free(entry_path);
-                g_hash_table_destroy(paths);
-                continue;
+            g_string_append_c(part->out, copy->col_types[i]);
+            g_string_append_len(part->out, (const gchar *) &len, sizeof(len));
+            g_string_append(part->out, copy->cols[i]);
+        }
+    }
+    else if (copy->header) {
+        for (guint i = 0; i < copy->ncols; ++i) {
+            if (i) {
+                g_string_append_c(part->out, copy->csv ? ',' : '\t');
             }
-            g_hash_table_destroy(paths);
+            g_string_append(part->out, copy->cols[i]);
+        }
+        g_string_append_c(part->out, '\n');
+    }
 
-            found_one_entry = TRUE;
-            // g_print("DELETE: %s [%s]\n", entry_path, purgatory_path);
+    g_free(path);
 
-            if (0 != g_mkdir_with_parents(purgatory_path, 0775)) {
-                fprintf(stderr, "error: g_mkdir_with_parents: %s: %s\n", purgatory_path, g_strerror(errno));
-                exit(EXIT_FAILURE);
-            }
+    return(part);
+}
 
-            if (0 != g_rename(entry_path, purgatory_entry)) {
-                fprintf(stderr, "error: g_rename: %s -> %s: %s\n", entry_path, purgatory_path, g_strerror(errno));
-                exit(EXIT_FAILURE);
-            }
+void copy_part_row(struct mdb_copy *copy, struct mdb_copy_part *part, struct mdb_col *values, GByteArray *scratch)
+{
+    for (guint i = 0; i < copy->ncols; ++i) {
+        if (i && !copy->binary) {
+            g_string_append_c(part->out, copy->csv ? ',' : '\t');
+        }
 
-            purgatory = g_slist_append(purgatory, g_strdup(purgatory_entry));
+        copy_format_value(copy, &values[i], part->out, scratch);
+    }
 
-            g_free(entry_path);
-            g_free(purgatory_entry);
-            entry = g_dir_read_name(row);
-        }
+    if (!copy->binary) {
+        g_string_append_c(part->out, '\n');
+    }
 
-        g_dir_close(row);
-        g_free(row_path);
+    ++part->rows;
+    ++mdb_counters()->copy_rows_out;
 
-        bucket = g_dir_read_name(rows);
+    if (part->out->len >= MDB_COPY_BATCH) {
+        write_fd(part->fd, part->out->str, part->out->len);
+        part->bytes += part->out->len;
+        g_string_truncate(part->out, 0);
     }
+}
 
-    if (found_one_entry) {
-        purgatory = g_slist_append(purgatory, g_strconcat(MULTIDB_PURGATORYDIR, "/", table->data, NULL));
+void copy_part_close(struct mdb_copy_part *part)
+{
+    write_fd(part->fd, part->out->str, part->out->len);
+    part->bytes += part->out->len;
+
+    if (-1 == fsync(part->fd)) {
+        fprintf(stderr, "error: fsync(%s): %s\n", part->name, g_strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    GSList *iterator = NULL;
-    for (iterator = purgatory; iterator; iterator = iterator->next) {
+    close(part->fd);
+    part->fd = -1;
 
-        /* 
-         * Remove the files in the directory
-         */
+    g_string_free(part->out, TRUE);
+    part->out = NULL;
+}
 
-        GDir *schema_dir = dir_open(schema_path);
-        const gchar *schema_entry = g_dir_read_name(schema_dir);
-        while (schema_entry) {
-            gchar *file = g_strconcat(iterator->data, "/", schema_entry, NULL);
+/* FALSE if the row went away under us */
+gboolean copy_read_row(struct mdb_copy *copy, int row, struct mdb_col *values, GByteArray *raw, GByteArray *plain)
+{
+    for (guint i = 0; i < copy->ncols; ++i) {
+        memset(&values[i], 0, sizeof(struct mdb_col));
+        values[i].col_type = copy->col_types[i];
+    }
 
-            if (g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
-                if (0 != g_remove(file)) {
-                    fprintf(stderr, "error: g_remove: %s: %s\n", file, g_strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
-            }
+    for (guint i = 0; i < copy->ncols; ++i) {
+        gsize len;
+        const gchar *buf = read_col_file_into(row, copy->cols[i], raw, plain, &len);
 
-            g_free(file);
-            schema_entry = g_dir_read_name(schema_dir);
+        if (NULL == buf) {
+            return(FALSE);
         }
 
-        /* 
-         * Remove the directory
-         */
-        if (0 != g_remove(iterator->data)) {
-            fprintf(stderr, "error: g_remove: %s: %s\n", iterator->data, g_strerror(errno));
+        if (!decode_mdb_col(&values[i], buf, len)) {
+            fprintf(stderr, "error: %s: %s: corrupt value (%lu bytes)\n", copy->table, copy->cols[i], len);
             exit(EXIT_FAILURE);
         }
     }
 
-    g_free(schema_path);
-    g_slist_free_full(purgatory, g_free);
-
-    g_dir_close(rows);
-    g_free(rows_path);
+    return(TRUE);
 }
 
-/*
- * UPDATE site_key SET id = 4 WHERE id = 3;
- */
-
-struct ddl_parsed parse_update(const gchar *text)
+gpointer copy_export_thread(gpointer data)
 {
-    GScanner *scanner;
-    
-    scanner = g_scanner_new(NULL);
-    
-    /* feed in the text */
-    g_scanner_input_text(scanner, text, strlen(text));
-    
-    /* give the error handler an idea on how the input is named */
-    scanner->input_name = "UPDATE";
+    struct mdb_copy *copy = data;
+    struct mdb_copy_part *part = copy_part_open(copy, g_atomic_int_add(&copy->started, 1));
+    struct mdb_col *values = g_new0(struct mdb_col, copy->ncols);
+    GByteArray *raw = g_byte_array_new();
+    GByteArray *plain = g_byte_array_new();
+    GByteArray *scratch = g_byte_array_new();
+    guint u;
+
+    while ((u = g_atomic_int_add(&copy->next, 1)) < copy->units->len) {
+        struct mdb_dir bucket;
+        const gchar *entry;
+
+        /* could have been dropped */
+        if (!mdb_dir_open_at(&bucket, AT_FDCWD, g_ptr_array_index(copy->units, u))) {
+            continue;
+        }
 
-    int state = STATE_START;
-    gchar *_buf = NULL;
+        while ((entry = mdb_dir_read(&bucket))) {
+            int row = openat(bucket.fd, entry, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
 
-    struct ddl_parsed ddl_update = {NULL, NULL, NULL, NULL};
+            /* could have been deleted */
+            if (-1 == row) {
+                continue;
+            }
 
-    while (!g_scanner_eof(scanner))
-    {
-        GTokenType tokenType = g_scanner_get_next_token(scanner);
-        GTokenType nextToken = g_scanner_peek_next_token(scanner);
+            ++mdb_counters()->files_opened;
+            ++mdb_counters()->rows_scanned;
 
-        gchar *converted = NULL;
-        gchar *t = NULL;
+            if (copy_read_row(copy, row, values, raw, plain)) {
+                copy_part_row(copy, part, values, scratch);
+            }
 
-        // g_print("%s %s [%d]\n", tickGTokenType(tokenType), G_TOKEN_IDENTIFIER == tokenType ? scanner->value.v_identifier : "", state);
+            close(row);
 
-        switch (state) {
-            case STATE_START: 
-                if (G_TOKEN_IDENTIFIER != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
+            for (guint i = 0; i < copy->ncols; ++i) {
+                g_free(values[i].v_text);
+            }
+        }
 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 != g_ascii_strncasecmp("UPDATE", scanner->value.v_identifier, strlen("UPDATE"))) {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
+        mdb_dir_close(&bucket);
+    }
 
-                    if (G_TOKEN_IDENTIFIER == nextToken) {
-                        state = STATE_TABLENAME;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            break;
+    copy_part_close(part);
 
-            case STATE_TABLENAME: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    ddl_update.tables = g_slist_append(ddl_update.tables, g_strdup(scanner->value.v_identifier));
+    g_byte_array_free(scratch, TRUE);
+    g_byte_array_free(plain, TRUE);
+    g_byte_array_free(raw, TRUE);
+    g_free(values);
 
-                    if (G_TOKEN_IDENTIFIER == nextToken) {
-                        state = STATE_SET;
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    return(NULL);
+}
 
-            case STATE_SET: 
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("SET", scanner->value.v_identifier, strlen("SET"))) {
-                        state = STATE_UPDATE;
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+void copy_export_scan(struct mdb_copy *copy)
+{
+    struct mdb_copy_part *part = copy_part_open(copy, copy->started++);
+    struct mdb_col *values = g_new0(struct mdb_col, copy->ncols);
+    GByteArray *scratch = g_byte_array_new();
+    GHashTable *schema = cached_schema(copy->table);
+    struct mdb_tbl_scanner *scan = NULL;
 
-            case STATE_UPDATE:
-                if (G_TOKEN_IDENTIFIER == tokenType) {
-                    if (0 == g_ascii_strncasecmp("WHERE", scanner->value.v_identifier, strlen("WHERE"))) {
-                        if (_buf) {
-                            ddl_update.cols = g_slist_append(ddl_update.cols, g_strdup(_buf));
-                            g_free(_buf);
-                            _buf = NULL;
-                        }
+    init_scan_table(&scan, copy->table);
 
-                        state = STATE_WHERE;
-                    }
-                    else {
-                        if (0 == g_ascii_strncasecmp("null", scanner->value.v_identifier, strlen("null"))) {
-                            if (_buf) {
-                                gchar *t = _buf;
-                                _buf = g_strconcat(_buf, g_strdup("NULL"), NULL);
-                                g_free(t);
-                            }
-                            else {
-                                _buf = g_strdup("NULL");
-                            }
-                        }
-                        else {
-                            if (_buf) {
-                                gchar *t = _buf;
-                                _buf = g_strconcat(_buf, scanner->value.v_identifier, NULL);
-                                g_free(t);
-                            }
-                            else {
-                                _buf = g_strdup(scanner->value.v_identifier);
-                            }
-                        }
-                    }
-                }
-                else if (G_TOKEN_COMMA == tokenType || ';' == tokenType) {
-                    ddl_update.cols = g_slist_append(ddl_update.cols, g_strdup(_buf));
-                    g_free(_buf);
-                    _buf = NULL;
-                }
-                else if (G_TOKEN_EQUAL_SIGN == tokenType) {
-                    if (_buf) {
-                        gchar *t = _buf;
-                        _buf = g_strconcat(_buf, "=", NULL);
-                        g_free(t);
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else if (G_TOKEN_INT == tokenType) {
-                    if (_buf) {
-                        gchar *t = _buf;
-                        gchar *converted = g_strdup_printf("%li", scanner->value.v_int);
-                        _buf = g_strconcat(_buf, converted, NULL);
-                        g_free(t);
-                        g_free(converted);
-                    }
-                    else {
-                        gchar *converted = g_strdup_printf("%li", scanner->value.v_int);
-                        _buf = g_strdup(converted);
-                        g_free(converted);
-                    }
-                }
-                else if (G_TOKEN_STRING == tokenType) {
-                    if (_buf) {
-                        gchar *t = _buf;
-                        _buf = g_strconcat(_buf, "'", scanner->value.v_string, "'", NULL);
-                        g_free(t);
-                    }
-                    else {
-                        g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+    while (scan_table(scan)) {
+        gboolean stale = FALSE;
 
-            case STATE_WHERE:
-                extract_where(scanner, tokenType, &_buf, &state);
-            break;
+        for (guint i = 0; i < copy->ncols; ++i) {
+            read_mdb_col(copy->table, copy->cols[i], schema, scan->entry_path, &values[i]);
+            stale |= values[i].stale;
+        }
 
-            case STATE_END:
-                if (';' == tokenType) {
-                    if (_buf) {
-                        ddl_update.where = g_strdup(_buf);
-                        g_free(_buf);
-                        _buf = NULL;
-                    }
-                }
+        if (!stale) {
+            copy_part_row(copy, part, values, scratch);
+        }
 
-                if (';' != tokenType && G_TOKEN_EOF != tokenType) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-            break;
+        for (guint i = 0; i < copy->ncols; ++i) {
+            g_free(values[i].v_text);
         }
     }
 
-    g_free(_buf);
+    final_scan_table(&scan);
+    copy_part_close(part);
 
-    return(ddl_update);
+    g_byte_array_free(scratch, TRUE);
+    g_free(values);
 }
 
-void execute_ddl_update(gchar *sql)
+void execute_copy_to(struct ddl_parsed *ddl_copy)
 {
-    struct ddl_parsed ddl_update = parse_update(sql);
+    struct mdb_copy *copy = g_malloc0(sizeof(struct mdb_copy));
+    guint workers = g_get_num_processors();
 
-    GSList *table = NULL;
-    GSList *purgatory = NULL;
+    copy->csv = TRUE;
 
-    // g_print("WHERE [UPDATE]: %s\n", ddl_update.where);
-    /*
-    for (GSList *iterator = ddl_update.cols; iterator; iterator = iterator->next) {
-        g_print("\t%s\n", iterator->data);
+    for (GSList *iterator = ddl_copy->options; iterator; iterator = iterator->next) {
+        gchar **items = g_strsplit(iterator->data, "=", 2);
+
+        if (0 == g_ascii_strcasecmp("format", items[0]) && (0 == g_ascii_strcasecmp("csv", items[1]) || 0 == g_ascii_strcasecmp("tsv", items[1]))) {
+            copy->csv = 0 == g_ascii_strcasecmp("csv", items[1]);
+        }
+        else if (0 == g_ascii_strcasecmp("format", items[0]) && 0 == g_ascii_strcasecmp("binary", items[1])) {
+            copy->binary = TRUE;
+        }
+        else if (0 == g_ascii_strcasecmp("header", items[0])) {
+            copy->header = copy_option_true(items[1]);
+        }
+        else if (0 == g_ascii_strcasecmp("parallel", items[0]) && g_ascii_strtoll(items[1], NULL, 10) > 0) {
+            workers = g_ascii_strtoll(items[1], NULL, 10);
+        }
+        else {
+            fprintf(stderr, "error: COPY TO: option: %s %s: unknown (FORMAT csv|tsv|binary, HEADER, PARALLEL n)\n", items[0], items[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        g_strfreev(items);
     }
-    */
 
-    /* Update the rows */
-    table = ddl_update.tables;
-    
-    gchar *rows_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", NULL);
-    if (!g_file_test(rows_path, G_FILE_TEST_IS_DIR)) {
-        fprintf(stderr, "error: table: %s: does not exist: %s\n", table->data, rows_path);
+    copy->table = g_strdup(ddl_copy->tbl_name);
+    copy->table_path = g_strconcat(MULTIDB_TABLESDIR, "/", copy->table, NULL);
+
+    if (g_file_test(ddl_copy->file, G_FILE_TEST_EXISTS)) {
+        fprintf(stderr, "error: COPY TO: %s: already exists\n", ddl_copy->file);
         exit(EXIT_FAILURE);
     }
 
-    GDir *rows = dir_open(rows_path);
-    const gchar *bucket = g_dir_read_name(rows);
+    /* The columns: as listed, or all of them */
+    GHashTable *schema = cached_schema(copy->table);
+    GList *keys = g_list_sort(g_hash_table_get_keys(schema), (GCompareFunc) g_strcmp0);
+    GSList *names = g_slist_copy_deep(ddl_copy->cols, (GCopyFunc) g_strdup, NULL);
+
+    for (GList *key = keys; key && NULL == ddl_copy->cols; key = key->next) {
+        names = g_slist_append(names, g_strdup(key->data));
+    }
+
+    copy->ncols = g_slist_length(names);
+    copy->cols = g_new0(gchar *, copy->ncols + 1);
+    copy->col_types = g_new0(MdbColumnType, copy->ncols);
+
+    guint i = 0;
+    for (GSList *name = names; name; name = name->next, ++i) {
+        if (!g_hash_table_contains(schema, name->data)) {
+            fprintf(stderr, "error: schema: [%s]::[%s]: not found\n", copy->table, (gchar *) name->data);
+            exit(EXIT_FAILURE);
+        }
 
-    gchar *schema_path = g_strconcat(MULTIDB_SCHEMADIR, "/", table->data, NULL);
+        if (g_slist_find_custom(name->next, name->data, (GCompareFunc) g_strcmp0)) {
+            fprintf(stderr, "error: COPY TO: [%s]::[%s]: named twice\n", copy->table, (gchar *) name->data);
+            exit(EXIT_FAILURE);
+        }
 
-    while (bucket) {
-        gchar *row_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", "/", bucket, NULL);
-        GDir *row = dir_open(row_path);
+        copy->cols[i] = g_strdup(name->data);
+        copy->col_types[i] = MDB_COL_TEXT;
 
-        const gchar *entry = g_dir_read_name(row);
+        mdb_col_type_from_name(g_hash_table_lookup(schema, name->data), &copy->col_types[i]);
+    }
 
-        while (entry) {
-            gchar *entry_path = g_strconcat(MULTIDB_TABLESDIR, "/", table->data, "/", "rows", "/", bucket, "/", entry, NULL);
-            GHashTable *paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-            g_hash_table_insert(paths, g_strdup(table->data), g_strdup(entry_path));
+    copy->dir = g_strdup_printf("%s.%d.tmp", ddl_copy->file, getpid());
 
-            if (FALSE == included_in_where(paths, table->data, ddl_update.where)) {
-                entry = g_dir_read_name(row);
-                g_free(entry_path);
-                g_hash_table_destroy(paths);
-                continue;
-            }
-            g_hash_table_destroy(paths);
+    if (-1 == g_mkdir_with_parents(copy->dir, 0775)) {
+        fprintf(stderr, "error: COPY TO: mkdir(%s): %s\n", copy->dir, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-            for (GSList *iterator = ddl_update.cols; iterator; iterator = iterator->next) {
-                gchar *t = g_strdup(iterator->data);
+    g_mutex_init(&copy->lock);
 
-                gchar *equals = g_strstr_len(t, strlen(t), "=");
-                t[equals - t] = '\0';
-                gchar *left = t;
-                gchar *right = &t[equals - t + 1];
+    if (table_version(copy->table) >= 2 && NULL == lsm_view(copy->table)) {
+        gchar *partition_col = table_partition_col(copy->table);
+        GPtrArray *rows_paths = g_ptr_array_new_with_free_func(g_free);
 
-                gchar *path = g_strconcat(entry_path, "/", left, NULL);
+        if (partition_col) {
+            GPtrArray *partitions = load_partitions(copy->table, partition_col);
 
-                if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
-                    fprintf(stderr, "error: table: [%s]::[%s]: not found: %s\n", table->data, left, path);
-                    exit(EXIT_FAILURE);
-                }
+            for (guint p = 0; p < partitions->len; ++p) {
+                struct mdb_partition *part = g_ptr_array_index(partitions, p);
 
-                write_file(path, right);
+                g_ptr_array_add(rows_paths, g_strconcat(copy->table_path, "/", "partitions", "/", part->name, "/", "rows", NULL));
             }
-            
 
-            g_free(entry_path);
-            entry = g_dir_read_name(row);
+            g_ptr_array_free(partitions, TRUE);
+        }
+        else {
+            g_ptr_array_add(rows_paths, g_strconcat(copy->table_path, "/", "rows", NULL));
         }
 
-        g_dir_close(row);
-        g_free(row_path);
+        copy->units = g_ptr_array_new_with_free_func(g_free);
 
-        bucket = g_dir_read_name(rows);
-    }
+        for (guint p = 0; p < rows_paths->len; ++p) {
+            const gchar *rows_path = g_ptr_array_index(rows_paths, p);
+            struct mdb_dir rows;
+            const gchar *bucket;
 
-    g_free(schema_path);
-    g_slist_free_full(purgatory, g_free);
+            /* could have been dropped */
+            if (!mdb_dir_open_at(&rows, AT_FDCWD, rows_path)) {
+                continue;
+            }
 
-    g_dir_close(rows);
-    g_free(rows_path);
-}
+            while ((bucket = mdb_dir_read(&rows))) {
+                g_ptr_array_add(copy->units, g_strconcat(rows_path, "/", bucket, NULL));
+            }
 
-void extract_where(GScanner *scanner, GTokenType tokenType, gchar **_buf, int *state)
-{
-    GTokenType nextToken;
+            mdb_dir_close(&rows);
+        }
 
-    gchar *converted = NULL;
-    gchar *t = NULL;
+        copy->parts = g_new0(struct mdb_copy_part, MAX(1, MIN(workers, copy->units->len)));
 
-    nextToken = g_scanner_peek_next_token(scanner);
+        copy_run(copy, workers, copy_export_thread);
 
-    if (';' == nextToken) {
-        *state = STATE_END;
+        g_ptr_array_free(rows_paths, TRUE);
+        g_free(partition_col);
     }
+    else {
+        copy->parts = g_new0(struct mdb_copy_part, 1);
 
-    if (NULL == *_buf && G_TOKEN_IDENTIFIER == tokenType && 0 == g_ascii_strncasecmp("WHERE", scanner->value.v_identifier, strlen("WHERE"))) {
-        return;
+        copy_export_scan(copy);
     }
 
-    // g_print("%s %s [%d]\n", tickGTokenType(tokenType), G_TOKEN_IDENTIFIER == tokenType ? scanner->value.v_identifier : "", *state);
-
-    switch ((int)tokenType) {
-        case G_TOKEN_IDENTIFIER: 
-            if (NULL == *_buf) {
-                *_buf = g_strconcat(scanner->value.v_identifier, NULL);
-            }
-            else if (
-                    0 == g_ascii_strncasecmp("AND", scanner->value.v_identifier, strlen("AND")) ||
-                    0 == g_ascii_strncasecmp("OR", scanner->value.v_identifier, strlen("OR")) ||
-                    0 == g_ascii_strncasecmp("NOT", scanner->value.v_identifier, strlen("NOT"))
-            ) {
-                t = *_buf;
-                *_buf = g_strconcat(*_buf, " ", scanner->value.v_identifier, " ", NULL);
-                g_free(t);
-            }
-            else if (
-                    0 == g_ascii_strncasecmp("IS", scanner->value.v_identifier, strlen("IS")) ||
-                    0 == g_ascii_strncasecmp("NULL", scanner->value.v_identifier, strlen("NULL"))
-            ) {
-                if (NULL == *_buf) {
-                    g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                    exit(EXIT_FAILURE);
-                }
-                gchar *identifier = g_ascii_strup(scanner->value.v_identifier, -1);
-                *_buf = g_strconcat(*_buf, " ", identifier, NULL);
-                g_free(identifier);
-            }
-            else {
-                t = *_buf;
-                *_buf = g_strconcat(*_buf, scanner->value.v_identifier, NULL);
-                g_free(t);
-            }
-        break;
-
-        case G_TOKEN_LEFT_PAREN: 
-            if (NULL == converted) {
-                converted = g_strdup_printf("%s", "(");
-            }
-
-            if (NULL == *_buf) {
-                *_buf = g_strconcat(converted, NULL);
-            }
-            else {
-                t = *_buf;
-                *_buf = g_strconcat(*_buf, converted, NULL);
-                g_free(t);
-            }
-            g_free(converted);
-            converted = NULL;
-        break;
+    /* The manifest goes last: a directory with one is complete */
+    GString *manifest = g_string_new("file\trows\tbytes\n");
 
-        case G_TOKEN_RIGHT_PAREN: 
-            if (NULL == converted) {
-                converted = g_strdup_printf("%s", ")");
-            }
+    for (gint w = 0; w < copy->started; ++w) {
+        g_string_append_printf(manifest, "%s\t%li\t%li\n", copy->parts[w].name, copy->parts[w].rows, copy->parts[w].bytes);
+    }
 
-            if (NULL == *_buf) {
-                *_buf = g_strconcat(converted, NULL);
-            }
-            else {
-                t = *_buf;
-                *_buf = g_strconcat(*_buf, converted, NULL);
-                g_free(t);
-            }
-            g_free(converted);
-            converted = NULL;
-        break;
+    gchar *manifest_path = g_strconcat(copy->dir, "/", "manifest", NULL);
+    write_file(manifest_path, manifest->str);
 
-        case G_TOKEN_EQUAL_SIGN: 
-            if (NULL == converted) {
-                converted = g_strdup_printf("%s", "=");
-            }
-            else {
-                gchar *t = converted;
-                converted = g_strdup_printf("%s%s", t, "=");
-                g_free(t);
-            }
+    if (-1 == rename(copy->dir, ddl_copy->file)) {
+        fprintf(stderr, "error: COPY TO: rename(%s, %s): %s\n", copy->dir, ddl_copy->file, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-            if (NULL == *_buf) {
-                *_buf = g_strconcat(converted, NULL);
-            }
-            else {
-                t = *_buf;
-                *_buf = g_strconcat(*_buf, converted, NULL);
-                g_free(t);
-            }
-            g_free(converted);
-            converted = NULL;
-        break;
+    g_free(manifest_path);
+    g_string_free(manifest, TRUE);
+    g_slist_free_full(names, g_free);
+    g_list_free(keys);
+    free_mdb_copy(copy);
+}
 
-        case '>': 
-            if (NULL == converted) {
-                converted = g_strdup_printf("%s", ">");
-            }
+void execute_copy(gchar *sql)
+{
+    gint64 started_us = g_get_monotonic_time();
+    struct ddl_parsed ddl_copy = parse_copy(sql);
 
-            nextToken = g_scanner_peek_next_token(scanner);
-            if (G_TOKEN_EQUAL_SIGN != nextToken) {
-                if (NULL == *_buf) {
-                    *_buf = g_strconcat(converted, NULL);
-                }
-                else {
-                    t = *_buf;
-                    *_buf = g_strconcat(*_buf, converted, NULL);
-                    g_free(t);
-                }
-                g_free(converted);
-                converted = NULL;
-            }
-        break;
+    gchar *table_path = g_strconcat(MULTIDB_TABLESDIR, "/", ddl_copy.tbl_name, NULL);
+    if (!g_file_test(table_path, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "error: table: %s: does not already exist: %s\n", ddl_copy.tbl_name, table_path);
+        exit(EXIT_FAILURE);
+    }
 
-        case '<': 
-            if (NULL == converted) {
-                converted = g_strdup_printf("%s", "<");
-            }
+    /* COPY TO only reads */
+    if (0 == g_strcmp0("TO", ddl_copy.action)) {
+        execute_copy_to(&ddl_copy);
+    }
+    else {
+        mdb_refuse_replica("COPY FROM");
+        mdb_refuse_view(ddl_copy.tbl_name, "COPY FROM");
+        mdb_quiesce_enter();
 
-            nextToken = g_scanner_peek_next_token(scanner);
-            if (G_TOKEN_EQUAL_SIGN != nextToken) {
-                if (NULL == *_buf) {
-                    *_buf = g_strconcat(converted, NULL);
-                }
-                else {
-                    t = *_buf;
-                    *_buf = g_strconcat(*_buf, converted, NULL);
-                    g_free(t);
-                }
-                g_free(converted);
-                converted = NULL;
-            }
-        break;
+        execute_copy_from(&ddl_copy);
 
-        case '!': 
-            if (NULL == converted) {
-                converted = g_strdup_printf("%s", "!");
-            }
-            else {
-                g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-                exit(EXIT_FAILURE);
-            }
-        break;
+        mdb_quiesce_leave();
+    }
 
-        case G_TOKEN_INT: 
-            converted = g_strdup_printf("%li", scanner->value.v_int);
-            t = *_buf;
-            *_buf = g_strconcat(*_buf, converted, NULL);
-            g_free(t);
-            g_free(converted);
-            converted = NULL;
-        break;
+    g_slist_free_full(ddl_copy.cols, g_free);
+    g_slist_free_full(ddl_copy.options, g_free);
+    g_free(ddl_copy.tbl_name);
+    g_free(ddl_copy.action);
+    g_free(ddl_copy.file);
+    g_free(table_path);
 
-        case G_TOKEN_STRING: 
-            converted = g_strdup_printf("'%s'", scanner->value.v_string);
-            t = *_buf;
-            *_buf = g_strconcat(*_buf, converted, NULL);
-            g_free(t);
-            g_free(converted);
-            converted = NULL;
-        break;
+    mdb_stats_statement(MDB_STMT_COPY, started_us);
+}
 
-        default:
-            g_scanner_unexp_token(scanner, tokenType, NULL, "symbol", NULL, g_strdup_printf("Line: %d", __LINE__), TRUE);
-            exit(EXIT_FAILURE);
-        break;
-    }
+void mdb_col_destroy(gpointer mdb_col)
+{
+    g_free(((struct mdb_col *) mdb_col)->v_text);
+    g_free(mdb_col);
 }
@@ -8,6 +8,7 @@ gchar *MULTIDB_DATADIR;
 gchar *MULTIDB_SCHEMADIR;
 gchar *MULTIDB_TABLESDIR;
 gchar *MULTIDB_PURGATORYDIR;
+gchar *MULTIDB_TXNDIR;
 
 // #define MULTIDB_BASEDIR "multidb"
 
@@ -27,6 +28,20 @@ struct ddl_join {
     gchar *on_right;
 };
 
+/* bound is the literal it was declared with, NULL for MAXVALUE */
+
+struct ddl_partition {
+    gchar *name;
+    gchar *bound;
+};
+
+/*
+ * SELECT, INSERT, UPDATE and DELETE come out of the parser with their
+ * expressions built: exprs[i] is SELECT's cols[i] (NULL for *) or
+ * UPDATE's SET cols[i] = values[i], where_expr is where.  The texts are
+ * the statement's own, for headers and EXPLAIN.
+ */
+
 struct ddl_parsed {
     gchar *tbl_name;
     GSList *row;
@@ -35,52 +50,1062 @@ struct ddl_parsed {
     GSList *tables;
     GSList *joins;
     gchar *where;
+    GSList *options;
+    gchar *partition_by;
+    GSList *partitions;
+    gchar *action;
+    gchar *query;
+    gchar *file;
+    GPtrArray *exprs;
+    struct mdb_expr *where_expr;
 };
 
 typedef enum {
     MDB_COL_TEXT,
     MDB_COL_INT64,
+    MDB_COL_DOUBLE,
+    MDB_COL_BOOLEAN,
+    MDB_COL_TIMESTAMP,
 } MdbColumnType;
 
+/*
+ * v1 tables keep every value as text; v2 tables store INT64, DOUBLE,
+ * BOOLEAN and TIMESTAMP (epoch micros) as fixed width little endian
+ * binary and NULL as an empty file.
+ */
+
+#define MDB_TABLE_VERSION 2
+
+#define MDB_BUCKETS_DEFAULT 4096
+#define MDB_BUCKETS_MAX 65536
+
+/*
+ * A row's version word: the count of its writes in the low half (odd
+ * while one is under way) and the writer's pid in the top half
+ */
+
+#define MDB_ROW_VERSION(word) ((guint32) (word))
+#define MDB_ROW_VERSION_PID(word) ((pid_t) ((word) >> 32))
+#define MDB_ROW_VERSIONS_GROW 65536
+
+/* Optimistic writers fall back to the row lock after this many conflicts */
+#define MDB_OCC_RETRIES 4
+
+struct mdb_row_versions {
+    gchar *path;
+    int fd;
+    guint64 *words;
+    gsize count;
+};
+
+typedef enum {
+    MDB_CODEC_NONE,
+    MDB_CODEC_LZ4,
+    MDB_CODEC_ZSTD,
+    MDB_CODEC_AUTO
+} MdbCodec;
+
 struct mdb_col {
     MdbColumnType col_type;
     gboolean stale;
+    gboolean null;
     gint64 v_int64;
+    gdouble v_double;
+    gboolean v_bool;
     gchar *v_text;
 };
 
+/*
+ * A range partition holds the rows whose key is below bound and at or
+ * above the bound of the partition before it.
+ */
+
+struct mdb_partition {
+    gchar *name;
+    gboolean max;
+    struct mdb_col bound;
+    gboolean pruned;
+};
+
+typedef enum {
+    MDB_EXPR_LITERAL,
+    MDB_EXPR_COLUMN,
+    MDB_EXPR_NEGATE,
+    MDB_EXPR_NOT,
+    MDB_EXPR_BINARY,
+    MDB_EXPR_IS_NULL,
+    MDB_EXPR_FUNCTION
+} MdbExprKind;
+
+typedef enum {
+    MDB_OP_ADD,
+    MDB_OP_SUB,
+    MDB_OP_MUL,
+    MDB_OP_DIV,
+    MDB_OP_MOD,
+    MDB_OP_CONCAT,
+    MDB_OP_EQ,
+    MDB_OP_NE,
+    MDB_OP_LT,
+    MDB_OP_LE,
+    MDB_OP_GT,
+    MDB_OP_GE,
+    MDB_OP_AND,
+    MDB_OP_OR
+} MdbExprOp;
+
+struct mdb_expr {
+    MdbExprKind kind;
+    MdbExprOp op;
+    gboolean not_null;
+    struct mdb_col value;
+    gchar *table;
+    gchar *col;
+    gchar *func;
+    GPtrArray *args;
+};
+
+/*
+ * The lexer hands out slices of the statement, never copies: a token is
+ * where it starts and how long it is, numbers with their value too.
+ * next is the token not yet taken, end where the last one taken ended.
+ */
+
+typedef enum {
+    MDB_TOKEN_EOF,
+    MDB_TOKEN_IDENTIFIER,
+    MDB_TOKEN_INT,
+    MDB_TOKEN_FLOAT,
+    MDB_TOKEN_STRING,
+    MDB_TOKEN_SYMBOL
+} MdbTokenKind;
+
+struct mdb_token {
+    MdbTokenKind kind;
+    const gchar *start;
+    guint len;
+    gint64 v_int;
+    gdouble v_float;
+};
+
+struct mdb_lexer {
+    const gchar *text;
+    const gchar *input_name;
+    const gchar *pos;
+    const gchar *end;
+    struct mdb_token next;
+};
+
+/*
+ * What an expression reads a row through: table name -> entry path.
+ * override stands in for override_col of table, as read under a lock;
+ * pending (column file -> value) for what a transaction has SET so far.
+ */
+
+struct mdb_row_ctx {
+    GHashTable *paths;
+    const gchar *table;
+    const gchar *override_col;
+    struct mdb_col *override;
+    GHashTable *pending;
+    gboolean stale;
+};
+
+struct mdb_set {
+    gchar *col;
+    gchar *rhs;
+    gchar *literal;
+    MdbColumnType col_type;
+    gboolean fixed;
+    struct mdb_expr *expr;
+    gboolean constant;
+    struct mdb_col value;
+    GByteArray *encoded;
+};
+
+/*
+ * Blocks are kept when an arena is reset, so a mark taken before a
+ * loop and reset to on every pass lets the loop run without malloc.
+ */
+
+#define MDB_ARENA_BLOCK_SIZE (64 * 1024)
+
+struct mdb_arena_block {
+    gsize size;
+    gchar data[];
+};
+
+struct mdb_arena {
+    GPtrArray *blocks;
+    guint block;
+    gsize used;
+};
+
+struct mdb_arena_mark {
+    guint block;
+    gsize used;
+};
+
+#define MDB_DIRENT_BUF_SIZE (64 * 1024)
+#define MDB_ENTRY_FDS_MAX 64
+
+struct mdb_dir {
+    int fd;
+    gchar *buf;
+    gsize pos;
+    gsize len;
+    gpointer dir;
+};
+
+/*
+ * Rows are queued in ahead (bucket/entry) so the files of the
+ * prefetch_cols of a batch of them can be read together.
+ */
+
+#define MDB_PREFETCH_ROWS 64
+
 struct mdb_tbl_scanner {
-    GDir *rows;
-    GDir *bucket_dir;
+    struct mdb_dir rows;
+    struct mdb_dir bucket;
     gchar *table;
+    gchar *rows_path;
+    gchar *bucket_name;
+    const gchar *entry;
+    const gchar *entry_rel;
     gchar *entry_path;
-    GSList *cols;
+    GPtrArray *ahead;
+    guint ahead_pos;
+    GPtrArray *prefetch_cols;
+    GPtrArray *reqs;
+    GPtrArray *misses;
+    struct mdb_arena *arena;
+    gchar *partition_col;
+    GPtrArray *partitions;
+    guint partition_pos;
+    GArray *lsm_roids;
+    guint lsm_pos;
+    gboolean rows_done;
+    GPtrArray *staged;
+    guint staged_pos;
+};
+
+/*
+ * Counted as it happens by the thread doing the work: mdb_counters() is
+ * the calling thread's.  EXPLAIN ANALYZE charges the change across each
+ * call to the operator that made it; the stats file adds up every
+ * thread of every process.
+ */
+
+struct mdb_counters {
+    guint64 files_opened;
+    guint64 bytes_read;
+    gint64 lock_wait_us;
+    guint64 rows_scanned;
+    guint64 rows_returned;
+    guint64 bytes_written;
+    guint64 lock_acquisitions;
+    guint64 roids_allocated;
+    guint64 purgatory_reclaimed;
+    guint64 occ_writes;
+    guint64 occ_conflicts;
+    guint64 pool_hits;
+    guint64 pool_misses;
+    guint64 lsm_flushes;
+    guint64 lsm_compactions;
+    guint64 changes_logged;
+    guint64 view_rows_refreshed;
+    guint64 replica_changes_applied;
+    guint64 snapshot_files_cloned;
+    guint64 snapshot_files_linked;
+    guint64 snapshot_files_copied;
+    guint64 copy_rows_in;
+    guint64 copy_rows_out;
+};
+
+typedef enum {
+    MDB_STMT_CREATE,
+    MDB_STMT_INSERT,
+    MDB_STMT_SELECT,
+    MDB_STMT_UPDATE,
+    MDB_STMT_DELETE,
+    MDB_STMT_ALTER,
+    MDB_STMT_COPY,
+    MDB_STMT_TYPES
+} MdbStatement;
+
+/*
+ * Statement latency in microseconds, HDR style: exact below
+ * 2^MDB_LATENCY_SUB_BITS, then 2^MDB_LATENCY_SUB_BITS buckets to each
+ * power of two.  The last bucket takes everything above.
+ */
+
+#define MDB_LATENCY_SUB_BITS 2
+#define MDB_LATENCY_BUCKETS 128
+
+struct mdb_stats {
+    struct mdb_counters counters;
+    guint64 latency[MDB_STMT_TYPES][MDB_LATENCY_BUCKETS];
+    guint64 latency_sum_us[MDB_STMT_TYPES];
+};
+
+/* What's in multidb/stats: the magic, then a struct mdb_stats */
+#define MDB_STATS_MAGIC "MDBSTAT10"
+#define MDB_STATS_FLUSH_INTERVAL_US G_USEC_PER_SEC
+
+/*
+ * Between BEGIN and COMMIT, INSERT writes its row to data/txn/<pid>
+ * and UPDATE and DELETE only note the rows they matched.  COMMIT turns
+ * that into a log of renames and writes, syncs it once and publishes.
+ */
+
+typedef enum {
+    MDB_TXN_INSERT,
+    MDB_TXN_UPDATE,
+    MDB_TXN_DELETE
+} MdbTxnOpKind;
+
+struct mdb_txn_op {
+    MdbTxnOpKind kind;
+    gchar *table;
+    gchar *staged;
+    gchar *partition;
+    GSList *serials;
+    GSList *nulls;
+    GSList *entries;
+    GSList *sets;
+    struct mdb_expr *where;
+    MdbCodec codec;
+    GHashTable *after;
+};
+
+struct mdb_txn {
+    gboolean active;
+    gboolean committing;
+    gchar *path;
+    guint staged;
+    GPtrArray *ops;
+    GHashTable *locked;
+    GHashTable *roids;
+    GHashTable *pending;
+    GHashTable *dropped;
+    GString *log;
 };
 
+/* The last line of a complete commit log */
+#define MDB_TXN_LOG_END "end"
+
+/*
+ * What a write has to log, as of the start of the statement: data/changes
+ * is only written while data/consumers names someone to read it, and
+ * values from before a change only go in for a consumer that asked for
+ * them.  Views need the changes of the tables they read, and the old
+ * keys of those they join.  The log is trimmed back to the consumer
+ * furthest behind in MDB_CHANGES_TRIM byte steps.
+ */
+
+typedef enum {
+    MDB_CHANGES_OFF,
+    MDB_CHANGES_AFTER,
+    MDB_CHANGES_FULL
+} MdbChangesMode;
+
+struct mdb_changes {
+    gboolean loaded;
+    MdbChangesMode mode;
+    GHashTable *viewed;
+    GHashTable *joined;
+};
+
+#define MDB_CHANGES_TRIM 4096
+
+/*
+ * A materialized view, as data/views/<name> defines it: the names of
+ * its columns and the SELECT that fills them, compiled
+ */
+
+struct mdb_view {
+    gchar *name;
+    gchar **cols;
+    MdbColumnType *col_types;
+    struct ddl_parsed select;
+    GSList *tables;
+    GPtrArray *exprs;
+    struct mdb_expr *where;
+};
+
+/*
+ * multidb/replica of a replica: its primary's MULTIDB_PREFIX, the LSN of
+ * the first change not applied and when the follower last had the whole
+ * log.  The follower reads at most MDB_REPLICA_BATCH bytes of log at once.
+ */
+
+struct mdb_replica {
+    gchar *primary;
+    gchar *datadir;
+    gint64 lsn;
+    gint64 caught_up_us;
+};
+
+#define MDB_REPLICA_BATCH (4 * 1024 * 1024)
+
+/* data/quiesce, opened once, and how many statements deep this process is */
+struct mdb_quiesce {
+    int fd;
+    guint depth;
+};
+
+/*
+ * COPY FROM: the input is mapped and cut into chunks of whole rows,
+ * each of which a worker stages under staging/<chunk>.  Every column
+ * of the table is in cols; field[i] is where it is in a row of the
+ * input, -1 when it isn't, and serial[i] the first of the serials
+ * handed out for it, 0 when it has none.  partition is the column the
+ * table is partitioned on, -1 when it isn't.
+ *
+ * COPY TO: cols are the ones exported, in order; units the bucket
+ * directories workers take in turn, and parts[w] the file worker w
+ * writes, rows formatted into out and written a batch at a time.
+ */
+
+#define MDB_COPY_CHUNK_MIN (1024 * 1024)
+#define MDB_COPY_BATCH (1024 * 1024)
+#define MDB_COPY_BINARY_MAGIC "MDBCOPY1"
+
+struct mdb_copy_chunk {
+    gsize start;
+    gsize end;
+    gint64 first;
+    gint64 rows;
+};
+
+struct mdb_copy_part {
+    gchar *name;
+    int fd;
+    GString *out;
+    gint64 rows;
+    gint64 bytes;
+};
+
+struct mdb_copy {
+    gchar *table;
+    gchar *table_path;
+    gchar *staging;
+    const gchar *data;
+    gsize len;
+    gboolean csv;
+    guint fields;
+    guint ncols;
+    gchar **cols;
+    MdbColumnType *col_types;
+    gint *field;
+    gint64 *serial;
+    MdbCodec codec;
+    gint buckets;
+    gint64 roid;
+    gint partition;
+    GPtrArray *partitions;
+    gboolean views;
+    gboolean logged;
+    GArray *chunks;
+    gint next;
+    GMutex lock;
+    gchar *dir;
+    gboolean binary;
+    gboolean header;
+    GPtrArray *units;
+    struct mdb_copy_part *parts;
+    gint started;
+};
+
+typedef enum {
+    MDB_EXPLAIN_NONE,
+    MDB_EXPLAIN_PLAN,
+    MDB_EXPLAIN_ANALYZE
+} MdbExplain;
+
+struct mdb_op_stats {
+    guint64 rows;
+    gint64 wall_us;
+    gint64 cpu_us;
+    struct mdb_counters counters;
+};
+
+struct mdb_op_probe {
+    gint64 wall_us;
+    gint64 cpu_us;
+    struct mdb_counters counters;
+};
+
+struct mdb_explain {
+    MdbExplain mode;
+    gint64 started_us;
+    struct mdb_op_stats scan;
+    struct mdb_op_stats join;
+    struct mdb_op_stats filter;
+    struct mdb_op_stats output;
+};
+
+#define MDB_IO_QUEUE_DEPTH 256
+#define MDB_IO_READ_SIZE 4096
+
+typedef enum {
+    MDB_IO_OPEN,
+    MDB_IO_READ,
+    MDB_IO_CLOSE
+} MdbIoOp;
+
+/*
+ * pooled: data is a value from the buffer pool, already inflated.
+ * Otherwise, when poolable, version is the row's version from before
+ * the read, which the value may be pooled under.  retry: io_uring
+ * failed the request for some reason other than a missing file, so it
+ * is read again without the ring.
+ */
+
+struct mdb_io_req {
+    int at;
+    gchar *name;
+    gchar *key;
+    int fd;
+    gssize got;
+    guint8 *data;
+    gsize size;
+    gboolean pooled;
+    gboolean poolable;
+    guint32 version;
+    gboolean retry;
+};
+
+/*
+ * Buffer pool: inflated column values shared by every process using a
+ * database, in POSIX shared memory.  The pool is sets of MDB_POOL_WAYS
+ * frames.  A value goes in the set its key hashes to, and the set's
+ * clock hand picks the frame it replaces.  A frame's seq is odd, with
+ * the filler's pid on top, while it is being filled; readers copy the
+ * value out and check seq didn't move, so frames are never pinned.  A
+ * value is only used while its row is at the version it was read at.
+ */
+
+#define MDB_POOL_MAGIC "MDBPOOL1"
+#define MDB_POOL_DEFAULT_MB 32
+#define MDB_POOL_WAYS 8
+#define MDB_POOL_VALUE_MAX 216
+#define MDB_POOL_READY 2
+
+struct mdb_pool_frame {
+    guint64 seq;
+    guint64 key;
+    gint64 roid;
+    guint32 version;
+    guint32 len;
+    guint32 ref;
+    guint8 data[MDB_POOL_VALUE_MAX];
+};
+
+struct mdb_pool_set {
+    guint32 hand;
+    guint32 pad[15];
+    struct mdb_pool_frame frames[MDB_POOL_WAYS];
+};
+
+struct mdb_pool {
+    gchar magic[8];
+    guint64 state;
+    guint64 db_id;
+    guint64 nsets;
+    guint64 pad[4];
+    struct mdb_pool_set sets[];
+};
+
+/*
+ * LSM tables (WITH (engine = lsm)) have no row directories.  INSERT,
+ * UPDATE and DELETE append the whole row, or a tombstone, to lsm/wal,
+ * which every process reads back as the memtable.  Past memtable_kb the
+ * wal is flushed to an immutable run sorted by roid, lsm/runs/<n>, and
+ * lsm/manifest (a generation, then the runs oldest first) takes it in.
+ * MDB_LSM_MERGE_RUNS runs of a size tier are merged into one in the
+ * background.  The newest record of a roid is the row.
+ */
+
+#define MDB_LSM_RECORD_MAGIC 0x4c42444d
+#define MDB_LSM_RUN_MAGIC "MDBRUN01"
+#define MDB_LSM_MEMTABLE_KB_DEFAULT 4096
+#define MDB_LSM_MEMTABLE_KB_MAX (1024 * 1024)
+#define MDB_LSM_MERGE_RUNS 4
+#define MDB_LSM_TIER_FACTOR 4
+#define MDB_LSM_RECORD_MAX (64 * 1024 * 1024)
+#define MDB_LSM_WRITE_BUFFER (1024 * 1024)
+#define MDB_LSM_ALIGN(len) (((len) + 7) & ~(gsize) 7)
+
+typedef enum {
+    MDB_LSM_PUT,
+    MDB_LSM_DELETE
+} MdbLsmKind;
+
+/*
+ * Followed by len bytes of columns, each its name, a NUL, a guint32
+ * length and the value as its column file would hold it, then padding
+ * to 8 bytes.  sum covers everything but magic and the padding.
+ */
+
+struct mdb_lsm_record {
+    guint32 magic;
+    guint32 kind;
+    gint64 roid;
+    guint32 len;
+    guint32 sum;
+};
+
+/* A run: its records, then count of these, then the footer */
+struct mdb_lsm_index_entry {
+    gint64 roid;
+    guint64 offset;
+};
+
+struct mdb_lsm_run_footer {
+    guint64 count;
+    guint64 index_offset;
+    gchar magic[8];
+};
+
+struct mdb_lsm_run {
+    gchar *name;
+    guint8 *data;
+    gsize size;
+    const struct mdb_lsm_index_entry *index;
+    guint64 count;
+};
+
+/*
+ * A process's picture of an LSM table: the runs of the manifest it last
+ * read, and the records of wal.flushing and wal up to wal_off in mem,
+ * with latest (roid -> offset + 1) pointing at each roid's newest.
+ */
+
+struct mdb_lsm_view {
+    gchar *table;
+    gsize memtable_bytes;
+    gboolean loaded;
+    guint64 generation;
+    guint64 flushing_ino;
+    guint64 wal_ino;
+    gint64 wal_off;
+    int wal_fd;
+    GPtrArray *runs;
+    GByteArray *mem;
+    GHashTable *latest;
+    gint64 cached_roid;
+    const struct mdb_lsm_record *cached;
+};
+
+/* The one compaction thread of a process, and the table it's merging */
+struct mdb_lsm_compactor {
+    GThread *thread;
+    gint busy;
+    gboolean registered;
+    gchar *table;
+    gsize memtable_bytes;
+};
+
+struct flock;
+
 void mdb_init(void);
 struct ddl_parsed parse_create(const gchar *text);
 struct ddl_parsed parse_insert(const gchar *text);
+gchar * parse_insert_value(struct mdb_lexer *lex);
 struct ddl_parsed parse_select(const gchar *text);
+void expand_select_star(struct ddl_parsed *ddl_select);
+void free_ddl_parsed(struct ddl_parsed *ddl);
+struct ddl_parsed parse_alter(const gchar *text);
+void ddl_syntax_error(GScanner *scanner, const gchar *expected);
+void ddl_expect_keyword(GScanner *scanner, const gchar *word);
+void ddl_expect(GScanner *scanner, GTokenType token, const gchar *expected);
+struct ddl_partition * parse_partition_def(GScanner *scanner);
+void parse_partition_by(GScanner *scanner, struct ddl_parsed *ddl);
+void free_ddl_partition(struct ddl_partition *def);
 void execute_ddl_create(gchar *sql);
 void execute_ddl_insert(gchar *sql);
 void execute_ddl_select(gchar *sql);
+gchar * parse_explain(gchar *sql, struct mdb_explain *ex);
+struct mdb_counters * mdb_counters(void);
+struct mdb_stats * mdb_thread_stats(void);
+GMutex * mdb_stats_lock(void);
+GPtrArray * mdb_stats_blocks(void);
+void mdb_stats_collect(struct mdb_stats *total);
+guint mdb_latency_bucket(gint64 us);
+gint64 mdb_latency_bucket_limit(guint bucket);
+void mdb_stats_statement(MdbStatement type, gint64 started_us);
+void mdb_stats_add(struct mdb_stats *to, const struct mdb_stats *from, gint sign);
+gboolean mdb_stats_read(int fd, struct mdb_stats *stats);
+void mdb_stats_flush(void);
+gchar * mdb_stats_prometheus(const struct mdb_stats *stats);
+void mdb_stats_print(void);
+gint64 mdb_cpu_time(void);
+void mdb_lock_wait(int fd, struct flock *lock, const gchar *path);
+void op_probe_start(struct mdb_explain *ex, struct mdb_op_probe *probe);
+void op_probe_stop(struct mdb_explain *ex, struct mdb_op_probe *probe, struct mdb_op_stats *op, gboolean row);
+void print_explain_op(struct mdb_explain *ex, guint depth, const struct mdb_op_stats *op, const gchar *label, const gchar *detail);
+void print_explain_scan(struct mdb_explain *ex, guint depth, struct mdb_tbl_scanner *scan);
+void print_explain_total(struct mdb_explain *ex);
+gchar * join_list_text(GSList *list, const gchar *sep);
+void execute_alter_options(gchar *table_path, GSList *options);
+void execute_ddl_alter(gchar *sql);
 void get_table_lock(gchar *table_path);
 void free_table_lock(gchar *table_path);
-gchar * next_row_bucket(gchar *table_path);
+struct mdb_quiesce * mdb_quiesce(void);
+void quiesce_lock(short type, gint64 byte);
+void mdb_quiesce_enter(void);
+void mdb_quiesce_writers(void);
+void mdb_quiesce_leave(void);
+void mdb_commits_hold(void);
+void mdb_commits_release(void);
+void mdb_commits_exclude(void);
+int row_lock_fd(const gchar *table);
+GHashTable * row_lock_tables(void);
+void row_lock(const gchar *table, gint64 roid);
+void row_unlock(const gchar *table, gint64 roid);
+void row_unlock_all(void);
+gboolean lock_matching_row(struct mdb_tbl_scanner *scan, struct mdb_expr *where, GHashTable *paths);
+struct mdb_row_versions * row_versions(const gchar *table);
+guint64 * row_version_word(const gchar *table, gint64 roid);
+GHashTable * row_version_claims(void);
+gboolean row_version_held(const gchar *table, gint64 roid);
+guint64 row_version_idle(const gchar *table, gint64 roid);
+gboolean row_version_claim(const gchar *table, gint64 roid, guint64 seen);
+void row_version_take(const gchar *table, gint64 roid);
+void row_version_release(const gchar *table, gint64 roid);
+void row_version_release_all(void);
+gboolean row_version_peek(const gchar *table, gint64 roid, guint32 *version);
+gboolean occ_matching_row(struct mdb_tbl_scanner *scan, struct mdb_expr *where, GHashTable *paths, GSList *sets, GHashTable *values, gboolean *locked);
+gchar * next_row_bucket(gchar *table_path, const gchar *partition);
+gchar * row_entry_path(gchar *table_path, const gchar *partition, gint roid);
 gint next_roid(gchar *table_path);
+gint next_roids(gchar *table_path, gint count);
+void write_fd(int fd, gchar *buf, size_t nbyte);
 void read_first_line(const gchar *path, gchar **buf);
+const gchar * read_col_file(const gchar *path, gsize *len);
+void write_col_file(gchar *path, gchar *buf, MdbCodec codec);
+gsize pack_col_text(const gchar *buf, gsize len, MdbCodec codec, GByteArray *packed);
+gboolean mdb_codec_from_name(const gchar *name, MdbCodec *codec);
+const gchar * mdb_codec_name(MdbCodec codec);
+gboolean mdb_codec_available(MdbCodec codec);
+gsize mdb_compress(MdbCodec codec, const gchar *src, gsize src_len, GByteArray *dst);
+gboolean mdb_decompress(MdbCodec codec, const gchar *src, gsize src_len, GByteArray *dst, gsize raw_len);
+MdbCodec load_table_codec(gchar *table_path);
+gboolean mdb_buckets_from_name(const gchar *name, gint *buckets);
+gint load_table_buckets(gchar *table_path);
+gboolean mdb_concurrency_from_name(const gchar *name, gboolean *optimistic);
+gboolean load_table_optimistic(gchar *table_path);
+gchar * table_partition_col(const gchar *table);
+struct mdb_partition * mdb_partition_new(const gchar *name, const gchar *bound, MdbColumnType col_type);
+void free_mdb_partition(struct mdb_partition *part);
+gint mdb_partition_cmp(gconstpointer a, gconstpointer b);
+GPtrArray * load_partitions(const gchar *table, const gchar *col);
+GPtrArray * partitions_from_ddl(GSList *defs, MdbColumnType col_type);
+void create_partition(const gchar *table_path, struct ddl_partition *def);
+gchar * insert_partition(const gchar *table, GSList *cols, GSList *values);
+gchar * partition_for(const gchar *table, const gchar *col, const gchar *literal);
+gboolean is_partition_col(struct mdb_expr *expr, const gchar *table, const gchar *col);
+gboolean partition_may_match(struct mdb_expr *expr, const gchar *table, const gchar *col, const struct mdb_col *lo, const struct mdb_partition *part);
+void remove_tree(const gchar *path);
+GDir * dir_open(gchar *path);
+struct mdb_arena * mdb_arena_new(void);
+void mdb_arena_free(struct mdb_arena *arena);
+gpointer mdb_arena_alloc(struct mdb_arena *arena, gsize size);
+gchar * mdb_arena_strdup(struct mdb_arena *arena, const gchar *str);
+gchar * mdb_arena_strconcat(struct mdb_arena *arena, const gchar *first, ...) G_GNUC_NULL_TERMINATED;
+struct mdb_arena_mark mdb_arena_mark(struct mdb_arena *arena);
+void mdb_arena_reset(struct mdb_arena *arena, struct mdb_arena_mark mark);
+struct mdb_arena * mdb_stmt_arena(void);
+void mdb_stmt_begin(void);
 gint next_serial(gchar *table_path, gchar *serial_file);
-gboolean included_in_where(GHashTable *paths, gchar *table, gchar *where_clause);
-GSList * parse_where(gchar *where_clause);
+gint next_serials(gchar *table_path, gchar *serial_file, gint count);
 void execute_ddl_delete(gchar *sql);
 void execute_ddl_update(gchar *sql);
-GHashTable * included_in_join(gchar *entry_path, GSList *joins);
+GHashTable * included_in_join(gchar *entry_path, GSList *joins, struct mdb_arena *arena);
 void init_scan_table(struct mdb_tbl_scanner **scan, gchar *table);
 void final_scan_table(struct mdb_tbl_scanner **scan);
 gboolean scan_table(struct mdb_tbl_scanner *scan);
+gchar * next_scan_entry(struct mdb_tbl_scanner *scan);
+void scan_prefetch_expr(struct mdb_tbl_scanner *scan, struct mdb_expr *expr);
+gboolean scan_next_partition(struct mdb_tbl_scanner *scan);
+gboolean scan_staged_row(struct mdb_tbl_scanner *scan);
+void scan_prune_partitions(struct mdb_tbl_scanner *scan, struct mdb_expr *where);
+gboolean mdb_dir_open_at(struct mdb_dir *dir, int at, const gchar *name);
+void mdb_dir_close(struct mdb_dir *dir);
+const gchar * mdb_dir_read(struct mdb_dir *dir);
+void close_entry_fd(gpointer fd);
+GHashTable * entry_fds(void);
+void remember_entry_fd(const gchar *entry_path, int fd);
+int entry_dir_fd(const gchar *entry_path);
+const gchar * read_col_file_at(int at, const gchar *path, gsize *len);
+const gchar * read_col_file_into(int at, const gchar *path, GByteArray *raw, GByteArray *plain, gsize *len);
+const gchar * col_file_value(const gchar *path, guint8 *data, gsize got, gsize *len);
+const gchar * col_file_inflate(const gchar *path, guint8 *data, gsize got, GByteArray *plain, gsize *len);
+#ifdef MDB_HAVE_LIBURING
+struct io_uring * mdb_ring(void);
+void ring_run(struct io_uring *ring, GPtrArray *reqs, MdbIoOp op);
+#endif
+void io_read_rest(struct mdb_io_req *req, struct mdb_arena *arena);
+void io_read_sync(struct mdb_io_req *req, struct mdb_arena *arena);
+void mdb_io_read_batch(GPtrArray *reqs, struct mdb_arena *arena);
+guint64 mdb_database_id(void);
+struct mdb_pool * mdb_pool(void);
+guint64 mdb_pool_key(const gchar *table, const gchar *col);
+gssize mdb_pool_get(struct mdb_pool *pool, guint64 key, gint64 roid, guint32 version, guint8 *out);
+void mdb_pool_put(struct mdb_pool *pool, guint64 key, gint64 roid, guint32 version, const gchar *data, gsize len);
+void mdb_pool_fill(const gchar *table, gint64 roid, guint64 key, guint32 version, const gchar *data, gsize len);
+gboolean mdb_engine_from_name(const gchar *name, gboolean *lsm);
+gboolean mdb_memtable_from_name(const gchar *name, gint *kb);
+gsize load_table_memtable(gchar *table_path);
+gchar * lsm_path(const gchar *table, const gchar *name);
+struct mdb_lsm_view * lsm_view(const gchar *table);
+GMutex * lsm_lock(void);
+int lsm_lock_fd(const gchar *table);
+void lsm_enter(const gchar *table, short type);
+void lsm_leave(const gchar *table);
+guint32 lsm_record_sum(const struct mdb_lsm_record *rec, const guint8 *payload);
+const struct mdb_lsm_record * lsm_next_record(const guint8 *buf, gsize len, gsize *pos);
+const guint8 * lsm_record_next_col(const struct mdb_lsm_record *rec, const guint8 *p, const gchar **name, const guint8 **value, guint32 *len);
+const guint8 * lsm_record_col(const struct mdb_lsm_record *rec, const gchar *col, guint32 *len);
+void lsm_payload_add(GByteArray *payload, const gchar *col, const guint8 *data, guint32 len);
+GPtrArray * lsm_manifest(const gchar *table, guint64 *generation);
+void lsm_write_manifest(const gchar *table, GPtrArray *names, guint64 generation);
+gchar * lsm_run_name(GPtrArray *names);
+struct mdb_lsm_run * lsm_run_open(const gchar *table, const gchar *name);
+void lsm_run_close(struct mdb_lsm_run *run);
+const struct mdb_lsm_record * lsm_run_find(const struct mdb_lsm_run *run, gint64 roid);
+gchar * lsm_write_run(const gchar *table, GPtrArray *recs, const gchar *tag);
+GByteArray * lsm_read_from(int fd, gint64 off);
+void lsm_read_wal(struct mdb_lsm_view *view, const gchar *name, gint64 *off);
+void lsm_refresh(struct mdb_lsm_view *view);
+const struct mdb_lsm_record * lsm_find(struct mdb_lsm_view *view, gint64 roid);
+gint lsm_record_cmp(gconstpointer a, gconstpointer b);
+gint lsm_roid_cmp(gconstpointer a, gconstpointer b);
+gint64 lsm_merge_key(GPtrArray *runs, GArray *mem, guint source, guint64 at);
+GPtrArray * lsm_merge(GPtrArray *runs, struct mdb_lsm_view *view, gboolean tombstones);
+GArray * lsm_live_roids(struct mdb_lsm_view *view);
+void lsm_append(const gchar *table, MdbLsmKind kind, gint64 roid, GByteArray *payload);
+void lsm_publish(const gchar *table, int fd);
+void lsm_flush(const gchar *table);
+guint lsm_tier(gsize size, gsize memtable_bytes);
+gboolean lsm_compact(const gchar *table, gsize memtable_bytes);
+gpointer lsm_compact_thread(gpointer data);
+struct mdb_lsm_compactor * lsm_compactor(void);
+void lsm_compact_start(const gchar *table);
+void lsm_compact_wait(void);
+void lsm_insert(gchar *table_path, const gchar *table, GSList *cols, GSList *values);
+void lsm_write_sets(const gchar *table, const gchar *entry_path, GHashTable *values);
+gboolean mdb_row_exists(const gchar *table, const gchar *entry_path);
+GHashTable * prefetched(void);
+struct mdb_io_req * take_prefetched(const gchar *entry_path, const gchar *col);
+void prefetch_rows(struct mdb_tbl_scanner *scan);
+void forget_prefetched(struct mdb_tbl_scanner *scan);
+void scan_prefetch_col(struct mdb_tbl_scanner *scan, const gchar *col);
 GHashTable * load_schema(gchar *table);
 struct mdb_col *load_mdb_col(gchar *table, gchar *col_name, GHashTable *schema, const gchar *entry_path);
+void read_mdb_col(gchar *table, const gchar *col_name, GHashTable *schema, const gchar *entry_path, struct mdb_col *mdb_col);
 void free_mdb_col(struct mdb_col **mdb_col);
-void extract_where(GScanner *scanner, GTokenType tokenType, gchar **_buf, int *state);
+gboolean mdb_col_type_from_name(const gchar *type, MdbColumnType *col_type);
+GHashTable * cached_schema(const gchar *table);
+gint table_version(const gchar *table);
+gboolean mdb_col_from_literal(MdbColumnType col_type, const gchar *literal, struct mdb_col *mdb_col);
+gint mdb_col_cmp(const struct mdb_col *a, const struct mdb_col *b);
+void encode_mdb_col(const struct mdb_col *mdb_col, GByteArray *out);
+gboolean decode_mdb_col(struct mdb_col *mdb_col, const gchar *buf, gsize len);
+gchar * mdb_col_to_string(const struct mdb_col *mdb_col);
+void print_mdb_col(const struct mdb_col *mdb_col);
+void unquoted_span(const gchar *text, const gchar **start, gsize *len);
+gboolean mdb_parse_timestamp(const gchar *text, gint64 *usec);
+gchar * mdb_format_timestamp(gint64 usec);
+void write_bytes_file(gchar *path, const guint8 *data, gsize len);
+gboolean write_typed_col_file(gchar *path, MdbColumnType col_type, const gchar *literal, MdbCodec codec);
+gchar * null_bitmap_path(const gchar *table, const gchar *col);
+GHashTable * null_bitmaps(void);
+void set_null_bit(const gchar *table, const gchar *col, gint64 roid, gboolean null);
+void set_null_bits(const gchar *table, const gchar *col, gint64 offset, const guint8 *bits, gsize len);
+gboolean is_null_bit(const gchar *table, const gchar *col, gint64 roid);
+gint64 entry_roid(const gchar *entry_path);
+GSList * compile_set_list(const gchar *table, struct ddl_parsed *ddl_update);
+void free_mdb_set(struct mdb_set *set);
+void set_value_literal(const gchar *table, struct mdb_set *set, struct mdb_col *value);
+void compute_sets(const gchar *table, GHashTable *paths, GSList *sets, GHashTable *values);
+void write_sets(const gchar *table, const gchar *entry_path, GSList *sets, GHashTable *values, MdbCodec codec);
+void execute_sql(gchar *sql);
+struct mdb_txn * mdb_txn(void);
+void mdb_begin(void);
+void mdb_commit(void);
+void mdb_rollback(void);
+void mdb_txn_unlock(struct mdb_txn *txn);
+void mdb_txn_end(struct mdb_txn *txn);
+void mdb_txn_exit(void);
+void mdb_txn_recover(void);
+struct mdb_txn_op * mdb_txn_op_new(MdbTxnOpKind kind, const gchar *table);
+void free_mdb_txn_op(struct mdb_txn_op *op);
+gchar * mdb_txn_stage(struct mdb_txn *txn);
+const gchar * data_relative(const gchar *path);
+void mdb_txn_log(struct mdb_txn *txn, const gchar *first, ...) G_GNUC_NULL_TERMINATED;
+void txn_resolve_insert(struct mdb_txn *txn, struct mdb_txn_op *op);
+void txn_resolve_set(struct mdb_txn *txn, struct mdb_txn_op *op, const gchar *entry_path, struct mdb_set *set, GHashTable *before, GHashTable *after);
+gboolean txn_staged_row(const gchar *entry_path);
+struct mdb_txn_op * txn_staged_op(const gchar *entry_path);
+GPtrArray * txn_staged_rows(const gchar *table);
+void txn_update_staged(struct mdb_txn_op *insert, GSList *sets, GHashTable *values, MdbCodec codec);
+void txn_delete_staged(struct mdb_txn_op *insert);
+gboolean txn_lock_matching_row(struct mdb_txn *txn, struct mdb_txn_op *op, const gchar *entry_path);
+void txn_resolve_delete(struct mdb_txn *txn, struct mdb_txn_op *op, const gchar *entry_path);
+void txn_read_col(struct mdb_txn *txn, const gchar *table, const gchar *entry_path, const gchar *col, struct mdb_col *out);
+void txn_log_change(struct mdb_txn *txn, const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after);
+void txn_publish(const gchar *txn_path, const gchar *log, gboolean recovery);
+void txn_apply(gchar **fields, const gchar *txn_path, const gchar *purgatory, guint *dropped, gboolean recovery, GString *changes);
+void mdb_sync(void);
+GHashTable * mdb_change_cols_new(void);
+void mdb_change_add(GHashTable *cols, const gchar *col, const struct mdb_col *value);
+void mdb_change_add_literal(GHashTable *cols, const gchar *table, const gchar *col, const gchar *literal);
+void mdb_change_read(GHashTable *cols, const gchar *table, const gchar *entry_path, const gchar *col);
+void mdb_change_read_row(GHashTable *cols, const gchar *table, const gchar *entry_path);
+void mdb_change_escape(GString *out, const gchar *text);
+void mdb_change_record(GString *out, const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after);
+struct mdb_changes * mdb_changes(void);
+void mdb_changes_refresh(void);
+gboolean mdb_change_wanted(const gchar *table);
+gboolean mdb_change_wants_before(const gchar *table);
+gchar * changes_consumer_path(const gchar *datadir, const gchar *name);
+gboolean changes_consumer_load(const gchar *path, gint64 *lsn, MdbChangesMode *mode);
+void changes_consumer_save(const gchar *path, gint64 lsn, MdbChangesMode mode);
+int changes_writers_hold(const gchar *datadir);
+void changes_writers_release(int fd);
+gint64 mdb_changes_register(const gchar *datadir, const gchar *name, gboolean before);
+void mdb_changes_ack(const gchar *datadir, const gchar *name, gint64 lsn);
+void mdb_changes_drop(const gchar *datadir, const gchar *name);
+void changes_trim(const gchar *datadir);
+gint64 mdb_changes_start(const gchar *datadir);
+void mdb_changes_append(const gchar *text, gsize len);
+void mdb_change_log(const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after);
+void mdb_change_log_ddl(const gchar *kind, const gchar *table);
+gboolean mdb_tail_wait(int notify_fd, const gchar *path, gboolean exists);
+void mdb_tail_changes(gint64 from, gint64 count);
+gchar * mdb_change_unescape(const gchar *text);
+gboolean mdb_change_parse(const gchar *line, gchar **kind, gchar **table, gint64 *roid, GHashTable *before, GHashTable *after);
+struct ddl_parsed parse_create_view(const gchar *text);
+void execute_create_view(gchar *sql);
+void execute_refresh_view(gchar *sql);
+struct mdb_view * mdb_view_load(const gchar *name, const gchar *definition);
+void free_mdb_view(struct mdb_view *view);
+GPtrArray * mdb_views(void);
+gboolean mdb_is_view(const gchar *table);
+void mdb_refuse_view(const gchar *table, const gchar *stmt);
+gchar * mdb_row_entry(const gchar *table, gint64 roid);
+gboolean mdb_expr_uses(struct mdb_expr *expr, const gchar *from, const gchar *table, GHashTable *cols);
+gboolean view_uses(struct mdb_view *view, const gchar *table, GHashTable *cols);
+void mdb_purge_row(const gchar *table, gint64 roid, const gchar *row_path);
+void view_refresh_row(struct mdb_view *view, gint64 roid, const gchar *entry_path);
+void view_refresh_all(struct mdb_view *view);
+void view_refresh_joined(struct mdb_view *view, struct ddl_join *join, GSList *keys);
+void mdb_views_apply(const gchar *kind, const gchar *table, gint64 roid, GHashTable *before, GHashTable *after);
+void mdb_views_apply_changes(const gchar *text);
+void mdb_mirror(const gchar *from, const gchar *to, const gchar * const *skip);
+gboolean mdb_replica_load(struct mdb_replica *replica);
+void mdb_replica_save(struct mdb_replica *replica);
+void free_mdb_replica(struct mdb_replica *replica);
+void mdb_refuse_replica(const gchar *stmt);
+gboolean mdb_replica_lag(gint64 *bytes, gdouble *seconds);
+void replica_sync_table(struct mdb_replica *replica, const gchar *table, gboolean rows);
+void replica_sync_tables(struct mdb_replica *replica);
+void replica_sync_ddl(struct mdb_replica *replica, const gchar *table);
+gchar * replica_partition(struct mdb_replica *replica, const gchar *table, GHashTable *after);
+void replica_insert(struct mdb_replica *replica, const gchar *table, gint64 roid, GHashTable *after);
+void replica_update(const gchar *table, gint64 roid, GHashTable *after);
+void replica_delete(const gchar *table, gint64 roid);
+void replica_apply(struct mdb_replica *replica, const gchar *line);
+gchar * replica_consumer_name(void);
+void replica_seed(struct mdb_replica *replica, const gchar *primary);
+void mdb_replica_follow(const gchar *primary, gboolean once);
+gboolean snapshot_matches(const gchar *rel, const gchar * const *patterns);
+void snapshot_file(const gchar *from, const gchar *to, gboolean immutable);
+void snapshot_tree(const gchar *from, const gchar *to, const gchar *rel);
+void mdb_snapshot(const gchar *dir);
+gsize copy_find_scalar(const gchar *p, gsize len, gchar a, gchar b);
+gsize copy_find_sse2(const gchar *p, gsize len, gchar a, gchar b);
+gsize copy_find_avx2(const gchar *p, gsize len, gchar a, gchar b);
+gsize copy_find(const gchar *p, gsize len, gchar a, gchar b);
+gsize copy_row_end(const gchar *data, gsize pos, gsize len, gboolean csv);
+gboolean copy_row_empty(const gchar *data, gsize start, gsize end);
+guint copy_split_row(struct mdb_copy *copy, gsize start, gsize end, GString *buf, GArray *offsets);
+struct ddl_parsed parse_copy(const gchar *text);
+void free_mdb_copy(struct mdb_copy *copy);
+gboolean copy_option_true(const gchar *value);
+gboolean copy_col_from_field(MdbColumnType col_type, const gchar *text, struct mdb_col *mdb_col);
+void copy_write_col(int dirfd, const gchar *col, const struct mdb_col *value, MdbCodec codec, GByteArray *out);
+void copy_stage_chunk(struct mdb_copy *copy, guint c);
+void copy_publish_chunk(struct mdb_copy *copy, guint c);
+gpointer copy_stage_thread(gpointer data);
+gpointer copy_publish_thread(gpointer data);
+void copy_run(struct mdb_copy *copy, guint workers, GThreadFunc func);
+void execute_copy_from(struct ddl_parsed *ddl_copy);
+const gchar * copy_format_ext(struct mdb_copy *copy);
+void copy_format_value(struct mdb_copy *copy, const struct mdb_col *value, GString *out, GByteArray *scratch);
+struct mdb_copy_part * copy_part_open(struct mdb_copy *copy, guint w);
+void copy_part_row(struct mdb_copy *copy, struct mdb_copy_part *part, struct mdb_col *values, GByteArray *scratch);
+void copy_part_close(struct mdb_copy_part *part);
+gboolean copy_read_row(struct mdb_copy *copy, int row, struct mdb_col *values, GByteArray *raw, GByteArray *plain);
+gpointer copy_export_thread(gpointer data);
+void copy_export_scan(struct mdb_copy *copy);
+void execute_copy_to(struct ddl_parsed *ddl_copy);
+void execute_copy(gchar *sql);
+void mdb_col_destroy(gpointer mdb_col);
+struct mdb_expr * mdb_expr_new(MdbExprKind kind);
+void mdb_expr_free(struct mdb_expr *expr);
+struct mdb_expr * mdb_expr_binary(MdbExprOp op, struct mdb_expr *left, struct mdb_expr *right);
+void mdb_lex_init(struct mdb_lexer *lex, const gchar *text, const gchar *input_name);
+void lex_scan(struct mdb_lexer *lex);
+struct mdb_token lex_take(struct mdb_lexer *lex);
+void lex_syntax_error(struct mdb_lexer *lex, const gchar *expected);
+gboolean lex_is_keyword(struct mdb_lexer *lex, const gchar *word);
+gboolean lex_is_symbol(struct mdb_lexer *lex, const gchar *symbol);
+gboolean lex_accept_keyword(struct mdb_lexer *lex, const gchar *word);
+gboolean lex_accept_symbol(struct mdb_lexer *lex, const gchar *symbol);
+void lex_expect_keyword(struct mdb_lexer *lex, const gchar *word);
+void lex_expect_symbol(struct mdb_lexer *lex, const gchar *symbol);
+struct mdb_token lex_expect(struct mdb_lexer *lex, MdbTokenKind kind, const gchar *expected);
+void lex_expect_end(struct mdb_lexer *lex);
+gboolean lex_is_ident_char(guchar c, gboolean first);
+gchar * lex_token_text(const struct mdb_token *token);
+gchar * lex_string_literal(const struct mdb_token *token);
+gchar * lex_text_from(struct mdb_lexer *lex, const gchar *start);
+gboolean expr_peek_keyword(GScanner *scanner, const gchar *word);
+void expr_need_operand(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_or(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_and(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_not(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_cmp(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_concat(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_add(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_mul(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_unary(struct mdb_lexer *lex);
+struct mdb_expr * expr_parse_primary(struct mdb_lexer *lex);
+void expr_check_function(struct mdb_expr *expr);
+void mdb_expr_check_columns(struct mdb_expr *expr, GSList *tables, const gchar *stmt);
+gboolean mdb_expr_is_constant(struct mdb_expr *expr);
+const gchar * mdb_col_type_name(MdbColumnType col_type);
+void mdb_col_clear(struct mdb_col *mdb_col);
+void mdb_col_set_null(struct mdb_col *mdb_col);
+void mdb_col_set_bool(struct mdb_col *mdb_col, gboolean v);
+gboolean mdb_col_truth(const struct mdb_col *mdb_col);
+gchar * mdb_col_to_plain(const struct mdb_col *mdb_col);
+void mdb_col_set_plain(struct mdb_col *mdb_col, gchar *plain);
+gboolean mdb_col_cast(struct mdb_col *mdb_col, MdbColumnType col_type);
+void expr_eval_column(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out);
+void expr_eval_is_null(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out);
+gint expr_compare(struct mdb_expr *expr, struct mdb_col *a, struct mdb_col *b);
+void expr_arith(MdbExprOp op, struct mdb_col *a, struct mdb_col *b, struct mdb_col *out);
+void expr_eval_binary(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out);
+void expr_eval_function(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out);
+void mdb_expr_eval(struct mdb_expr *expr, struct mdb_row_ctx *ctx, struct mdb_col *out);
+gboolean row_matches(struct mdb_expr *where, GHashTable *paths, const gchar *table);
+struct mdb_expr * compile_where(struct ddl_parsed *ddl, GSList *tables, const gchar *stmt);
+void parse_where(struct mdb_lexer *lex, struct ddl_parsed *ddl);
+struct ddl_parsed parse_delete(const gchar *text);
+struct ddl_parsed parse_update(const gchar *text);
 
 #endif
@@ -242,6 +242,881 @@ $cb = sub {
 };
 $run->run_sql($sql, "update", $cb, { run_fail => 1 });
 
+$sql = "CREATE TABLE blob (id serial, body text) WITH (compression = auto);";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "create", $cb);
+
+my $body = join("", map { "/opt/joy/site/value/path/segment$_" } (1 .. 20));
+$sql = "INSERT INTO blob (id, body) VALUES (0, '$body');";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "insert", $cb);
+
+$sql = "SELECT body FROM blob WHERE id = 1;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^'\Q$body\E'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "CREATE TABLE blob_bad (id serial) WITH (compression = gzip);";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    like($err, qr/^error: compression: unknown codec: gzip/, "STDERR");
+};
+$run->run_sql($sql, "create", $cb, { run_fail => 1 });
+
+$sql = "CREATE TABLE metric (id serial, name text, value double, ok boolean, seen timestamp);";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "create", $cb);
+
+$sql = "INSERT INTO metric (id, name, value, ok, seen) VALUES (0, 'cpu', 1.5, true, '2014-10-06T21:01');";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "insert", $cb);
+
+$sql = "INSERT INTO metric (id, name, value) VALUES (0, 'mem', -0.25);";
+$run->run_sql($sql, "insert", $cb);
+
+$sql = "SELECT name, value, ok, seen FROM metric WHERE value >= 1.5;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^'cpu'\s+1.5\s+true\s+'2014-10-06T21:01:00'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "SELECT name FROM metric WHERE seen IS NULL;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^'mem'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "SELECT name FROM metric WHERE seen IS NOT NULL;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^'cpu'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "UPDATE metric SET value = value + 1 WHERE name = 'cpu';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "update", $cb);
+
+$sql = "SELECT value FROM metric WHERE name = 'cpu';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^2.5$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+# A fixed width value over another is the one pwrite of its bytes
+sub bytes_written
+{
+    my @cmd = ("./cli_multidb", "--stats");
+    my ($in, $out, $err);
+    run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+
+    return($out =~ m/^multidb_bytes_written_total (\d+)$/m ? $1 : -1);
+}
+my $written = bytes_written();
+$run->run_sql("UPDATE metric SET value = value - 0 WHERE name = 'mem';", "update");
+is(bytes_written() - $written, 8, "UPDATE of a float wrote 8 bytes");
+
+$sql = "INSERT INTO metric (id, name, value) VALUES (0, 'disk', 'lots');";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    like($err, qr/^error: \[metric\]::\[value\]: invalid value/, "STDERR");
+};
+$run->run_sql($sql, "insert", $cb, { run_fail => 1 });
+
+$sql = "SELECT upper(name) || '=' || value, value * 2 FROM metric WHERE NOT (value < 0) OR name = 'disk';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^'CPU=2.5'\t5$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "UPDATE metric SET value = (value - 0.5) * 2, name = name || '!' WHERE name = 'mem';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "update", $cb);
+
+$sql = "SELECT name, value FROM metric WHERE value < 0;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 2, "STDOUT");
+    like($out, qr/^'mem!'\t-1.5$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "SELECT value / 0 FROM metric;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: expression: division by zero/, "STDERR");
+};
+$run->run_sql($sql, "select", $cb, { run_fail => 1 });
+
+# Doubled quotes, comments, no closing ; and the header as written
+$sql = "SELECT name || '''s' FROM metric /* every */ WHERE value > 0 -- but mem!";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "name || '''s'\n'cpu's'\n", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "SELECT name FROM metric WHERE value > ;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: SELECT: expected a value, column or \( at position 39/, "STDERR");
+};
+$run->run_sql($sql, "select", $cb, { run_fail => 1 });
+
+$sql = "SELECT name FROM metric WHERE id = 99999999999999999999;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: invalid integer literal: 99999999999999999999/, "STDERR");
+};
+$run->run_sql($sql, "select", $cb, { run_fail => 1 });
+
+$sql = "SELECT name FROM metric WHERE value > 0;;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "name\n'cpu'\n", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "SELECT name FROM metric; SELECT id FROM metric;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: SELECT: one statement only, another starts at position 26/, "STDERR");
+};
+$run->run_sql($sql, "select", $cb, { run_fail => 1 });
+
+# 4345088 is 00 4D 42 00 ... in binary, the first bytes of a compressed file
+$run->run_sql("CREATE TABLE magic (id serial, num int) WITH (compression = auto);", "create");
+$run->run_sql("INSERT INTO magic (id, num) VALUES (0, 4345088);", "insert");
+
+$sql = "SELECT num FROM magic WHERE num = 4345088;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "num\n4345088\n", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+# More rows than one prefetch batch, read with and without io_uring
+$run->run_sql("CREATE TABLE batch (id serial, num integer, label text);", "create");
+for my $i (1 .. 70) {
+    $run->run_sql("INSERT INTO batch (id, num, label) VALUES (0, $i, 'row $i');", "insert");
+}
+
+$sql = "SELECT num, label FROM batch WHERE num % 10 = 3;";
+my $batched;
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 8, "STDOUT");
+    like($out, qr/^63\t'row 63'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+    $batched = join("\n", sort { $a cmp $b } split(/\n/, $out));
+};
+$run->run_sql($sql, "select", $cb);
+
+$ENV{MULTIDB_NO_IO_URING} = 1;
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is(join("\n", sort { $a cmp $b } split(/\n/, $out)), $batched, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+delete($ENV{MULTIDB_NO_IO_URING});
+
+# Buckets are made on first insert, up to the table's fan-out
+$run->run_sql("CREATE TABLE tenant (id serial, label text) WITH (buckets = 4);", "create");
+my $rows_dir = "$dirname/multidb/data/tables/tenant/rows";
+opendir(my $dh, $rows_dir) || die("opendir: $rows_dir: $!");
+is(scalar(grep { !/^\./ } readdir($dh)), 0, "no buckets before the first row");
+closedir($dh);
+
+for my $i (1 .. 6) {
+    $run->run_sql("INSERT INTO tenant (id, label) VALUES (0, 'tenant $i');", "insert");
+}
+
+$sql = "SELECT id, label FROM tenant;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 7, "STDOUT");
+    like($out, qr/^6\t'tenant 6'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+opendir($dh, $rows_dir) || die("opendir: $rows_dir: $!");
+is(join(",", sort { $a cmp $b } grep { !/^\./ } readdir($dh)), "0000,0001,0002,0003", "buckets");
+closedir($dh);
+
+$sql = "CREATE TABLE tenant_bad (id serial) WITH (buckets = 0);";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: buckets: invalid count: 0/, "STDERR");
+};
+$run->run_sql($sql, "create", $cb, { run_fail => 1 });
+
+# Range partitions
+$run->run_sql("CREATE TABLE applog (id serial, at timestamp, msg text) PARTITION BY RANGE (at) (PARTITION p2014_10 VALUES LESS THAN ('2014-11-01'), PARTITION p2014_11 VALUES LESS THAN ('2014-12-01'));", "create");
+$run->run_sql("INSERT INTO applog (id, at, msg) VALUES (0, '2014-10-06T21:01', 'october');", "insert");
+$run->run_sql("INSERT INTO applog (id, at, msg) VALUES (0, '2014-11-02T10:00', 'november');", "insert");
+
+$sql = "INSERT INTO applog (id, at, msg) VALUES (0, '2014-12-02T10:00', 'december');";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: \[applog\]::\[at\]: no partition for/, "STDERR");
+};
+$run->run_sql($sql, "insert", $cb, { run_fail => 1 });
+
+$run->run_sql("ALTER TABLE applog ADD PARTITION p2014_12 VALUES LESS THAN ('2015-01-01');", "alter");
+$run->run_sql($sql, "insert");
+
+$sql = "SELECT msg FROM applog WHERE at >= '2014-11-01';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 3, "STDOUT");
+    like($out, qr/^'november'$/ms, "STDOUT");
+    like($out, qr/^'december'$/ms, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$run->run_sql("ALTER TABLE applog DROP PARTITION p2014_10;", "alter");
+ok(!-e "$dirname/multidb/data/tables/applog/partitions/p2014_10", "partition directory is gone");
+
+$sql = "SELECT msg FROM applog;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 3, "STDOUT");
+    unlike($out, qr/october/, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "UPDATE applog SET at = '2014-12-24' WHERE msg = 'november';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($err, qr/^error: \[applog\]::\[at\]: partition key can't be updated/, "STDERR");
+};
+$run->run_sql($sql, "update", $cb, { run_fail => 1 });
+
+# EXPLAIN
+$sql = "EXPLAIN SELECT msg FROM applog WHERE at >= '2014-12-01';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($out, qr/^Project: msg$/m, "STDOUT");
+    like($out, qr/-> Seq Scan: applog /, "STDOUT");
+    like($out, qr/-> Partitions: p2014_12 on at; pruned: p2014_11$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$sql = "EXPLAIN ANALYZE SELECT msg FROM applog WHERE at >= '2014-12-01';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($out, qr/^Project: msg  \(rows=1 wall=[\d.]+ms cpu=[\d.]+ms files=\d+ bytes=\d+ lock_wait=[\d.]+ms\)$/m, "STDOUT");
+    like($out, qr/^Execution time: [\d.]+ms$/m, "STDOUT");
+    unlike($out, qr/december/, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+# Performance counters, summed over every process so far
+@cmd = ("./cli_multidb", "--stats");
+say("./cli_multidb --stats");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+
+ok($ret, "run --stats");
+like($out, qr/^multidb_roids_allocated_total [1-9]\d*$/m, "STDOUT");
+like($out, qr/^multidb_purgatory_reclaimed_total [1-9]\d*$/m, "STDOUT");
+like($out, qr/^multidb_statement_duration_seconds_count\{statement="select"\} [1-9]\d*$/m, "STDOUT");
+like($out, qr/^multidb_statement_duration_seconds_bucket\{statement="select",le="\+Inf"\} [1-9]\d*$/m, "STDOUT");
+is($err, "", "STDERR");
+ok(-s "$dirname/multidb/metrics.prom", "metrics.prom is written");
+
+# Transactions
+$run->run_sql("CREATE TABLE ledger (id serial, acct text, amt int);", "create");
+
+sub run_txn
+{
+    my (@statements) = @_;
+
+    @cmd = ("./cli_multidb", map { ("--sql", $_) } @statements);
+    say("./cli_multidb -> " . join(" ", @statements));
+    $ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "txn");
+
+    ok($ret, "run transaction");
+    is($err, "", "STDERR");
+}
+
+run_txn(
+    "BEGIN;",
+    "INSERT INTO ledger (id, acct, amt) VALUES (0, 'cash', 100);",
+    "INSERT INTO ledger (id, acct, amt) VALUES (0, 'bank', 50);",
+    "COMMIT;",
+);
+run_txn(
+    "BEGIN;",
+    "UPDATE ledger SET amt = amt - 10 WHERE acct = 'cash';",
+    "UPDATE ledger SET amt = amt - 10 WHERE acct = 'cash';",
+    "UPDATE ledger SET amt = amt + 20 WHERE acct = 'bank';",
+    "COMMIT;",
+);
+run_txn(
+    "BEGIN;",
+    "INSERT INTO ledger (id, acct, amt) VALUES (0, 'lost', 1);",
+    "DELETE FROM ledger WHERE acct = 'bank';",
+    "ROLLBACK;",
+);
+run_txn(
+    "BEGIN;",
+    "INSERT INTO ledger (id, acct, amt) VALUES (0, 'open', 1);",
+);
+
+$sql = "SELECT id, acct, amt FROM ledger;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 3, "STDOUT");
+    like($out, qr/^1\t'cash'\t80$/m, "STDOUT");
+    like($out, qr/^2\t'bank'\t70$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+ok(!glob("$dirname/multidb/data/txn/*"), "nothing is left staged");
+
+# COMMIT looks at the WHERE again: the DELETE's row was renamed first
+$run->run_sql("CREATE TABLE chores (id serial, label text);", "create");
+$run->run_sql("INSERT INTO chores (id, label) VALUES (0, 'keep');", "insert");
+run_txn(
+    "BEGIN;",
+    "UPDATE chores SET label = 'kept' WHERE label = 'keep';",
+    "DELETE FROM chores WHERE label = 'keep';",
+    "COMMIT;",
+);
+
+$sql = "SELECT id, label FROM chores;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    unlike($out, qr/'keep'/, "STDOUT");
+    like($out, qr/^1\t'kept'$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+# A transaction's statements see the rows it inserted
+run_txn(
+    "BEGIN;",
+    "INSERT INTO chores (id, label) VALUES (0, 'sweep');",
+    "INSERT INTO chores (id, label) VALUES (0, 'dust');",
+    "UPDATE chores SET label = 'swept' WHERE label = 'sweep';",
+    "DELETE FROM chores WHERE label = 'dust';",
+    "SELECT label FROM chores WHERE label = 'swept';",
+    "COMMIT;",
+);
+like($out, qr/^'swept'$/m, "STDOUT");
+
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 3, "STDOUT");
+    like($out, qr/^2\t'swept'$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+# Row locks: concurrent UPDATEs of one row lose nothing, text included
+my @writers;
+for my $w (1 .. 4) {
+    my $pid = fork();
+    if (0 == $pid) {
+        for (1 .. 5) {
+            system("./cli_multidb", "--sql_update", "UPDATE ledger SET acct = acct || 'x', amt = amt + 1 WHERE id = 1;") == 0 or exit(1);
+        }
+        exit(0);
+    }
+    push(@writers, $pid);
+}
+for my $pid (@writers) {
+    waitpid($pid, 0);
+    is($?, 0, "concurrent UPDATE writer");
+}
+
+$sql = "SELECT length(acct), amt FROM ledger WHERE id = 1;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($out, qr/^24\t100$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+ok(-e "$dirname/multidb/data/tables/ledger/metadata/row_locks", "row lock file");
+
+@cmd = ("./cli_multidb", "--sql", "BEGIN;", "--sql", "CREATE TABLE nope (id serial);");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "txn");
+ok(!$ret, "run CREATE in a transaction");
+like($err, qr/^error: CREATE: not allowed in a transaction/, "STDERR");
+
+# Optimistic concurrency: the same writers, retrying instead of locking
+$run->run_sql("CREATE TABLE tally (id serial, tag text, hits int) WITH (concurrency = optimistic);", "create");
+$run->run_sql("INSERT INTO tally (id, tag, hits) VALUES (0, 'a', 0);", "insert");
+
+@writers = ();
+for my $w (1 .. 4) {
+    my $pid = fork();
+    if (0 == $pid) {
+        for (1 .. 5) {
+            system("./cli_multidb", "--sql_update", "UPDATE tally SET tag = tag || 'x', hits = hits + 1 WHERE id = 1;") == 0 or exit(1);
+        }
+        exit(0);
+    }
+    push(@writers, $pid);
+}
+for my $pid (@writers) {
+    waitpid($pid, 0);
+    is($?, 0, "concurrent optimistic UPDATE writer");
+}
+
+$sql = "SELECT length(tag), hits FROM tally WHERE id = 1;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($out, qr/^21\t20$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+ok(-s "$dirname/multidb/data/tables/tally/metadata/row_versions", "row version file");
+
+$run->run_sql("ALTER TABLE tally SET (concurrency = pessimistic);", "alter");
+$run->run_sql("UPDATE tally SET hits = hits + 1 WHERE id = 1;", "update");
+$run->run_sql("ALTER TABLE tally SET (buckets = 8);", "alter", undef, { run_fail => 1 });
+
+@cmd = ("./cli_multidb", "--stats");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+like($out, qr/^multidb_occ_writes_total (\d+)$/m, "STDOUT");
+like($out, qr/^multidb_occ_conflicts_total \d+$/m, "STDOUT");
+my ($occ_writes) = $out =~ m/^multidb_occ_writes_total (\d+)$/m;
+is($occ_writes, 20, "every optimistic write counted");
+
+# Buffer pool: a later process finds the values an earlier one read
+$run->run_sql("SELECT * FROM tally;", "select");
+$run->run_sql("UPDATE tally SET hits = hits * 2 WHERE id = 1;", "update");
+
+$sql = "SELECT hits FROM tally WHERE id = 1;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    like($out, qr/^42$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+{
+    local $ENV{MULTIDB_BUFFER_POOL_MB} = 0;
+    $run->run_sql($sql, "select", $cb);
+}
+
+@cmd = ("./cli_multidb", "--stats");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+like($out, qr/^multidb_pool_hits_total [1-9]\d*$/m, "STDOUT");
+ok(-s "$dirname/multidb/id", "database id");
+
+# LSM tables: a 1KB memtable, so 80 rows take a few flushes and a compaction
+$run->run_sql("CREATE TABLE events (id serial, kind text, score int) WITH (engine = lsm, memtable_kb = 1);", "create");
+$run->run_sql("CREATE TABLE nope (id serial) WITH (engine = lsm, compression = lz4);", "create", undef, { run_fail => 1 });
+
+my $inserted = 0;
+for my $i (1 .. 80) {
+    my $kind = 0 == $i % 2 ? "even" : "odd";
+    $inserted += 0 == system("./cli_multidb", "--sql_insert", "INSERT INTO events (id, kind, score) VALUES (0, '$kind', $i);");
+}
+is($inserted, 80, "INSERT into an LSM table");
+$run->run_sql("UPDATE events SET score = score + 1000 WHERE kind = 'even';", "update");
+$run->run_sql("DELETE FROM events WHERE score < 20;", "delete");
+
+$sql = "SELECT id, score FROM events;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 1 + 80 - 10, "STDOUT");
+    like($out, qr/^2\t1002$/m, "STDOUT");
+    unlike($out, qr/^3\t/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+ok(-s "$dirname/multidb/data/tables/events/lsm/manifest", "LSM manifest");
+
+@cmd = ("./cli_multidb", "--sql", "BEGIN;", "--sql", "INSERT INTO events (id, kind) VALUES (0, 'txn');");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "txn");
+ok(!$ret, "run INSERT into an LSM table in a transaction");
+like($err, qr/^error: table: events: lsm tables don't take part in transactions/, "STDERR");
+
+@cmd = ("./cli_multidb", "--stats");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+like($out, qr/^multidb_lsm_compactions_total [1-9]\d*$/m, "STDOUT");
+
+# Change data capture: off until a consumer asks for it
+ok(!-e "$dirname/multidb/data/changes", "no change log without a consumer");
+
+@cmd = ("./cli_multidb", "--add-consumer=audit", "--before-values");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "consumer");
+ok($ret, "run --add-consumer");
+is($out, "0\n", "STDOUT");
+
+# Each row change is a line of the log, at its LSN
+my $lsn = -s "$dirname/multidb/data/changes" || 0;
+$run->run_sql("CREATE TABLE stock (id serial, item text, onhand int);", "create");
+$run->run_sql("INSERT INTO stock (id, item, onhand) VALUES (0, 'bolt', 10);", "insert");
+$run->run_sql("UPDATE stock SET onhand = onhand - 4 WHERE item = 'bolt';", "update");
+run_txn(
+    "BEGIN;",
+    "INSERT INTO stock (id, item) VALUES (0, 'nut');",
+    "DELETE FROM stock WHERE item = 'bolt';",
+    "COMMIT;",
+);
+
+@cmd = ("./cli_multidb", "--tail-changes", "--from=$lsn", "--count=5");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "tail");
+ok($ret, "run --tail-changes");
+is($out, join("",
+    "$lsn\tCREATE\tstock\t0\n",
+    ($lsn + 15) . "\tINSERT\tstock\t1\t+id=1\t+item='bolt'\t+onhand=10\n",
+    ($lsn + 60) . "\tUPDATE\tstock\t1\t-onhand=10\t+onhand=6\n",
+    ($lsn + 96) . "\tINSERT\tstock\t2\t+id=2\t+item='nut'\t+onhand=NULL\n",
+    ($lsn + 142) . "\tDELETE\tstock\t1\t-id=1\t-item='bolt'\t-onhand=6\n",
+), "STDOUT");
+is($err, "", "STDERR");
+
+# A tail at the end waits for the next change
+$lsn = -s "$dirname/multidb/data/changes";
+my $inserter = fork();
+if (0 == $inserter) {
+    sleep(1);
+    exec("./cli_multidb", "--sql_insert", "INSERT INTO stock (id, item, onhand) VALUES (0, 'washer', 1);");
+}
+@cmd = ("./cli_multidb", "--tail-changes", "--from=$lsn", "--count=1");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "tail");
+waitpid($inserter, 0);
+ok($ret, "run --tail-changes");
+is($out, "$lsn\tINSERT\tstock\t3\t+id=3\t+item='washer'\t+onhand=1\n", "STDOUT");
+
+@cmd = ("./cli_multidb", "--stats");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+like($out, qr/^multidb_changes_total [1-9]\d*$/m, "STDOUT");
+
+# What every consumer acknowledged is let go of
+my $old = $lsn;
+$run->run_sql("INSERT INTO stock (id, item) VALUES (0, '" . ("x" x 5000) . "');", "insert");
+$lsn = -s "$dirname/multidb/data/changes";
+
+@cmd = ("./cli_multidb", "--ack-changes=$lsn");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "ack");
+ok(!$ret, "run --ack-changes without --consumer");
+
+@cmd = ("./cli_multidb", "--ack-changes=$lsn", "--consumer=audit");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "ack");
+ok($ret, "run --ack-changes");
+is($err, "", "STDERR");
+is(-s "$dirname/multidb/data/changes", $lsn, "LSNs stay offsets");
+
+@cmd = ("./cli_multidb", "--tail-changes", "--from=$old", "--count=1");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "tail");
+ok(!$ret, "run --tail-changes from before the acknowledged LSN");
+like($err, qr/^error: --from: LSN $old was trimmed, the log starts at $lsn/, "STDERR");
+
+@cmd = ("./cli_multidb", "--drop-consumer=audit");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "consumer");
+ok($ret, "run --drop-consumer");
+$run->run_sql("INSERT INTO stock (id, item) VALUES (0, 'rivet');", "insert");
+is(-s "$dirname/multidb/data/changes", $lsn, "nothing logged without a consumer");
+
+# Materialized views: kept up by each change to the tables they read
+$run->run_sql("CREATE TABLE opt_key (id serial, name text);", "create");
+$run->run_sql("CREATE TABLE opt_value (id serial, key_id int, val text);", "create");
+$run->run_sql("INSERT INTO opt_key (id, name) VALUES (0, 'color');", "insert");
+$run->run_sql("INSERT INTO opt_value (id, key_id, val) VALUES (0, 1, 'red');", "insert");
+$run->run_sql("INSERT INTO opt_value (id, key_id, val) VALUES (0, 2, 'large');", "insert");
+$run->run_sql("CREATE MATERIALIZED VIEW settings (vid, setting, val) AS SELECT opt_value.id, opt_key.name, opt_value.val FROM opt_value INNER JOIN opt_key ON opt_value.key_id = opt_key.id;", "create");
+$run->run_sql("INSERT INTO opt_key (id, name) VALUES (0, 'size');", "insert");
+$run->run_sql("UPDATE opt_key SET name = 'colour' WHERE id = 1;", "update");
+$run->run_sql("DELETE FROM opt_value WHERE val = 'red';", "delete");
+run_txn(
+    "BEGIN;",
+    "INSERT INTO opt_value (id, key_id, val) VALUES (0, 1, 'blue');",
+    "COMMIT;",
+);
+
+$sql = "SELECT vid, setting, val FROM settings;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    my $count = () = $out =~ m/\n/g;
+    is($count, 3, "STDOUT");
+    like($out, qr/^2\t'size'\t'large'$/m, "STDOUT");
+    like($out, qr/^3\t'colour'\t'blue'$/m, "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+$run->run_sql("INSERT INTO settings (vid) VALUES (9);", "insert", undef, { run_fail => 1 });
+$run->run_sql("CREATE MATERIALIZED VIEW nameless AS SELECT val || 'x' FROM opt_value;", "create", undef, { run_fail => 1 });
+
+# A replica in a second directory, following the change log
+my $replica = "$dirname/replica";
+mkdir($replica);
+
+sub run_replica
+{
+    my (@args) = @_;
+
+    local $ENV{MULTIDB_PREFIX} = "$replica/";
+    @cmd = ("./cli_multidb", @args);
+    say("./cli_multidb -> " . join(" ", @args) . " (replica)");
+    $ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "replica");
+
+    return($ret);
+}
+
+ok(run_replica("--replica=$dirname", "--once"), "run --replica");
+is($err, "", "STDERR");
+
+$run->run_sql("UPDATE opt_value SET val = 'green' WHERE val = 'blue';", "update");
+$run->run_sql("INSERT INTO opt_value (id, key_id, val) VALUES (0, 2, 'small');", "insert");
+
+ok(run_replica("--replica=$dirname", "--once"), "run --replica");
+ok(run_replica("--sql_select", "SELECT vid, setting, val FROM settings;"), "run select on the replica");
+$count = () = $out =~ m/\n/g;
+is($count, 4, "STDOUT");
+like($out, qr/^3\t'colour'\t'green'$/m, "STDOUT");
+like($out, qr/^4\t'size'\t'small'$/m, "STDOUT");
+
+ok(!run_replica("--sql_insert", "INSERT INTO opt_key (id, name) VALUES (0, 'weight');"), "INSERT on the replica fails");
+like($err, qr/replica/, "STDERR");
+
+ok(run_replica("--stats"), "run --stats on the replica");
+like($out, qr/^multidb_replica_lag_bytes 0$/m, "STDOUT");
+like($out, qr/^multidb_replica_changes_applied_total 2$/m, "STDOUT");
+
+# A table made since comes across with its CREATE, and rows are written
+# from the values in the log, not read from the primary's files
+$run->run_sql("CREATE TABLE bins (id serial, label text, weight int);", "create");
+$run->run_sql("INSERT INTO bins (id, label, weight) VALUES (0, 'a', 1);", "insert");
+$run->run_sql("INSERT INTO bins (id, label) VALUES (0, 'b');", "insert");
+$run->run_sql("UPDATE bins SET weight = 7 WHERE label = 'b';", "update");
+$run->run_sql("DELETE FROM bins WHERE label = 'a';", "delete");
+$run->run_sql("UPDATE events SET score = -1 WHERE id = 2;", "update");
+system("rm", "-rf", "$dirname/multidb/data/tables/bins/rows");
+
+ok(run_replica("--replica=$dirname", "--once"), "run --replica");
+is($err, "", "STDERR");
+ok(run_replica("--sql_select", "SELECT label, weight FROM bins;"), "run select on the replica");
+is($out, "label\tweight\n'b'\t7\n", "STDOUT");
+ok(run_replica("--sql_select", "SELECT id FROM bins WHERE weight IS NULL;"), "run select on the replica");
+is($out, "id\n", "STDOUT");
+ok(run_replica("--sql_select", "SELECT id FROM events WHERE score < 0;"), "run select on the replica");
+is($out, "id\n2\n", "STDOUT");
+
+# A snapshot of the primary, taken while it is open
+@cmd = ("./cli_multidb", "--snapshot=$dirname/snap");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "snapshot");
+ok($ret, "run --snapshot");
+
+@cmd = ("./cli_multidb", "--snapshot=$dirname/snap");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "snapshot");
+ok(!$ret, "run --snapshot into a used directory fails");
+like($err, qr/already exists/, "STDERR");
+
+$run->run_sql("UPDATE opt_value SET val = 'red' WHERE val = 'green';", "update");
+{
+    local $ENV{MULTIDB_PREFIX} = "$dirname/snap/";
+    @cmd = ("./cli_multidb", "--sql_select", "SELECT vid, setting, val FROM settings;");
+    $ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "snapshot");
+}
+ok($ret, "run select on the snapshot");
+like($out, qr/^3\t'colour'\t'green'$/m, "STDOUT");
+
+@cmd = ("./cli_multidb", "--stats");
+$ret = run(\@cmd, \$in, \$out, \$err, timeout(10), "stats");
+like($out, qr/^multidb_snapshot_files_copied_total [1-9]\d*$/m, "STDOUT");
+
+# COPY FROM: a CSV with a header, quoted fields and NULLs
+$run->run_sql("CREATE TABLE parts (id serial, sku text, qty int);", "create");
+write_file("$dirname/parts.csv", "sku,qty\nbolt,10\n\"nut, hex\",\n\"say \"\"hi\"\"\",3\n");
+$run->run_sql("COPY parts FROM '$dirname/parts.csv' (FORMAT csv, HEADER, PARALLEL 2);", "copy");
+
+$sql = "SELECT id, sku, qty FROM parts;";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "id\tsku\tqty\n1\t'bolt'\t10\n2\t'nut, hex'\tNULL\n3\t'say \"hi\"'\t3\n", "STDOUT");
+    is($err, "", "STDERR");
+};
+$run->run_sql($sql, "select", $cb);
+
+# A bad value fails the load before any of it shows
+write_file("$dirname/parts.tsv", "washer\t1\nspring\tmany\n");
+$run->run_sql("COPY parts (sku, qty) FROM '$dirname/parts.tsv' (FORMAT tsv);", "copy", undef, { run_fail => 1 });
+like($err, qr/invalid value: many/, "STDERR");
+
+$sql = "SELECT id, sku FROM parts WHERE sku = 'washer';";
+$cb = sub {
+    my $this = shift;
+    my ($in, $out, $err) = @_;
+
+    is($out, "id\tsku\n", "STDOUT");
+};
+$run->run_sql($sql, "select", $cb);
+
+# COPY TO: a file per worker and a manifest of them
+$run->run_sql("COPY parts (id, sku, qty) TO '$dirname/export' (FORMAT csv, PARALLEL 2);", "copy");
+
+my @manifest = split(/\n/, read_file("$dirname/export/manifest"));
+is(shift(@manifest), "file\trows\tbytes", "manifest");
+
+my ($exported, @lines) = (0);
+for my $part (@manifest) {
+    my ($file, $rows) = split(/\t/, $part);
+    $exported += $rows;
+    push(@lines, split(/\n/, read_file("$dirname/export/$file")));
+}
+is($exported, 3, "manifest rows");
+is(join("\n", sort(@lines)), "1,bolt,10\n2,\"nut, hex\",\n3,\"say \"\"hi\"\"\",3", "exported rows");
+
+$run->run_sql("COPY parts TO '$dirname/export';", "copy", undef, { run_fail => 1 });
+like($err, qr/already exists/, "STDERR");
+
 done_testing();
 
 package RunSQL;